@@ -9,7 +9,7 @@
  * - Ping: A special read request "__ping__" to verify server availability
  *
  * The implementation uses CRC-8 validation to ensure data integrity and handles retransmissions
- * on timeouts or missing acknowledgments. This client is compatible with a custom TFTP server
+ * on timeouts or missing acknowledgments. Timeouts adapt to the measured round-trip time. This client is compatible with a custom TFTP server
  * that supports dynamic ports and extended functionality like deletion and ping.
  */
 
@@ -17,26 +17,26 @@
  #include <stdio.h>
  #include <stdlib.h>
  #include <string.h>
+ #include <strings.h>
  #include <unistd.h>
+ #include <fcntl.h>
+ #include <poll.h>
+ #include <pthread.h>
  #include <arpa/inet.h>
  #include <sys/time.h>
- 
- /**
-  * @brief Compute CRC-8 checksum over a data buffer using polynomial 0x07.
-  *
-  * @param data Pointer to input data.
-  * @param len Number of bytes in the input buffer.
-  * @return CRC-8 checksum result.
-  */
- uint8_t calculate_crc8(const uint8_t *data, size_t len) {
-     uint8_t crc = 0;
-     for (size_t i = 0; i < len; ++i) {
-         crc ^= data[i];
-         for (int j = 0; j < 8; ++j)
-             crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
-     }
-     return crc;
- }
+ #include <sys/stat.h>
+
+ // Options sent with every RRQ/WRQ (set from the command line)
+ tftp_options g_request_options = {0};
+
+ // Congestion control of windowed uploads (set from the command line)
+ const tftp_cc_ops *g_cc_ops = NULL;
+
+ // Concurrent range sessions per download (set from the command line)
+ int g_streams = 1;
+
+ // Resume interrupted transfers (set from the command line)
+ int g_resume = 0;
  
  /**
   * @brief Ping the server using a special RRQ for "__ping__" to verify it's alive.
@@ -90,239 +90,908 @@
  }
  
 /**
- * @brief Download a file from the server using RRQ (Read Request).
- *        Handles retransmissions and CRC-8 validation.
+ * @brief Size of a packet buffer able to hold a DATA block of the given blksize.
  *
- * @param sock The UDP socket to use
- * @param server_addr Pointer to the server address struct
- * @param filename The name of the file to download
+ * @param blksize Requested block size, or 0 for the default.
+ * @return Buffer size in bytes (never smaller than MAX_PACKET_SIZE).
  */
-void rrq(int sock, struct sockaddr_in *server_addr, const char *filename) {
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        perror("fopen");
+static int packet_size_for(int blksize) {
+    int size = (blksize ? blksize : DEFAULT_BLKSIZE) + DATA_OVERHEAD_MAX;
+    return size < MAX_PACKET_SIZE ? MAX_PACKET_SIZE : size;
+}
+
+/**
+ * @brief Send an ACK for a block.
+ *
+ * @param sock UDP socket.
+ * @param to Server data address.
+ * @param to_len Length of the server address.
+ * @param block Block number to acknowledge.
+ */
+static void send_ack(int sock, struct sockaddr_in *to, socklen_t to_len, uint16_t block) {
+    unsigned char ack[4];
+    ack[0] = 0;
+    ack[1] = OP_ACK;
+    ack[2] = (block >> 8) & 0xFF;
+    ack[3] = block & 0xFF;
+    sendto(sock, ack, sizeof(ack), 0, (struct sockaddr *)to, to_len);
+}
+
+/**
+ * @brief Make the socket receive timeout follow the retransmission timeout of a transfer.
+ *
+ * @param sock UDP socket.
+ * @param rto Estimator of the transfer.
+ * @param applied Timeout currently set on the socket (ms), updated.
+ */
+static void apply_rto(int sock, const tftp_rto *rto, uint32_t *applied) {
+    // one setsockopt() per change, not per packet
+    if (*applied == rto->rto_ms)
         return;
+    struct timeval timeout = {rto->rto_ms / 1000, (rto->rto_ms % 1000) * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    *applied = rto->rto_ms;
+}
+
+/**
+ * @brief Wait until a datagram is queued on the socket, with a sub-millisecond timeout.
+ *
+ * ppoll() runs on a high-resolution timer; SO_RCVTIMEO would round the
+ * timeout up to a scheduler tick.
+ *
+ * @param sock UDP socket.
+ * @param us Timeout in microseconds.
+ * @return int 0 if nothing arrived in time, 1 otherwise (errors included: recvfrom() reports them).
+ */
+static int wait_readable(int sock, uint32_t us) {
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    struct timespec timeout = {us / 1000000, (long)(us % 1000000) * 1000};
+    return ppoll(&pfd, 1, &timeout, NULL) != 0;
+}
+
+/**
+ * @brief Print the round-trip time measured during a transfer.
+ *
+ * @param rto Estimator of the transfer.
+ */
+static void print_rtt(const tftp_rto *rto) {
+    if (rto->srtt_us)
+        printf("RTT %.3f ms (timeout %u ms)\n", rto->srtt_us / 1000.0, rto->rto_ms);
+}
+
+/**
+ * @brief Apply the options of an OACK received in answer to a request.
+ *
+ * Rejects the OACK with an ERROR (code 8) if the server granted more than
+ * was requested. A resume offset left out of the OACK means the transfer
+ * starts at byte 0.
+ *
+ * @param sock UDP socket.
+ * @param from_addr Server data address.
+ * @param from_len Length of the server address.
+ * @param oack Received OACK packet.
+ * @param n Length of the packet.
+ * @param requested Options sent with the request.
+ * @param negotiated Updated with every option the server accepted.
+ * @return 0 on success, -1 if the options were refused.
+ */
+static int oack_apply(int sock, struct sockaddr_in *from_addr, socklen_t from_len, const unsigned char *oack, int n,
+                      const tftp_options *requested, tftp_options *negotiated) {
+    tftp_options accepted;
+    options_parse((const char *)&oack[2], n - 2, &accepted);
+
+    // a range the server did not confirm would be written at the wrong place
+    int range_refused = (requested->offset || requested->length) &&
+                        (accepted.offset != requested->offset || accepted.length != requested->length);
+    // the server may only echo the check asked for, or leave it out (CRC-8)
+    int check_refused = accepted.check != CHECK_ABSENT && accepted.check != requested->check;
+    if (accepted.blksize > requested->blksize || accepted.windowsize > requested->windowsize || range_refused ||
+        accepted.resume > requested->resume || check_refused || accepted.digest > requested->digest ||
+        accepted.compress > requested->compress) {
+        send_error(sock, from_addr, from_len, 8, "Option negotiation failed");
+        printf("Server sent an invalid OACK\n");
+        return -1;
     }
+    if (accepted.blksize)
+        negotiated->blksize = accepted.blksize;
+    if (accepted.windowsize)
+        negotiated->windowsize = accepted.windowsize;
+    negotiated->rollover = accepted.rollover;
+    negotiated->has_tsize = accepted.has_tsize;
+    negotiated->tsize = accepted.tsize;
+    negotiated->offset = accepted.offset;
+    negotiated->resume = accepted.resume;
+    negotiated->has_prefixcrc = accepted.has_prefixcrc;
+    negotiated->prefixcrc = accepted.prefixcrc;
+    negotiated->check = accepted.check != CHECK_ABSENT ? accepted.check : CHECK_CRC8;
+    negotiated->digest = accepted.digest;
+    negotiated->compress = accepted.compress;
+    return 0;
+}
 
-    // Build and send RRQ packet
+/**
+ * @brief Run one RRQ transfer: the whole file, or the byte range set in the options.
+ *        Handles retransmissions and validation of the negotiated per-block check.
+ *        With the digest option the transfer only succeeds once the server's
+ *        SHA-256, sent after the last block, matches the bytes received.
+ *        With the compress option every block is decompressed before it is written.
+ *
+ * Blocks are written with pwrite() at their offset in the output file, so
+ * several ranges of one file can be received into it at the same time. A
+ * resumed download continues after the bytes the server confirmed, or
+ * truncates the file and starts over if the server's file differs.
+ *
+ * @param sock The UDP socket to use
+ * @param server_addr Pointer to the server address struct
+ * @param filename The name of the file to download
+ * @param fd Output file
+ * @param requested Options to send (offset/length select a range)
+ * @param rto_out Receives the round-trip estimator of the transfer
+ * @return 0 once the last block was received, -1 on error
+ */
+static int rrq_session(int sock, struct sockaddr_in *server_addr, const char *filename, int fd,
+                       const tftp_options *requested, tftp_rto *rto_out) {
+    // Build and send RRQ packet (with options, if any were requested)
     unsigned char rrq_packet[516];
-    int rrq_len = 2 + strlen(filename) + 1;
-    rrq_packet[0] = 0;
-    rrq_packet[1] = OP_RRQ;
-    strcpy((char *)&rrq_packet[2], filename);
+    int rrq_len = request_build(rrq_packet, sizeof(rrq_packet), OP_RRQ, filename, requested);
+    if (rrq_len < 0) {
+        printf("Filename too long\n");
+        return -1;
+    }
     sendto(sock, rrq_packet, rrq_len, 0, (struct sockaddr *)server_addr, sizeof(*server_addr));
 
-    uint16_t expected_block = 1;
+    tftp_rto rto;
+    uint32_t applied = 0;
+    rto_init(&rto);
+    rto_start(&rto, 0);
+
+    // Receive buffer sized for the largest block this transfer may use
+    tftp_options negotiated = {.blksize = MAX_DATA_SIZE, .windowsize = 1, .check = CHECK_CRC8};
+    int packet_size = packet_size_for(requested->blksize);
+    unsigned char *buf = malloc(packet_size);
+    // decompressed blocks, at most the requested blksize
+    unsigned char *scratch = requested->compress ? malloc(packet_size) : NULL;
+    if (!buf || (requested->compress && !scratch)) {
+        perror("malloc");
+        free(buf);
+        free(scratch);
+        return -1;
+    }
+
+    uint64_t expected_block = 1;  // absolute number of the next block to write
+    int since_ack = 0;   // blocks received since the last window ACK we sent
+    int gap_acked = 0;   // an out-of-order block was already answered
+    int retries = 3;
+    int wrap_to = 0;     // block number following 65535
+    int answered = 0;    // the server answered the request
+    int digest_wait = 0; // last block received, waiting for the server's digest
+    int status = -1;
+    uint64_t received = 0;      // bytes written
+    uint64_t wire_received = 0; // bytes of the frames they arrived in
+    tftp_sha256 sha;
+    sha256_init(&sha);
     struct sockaddr_in from_addr;
     socklen_t from_len = sizeof(from_addr);
-    unsigned char buf[MAX_PACKET_SIZE];
 
     while (1) {
-        int n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from_addr, &from_len);
-        if (n < 5) {
+        // a partial window is acknowledged once the server stops sending: its
+        // cwnd may hold it to fewer blocks in flight than the window
+        if (since_ack > 0 && !gap_acked && !wait_readable(sock, rto_ack_delay_us(&rto))) {
+            send_ack(sock, &from_addr, from_len, block_to_wire(expected_block - 1, wrap_to));
+            rto_start(&rto, expected_block);
+            since_ack = 0;
+            continue;
+        }
+        apply_rto(sock, &rto, &applied);
+        int n = recvfrom(sock, buf, packet_size, 0, (struct sockaddr *)&from_addr, &from_len);
+        if (n < 0 && --retries > 0) {
+            rto_backoff(&rto);
+            // Not answered yet: keep waiting (a second RRQ would start a second transfer)
+            if (!answered)
+                continue;
+            // Timeout mid-transfer: repeat our last ACK so the server resends
+            send_ack(sock, &from_addr, from_len, block_to_wire(expected_block - 1, wrap_to));
+            gap_acked = 0;
+            continue;
+        }
+        if (n < 0 && digest_wait) {
+            printf("No digest from the server\n");
+            break;
+        }
+        if (n >= 2 && buf[1] == OP_OACK && expected_block == 1) {
+            // Server accepted our options: adopt them and confirm with ACK(0)
+            if (oack_apply(sock, &from_addr, from_len, buf, n, requested, &negotiated) < 0)
+                break;
+            rto_ack(&rto, 0);
+            answered = 1;
+            wrap_to = negotiated.rollover == ROLLOVER_TO_1 ? 1 : 0;
+            // a window arrives as one burst: the socket must hold all of it
+            uint64_t window_bytes = (uint64_t)negotiated.windowsize * packet_size * 2;
+            int rcvbuf = window_bytes < INT_MAX ? (int)window_bytes : INT_MAX;
+            if (rcvbuf > RCVBUF_DEFAULT)
+                setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+            if (negotiated.resume) {
+                printf("Resuming download at byte %llu\n", (unsigned long long)negotiated.resume);
+            } else if (requested->resume) {
+                printf("Local copy differs from the server's file, downloading from the start\n");
+                if (ftruncate(fd, 0) < 0)
+                    perror("ftruncate");
+            }
+            send_ack(sock, &from_addr, from_len, 0);
+            rto_start(&rto, 1);
+            continue;
+        }
+        if (n >= 4 && buf[1] == OP_ERROR) {
+            printf("Server error: %s\n", &buf[4]);
+            break;
+        }
+        if (digest_wait && n >= 4 && buf[1] == OP_DIGEST) {
+            // the digest travels as the block after the last one
+            uint16_t wire = block_to_wire(expected_block, wrap_to);
+            if (n != 4 + SHA256_SIZE || ((buf[2] << 8) | buf[3]) != wire)
+                continue;
+            uint8_t digest[SHA256_SIZE];
+            sha256_final(&sha, digest);
+            if (memcmp(digest, &buf[4], SHA256_SIZE) != 0) {
+                send_error(sock, &from_addr, from_len, 0, "Digest mismatch");
+                printf("Digest mismatch: the data received differs from the server's file\n");
+                break;
+            }
+            send_ack(sock, &from_addr, from_len, wire);
+            rto_ack(&rto, expected_block);
+            printf("SHA-256 digest verified\n");
+            status = 0;
+            break;
+        }
+        int check_len = block_check_len(negotiated.check);
+        if (n < 4 + check_len) {
             printf("Invalid packet\n");
             break;
         }
 
         uint8_t opcode = buf[1];
         uint16_t block = (buf[2] << 8) | buf[3];
-        uint8_t crc_received = buf[n - 1];
-
-        // Calculate CRC over opcode + block + data
- uint8_t crc_calc =calculate_crc8(&buf[4], n - 5);
 
-        if (crc_calc != crc_received) {
-            printf("CRC mismatch on block %d (expected %02X, got %02X)\n", block, crc_calc, crc_received);
+        // Verify the check trailer over the data
+        if (!block_check_ok(negotiated.check, &buf[4], n - 4 - check_len, &buf[n - check_len])) {
+            printf("%s mismatch on block %d\n", check_name(negotiated.check), block);
             continue; // wait for retransmit
         }
 
-        if (opcode == OP_DATA && block == expected_block) {
-            int data_len = n - 4 - 1;  // total - header (2+2) - CRC
+        if (opcode == OP_DATA && block == block_to_wire(expected_block, wrap_to)) {
+            int data_len = n - 4 - check_len;  // total - header (2+2) - check
+            const unsigned char *data = &buf[4];
+            wire_received += data_len;
+            if (negotiated.compress &&
+                !(data = block_unpack(&buf[4], data_len, scratch, negotiated.blksize, &data_len))) {
+                printf("Malformed compressed block %d\n", block);
+                break;
+            }
             if (data_len > 0) {
-                fwrite(&buf[4], 1, data_len, fp);
+                off_t offset = (off_t)(negotiated.offset + negotiated.resume) +
+                               (off_t)(expected_block - 1) * negotiated.blksize;
+                if (pwrite(fd, data, data_len, offset) != data_len) {
+                    perror("pwrite");
+                    break;
+                }
+                if (negotiated.digest)
+                    sha256_update(&sha, data, data_len);
+                received += data_len;
             }
 
-            // Send ACK for received block
-            unsigned char ack[4];
-            ack[0] = 0;
-            ack[1] = OP_ACK;
-            ack[2] = buf[2];
-            ack[3] = buf[3];
-            sendto(sock, ack, sizeof(ack), 0, (struct sockaddr *)&from_addr, from_len);
-
+            rto_ack(&rto, expected_block);
             expected_block++;
+            since_ack++;
+            gap_acked = 0;
+            answered = 1;
+            retries = 3;
 
-            //  Case 1: Normal end — data block is less than 512 bytes
-            if (data_len < MAX_DATA_SIZE) {
-                printf("Download complete\n");
+            // ACK once per window, and always the final block
+            int last = data_len < negotiated.blksize;
+            if (last || since_ack >= negotiated.windowsize) {
+                send_ack(sock, &from_addr, from_len, block);
+                rto_start(&rto, expected_block);
+                since_ack = 0;
+            }
+
+            // Normal end: the block is shorter than blksize (possibly empty)
+            if (last) {
+                if (negotiated.digest) {
+                    digest_wait = 1;
+                    continue;
+                }
+                status = 0;
                 break;
             }
 
-        } else if (opcode == OP_DATA && block == expected_block && (n == 5)) {
-            // Case 2: Empty data block (0 bytes of data)
-            // This is sent *only* after a final 512-byte block to signal end of file.
-            printf("Received final empty block (block %d)\n", block);
+        } else if (opcode == OP_DATA) {
+            // Out of order: answer once with the last in-order block. A block we
+            // hold means the server missed our ACK; a block ahead is a gap, which
+            // the server only resends after on a repeated ACK, so that ACK goes
+            // out twice if the server has not been told of the block yet.
+            if (!gap_acked) {
+                uint64_t distance = block_distance(expected_block - 1, block, wrap_to);
+                uint16_t in_order = block_to_wire(expected_block - 1, wrap_to);
+                send_ack(sock, &from_addr, from_len, in_order);
+                if (distance > 1 && distance <= (uint64_t)negotiated.windowsize && since_ack > 0)
+                    send_ack(sock, &from_addr, from_len, in_order);
+                rto_resent(&rto, expected_block);
+                gap_acked = 1;
+            }
+
+        } else {
+            printf("Unexpected packet (opcode: %d, block: %d)\n", opcode, block);
+        }
+    }
 
-            // Send ACK for empty block
-            unsigned char ack[4];
-            ack[0] = 0;
-            ack[1] = OP_ACK;
-            ack[2] = buf[2];
-            ack[3] = buf[3];
-            sendto(sock, ack, sizeof(ack), 0, (struct sockaddr *)&from_addr, from_len);
+    if (status == 0 && negotiated.compress && received > 0)
+        printf("lz4: %llu bytes received as %llu (%.1f%%)\n", (unsigned long long)received,
+               (unsigned long long)wire_received, 100.0 * wire_received / received);
+    free(scratch);
+    free(buf);
+    *rto_out = rto;
+    return status;
+}
 
-            printf("Download complete\n");
-            break;
+/**
+ * @brief Ask the server for the size of a file (RFC 2349 tsize) without downloading it.
+ *
+ * The RRQ is sent from its own socket and the transfer is cancelled with an
+ * ERROR as soon as the OACK (or a first DATA block, from a server ignoring
+ * options) arrives.
+ *
+ * @param server_addr Server address.
+ * @param filename File to query.
+ * @param size Receives the file size.
+ * @return 0 on success, -1 if the server does not report sizes, -2 if it refused the file.
+ */
+static int rrq_probe_size(struct sockaddr_in *server_addr, const char *filename, uint64_t *size) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
 
-        } else if (opcode == OP_ERROR) {
-            printf("Server error: %s\n", &buf[4]);
+    tftp_options probe = {.blksize = g_request_options.blksize, .has_tsize = 1};
+    unsigned char buf[MAX_PACKET_SIZE];
+    int len = request_build(buf, sizeof(buf), OP_RRQ, filename, &probe);
+    if (len < 0) {
+        close(sock);
+        return -1;
+    }
+    sendto(sock, buf, len, 0, (struct sockaddr *)server_addr, sizeof(*server_addr));
+
+    struct timeval timeout = {RTO_INITIAL_MS / 1000, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in from_addr;
+    socklen_t from_len = sizeof(from_addr);
+    int n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from_addr, &from_len);
+
+    int ret = -1;
+    if (n >= 4 && buf[1] == OP_ERROR) {
+        printf("Server error: %s\n", &buf[4]);
+        ret = -2;
+    } else if (n >= 2) {
+        tftp_options accepted = {0};
+        if (buf[1] == OP_OACK)
+            options_parse((const char *)&buf[2], n - 2, &accepted);
+        if (accepted.has_tsize) {
+            *size = accepted.tsize;
+            ret = 0;
+        }
+        send_error(sock, &from_addr, from_len, 0, "Size probe done");
+    }
+    close(sock);
+    return ret;
+}
+
+/**
+ * @brief One range of a parallel download.
+ */
+typedef struct rrq_stream {
+    struct sockaddr_in server;  ///< Server address
+    const char *filename;       ///< File to download
+    int fd;                     ///< Shared output file
+    tftp_options opts;          ///< Request options, with the range
+    int status;                 ///< Result of rrq_session()
+    pthread_t thread;
+} rrq_stream;
+
+/**
+ * @brief Thread body: download one range over its own socket (its own server session).
+ *
+ * @param arg The rrq_stream.
+ * @return void* Always NULL.
+ */
+static void *rrq_stream_main(void *arg) {
+    rrq_stream *st = arg;
+    tftp_rto rto;
+
+    st->status = -1;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return NULL;
+    }
+    st->status = rrq_session(sock, &st->server, st->filename, st->fd, &st->opts, &rto);
+    close(sock);
+    return NULL;
+}
+
+/**
+ * @brief Download a file as g_streams byte ranges over concurrent sessions.
+ *
+ * The output file is preallocated to its final size and every stream writes
+ * its blocks in place. Ranges are whole numbers of blocks, so only the last
+ * one ends with a short block.
+ *
+ * @param server_addr Server address.
+ * @param filename File to download.
+ * @param size File size reported by the server.
+ */
+static void rrq_parallel(struct sockaddr_in *server_addr, const char *filename, uint64_t size) {
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open");
+        return;
+    }
+    if (size > 0 && posix_fallocate(fd, 0, size) != 0 && ftruncate(fd, size) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return;
+    }
+
+    rrq_stream *streams = calloc(g_streams, sizeof(*streams));
+    if (!streams) {
+        perror("calloc");
+        close(fd);
+        return;
+    }
+
+    uint64_t blksize = g_request_options.blksize ? g_request_options.blksize : MAX_DATA_SIZE;
+    uint64_t blocks = (size + blksize - 1) / blksize;
+    uint64_t per_stream = (blocks + g_streams - 1) / g_streams * blksize;
+    if (per_stream == 0)
+        per_stream = blksize;
+    uint64_t started_us = rto_now_us();
+
+    int count = 0;
+    for (uint64_t start = 0; count == 0 || start < size; start += per_stream) {
+        rrq_stream *st = &streams[count];
+        st->server = *server_addr;
+        st->filename = filename;
+        st->fd = fd;
+        st->opts = g_request_options;
+        st->opts.offset = start;
+        // the last range runs to the end of the file; a length of 0 would mean the same
+        st->opts.length = size - start < per_stream ? size - start : per_stream;
+        if (st->opts.length == 0)
+            st->opts.length = 1; // an empty file: one empty block
+        if (st->opts.length / blksize + 1 > 65535 && st->opts.rollover == ROLLOVER_ABSENT)
+            st->opts.rollover = ROLLOVER_TO_0;
+        if (pthread_create(&st->thread, NULL, rrq_stream_main, st) != 0) {
+            perror("pthread_create");
             break;
-        } else {
-            printf("Unexpected packet (opcode: %d, block: %d)\n", opcode, block);
         }
+        count++;
     }
 
-    fclose(fp);
+    int failed = count == 0;
+    for (int i = 0; i < count; i++) {
+        pthread_join(streams[i].thread, NULL);
+        if (streams[i].status != 0)
+            failed = 1;
+    }
+    double seconds = (rto_now_us() - started_us) / 1e6;
+
+    if (failed)
+        printf("Download failed\n");
+    else
+        printf("Download complete (%d streams, %.1f MB/s)\n", count, seconds > 0 ? size / seconds / 1e6 : 0.0);
+    free(streams);
+    close(fd);
 }
 
- 
- /**
-  * @brief Perform a TFTP WRQ (upload) to the server.
-  *
-  * @param sock UDP socket.
-  * @param server_addr Pointer to server address.
-  * @param addr_len Length of the address.
-  * @param local_file Path to local file to send.
-  * @param remote_file Destination filename on the server.
-  */
- /**
+/**
+ * @brief Ask to resume a download after the blocks already in the local file.
+ *
+ * The file is cut to a whole number of blocks; the request carries that size
+ * and the CRC-32C of those bytes so the server can check they match its file.
+ *
+ * @param fd Local file, opened without truncation.
+ * @param requested Request options, updated.
+ */
+static void rrq_prepare_resume(int fd, tftp_options *requested) {
+    struct stat st;
+    uint64_t blksize = requested->blksize ? requested->blksize : MAX_DATA_SIZE;
+    uint64_t keep = fstat(fd, &st) == 0 ? (uint64_t)st.st_size / blksize * blksize : 0;
+
+    if (keep > 0 && crc32c_file(fd, keep, &requested->prefixcrc) == 0) {
+        requested->resume = keep;
+        requested->has_prefixcrc = 1;
+    } else {
+        keep = 0;
+    }
+    if (ftruncate(fd, keep) < 0)
+        perror("ftruncate");
+}
+
+/**
+ * @brief Download a file from the server using RRQ (Read Request).
+ *
+ * With -p N (g_streams > 1) the file size is asked first and the file is
+ * fetched as N ranges in parallel; servers that do not report sizes get a
+ * single transfer.
+ *
+ * @param sock The UDP socket to use
+ * @param server_addr Pointer to the server address struct
+ * @param filename The name of the file to download
+ */
+void rrq(int sock, struct sockaddr_in *server_addr, const char *filename) {
+    // a partial local copy to resume is fetched by one stream
+    struct stat st;
+    int partial = g_resume && stat(filename, &st) == 0 && st.st_size > 0;
+    if (g_streams > 1 && !partial) {
+        uint64_t size;
+        int probed = rrq_probe_size(server_addr, filename, &size);
+        if (probed == 0) {
+            rrq_parallel(server_addr, filename, size);
+            return;
+        }
+        if (probed == -2)
+            return;
+        printf("Server does not report file sizes, using one stream\n");
+    }
+
+    // with -R an existing local file is the start of the download
+    int fd = open(filename, O_RDWR | O_CREAT | (g_resume ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        perror("open");
+        return;
+    }
+    tftp_options requested = g_request_options;
+    if (g_resume)
+        rrq_prepare_resume(fd, &requested);
+
+    tftp_rto rto;
+    if (rrq_session(sock, server_addr, filename, fd, &requested, &rto) == 0) {
+        printf("Download complete\n");
+        print_rtt(&rto);
+    }
+    close(fd);
+}
+
+/**
+ * @brief Send the digest of an upload once its last block is acknowledged.
+ *
+ * The digest travels as the block after the last one and is resent until the
+ * server acknowledges it, or answers that its copy differs.
+ *
+ * @param sock UDP socket.
+ * @param to Server data address.
+ * @param to_len Length of the server address.
+ * @param wire Wire number of the block after the last one.
+ * @param sha Digest of every block sent; finished here.
+ * @param rto Estimator of the transfer.
+ * @param applied Timeout currently set on the socket (ms), updated.
+ * @return 0 if the server confirmed the digest, -1 otherwise.
+ */
+static int wrq_send_digest(int sock, struct sockaddr_in *to, socklen_t to_len, uint16_t wire, tftp_sha256 *sha,
+                           tftp_rto *rto, uint32_t *applied) {
+    unsigned char packet[4 + SHA256_SIZE];
+    unsigned char reply[MAX_PACKET_SIZE];
+    packet[0] = 0;
+    packet[1] = OP_DIGEST;
+    packet[2] = (wire >> 8) & 0xFF;
+    packet[3] = wire & 0xFF;
+    sha256_final(sha, &packet[4]);
+
+    for (int attempt = 0; attempt < 3; attempt++) {
+        if (attempt > 0)
+            rto_backoff(rto);
+        sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *)to, to_len);
+        apply_rto(sock, rto, applied);
+
+        int n;
+        while ((n = recvfrom(sock, reply, sizeof(reply), 0, NULL, NULL)) >= 0) {
+            if (n >= 4 && reply[1] == OP_ERROR) {
+                printf("Server error: %s\n", &reply[4]);
+                return -1;
+            }
+            if (n >= 4 && reply[1] == OP_ACK && ((reply[2] << 8) | reply[3]) == wire)
+                return 0;
+            // a repeated ACK of the last block: the digest was lost
+            if (n >= 4 && reply[1] == OP_ACK)
+                break;
+        }
+    }
+    printf("No answer to the digest\n");
+    return -1;
+}
+
+/**
  * @brief Perform a TFTP WRQ (upload) to the server.
  *
  * This function uploads a local file to a TFTP server using the Write Request (WRQ) procedure.
- * It handles retries, acknowledgments, and special case of sending a final empty DATA block
- * if the file size is an exact multiple of 512 bytes.
+ * It keeps a window of DATA blocks in flight, paced by the congestion controller, and resends
+ * after a repeated ACK or a timeout; the file ends with a block shorter than blksize (possibly
+ * empty). With resume set the request offers to continue a partial upload the server kept; it
+ * answers with how many bytes it holds and their CRC-32C.
  *
  * @param sock UDP socket used for communication.
  * @param server_addr Pointer to the server's sockaddr_in structure.
  * @param addr_len Length of the server address structure.
  * @param local_file Path to the local file to be uploaded.
  * @param remote_file Target filename on the server.
+ * @param resume Offer to resume a partial upload.
+ * @return int 1 if the server's partial upload differs from the local file
+ *         (upload again without resume), 0 otherwise.
  */
-void wrq(int sock, struct sockaddr_in *server_addr, socklen_t addr_len, const char *local_file, const char *remote_file) {
-    unsigned char buf[MAX_PACKET_SIZE];
-    unsigned char ack[4];
+static int wrq_session(int sock, struct sockaddr_in *server_addr, socklen_t addr_len, const char *local_file,
+                       const char *remote_file, int resume) {
+    unsigned char ack[MAX_PACKET_SIZE];
 
     // Open the local file for reading in binary mode
     FILE *fp = fopen(local_file, "rb");
     if (!fp) {
         perror("Cannot open local file");
-        return;
+        return 0;
     }
 
-    // Check if file size is within TFTP limits (max 65535 blocks * 512 bytes)
-    fseek(fp, 0, SEEK_END);
-    long filesize = ftell(fp);
+    fseeko(fp, 0, SEEK_END);
+    off_t filesize = ftello(fp);
     rewind(fp);
-    if (filesize > 512 * 65535) {
-        printf("File too large for TFTP\n");
+
+    // Files needing more than 65535 blocks require block number rollover
+    tftp_options requested = g_request_options;
+    int req_blksize = requested.blksize ? requested.blksize : MAX_DATA_SIZE;
+    if (filesize / req_blksize + 1 > 65535 && requested.rollover == ROLLOVER_ABSENT)
+        requested.rollover = ROLLOVER_TO_0;
+    if (resume)
+        requested.resume = filesize;
+
+    // Packet buffer sized for the largest block this transfer may use
+    tftp_options negotiated = {.blksize = MAX_DATA_SIZE, .windowsize = 1, .check = CHECK_CRC8};
+    int packet_size = packet_size_for(g_request_options.blksize);
+    unsigned char *buf = malloc(packet_size);
+    // blocks read before being compressed into buf
+    unsigned char *raw = requested.compress ? malloc(packet_size) : NULL;
+    if (!buf || (requested.compress && !raw)) {
+        perror("malloc");
+        free(buf);
+        free(raw);
         fclose(fp);
-        return;
+        return 0;
     }
 
-    // Prepare and send the WRQ (Write Request) packet with the remote filename
-    int wrq_len = 2 + strlen(remote_file) + 1; // Opcode(2) + filename + null terminator
-    buf[0] = 0;
-    buf[1] = OP_WRQ;  // WRQ opcode
-    strcpy((char *)&buf[2], remote_file);
-    sendto(sock, buf, wrq_len, 0, (struct sockaddr *)server_addr, addr_len);
-
+    // Prepare and send the WRQ (Write Request) packet with the remote filename and options
+    int wrq_len = request_build(buf, packet_size, OP_WRQ, remote_file, &requested);
+    if (wrq_len < 0) {
+        printf("Filename too long\n");
+        free(raw);
+        free(buf);
+        fclose(fp);
+        return 0;
+    }
     struct sockaddr_in from_addr;
     socklen_t from_len = sizeof(from_addr);
 
-    // Set socket receive timeout (3 seconds)
-    struct timeval timeout = {3, 0};
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    tftp_rto rto;
+    uint32_t applied = 0;
+    rto_init(&rto);
 
-    // Wait for ACK(0) from the server acknowledging the WRQ
-    int n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from_addr, &from_len);
-    if (n < 4 || buf[1] != OP_ACK || buf[2] != 0 || buf[3] != 0) {
+    sendto(sock, buf, wrq_len, 0, (struct sockaddr *)server_addr, addr_len);
+    rto_start(&rto, 0);
+
+    // Wait for ACK(0), or an OACK if the server accepted our options, backing off on
+    // timeout (the WRQ is not repeated: that would start a second transfer)
+    int n = -1;
+    for (int attempt = 0; attempt < 3 && n < 0; attempt++) {
+        if (attempt > 0)
+            rto_backoff(&rto);
+        apply_rto(sock, &rto, &applied);
+        n = recvfrom(sock, buf, packet_size, 0, (struct sockaddr *)&from_addr, &from_len);
+    }
+    rto_ack(&rto, 0);
+    if (n >= 2 && buf[1] == OP_OACK) {
+        if (oack_apply(sock, &from_addr, from_len, buf, n, &requested, &negotiated) < 0) {
+            free(raw);
+            free(buf);
+            fclose(fp);
+            return 0;
+        }
+    } else if (n < 4 || buf[1] != OP_ACK || buf[2] != 0 || buf[3] != 0) {
         printf("Did not receive ACK for WRQ\n");
+        free(raw);
+        free(buf);
         fclose(fp);
-        return;
+        return 0;
     }
 
-    int block = 1;  // Start block numbering from 1
+    // Bytes the server already holds: continue after them if they match ours
+    uint64_t base = negotiated.resume;
+    if (base > 0) {
+        uint32_t crc;
+        if (!negotiated.has_prefixcrc || crc32c_file(fileno(fp), base, &crc) < 0 || crc != negotiated.prefixcrc) {
+            send_error(sock, &from_addr, from_len, 0, "Partial upload differs");
+            printf("Partial upload on the server differs from the local file, uploading from the start\n");
+            free(raw);
+            free(buf);
+            fclose(fp);
+            return 1;
+        }
+        printf("Resuming upload at byte %llu\n", (unsigned long long)base);
+    }
+
+    // Without rollover the server can only count 65535 blocks
+    int blksize = negotiated.blksize;
+    int wrap_to = negotiated.rollover == ROLLOVER_TO_1 ? 1 : 0;
+    if ((filesize - base) / blksize + 1 > 65535 && negotiated.rollover == ROLLOVER_ABSENT) {
+        send_error(sock, &from_addr, from_len, 3, "File too large");
+        printf("File too large for TFTP\n");
+        free(raw);
+        free(buf);
+        fclose(fp);
+        return 0;
+    }
+
+    // Sliding window state (windowsize 1 is plain stop-and-wait)
+    uint64_t acked = 0;       // last block acknowledged by the server
+    uint64_t next = 1;        // next block to send
+    uint64_t sent = 0;        // highest block sent so far
+    uint64_t last_block = 0;  // final (short) block once known
+    uint64_t rewound = 0;     // window resent from this block, 0 if not resent
+    uint64_t rewound_us = 0;  // when it was resent
+    int retries = 3;
+
+    // Congestion window: at most cwnd blocks in flight, paced out over a round trip
+    tftp_cc cc;
+    cc_init(&cc, g_cc_ops, negotiated.windowsize);
+
+    // Digest of the blocks sent, in order (first transmissions only)
+    tftp_sha256 sha;
+    sha256_init(&sha);
+
+    // Every ACK already queued is read before sending more: a repeated ACK right
+    // behind one that slid the window then resends before new blocks go out
+    int draining = 0;
 
     while (1) {
-        // Read up to MAX_DATA_SIZE bytes from file into buffer starting at buf[4]
-        size_t bytes_read = fread(&buf[4], 1, MAX_DATA_SIZE, fp);
-
-        // Construct DATA packet header
-        buf[0] = 0;
-        buf[1] = OP_DATA;  // DATA opcode
-        buf[2] = (block >> 8) & 0xFF;  // High byte of block number
-        buf[3] = block & 0xFF;         // Low byte of block number
-
-        // Calculate CRC8 over the data portion and store it immediately after data
-        buf[bytes_read + 4] = calculate_crc8(&buf[4], bytes_read);
-
-        // Retry logic: try up to 3 times to send DATA and receive correct ACK
-        int retries = 3;
-        while (retries-- > 0) {
-            sendto(sock, buf, bytes_read + 5, 0, (struct sockaddr *)&from_addr, from_len);
-            n = recvfrom(sock, ack, sizeof(ack), 0, (struct sockaddr *)&from_addr, &from_len);
-            if (n >= 4 && ack[1] == OP_ACK && ack[2] == buf[2] && ack[3] == buf[3]) {
-                // Correct ACK received for current block
-                break;
+        // Send blocks until cwnd of them (at most the window) are in flight
+        while (!draining && next <= acked + cc_flight_limit(&cc) && (last_block == 0 || next <= last_block)) {
+            uint64_t wait;
+            while ((wait = cc_release(&cc, &rto, rto_now_us(), 0)) > 0)
+                usleep(wait);
+
+            // Read the block from its offset so any block of the window can be resent
+            fseeko(fp, (off_t)base + (off_t)(next - 1) * blksize, SEEK_SET);
+            unsigned char *data = negotiated.compress ? raw : &buf[4];
+            size_t bytes_read = fread(data, 1, blksize, fp);
+
+            // A short (possibly empty) block is the final one
+            if (bytes_read < (size_t)blksize)
+                last_block = next;
+
+            // With compression the payload is the block's frame (tftp_compress.h)
+            size_t payload = negotiated.compress ? (size_t)block_pack(raw, bytes_read, &buf[4]) : bytes_read;
+
+            // Construct DATA packet header
+            buf[0] = 0;
+            buf[1] = OP_DATA;  // DATA opcode
+            uint16_t wire = block_to_wire(next, wrap_to);
+            buf[2] = (wire >> 8) & 0xFF;  // High byte of block number
+            buf[3] = wire & 0xFF;         // Low byte of block number
+
+            // Calculate the negotiated check over the data portion and store it immediately after data
+            block_check_put(negotiated.check, &buf[4], payload, &buf[payload + 4]);
+
+            sendto(sock, buf, payload + 4 + block_check_len(negotiated.check), 0, (struct sockaddr *)&from_addr, from_len);
+            int resent = next <= sent;
+            if (resent) {
+                rto_resent(&rto, next);
+            } else {
+                sent = next;
+                if (negotiated.digest)
+                    sha256_update(&sha, data, bytes_read);
+                // the server answers the last block in flight: time that one
+                if (next == acked + cc_flight_limit(&cc) || next == last_block)
+                    rto_start(&rto, next);
             }
+            cc_on_send(&cc, resent);
+            next++;
         }
 
-        if (retries < 0) {
-            // Timeout waiting for ACK, abort upload
-            printf("Timeout waiting for ACK for block %d\n", block);
-            break;
+        if (!draining)
+            apply_rto(sock, &rto, &applied);
+        n = recvfrom(sock, ack, sizeof(ack), draining ? MSG_DONTWAIT : 0, (struct sockaddr *)&from_addr, &from_len);
+        if (n < 0 && draining) {
+            draining = 0;
+            continue;
         }
-
-        block++;  // Increment block number for next DATA packet
-
-        if (bytes_read < MAX_DATA_SIZE) {
-            // File read less than 512 bytes → this is the final DATA block, upload complete
-            printf("Upload complete\n");
+        draining = 1;
+        if (n < 0) {
+            draining = 0;
+            // Timeout: resend the window with a doubled timeout, abort after 3 attempts
+            if (--retries <= 0) {
+                printf("Timeout waiting for ACK for block %llu\n", (unsigned long long)acked + 1);
+                break;
+            }
+            rto_backoff(&rto);
+            cc_on_timeout(&cc);
+            next = acked + 1;
+            rewound = next;
+            rewound_us = rto_now_us();
+            continue;
+        }
+        if (n >= 4 && ack[1] == OP_ERROR) {
+            printf("Server error: %s\n", &ack[4]);
             break;
         }
+        if (n < 4 || ack[1] != OP_ACK)
+            continue;
 
-        // If bytes_read == MAX_DATA_SIZE (512), we might be at file boundary.
-        // Check if EOF has been reached by attempting to read one more byte.
-        int next_byte = fgetc(fp);
-        if (next_byte == EOF) {
-            // File ends exactly at 512-byte boundary → send final zero-length DATA block
-
-            // Prepare zero-length DATA block with incremented block number
-            buf[0] = 0;
-            buf[1] = OP_DATA;
-            buf[2] = (block >> 8) & 0xFF;
-            buf[3] = block & 0xFF;
-            buf[4] =calculate_crc8(NULL, 0);  // CRC for empty data
-
-            retries = 3;
-            while (retries-- > 0) {
-                sendto(sock, buf, 5, 0, (struct sockaddr *)&from_addr, from_len);
-                n = recvfrom(sock, ack, sizeof(ack), 0, (struct sockaddr *)&from_addr, &from_len);
-                if (n >= 4 && ack[1] == OP_ACK && ack[2] == buf[2] && ack[3] == buf[3]) {
-                    // ACK received for zero-length block
-                    break;
-                }
+        // ACKs are cumulative; ignore stale ones from before the window
+        uint64_t advance = block_distance(acked, (ack[2] << 8) | ack[3], wrap_to);
+        if (advance > sent - acked)
+            continue;
+        if (advance == 0) {
+            // A repeated ACK reports a gap: resend from the block after it, once
+            // (a duplicate of the ACK the window was already resent after is ignored,
+            // but the server only repeats it later on a timeout: that resend was lost)
+            if ((rewound != acked + 1 || rto_now_us() - rewound_us >= RTO_MIN_MS * 1000 / 2) && acked < sent) {
+                cc_on_loss(&cc, acked, sent);
+                next = acked + 1;
+                rewound = next;
+                rewound_us = rto_now_us();
             }
+            continue;
+        }
+        // The server acknowledges once per window of its own count, so an ACK
+        // short of the blocks sent only slides the window: the rest are in flight
+        acked += advance;
+        retries = 3;
+        cc_on_ack(&cc, (uint32_t)advance, rto_ack(&rto, acked) ? rto.rtt_us : 0);
+
+        if (last_block && acked == last_block) {
+            uint16_t after_last = block_to_wire(last_block + 1, wrap_to);
+            if (negotiated.digest && wrq_send_digest(sock, &from_addr, from_len, after_last, &sha, &rto, &applied) < 0)
+                break;
             printf("Upload complete\n");
+            print_rtt(&rto);
+            if (negotiated.windowsize > 1) {
+                char report[128];
+                cc_describe(&cc, &rto, blksize, report, sizeof(report));
+                printf("%s\n", report);
+            }
             break;
-        } else {
-            // Not EOF, so push the byte back for next fread() call
-
-            ungetc(next_byte, fp);
         }
+
+        // A resend after a timeout or a gap continues past the acknowledged blocks
+        if (next <= acked)
+            next = acked + 1;
     }
 
+    free(raw);
+    free(buf);
     fclose(fp);
+    return 0;
+}
+
+/**
+ * @brief Perform a TFTP WRQ (upload) to the server.
+ *
+ * With -R a partial upload kept by the server is continued when it matches
+ * the local file; otherwise the file is uploaded from the start.
+ *
+ * @param sock UDP socket used for communication.
+ * @param server_addr Pointer to the server's sockaddr_in structure.
+ * @param addr_len Length of the server address structure.
+ * @param local_file Path to the local file to be uploaded.
+ * @param remote_file Target filename on the server.
+ */
+void wrq(int sock, struct sockaddr_in *server_addr, socklen_t addr_len, const char *local_file, const char *remote_file) {
+    if (wrq_session(sock, server_addr, addr_len, local_file, remote_file, g_resume))
+        wrq_session(sock, server_addr, addr_len, local_file, remote_file, 0);
 }
 
  
@@ -371,8 +1040,91 @@ void wrq(int sock, struct sockaddr_in *server_addr, socklen_t addr_len, const ch
   * 
   * Prompts user for server IP and provides a menu to upload, download, or delete files.
   * Communicates over UDP using standard TFTP opcodes with CRC-8 verification.
+  * Command line: [-b blksize] requests a block size (RFC 2348) and [-w windowsize]
+  * a window size (RFC 7440) and [-r 0|1] block number rollover for every transfer;
+  * [-c aimd|delay|none] picks the congestion control of windowed uploads;
+  * [-p streams] downloads each file as that many byte ranges in parallel;
+  * [-R] resumes interrupted downloads and uploads;
+  * [-k none|crc8|crc32c|xxh64] picks the integrity check of every DATA block;
+  * [-D] verifies every transfer with a SHA-256 of the whole file (digest option);
+  * [-z lz4] compresses every DATA block (compress option);
+  * [-P port] sends requests to another port than SERVER_PORT (e.g. an impairment proxy).
   */
- int main() {
+ int main(int argc, char *argv[]) {
+
+     int opt;
+     int server_port = SERVER_PORT;
+     while ((opt = getopt(argc, argv, "b:w:r:c:p:Rk:Dz:P:")) != -1) {
+         switch (opt) {
+             case 'b':
+                 g_request_options.blksize = atoi(optarg);
+                 if (g_request_options.blksize < MIN_BLKSIZE || g_request_options.blksize > MAX_BLKSIZE) {
+                     printf("blksize must be between %d and %d\n", MIN_BLKSIZE, MAX_BLKSIZE);
+                     return 1;
+                 }
+                 break;
+             case 'w':
+                 g_request_options.windowsize = atoi(optarg);
+                 if (g_request_options.windowsize < MIN_WINDOWSIZE || g_request_options.windowsize > MAX_WINDOWSIZE) {
+                     printf("windowsize must be between %d and %d\n", MIN_WINDOWSIZE, MAX_WINDOWSIZE);
+                     return 1;
+                 }
+                 break;
+             case 'r':
+                 if (strcmp(optarg, "0") && strcmp(optarg, "1")) {
+                     printf("rollover must be 0 or 1\n");
+                     return 1;
+                 }
+                 g_request_options.rollover = optarg[0] == '1' ? ROLLOVER_TO_1 : ROLLOVER_TO_0;
+                 break;
+             case 'c':
+                 g_cc_ops = cc_find(optarg);
+                 if (!g_cc_ops) {
+                     printf("congestion control must be aimd, delay or none\n");
+                     return 1;
+                 }
+                 break;
+             case 'p':
+                 g_streams = atoi(optarg);
+                 if (g_streams < 1 || g_streams > MAX_STREAMS) {
+                     printf("streams must be between 1 and %d\n", MAX_STREAMS);
+                     return 1;
+                 }
+                 break;
+             case 'R':
+                 g_resume = 1;
+                 break;
+             case 'k':
+                 g_request_options.check = check_find(optarg);
+                 if (g_request_options.check == CHECK_ABSENT) {
+                     printf("check must be none, crc8, crc32c or xxh64\n");
+                     return 1;
+                 }
+                 break;
+             case 'D':
+                 g_request_options.digest = DIGEST_SHA256;
+                 break;
+             case 'z':
+                 if (strcasecmp(optarg, "lz4") != 0) {
+                     printf("compression must be lz4\n");
+                     return 1;
+                 }
+                 g_request_options.compress = COMPRESS_LZ4;
+                 break;
+             case 'P':
+                 server_port = atoi(optarg);
+                 if (server_port <= 0 || server_port > 65535) {
+                     printf("port must be between 1 and 65535\n");
+                     return 1;
+                 }
+                 break;
+             default:
+                 printf("Usage: %s [-b blksize] [-w windowsize] [-r 0|1] [-c aimd|delay|none] [-p streams] [-R] [-k check] [-D] [-z lz4] [-P port]\n", argv[0]);
+                 return 1;
+         }
+     }
+     if (!g_cc_ops)
+         g_cc_ops = cc_find("aimd");
 
      char server_ip[16];
      printf("Enter server IP address: ");
@@ -390,7 +1142,7 @@ void wrq(int sock, struct sockaddr_in *server_addr, socklen_t addr_len, const ch
  
      struct sockaddr_in server_addr = {0};
      server_addr.sin_family = AF_INET;
-     server_addr.sin_port = htons(SERVER_PORT);
+     server_addr.sin_port = htons(server_port);
  
      if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) != 1) {
          printf("Invalid IP address\n");
@@ -7,12 +7,21 @@
  #define TFTP_CLIENT_H
  
  #include <stdint.h>
+ #include <limits.h>
  #include <netinet/in.h>
  #include <sys/socket.h>
+ #include "tftp_crc.h"
+ #include "tftp_options.h"
+ #include "tftp_sha256.h"
+ #include "tftp_compress.h"
+ #include "tftp_rto.h"
+ #include "tftp_cc.h"
  
  #define SERVER_PORT         6969
  #define MAX_DATA_SIZE      512
  #define MAX_PACKET_SIZE  517
+ #define MAX_STREAMS      64   // parallel range sessions of one download
+ #define RCVBUF_DEFAULT   (208 * 1024) // socket receive buffers are only raised above the kernel default
  
  // TFTP operation codes
  #define OP_RRQ     1
@@ -22,12 +31,26 @@
  #define OP_ERROR  5
  #define OP_DELETE 6
  
- 
- 
  /*!
-  * \brief Compute CRC-8 over a data buffer.
+  * \brief Options requested with every RRQ/WRQ (none by default).
+  */
+ extern tftp_options g_request_options;
+
+ /*!
+  * \brief Congestion control of uploads (aimd unless -c says otherwise).
+  */
+ extern const tftp_cc_ops *g_cc_ops;
+
+ /*!
+  * \brief Concurrent byte-range sessions per download (1 unless -p says otherwise).
+  */
+ extern int g_streams;
+
+ /*!
+  * \brief Resume interrupted transfers from the bytes already transferred (-R).
   */
- uint8_t calculate_crc8(const uint8_t *data, size_t len);
+ extern int g_resume;
+ 
  
  /*!
   * \brief Ping the TFTP server to verify connectivity.
@@ -0,0 +1,146 @@
+/**
+ * @file crc_bench.c
+ * @brief Microbenchmark and self-check for the CRC-8 implementations in tftp_crc.c.
+ *
+ * Every implementation is first checked bit-exact against crc8_bitwise() over
+ * random buffers of many lengths (including chained updates), then timed on
+ * buffers of typical DATA block sizes. Throughput is reported in GB/s, followed
+ * by the per-block checks a transfer can negotiate (CRC-8, CRC-32C, xxHash64).
+ *
+ * Usage: crc_bench [total_megabytes]   (default 256 MB hashed per measurement)
+ */
+
+#include "tftp_crc.h"
+#include "tftp_options.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+    const char *name;
+    crc8_fn fn;
+} crc8_variant;
+
+/**
+ * @brief Return a monotonic timestamp in seconds.
+ */
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Check one implementation against the bitwise reference.
+ *
+ * @param v Implementation to check.
+ * @param buf Random data.
+ * @param size Size of buf.
+ * @return int 1 if every result matched, 0 otherwise.
+ */
+static int verify(const crc8_variant *v, const uint8_t *buf, size_t size) {
+    for (size_t len = 0; len <= 1024 && len <= size; len++) {
+        for (size_t off = 0; off < 16 && off + len <= size; off += 5) {
+            uint8_t want = crc8_bitwise(0, buf + off, len);
+            if (v->fn(0, buf + off, len) != want) {
+                printf("%s: mismatch at len %zu offset %zu\n", v->name, len, off);
+                return 0;
+            }
+            // chained update must equal one-shot computation
+            size_t half = len / 3;
+            uint8_t crc = v->fn(0, buf + off, half);
+            if (v->fn(crc, buf + off + half, len - half) != want) {
+                printf("%s: chained mismatch at len %zu\n", v->name, len);
+                return 0;
+            }
+        }
+    }
+    if (v->fn(0, buf, size) != crc8_bitwise(0, buf, size)) {
+        printf("%s: mismatch on %zu bytes\n", v->name, size);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    size_t total = (argc > 1 ? strtoull(argv[1], NULL, 10) : 256) << 20;
+    const size_t sizes[] = {512, 1428, 8192, 65464, 1 << 20};
+    const size_t max_size = 1 << 20;
+
+    crc8_variant variants[4] = {
+        {"bitwise", crc8_bitwise},
+        {"table", crc8_table},
+        {"slice8", crc8_slice8},
+    };
+    int count = 3;
+    if (crc8_clmul_supported())
+        variants[count++] = (crc8_variant){"clmul", crc8_clmul};
+
+    uint8_t *buf = malloc(max_size);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    srand(12345);
+    for (size_t i = 0; i < max_size; i++)
+        buf[i] = rand() & 0xFF;
+
+    for (int v = 0; v < count; v++) {
+        if (!verify(&variants[v], buf, max_size))
+            return 1;
+    }
+    printf("all %d implementations bit-exact with the reference (default: %s)\n\n", count, crc8_impl_name());
+
+    printf("%-8s", "impl");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        printf(" %9zuB", sizes[s]);
+    printf("   (GB/s)\n");
+
+    volatile uint8_t sink = 0;   // every result is folded in, so no call can be optimized away
+    for (int v = 0; v < count; v++) {
+        printf("%-8s", variants[v].name);
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t size = sizes[s];
+            // the bitwise loop is ~50x slower, hash less data with it
+            size_t bytes = variants[v].fn == crc8_bitwise ? total / 32 : total;
+            size_t iterations = bytes / size ? bytes / size : 1;
+
+            double start = now_sec();
+            for (size_t i = 0; i < iterations; i++)
+                sink ^= variants[v].fn(0, buf + (i & 7), size - 8);
+            double elapsed = now_sec() - start;
+
+            printf(" %10.2f", (double)iterations * (size - 8) / elapsed / 1e9);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    const int checks[] = {CHECK_CRC8, CHECK_CRC32C, CHECK_XXH64};
+    printf("\n%-8s", "check");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        printf(" %9zuB", sizes[s]);
+    printf("   (GB/s)\n");
+    for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); c++) {
+        printf("%-8s", check_name(checks[c]));
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t size = sizes[s];
+            size_t iterations = total / size ? total / size : 1;
+            uint8_t trailer[CHECK_MAX_LEN];
+
+            double start = now_sec();
+            for (size_t i = 0; i < iterations; i++) {
+                block_check_put(checks[c], buf + (i & 7), size - 8, trailer);
+                sink ^= trailer[0];
+            }
+            double elapsed = now_sec() - start;
+
+            printf(" %10.2f", (double)iterations * (size - 8) / elapsed / 1e9);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    free(buf);
+    return 0;
+}
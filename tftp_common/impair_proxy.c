@@ -0,0 +1,555 @@
+/**
+ * @file impair_proxy.c
+ * @brief UDP proxy injecting delay, jitter, loss, duplication and reordering
+ *        between TFTP clients and the server.
+ *
+ * Clients send their requests to the proxy port instead of the server port.
+ * Every client address gets its own upstream socket, so the server still
+ * sees one peer per client. Each port the server answers from (the dynamic
+ * port of a session) is mirrored by a proxy socket of its own, which the
+ * client then talks to: the transfer ID handling of both sides is unchanged.
+ * Answers from the server's listening port (errors, DELETE replies) come
+ * back from the proxy port.
+ *
+ * Each packet, in each direction, is dropped with the loss probability;
+ * otherwise it is delayed by delay +/- jitter, held back by an extra reorder
+ * delay with the reorder probability (so the packets behind it overtake it)
+ * and sent twice with the duplication probability. Jitter alone never
+ * reorders the packets of a client: a packet is not released before the one
+ * ahead of it. Every decision comes from
+ * one xorshift64* generator seeded from the command line, so the same seed
+ * and the same packet sequence give the same impairments.
+ *
+ * SIGINT or SIGTERM prints the per-direction counters and exits.
+ *
+ * Usage: impair_proxy [-l listen_port] [-s server_ip] [-p server_port] [-L loss_pct]
+ *                     [-D delay_ms] [-J jitter_ms] [-U dup_pct] [-O reorder_pct]
+ *                     [-G reorder_ms] [-r seed] [-i idle_s]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#define PROXY_LISTEN_PORT  7069
+#define PROXY_SERVER_PORT  6969
+#define PROXY_MAX_PACKET   65536
+#define PROXY_MAX_EVENTS   64
+
+enum { DIR_UP, DIR_DOWN };           // client to server, server to client
+enum { EP_LISTEN, EP_UPSTREAM, EP_PORT };
+
+struct proxy_flow;
+
+/**
+ * @brief A server port mirrored for one client.
+ */
+typedef struct proxy_port {
+    int kind;                  ///< EP_PORT (first member: epoll data points here)
+    int sock;                  ///< Proxy socket the client talks to
+    uint16_t server_port;      ///< Server port it stands for (network order)
+    struct proxy_flow *flow;
+    struct proxy_port *next;
+} proxy_port;
+
+/**
+ * @brief Everything the proxy holds for one client address.
+ */
+typedef struct proxy_flow {
+    int kind;                  ///< EP_UPSTREAM
+    int upstream;              ///< Socket towards the server
+    struct sockaddr_in client;
+    uint64_t last_us;          ///< Last packet in either direction
+    uint64_t last_due_us[2];   ///< Release time of the last in-order packet, per direction
+    proxy_port *ports;
+    struct proxy_flow *next;
+} proxy_flow;
+
+/**
+ * @brief A packet waiting for its release time.
+ */
+typedef struct proxy_packet {
+    uint64_t due_us;
+    uint64_t seq;              ///< Keeps packets due at the same time in order
+    int sock;
+    struct sockaddr_in to;
+    int len;
+    unsigned char *data;
+} proxy_packet;
+
+/**
+ * @brief Counters of one direction.
+ */
+typedef struct proxy_stats {
+    uint64_t received;
+    uint64_t sent;
+    uint64_t dropped;
+    uint64_t duplicated;
+    uint64_t reordered;
+} proxy_stats;
+
+static struct {
+    struct sockaddr_in server;
+    int listen_kind;           ///< EP_LISTEN, epoll data of the listening socket
+    int listen_sock;
+    int epoll_fd;
+    double loss, dup, reorder; ///< Probabilities
+    uint64_t delay_us, jitter_us, reorder_us;
+    uint64_t idle_us;
+    uint64_t rng;
+    proxy_flow *flows;
+    proxy_packet *heap;        ///< Min-heap on (due_us, seq)
+    int heap_len, heap_cap;
+    uint64_t seq;
+    proxy_stats stats[2];
+} proxy = {
+    .listen_kind = EP_LISTEN,
+    .idle_us = 60000000,
+    .rng = 1,
+};
+
+static volatile sig_atomic_t stopping;
+
+/**
+ * @brief Monotonic clock in microseconds.
+ */
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Next number of the seeded generator, uniform in [0, 1).
+ */
+static double rng_unit(void) {
+    proxy.rng ^= proxy.rng >> 12;
+    proxy.rng ^= proxy.rng << 25;
+    proxy.rng ^= proxy.rng >> 27;
+    return ((proxy.rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief Tell whether heap entry a is released before entry b.
+ */
+static int packet_before(const proxy_packet *a, const proxy_packet *b) {
+    return a->due_us < b->due_us || (a->due_us == b->due_us && a->seq < b->seq);
+}
+
+/**
+ * @brief Queue a copy of a packet for release at a given time.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+static int heap_push(uint64_t due_us, int sock, const struct sockaddr_in *to, const unsigned char *data, int len) {
+    if (proxy.heap_len == proxy.heap_cap) {
+        int cap = proxy.heap_cap ? proxy.heap_cap * 2 : 256;
+        proxy_packet *heap = realloc(proxy.heap, cap * sizeof(*heap));
+        if (!heap)
+            return -1;
+        proxy.heap = heap;
+        proxy.heap_cap = cap;
+    }
+    proxy_packet p = {.due_us = due_us, .seq = proxy.seq++, .sock = sock, .to = *to, .len = len};
+    p.data = malloc(len ? len : 1);
+    if (!p.data)
+        return -1;
+    memcpy(p.data, data, len);
+
+    int i = proxy.heap_len++;
+    while (i > 0 && packet_before(&p, &proxy.heap[(i - 1) / 2])) {
+        proxy.heap[i] = proxy.heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    proxy.heap[i] = p;
+    return 0;
+}
+
+/**
+ * @brief Remove the first packet of the heap.
+ */
+static void heap_pop(void) {
+    proxy_packet last = proxy.heap[--proxy.heap_len];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= proxy.heap_len)
+            break;
+        if (child + 1 < proxy.heap_len && packet_before(&proxy.heap[child + 1], &proxy.heap[child]))
+            child++;
+        if (!packet_before(&proxy.heap[child], &last))
+            break;
+        proxy.heap[i] = proxy.heap[child];
+        i = child;
+    }
+    if (proxy.heap_len > 0)
+        proxy.heap[i] = last;
+}
+
+/**
+ * @brief Send every queued packet whose release time has come.
+ */
+static void release_due(uint64_t now) {
+    while (proxy.heap_len > 0 && proxy.heap[0].due_us <= now) {
+        proxy_packet *p = &proxy.heap[0];
+        sendto(p->sock, p->data, p->len, 0, (struct sockaddr *)&p->to, sizeof(p->to));
+        free(p->data);
+        heap_pop();
+    }
+}
+
+/**
+ * @brief Forward one packet through the impairments.
+ *
+ * @param f Flow of the packet.
+ * @param dir DIR_UP or DIR_DOWN.
+ * @param sock Socket to send from.
+ * @param to Destination.
+ * @param data Packet.
+ * @param len Packet length.
+ */
+static void impair_forward(proxy_flow *f, int dir, int sock, const struct sockaddr_in *to, const unsigned char *data, int len) {
+    proxy_stats *st = &proxy.stats[dir];
+    st->received++;
+    if (proxy.loss > 0 && rng_unit() < proxy.loss) {
+        st->dropped++;
+        return;
+    }
+
+    int copies = proxy.dup > 0 && rng_unit() < proxy.dup ? 2 : 1;
+    st->duplicated += copies - 1;
+    uint64_t now = now_us();
+    for (int c = 0; c < copies; c++) {
+        int64_t delay = (int64_t)proxy.delay_us;
+        if (proxy.jitter_us)
+            delay += (int64_t)((rng_unit() * 2 - 1) * proxy.jitter_us);
+        uint64_t due = now + (delay > 0 ? delay : 0);
+        if (proxy.reorder > 0 && rng_unit() < proxy.reorder) {
+            due += proxy.reorder_us;
+            st->reordered++;
+        } else {
+            if (due < f->last_due_us[dir])
+                due = f->last_due_us[dir];
+            f->last_due_us[dir] = due;
+        }
+        st->sent++;
+        if (due <= now && proxy.heap_len == 0) {
+            sendto(sock, data, len, 0, (const struct sockaddr *)to, sizeof(*to));
+            continue;
+        }
+        if (heap_push(due, sock, to, data, len) < 0)
+            perror("malloc");
+    }
+}
+
+/**
+ * @brief Create a UDP socket on an ephemeral port and watch it.
+ *
+ * @param owner Epoll data of the socket.
+ * @return int The socket, or -1 on error.
+ */
+static int proxy_socket(void *owner) {
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = owner};
+    if (epoll_ctl(proxy.epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+        perror("epoll_ctl");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Find the flow of a client address, creating it if needed.
+ *
+ * @return proxy_flow* The flow, or NULL on error.
+ */
+static proxy_flow *flow_get(const struct sockaddr_in *client) {
+    for (proxy_flow *f = proxy.flows; f; f = f->next) {
+        if (f->client.sin_addr.s_addr == client->sin_addr.s_addr && f->client.sin_port == client->sin_port)
+            return f;
+    }
+    proxy_flow *f = calloc(1, sizeof(*f));
+    if (!f)
+        return NULL;
+    f->kind = EP_UPSTREAM;
+    f->client = *client;
+    f->upstream = proxy_socket(f);
+    if (f->upstream < 0) {
+        free(f);
+        return NULL;
+    }
+    f->next = proxy.flows;
+    proxy.flows = f;
+    return f;
+}
+
+/**
+ * @brief Find the proxy socket standing for a server port, creating it if needed.
+ *
+ * @return proxy_port* The mirrored port, or NULL on error.
+ */
+static proxy_port *port_get(proxy_flow *f, uint16_t server_port) {
+    for (proxy_port *p = f->ports; p; p = p->next) {
+        if (p->server_port == server_port)
+            return p;
+    }
+    proxy_port *p = calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+    p->kind = EP_PORT;
+    p->server_port = server_port;
+    p->flow = f;
+    p->sock = proxy_socket(p);
+    if (p->sock < 0) {
+        free(p);
+        return NULL;
+    }
+    p->next = f->ports;
+    f->ports = p;
+    return p;
+}
+
+/**
+ * @brief Drop the flows idle for longer than the idle timeout.
+ *
+ * A flow is only idle once nothing of it is queued any more, since the
+ * longest delay is far below the timeout.
+ */
+static void flows_expire(uint64_t now) {
+    proxy_flow **link = &proxy.flows;
+    while (*link) {
+        proxy_flow *f = *link;
+        if (now - f->last_us < proxy.idle_us) {
+            link = &f->next;
+            continue;
+        }
+        *link = f->next;
+        while (f->ports) {
+            proxy_port *p = f->ports;
+            f->ports = p->next;
+            close(p->sock);
+            free(p);
+        }
+        close(f->upstream);
+        free(f);
+    }
+}
+
+/**
+ * @brief Read every queued datagram of a socket and forward it.
+ *
+ * @param owner Epoll data of the socket.
+ * @param buf Packet buffer of PROXY_MAX_PACKET bytes.
+ */
+static void proxy_readable(void *owner, unsigned char *buf) {
+    int kind = *(int *)owner;
+    int sock = kind == EP_LISTEN ? proxy.listen_sock
+               : kind == EP_UPSTREAM ? ((proxy_flow *)owner)->upstream
+                                     : ((proxy_port *)owner)->sock;
+    while (1) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int n = recvfrom(sock, buf, PROXY_MAX_PACKET, 0, (struct sockaddr *)&from, &from_len);
+        if (n < 0)
+            return;
+
+        if (kind == EP_LISTEN) {
+            // a request (or a packet to the server's listening port) from a client
+            proxy_flow *f = flow_get(&from);
+            if (!f)
+                continue;
+            f->last_us = now_us();
+            impair_forward(f, DIR_UP, f->upstream, &proxy.server, buf, n);
+        } else if (kind == EP_UPSTREAM) {
+            // the server answering a client, from its listening port or a session port
+            proxy_flow *f = owner;
+            f->last_us = now_us();
+            if (from.sin_port == proxy.server.sin_port) {
+                impair_forward(f, DIR_DOWN, proxy.listen_sock, &f->client, buf, n);
+                continue;
+            }
+            proxy_port *p = port_get(f, from.sin_port);
+            if (p)
+                impair_forward(f, DIR_DOWN, p->sock, &f->client, buf, n);
+        } else {
+            // the client talking to a session port of the server
+            proxy_port *p = owner;
+            if (from.sin_addr.s_addr != p->flow->client.sin_addr.s_addr || from.sin_port != p->flow->client.sin_port)
+                continue;
+            p->flow->last_us = now_us();
+            struct sockaddr_in to = proxy.server;
+            to.sin_port = p->server_port;
+            impair_forward(p->flow, DIR_UP, p->flow->upstream, &to, buf, n);
+        }
+    }
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+/**
+ * @brief Print the counters of both directions.
+ */
+static void print_stats(void) {
+    const char *names[2] = {"client->server", "server->client"};
+    for (int d = 0; d < 2; d++) {
+        const proxy_stats *st = &proxy.stats[d];
+        printf("%s: received %llu, sent %llu, dropped %llu, duplicated %llu, reordered %llu\n", names[d],
+               (unsigned long long)st->received, (unsigned long long)st->sent, (unsigned long long)st->dropped,
+               (unsigned long long)st->duplicated, (unsigned long long)st->reordered);
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief Print command line usage.
+ */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-l listen_port] [-s server_ip] [-p server_port] [-L loss_pct] [-D delay_ms] "
+                    "[-J jitter_ms] [-U dup_pct] [-O reorder_pct] [-G reorder_ms] [-r seed] [-i idle_s]\n", prog);
+    fprintf(stderr, "  -l N  port clients send their requests to (default %d)\n", PROXY_LISTEN_PORT);
+    fprintf(stderr, "  -s IP server address (default 127.0.0.1)\n");
+    fprintf(stderr, "  -p N  server port (default %d)\n", PROXY_SERVER_PORT);
+    fprintf(stderr, "  -L P  drop P%% of the packets of each direction (default 0)\n");
+    fprintf(stderr, "  -D N  delay every packet by N ms (default 0)\n");
+    fprintf(stderr, "  -J N  add a uniform jitter of +/- N ms to the delay (default 0)\n");
+    fprintf(stderr, "  -U P  send P%% of the packets twice (default 0)\n");
+    fprintf(stderr, "  -O P  hold P%% of the packets back by the reorder delay (default 0)\n");
+    fprintf(stderr, "  -G N  reorder delay in ms (default 10)\n");
+    fprintf(stderr, "  -r N  seed of the random decisions (default 1)\n");
+    fprintf(stderr, "  -i N  forget clients idle for N seconds (default 60)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int listen_port = PROXY_LISTEN_PORT, server_port = PROXY_SERVER_PORT;
+    const char *server_ip = "127.0.0.1";
+    double reorder_ms = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:s:p:L:D:J:U:O:G:r:i:h")) != -1) {
+        switch (opt) {
+            case 'l':
+                listen_port = atoi(optarg);
+                break;
+            case 's':
+                server_ip = optarg;
+                break;
+            case 'p':
+                server_port = atoi(optarg);
+                break;
+            case 'L':
+                proxy.loss = atof(optarg) / 100;
+                break;
+            case 'D':
+                proxy.delay_us = (uint64_t)(atof(optarg) * 1000);
+                break;
+            case 'J':
+                proxy.jitter_us = (uint64_t)(atof(optarg) * 1000);
+                break;
+            case 'U':
+                proxy.dup = atof(optarg) / 100;
+                break;
+            case 'O':
+                proxy.reorder = atof(optarg) / 100;
+                break;
+            case 'G':
+                reorder_ms = atof(optarg);
+                break;
+            case 'r':
+                proxy.rng = strtoull(optarg, NULL, 10);
+                break;
+            case 'i':
+                proxy.idle_us = (uint64_t)atoi(optarg) * 1000000;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    proxy.reorder_us = (uint64_t)(reorder_ms * 1000);
+    if (listen_port <= 0 || listen_port > 65535 || server_port <= 0 || server_port > 65535 || proxy.loss < 0 ||
+        proxy.loss > 1 || proxy.dup < 0 || proxy.dup > 1 || proxy.reorder < 0 || proxy.reorder > 1 ||
+        reorder_ms < 0 || proxy.idle_us == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (proxy.rng == 0)
+        proxy.rng = 1; // xorshift never leaves 0
+
+    proxy.server.sin_family = AF_INET;
+    proxy.server.sin_port = htons(server_port);
+    if (inet_pton(AF_INET, server_ip, &proxy.server.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IP address\n");
+        return 1;
+    }
+
+    proxy.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (proxy.epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    proxy.listen_sock = proxy_socket(&proxy.listen_kind);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(listen_port)};
+    if (proxy.listen_sock < 0 || bind(proxy.listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    // no SA_RESTART: the signals interrupt epoll_wait()
+    struct sigaction sa = {.sa_handler = on_signal};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    unsigned char *buf = malloc(PROXY_MAX_PACKET);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    printf("Proxying port %d to %s:%d (loss %.2f%%, delay %.1f ms, jitter %.1f ms, dup %.2f%%, reorder %.2f%%)\n",
+           listen_port, server_ip, server_port, proxy.loss * 100, proxy.delay_us / 1000.0,
+           proxy.jitter_us / 1000.0, proxy.dup * 100, proxy.reorder * 100);
+    fflush(stdout);
+
+    uint64_t next_expire = now_us() + 1000000;
+    struct epoll_event events[PROXY_MAX_EVENTS];
+    while (!stopping) {
+        uint64_t now = now_us();
+        int timeout = 1000;
+        if (proxy.heap_len > 0) {
+            uint64_t due = proxy.heap[0].due_us;
+            timeout = due <= now ? 0 : (int)((due - now + 999) / 1000);
+        }
+        int n = epoll_wait(proxy.epoll_fd, events, PROXY_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++)
+            proxy_readable(events[i].data.ptr, buf);
+
+        now = now_us();
+        release_due(now);
+        if (now >= next_expire) {
+            flows_expire(now);
+            next_expire = now + 1000000;
+        }
+    }
+
+    print_stats();
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,1012 @@
+/**
+ * @file load_bench.c
+ * @brief Load generator for the TFTP server, reporting JSON results.
+ *
+ * N client sessions (one thread each) run transfers back to back against the
+ * server, picking RRQ, WRQ or DELETE by weight and a file size from a list.
+ * Downloads read seed files uploaded before the measurement; uploads send
+ * random bytes from memory and downloads are checked (CRC-8) and discarded,
+ * so the client side never touches the disk. Each session deletes its own
+ * older uploads.
+ *
+ * Every transfer records its latency (request to last ACK), payload bytes and
+ * retransmissions (requests, DATA or ACK packets sent again, plus duplicate
+ * DATA blocks received from the server). The report is one JSON object: aggregate goodput,
+ * retransmissions in percent of the DATA packets, and p50/p99/p999 latencies, overall and
+ * per operation. The run fails when a transfer failed (-f allows a number of them),
+ * and with -x when that percentage is too high for any operation, to catch a
+ * recovery that resends far more than the loss it recovers from.
+ *
+ * With -S the server is started in the directory given by -d (arguments after
+ * "--" are passed to it) and stopped at the end, so the benchmark runs on
+ * loopback without any setup.
+ *
+ * Usage: load_bench [-s server_ip] [-P port] [-n sessions] [-t transfers] [-m rrq:wrq:delete]
+ *                   [-z sizes] [-b blksize] [-w windowsize] [-k check] [-o json_file]
+ *                   [-x max_resend_pct] [-f max_failed] [-S server_binary [-d dir]] [-- server arguments]
+ */
+
+#include "tftp_crc.h"
+#include "tftp_options.h"
+#include "tftp_rto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define BENCH_PORT        6969   // default server port
+#define BENCH_MAX_SIZES   16
+#define BENCH_MAX_SESSIONS 1024
+#define BENCH_RETRIES     5      // timeouts in a row before a transfer is given up
+
+#define OP_RRQ    1
+#define OP_WRQ    2
+#define OP_DATA   3
+#define OP_ACK    4
+#define OP_ERROR  5
+#define OP_DELETE 6
+
+enum { BENCH_RRQ, BENCH_WRQ, BENCH_DELETE, BENCH_OPS };
+static const char *op_names[BENCH_OPS] = {"rrq", "wrq", "delete"};
+
+/**
+ * @brief Outcome of one transfer.
+ */
+typedef struct bench_result {
+    int op;               ///< BENCH_RRQ, BENCH_WRQ or BENCH_DELETE
+    int ok;               ///< The transfer completed
+    uint64_t bytes;       ///< Payload bytes transferred
+    uint64_t latency_us;  ///< Request to completion
+    uint32_t retransmits; ///< Packets sent again, and duplicate DATA received
+    uint32_t packets;     ///< DATA packets sent (uploads, resends included) or received (downloads)
+    uint32_t timeouts;    ///< Receive timeouts
+    uint32_t crc_errors;  ///< DATA blocks received with a bad per-block check
+} bench_result;
+
+/**
+ * @brief One client session: a thread running transfers back to back.
+ */
+typedef struct bench_session {
+    int id;
+    pthread_t thread;
+    unsigned int seed;       ///< rand_r() state
+    bench_result *results;   ///< One per transfer
+    int done;                ///< Transfers run
+    int upload_head;         ///< Oldest upload not deleted yet
+    int upload_tail;         ///< Number of uploads made
+} bench_session;
+
+static struct {
+    struct sockaddr_in server;
+    int sessions;
+    int transfers;               ///< Per session
+    int weights[BENCH_OPS];
+    uint64_t sizes[BENCH_MAX_SIZES];
+    int size_count;
+    tftp_options options;        ///< blksize, windowsize and check requested by every transfer
+    unsigned char *data;         ///< Random payload of the largest size
+} bench = {
+    .sessions = 16,
+    .transfers = 20,
+    .weights = {70, 25, 5},
+    .sizes = {64 << 10, 1 << 20},
+    .size_count = 2,
+};
+
+/**
+ * @brief Name of the file a download of the given size reads.
+ */
+static void seed_name(char *buf, size_t size, uint64_t bytes) {
+    snprintf(buf, size, "bench_seed_%llu.bin", (unsigned long long)bytes);
+}
+
+/**
+ * @brief Name of the n-th upload of a session.
+ */
+static void upload_name(char *buf, size_t size, int session, int n) {
+    snprintf(buf, size, "bench_%d_%d.bin", session, n);
+}
+
+/**
+ * @brief Create the UDP socket of one transfer.
+ *
+ * @return int The socket, or -1 on error.
+ */
+static int bench_socket(void) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+        perror("socket");
+    return sock;
+}
+
+/**
+ * @brief Set the receive timeout of a socket from an estimator.
+ */
+static void bench_timeout(int sock, const tftp_rto *rto) {
+    struct timeval timeout = {rto->rto_ms / 1000, (rto->rto_ms % 1000) * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+/**
+ * @brief Wait up to us microseconds for a datagram (ppoll() is not rounded to a scheduler tick).
+ * @return int 0 if nothing arrived in time, 1 otherwise.
+ */
+static int bench_readable(int sock, uint32_t us) {
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    struct timespec timeout = {us / 1000000, (long)(us % 1000000) * 1000};
+    return ppoll(&pfd, 1, &timeout, NULL) != 0;
+}
+
+/**
+ * @brief Send an ACK for a block.
+ */
+static void bench_ack(int sock, const struct sockaddr_in *to, uint16_t block) {
+    unsigned char ack[4] = {0, OP_ACK, block >> 8, block & 0xFF};
+    sendto(sock, ack, sizeof(ack), 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+/**
+ * @brief Tell whether a packet comes from the session port a transfer locked onto.
+ */
+static int same_peer(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/**
+ * @brief Answer a packet from another session port with ERROR 5 (unknown transfer ID).
+ *
+ * A repeated request may start a second session on the server; this ends it.
+ */
+static void bench_reject(int sock, const struct sockaddr_in *to) {
+    unsigned char err[] = {0, OP_ERROR, 0, 5, 'U', 'n', 'k', 'n', 'o', 'w', 'n', ' ', 'T', 'I', 'D', 0};
+    sendto(sock, err, sizeof(err), 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+/**
+ * @brief Download a file, checking and discarding its blocks.
+ *
+ * The request is repeated while the server has not answered (it may have
+ * been lost); packets from any other session port than the first answer are
+ * rejected.
+ *
+ * @param name File to read.
+ * @param r Updated with the counters of the transfer.
+ * @return int 0 once the last block was received, -1 otherwise.
+ */
+static int bench_rrq(const char *name, bench_result *r) {
+    int sock = bench_socket();
+    if (sock < 0)
+        return -1;
+    int size = (bench.options.blksize ? bench.options.blksize : DEFAULT_BLKSIZE) + DATA_OVERHEAD_MAX;
+    if (size < DEFAULT_BLKSIZE + DATA_OVERHEAD_MAX)
+        size = DEFAULT_BLKSIZE + DATA_OVERHEAD_MAX;
+    unsigned char *buf = malloc(size);
+    if (!buf) {
+        perror("malloc");
+        close(sock);
+        return -1;
+    }
+
+    int len = request_build(buf, size, OP_RRQ, name, &bench.options);
+    sendto(sock, buf, len, 0, (struct sockaddr *)&bench.server, sizeof(bench.server));
+
+    tftp_rto rto;
+    rto_init(&rto);
+    rto_start(&rto, 0);
+    int blksize = DEFAULT_BLKSIZE, windowsize = 1, wrap_to = 0, check = CHECK_CRC8;
+    uint64_t expected = 1;
+    int since_ack = 0, gap_acked = 0, answered = 0, retries = BENCH_RETRIES, status = -1;
+    struct sockaddr_in peer, from;
+    socklen_t from_len = sizeof(from);
+
+    while (1) {
+        // a partial window is acknowledged once the server's cwnd stops it
+        if (since_ack > 0 && !gap_acked && !bench_readable(sock, rto_ack_delay_us(&rto))) {
+            bench_ack(sock, &peer, block_to_wire(expected - 1, wrap_to));
+            rto_start(&rto, expected);
+            since_ack = 0;
+            continue;
+        }
+        bench_timeout(sock, &rto);
+        int n = recvfrom(sock, buf, size, 0, (struct sockaddr *)&from, &from_len);
+        if (n < 0) {
+            r->timeouts++;
+            if (--retries <= 0)
+                break;
+            rto_backoff(&rto);
+            if (answered) {
+                // repeat the last ACK so the server resends
+                bench_ack(sock, &peer, block_to_wire(expected - 1, wrap_to));
+                gap_acked = 0;
+            } else {
+                request_build(buf, size, OP_RRQ, name, &bench.options);
+                sendto(sock, buf, len, 0, (struct sockaddr *)&bench.server, sizeof(bench.server));
+            }
+            r->retransmits++;
+            continue;
+        }
+        if (n >= 4 && buf[1] == OP_ERROR && (!answered || same_peer(&from, &peer)))
+            break;
+        if (answered && !same_peer(&from, &peer)) {
+            bench_reject(sock, &from);
+            continue;
+        }
+        if (!answered)
+            peer = from;
+        if (n >= 2 && buf[1] == OP_OACK && expected == 1) {
+            if (!answered) {
+                tftp_options accepted;
+                options_parse((const char *)&buf[2], n - 2, &accepted);
+                if (accepted.blksize)
+                    blksize = accepted.blksize;
+                if (accepted.windowsize)
+                    windowsize = accepted.windowsize;
+                if (accepted.check)
+                    check = accepted.check;
+                wrap_to = accepted.rollover == ROLLOVER_TO_1 ? 1 : 0;
+                // room for a whole window, as the client makes
+                uint64_t window_bytes = (uint64_t)windowsize * size * 2;
+                int rcvbuf = window_bytes < INT_MAX ? (int)window_bytes : INT_MAX;
+                setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+                rto_ack(&rto, 0);
+                answered = 1;
+            } else {
+                r->retransmits++;
+            }
+            bench_ack(sock, &peer, 0);
+            rto_start(&rto, 1);
+            continue;
+        }
+        int check_len = block_check_len(check);
+        if (n < 4 + check_len || buf[1] != OP_DATA)
+            continue;
+
+        uint16_t block = (buf[2] << 8) | buf[3];
+        int data_len = n - 4 - check_len;
+        r->packets++;
+        if (!block_check_ok(check, &buf[4], data_len, &buf[4 + data_len])) {
+            r->crc_errors++;
+            continue;
+        }
+        answered = 1;
+        if (block == block_to_wire(expected, wrap_to)) {
+            r->bytes += data_len;
+            rto_ack(&rto, expected);
+            expected++;
+            since_ack++;
+            gap_acked = 0;
+            retries = BENCH_RETRIES;
+
+            int last = data_len < blksize;
+            if (last || since_ack >= windowsize) {
+                bench_ack(sock, &peer, block);
+                rto_start(&rto, expected);
+                since_ack = 0;
+            }
+            if (last) {
+                status = 0;
+                break;
+            }
+        } else {
+            // a block we hold: the server resent after losing our ACK
+            uint64_t distance = block_distance(expected - 1, block, wrap_to);
+            if (distance == 0 || distance > (uint64_t)windowsize)
+                r->retransmits++;
+            if (gap_acked)
+                continue;
+            // answered once; a gap as a repeated ACK, sent twice if the server has not seen it yet
+            bench_ack(sock, &peer, block_to_wire(expected - 1, wrap_to));
+            if (distance > 1 && distance <= (uint64_t)windowsize && since_ack > 0)
+                bench_ack(sock, &peer, block_to_wire(expected - 1, wrap_to));
+            rto_resent(&rto, expected);
+            gap_acked = 1;
+        }
+    }
+
+    free(buf);
+    close(sock);
+    return status;
+}
+
+/**
+ * @brief Upload bytes from the random payload under a name.
+ *
+ * Sends windows go-back-N style: on a timeout or a repeated ACK (a gap) the
+ * window is resent from the first block not acknowledged; an ACK that
+ * advances only slides the window. As for downloads, the request is
+ * repeated until answered and other session ports are rejected.
+ *
+ * @param name File to write.
+ * @param bytes Upload size.
+ * @param r Updated with the counters of the transfer.
+ * @return int 0 once the last block was acknowledged, -1 otherwise.
+ */
+static int bench_wrq(const char *name, uint64_t bytes, bench_result *r) {
+    int sock = bench_socket();
+    if (sock < 0)
+        return -1;
+    tftp_options requested = bench.options;
+    int req_blksize = requested.blksize ? requested.blksize : DEFAULT_BLKSIZE;
+    if (bytes / req_blksize + 1 > 65535 && requested.rollover == ROLLOVER_ABSENT)
+        requested.rollover = ROLLOVER_TO_0;
+
+    int size = (req_blksize > DEFAULT_BLKSIZE ? req_blksize : DEFAULT_BLKSIZE) + DATA_OVERHEAD_MAX;
+    unsigned char *buf = malloc(size);
+    if (!buf) {
+        perror("malloc");
+        close(sock);
+        return -1;
+    }
+    int len = request_build(buf, size, OP_WRQ, name, &requested);
+    sendto(sock, buf, len, 0, (struct sockaddr *)&bench.server, sizeof(bench.server));
+
+    tftp_rto rto;
+    rto_init(&rto);
+    rto_start(&rto, 0);
+    struct sockaddr_in peer, from;
+    socklen_t from_len = sizeof(from);
+    unsigned char ack[DEFAULT_BLKSIZE];
+    int n = -1, status = -1;
+    for (int attempt = 0; attempt < BENCH_RETRIES && n < 0; attempt++) {
+        if (attempt > 0) {
+            r->timeouts++;
+            r->retransmits++;
+            rto_backoff(&rto);
+            sendto(sock, buf, len, 0, (struct sockaddr *)&bench.server, sizeof(bench.server));
+        }
+        bench_timeout(sock, &rto);
+        n = recvfrom(sock, ack, sizeof(ack), 0, (struct sockaddr *)&peer, &from_len);
+    }
+    rto_ack(&rto, 0);
+
+    int blksize = DEFAULT_BLKSIZE, windowsize = 1, wrap_to = 0, check = CHECK_CRC8;
+    if (n >= 2 && ack[1] == OP_OACK) {
+        tftp_options accepted;
+        options_parse((const char *)&ack[2], n - 2, &accepted);
+        if (accepted.blksize)
+            blksize = accepted.blksize;
+        if (accepted.windowsize)
+            windowsize = accepted.windowsize;
+        if (accepted.check)
+            check = accepted.check;
+        wrap_to = accepted.rollover == ROLLOVER_TO_1 ? 1 : 0;
+    } else if (n < 4 || ack[1] != OP_ACK || ack[2] != 0 || ack[3] != 0) {
+        goto done;
+    }
+
+    uint64_t acked = 0, next = 1, sent = 0;
+    uint64_t rewound = 0; // window resent from this block, 0 if not resent
+    uint64_t rewound_us = 0; // when it was resent
+    uint64_t last_block = bytes / blksize + 1;
+    int retries = BENCH_RETRIES;
+    int draining = 0; // read the ACKs already queued before sending more
+    while (1) {
+        while (!draining && next <= acked + windowsize && next <= last_block) {
+            uint64_t offset = (next - 1) * blksize;
+            int data_len = bytes - offset < (uint64_t)blksize ? (int)(bytes - offset) : blksize;
+            uint16_t wire = block_to_wire(next, wrap_to);
+            buf[0] = 0;
+            buf[1] = OP_DATA;
+            buf[2] = wire >> 8;
+            buf[3] = wire & 0xFF;
+            memcpy(&buf[4], bench.data + offset, data_len);
+            block_check_put(check, &buf[4], data_len, &buf[4 + data_len]);
+            sendto(sock, buf, data_len + 4 + block_check_len(check), 0, (struct sockaddr *)&peer, sizeof(peer));
+            r->packets++;
+            if (next <= sent) {
+                r->retransmits++;
+                rto_resent(&rto, next);
+            } else {
+                sent = next;
+                if (next == acked + windowsize || next == last_block)
+                    rto_start(&rto, next);
+            }
+            next++;
+        }
+
+        if (!draining)
+            bench_timeout(sock, &rto);
+        n = recvfrom(sock, ack, sizeof(ack), draining ? MSG_DONTWAIT : 0, (struct sockaddr *)&from, &from_len);
+        if (n < 0 && draining) {
+            draining = 0;
+            continue;
+        }
+        draining = n >= 0;
+        if (n >= 0 && !same_peer(&from, &peer)) {
+            bench_reject(sock, &from);
+            continue;
+        }
+        if (n < 0) {
+            r->timeouts++;
+            if (--retries <= 0)
+                break;
+            rto_backoff(&rto);
+            next = acked + 1;
+            rewound = next;
+            rewound_us = rto_now_us();
+            continue;
+        }
+        if (n >= 4 && ack[1] == OP_ERROR)
+            break;
+        if (n < 4 || ack[1] != OP_ACK)
+            continue;
+
+        uint64_t advance = block_distance(acked, (ack[2] << 8) | ack[3], wrap_to);
+        if (advance > sent - acked)
+            continue; // stale
+        if (advance == 0) {
+            // a repeated ACK reports a gap: resend once from the block after it, or
+            // again when the server repeats it on a timeout (the resend was lost)
+            if ((rewound != acked + 1 || rto_now_us() - rewound_us >= RTO_MIN_MS * 1000 / 2) && acked < sent) {
+                next = acked + 1;
+                rewound = next;
+                rewound_us = rto_now_us();
+            }
+            continue;
+        }
+        // an ACK short of the blocks sent slides the window, the rest are in flight
+        acked += advance;
+        retries = BENCH_RETRIES;
+        rto_ack(&rto, acked);
+        if (acked == last_block) {
+            r->bytes = bytes;
+            status = 0;
+            break;
+        }
+        if (next <= acked)
+            next = acked + 1;
+    }
+
+done:
+    free(buf);
+    close(sock);
+    return status;
+}
+
+/**
+ * @brief Delete a file on the server.
+ *
+ * @param name File to delete.
+ * @param r Updated with the counters of the request.
+ * @return int 0 if the server deleted it, -1 otherwise.
+ */
+static int bench_delete(const char *name, bench_result *r) {
+    int sock = bench_socket();
+    if (sock < 0)
+        return -1;
+    unsigned char buf[DEFAULT_BLKSIZE], reply[DEFAULT_BLKSIZE];
+    int len = snprintf((char *)&buf[2], sizeof(buf) - 2, "%s", name) + 3;
+    buf[0] = 0;
+    buf[1] = OP_DELETE;
+    sendto(sock, buf, len, 0, (struct sockaddr *)&bench.server, sizeof(bench.server));
+
+    // repeated while unanswered
+    struct timeval timeout = {1, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int n = -1, attempt;
+    for (attempt = 0; attempt < BENCH_RETRIES && n < 0; attempt++) {
+        if (attempt > 0) {
+            r->timeouts++;
+            r->retransmits++;
+            sendto(sock, buf, len, 0, (struct sockaddr *)&bench.server, sizeof(bench.server));
+        }
+        n = recv(sock, reply, sizeof(reply), 0);
+    }
+    close(sock);
+    // the server answers a DELETE with an ERROR packet, code 0 on success; a
+    // repeated DELETE is refused when the answer to the first one was lost
+    if (n < 4 || reply[1] != OP_ERROR)
+        return -1;
+    return reply[3] == 0 || (attempt > 1 && reply[3] == 1) ? 0 : -1;
+}
+
+/**
+ * @brief Body of a session thread.
+ *
+ * @param arg The session.
+ * @return void* Always NULL.
+ */
+static void *session_main(void *arg) {
+    bench_session *s = arg;
+    int total = bench.weights[BENCH_RRQ] + bench.weights[BENCH_WRQ] + bench.weights[BENCH_DELETE];
+    char name[64];
+
+    for (int i = 0; i < bench.transfers; i++) {
+        bench_result *r = &s->results[i];
+        int pick = rand_r(&s->seed) % total;
+        r->op = pick < bench.weights[BENCH_RRQ] ? BENCH_RRQ
+                : pick < bench.weights[BENCH_RRQ] + bench.weights[BENCH_WRQ] ? BENCH_WRQ
+                                                                           : BENCH_DELETE;
+        // delete only uploads older than the last one: that one may not be committed yet
+        if (r->op == BENCH_DELETE && s->upload_tail - s->upload_head < 2)
+            r->op = BENCH_WRQ;
+        uint64_t bytes = bench.sizes[rand_r(&s->seed) % bench.size_count];
+
+        uint64_t start = rto_now_us();
+        if (r->op == BENCH_RRQ) {
+            seed_name(name, sizeof(name), bytes);
+            r->ok = bench_rrq(name, r) == 0;
+        } else if (r->op == BENCH_WRQ) {
+            upload_name(name, sizeof(name), s->id, s->upload_tail);
+            r->ok = bench_wrq(name, bytes, r) == 0;
+            s->upload_tail += r->ok;
+        } else {
+            upload_name(name, sizeof(name), s->id, s->upload_head);
+            r->ok = bench_delete(name, r) == 0;
+            s->upload_head++;
+        }
+        r->latency_us = rto_now_us() - start;
+        s->done = i + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Tell whether a server answers on the configured address.
+ *
+ * @param wait_ms How long to wait for the answer.
+ * @return int Non-zero if it answered a ping.
+ */
+static int bench_ping(int wait_ms) {
+    int sock = bench_socket();
+    if (sock < 0)
+        return 0;
+    unsigned char ping[] = {0, OP_RRQ, '_', '_', 'p', 'i', 'n', 'g', '_', '_', 0};
+    sendto(sock, ping, sizeof(ping), 0, (struct sockaddr *)&bench.server, sizeof(bench.server));
+
+    unsigned char buf[DEFAULT_BLKSIZE];
+    struct timeval timeout = {wait_ms / 1000, (wait_ms % 1000) * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int n = recv(sock, buf, sizeof(buf), 0);
+    close(sock);
+    return n >= 5 && buf[1] == OP_DATA;
+}
+
+/**
+ * @brief Start the server in its own directory and wait until it answers.
+ *
+ * @param path Server binary.
+ * @param dir Working directory of the server (created if missing).
+ * @param args Extra server arguments.
+ * @param nargs Number of extra arguments.
+ * @return pid_t The server process, or -1 on error.
+ */
+static pid_t server_spawn(const char *path, const char *dir, char **args, int nargs) {
+    char exe[PATH_MAX];
+    if (!realpath(path, exe)) {
+        perror(path);
+        return -1;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+    if (bench_ping(200)) {
+        fprintf(stderr, "A server is already running on port %d\n", ntohs(bench.server.sin_port));
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        char **argv = calloc(nargs + 2, sizeof(*argv));
+        if (!argv || chdir(dir) != 0 || !freopen("server.log", "w", stdout) || dup2(1, 2) < 0)
+            _exit(127);
+        argv[0] = exe;
+        for (int i = 0; i < nargs; i++)
+            argv[i + 1] = args[i];
+        execv(exe, argv);
+        _exit(127);
+    }
+
+    for (int i = 0; i < 50; i++) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            fprintf(stderr, "Server exited, see %s/server.log\n", dir);
+            return -1;
+        }
+        if (bench_ping(100))
+            return pid;
+    }
+    fprintf(stderr, "Server did not answer, see %s/server.log\n", dir);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/**
+ * @brief Upload the file of every size that downloads read.
+ *
+ * Uploads are renamed into place by the server's commit thread, so each seed
+ * is downloaded once (retrying for a while) before the measurement starts.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+static int seed_files(void) {
+    char name[64];
+    for (int i = 0; i < bench.size_count; i++) {
+        bench_result r = {0};
+        seed_name(name, sizeof(name), bench.sizes[i]);
+        if (bench_wrq(name, bench.sizes[i], &r) < 0) {
+            fprintf(stderr, "Failed to upload %s\n", name);
+            return -1;
+        }
+    }
+    for (int i = 0; i < bench.size_count; i++) {
+        seed_name(name, sizeof(name), bench.sizes[i]);
+        int tries = 0;
+        bench_result r = {0};
+        while (bench_rrq(name, &r) < 0) {
+            if (++tries == 100) {
+                fprintf(stderr, "Seed file %s cannot be read back\n", name);
+                return -1;
+            }
+            usleep(20000);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Delete the seeds and the uploads the sessions left behind.
+ */
+static void cleanup_files(bench_session *sessions) {
+    char name[64];
+    bench_result r;
+    for (int i = 0; i < bench.sessions; i++) {
+        for (int n = sessions[i].upload_head; n < sessions[i].upload_tail; n++) {
+            upload_name(name, sizeof(name), sessions[i].id, n);
+            bench_delete(name, &r);
+        }
+    }
+    for (int i = 0; i < bench.size_count && bench.weights[BENCH_RRQ]; i++) {
+        seed_name(name, sizeof(name), bench.sizes[i]);
+        bench_delete(name, &r);
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Write the latency percentiles of the completed transfers of one operation.
+ *
+ * @param out Output stream.
+ * @param sessions Sessions.
+ * @param op Operation, or -1 for all of them.
+ * @param lat Scratch array of one entry per transfer.
+ */
+static void report_latency(FILE *out, bench_session *sessions, int op, uint64_t *lat) {
+    size_t n = 0;
+    for (int i = 0; i < bench.sessions; i++) {
+        for (int t = 0; t < sessions[i].done; t++) {
+            const bench_result *r = &sessions[i].results[t];
+            if (r->ok && (op < 0 || r->op == op))
+                lat[n++] = r->latency_us;
+        }
+    }
+    qsort(lat, n, sizeof(*lat), compare_u64);
+
+    // nearest rank: the smallest latency at or above the given fraction of transfers
+    const double quantiles[] = {0.5, 0.99, 0.999};
+    const char *names[] = {"p50", "p99", "p999"};
+    fprintf(out, "{");
+    for (int q = 0; q < 3; q++) {
+        size_t rank = (size_t)(quantiles[q] * n + 0.999999);
+        double ms = n ? lat[rank ? rank - 1 : 0] / 1000.0 : 0;
+        fprintf(out, "\"%s\": %.3f, ", names[q], ms);
+    }
+    fprintf(out, "\"max\": %.3f}", n ? lat[n - 1] / 1000.0 : 0);
+}
+
+/**
+ * @brief Retransmissions in percent of the DATA packets of a set of transfers.
+ */
+static double resend_pct(uint64_t retransmits, uint64_t packets) {
+    return packets ? 100.0 * retransmits / packets : 0.0;
+}
+
+/**
+ * @brief Write the results as one JSON object.
+ *
+ * @param out Output stream.
+ * @param sessions Sessions.
+ * @param elapsed Wall time of the measurement in seconds.
+ * @param resend Receives the highest retransmissions in percent of the DATA packets of an operation.
+ * @param failed Receives the number of transfers that failed.
+ * @return int 0 on success, -1 on error.
+ */
+static int report(FILE *out, bench_session *sessions, double elapsed, double *resend, uint64_t *failed) {
+    uint64_t *lat = malloc((size_t)bench.sessions * bench.transfers * sizeof(*lat));
+    if (!lat) {
+        perror("malloc");
+        return -1;
+    }
+
+    struct {
+        uint64_t completed, failed, bytes, retransmits, packets, timeouts, crc_errors;
+    } sum[BENCH_OPS + 1] = {{0}};
+    for (int i = 0; i < bench.sessions; i++) {
+        for (int t = 0; t < sessions[i].done; t++) {
+            const bench_result *r = &sessions[i].results[t];
+            for (int k = 0; k < 2; k++) {
+                int at = k ? BENCH_OPS : r->op;
+                sum[at].completed += r->ok;
+                sum[at].failed += !r->ok;
+                sum[at].bytes += r->ok ? r->bytes : 0;
+                sum[at].retransmits += r->retransmits;
+                sum[at].packets += r->packets;
+                sum[at].timeouts += r->timeouts;
+                sum[at].crc_errors += r->crc_errors;
+            }
+        }
+    }
+
+    fprintf(out, "{\n  \"server\": \"%s\",\n", inet_ntoa(bench.server.sin_addr));
+    fprintf(out, "  \"sessions\": %d,\n  \"transfers_per_session\": %d,\n", bench.sessions, bench.transfers);
+    fprintf(out, "  \"blksize\": %d,\n  \"windowsize\": %d,\n  \"check\": \"%s\",\n",
+            bench.options.blksize ? bench.options.blksize : DEFAULT_BLKSIZE,
+            bench.options.windowsize ? bench.options.windowsize : 1, check_name(bench.options.check));
+    fprintf(out, "  \"mix\": {\"rrq\": %d, \"wrq\": %d, \"delete\": %d},\n  \"sizes\": [",
+            bench.weights[BENCH_RRQ], bench.weights[BENCH_WRQ], bench.weights[BENCH_DELETE]);
+    for (int i = 0; i < bench.size_count; i++)
+        fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)bench.sizes[i]);
+    fprintf(out, "],\n  \"elapsed_s\": %.3f,\n", elapsed);
+
+    const typeof(sum[0]) *all = &sum[BENCH_OPS];
+    fprintf(out, "  \"completed\": %llu,\n  \"failed\": %llu,\n  \"bytes\": %llu,\n",
+            (unsigned long long)all->completed, (unsigned long long)all->failed, (unsigned long long)all->bytes);
+    fprintf(out, "  \"goodput_mbit_s\": %.1f,\n", elapsed > 0 ? all->bytes * 8 / elapsed / 1e6 : 0);
+    fprintf(out, "  \"transfers_per_s\": %.1f,\n", elapsed > 0 ? all->completed / elapsed : 0);
+    fprintf(out, "  \"retransmits\": %llu,\n  \"data_packets\": %llu,\n  \"resend_pct\": %.2f,\n",
+            (unsigned long long)all->retransmits, (unsigned long long)all->packets,
+            resend_pct(all->retransmits, all->packets));
+    fprintf(out, "  \"timeouts\": %llu,\n  \"crc_errors\": %llu,\n", (unsigned long long)all->timeouts,
+            (unsigned long long)all->crc_errors);
+    fprintf(out, "  \"latency_ms\": ");
+    report_latency(out, sessions, -1, lat);
+    fprintf(out, ",\n  \"ops\": {\n");
+    *failed = all->failed;
+    *resend = 0;
+    for (int op = 0; op < BENCH_OPS; op++) {
+        double pct = resend_pct(sum[op].retransmits, sum[op].packets);
+        if (pct > *resend)
+            *resend = pct;
+        fprintf(out, "    \"%s\": {\"completed\": %llu, \"failed\": %llu, \"bytes\": %llu, \"retransmits\": %llu, "
+                     "\"resend_pct\": %.2f, \"timeouts\": %llu, \"latency_ms\": ",
+                op_names[op], (unsigned long long)sum[op].completed, (unsigned long long)sum[op].failed,
+                (unsigned long long)sum[op].bytes, (unsigned long long)sum[op].retransmits,
+                pct, (unsigned long long)sum[op].timeouts);
+        report_latency(out, sessions, op, lat);
+        fprintf(out, "}%s\n", op < BENCH_OPS - 1 ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+    free(lat);
+    return 0;
+}
+
+/**
+ * @brief Parse a comma-separated list of sizes with optional k/m/g suffixes.
+ *
+ * @param list Text to parse.
+ * @return int 0 on success, -1 on error.
+ */
+static int parse_sizes(const char *list) {
+    bench.size_count = 0;
+    while (*list) {
+        char *end;
+        unsigned long long v = strtoull(list, &end, 10);
+        if (end == list || bench.size_count == BENCH_MAX_SIZES)
+            return -1;
+        if (*end == 'k' || *end == 'K')
+            v <<= 10, end++;
+        else if (*end == 'm' || *end == 'M')
+            v <<= 20, end++;
+        else if (*end == 'g' || *end == 'G')
+            v <<= 30, end++;
+        bench.sizes[bench.size_count++] = v;
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return -1;
+        list = end;
+    }
+    return bench.size_count ? 0 : -1;
+}
+
+/**
+ * @brief Print command line usage.
+ */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s server_ip] [-P port] [-n sessions] [-t transfers] [-m rrq:wrq:delete] [-z sizes] "
+                    "[-b blksize] [-w windowsize] [-k check] [-o json_file] [-x max_resend_pct] [-f max_failed] [-S server_binary [-d dir]] [-- server args]\n", prog);
+    fprintf(stderr, "  -s IP  server address (default 127.0.0.1)\n");
+    fprintf(stderr, "  -P N   server port, e.g. of an impairment proxy in front of it (default %d)\n", BENCH_PORT);
+    fprintf(stderr, "  -n N   concurrent client sessions (default 16, at most %d)\n", BENCH_MAX_SESSIONS);
+    fprintf(stderr, "  -t N   transfers run by each session (default 20)\n");
+    fprintf(stderr, "  -m M   weights of downloads, uploads and deletes (default 70:25:5)\n");
+    fprintf(stderr, "  -z L   file sizes, picked at random per transfer (default 64k,1m)\n");
+    fprintf(stderr, "  -b N   blksize option of every transfer (default: none)\n");
+    fprintf(stderr, "  -w N   windowsize option of every transfer (default: none)\n");
+    fprintf(stderr, "  -k C   check option of every transfer: none, crc8, crc32c or xxh64 (default: none sent, CRC-8)\n");
+    fprintf(stderr, "  -o F   write the JSON report to F (default: stdout)\n");
+    fprintf(stderr, "  -x P   fail if more than P percent of the DATA packets are retransmissions (default: off)\n");
+    fprintf(stderr, "  -f N   fail if more than N transfers fail (default 0)\n");
+    fprintf(stderr, "  -S P   start the server binary P for the run, and stop it after\n");
+    fprintf(stderr, "  -d D   working directory of the started server (default bench_data)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *server_ip = "127.0.0.1", *output = NULL, *server_bin = NULL, *server_dir = "bench_data";
+    int server_port = BENCH_PORT;
+    double max_resend = -1;
+    uint64_t max_failed = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:P:n:t:m:z:b:w:k:o:x:f:S:d:h")) != -1) {
+        switch (opt) {
+            case 's':
+                server_ip = optarg;
+                break;
+            case 'P':
+                server_port = atoi(optarg);
+                break;
+            case 'n':
+                bench.sessions = atoi(optarg);
+                break;
+            case 't':
+                bench.transfers = atoi(optarg);
+                break;
+            case 'm':
+                if (sscanf(optarg, "%d:%d:%d", &bench.weights[BENCH_RRQ], &bench.weights[BENCH_WRQ],
+                           &bench.weights[BENCH_DELETE]) != 3) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'z':
+                if (parse_sizes(optarg) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'b':
+                bench.options.blksize = atoi(optarg);
+                break;
+            case 'w':
+                bench.options.windowsize = atoi(optarg);
+                break;
+            case 'k':
+                bench.options.check = check_find(optarg);
+                if (bench.options.check == CHECK_ABSENT) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'x':
+                max_resend = atof(optarg);
+                break;
+            case 'f':
+                max_failed = strtoull(optarg, NULL, 10);
+                break;
+            case 'S':
+                server_bin = optarg;
+                break;
+            case 'd':
+                server_dir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    int weight = bench.weights[BENCH_RRQ] + bench.weights[BENCH_WRQ] + bench.weights[BENCH_DELETE];
+    if (bench.sessions < 1 || bench.sessions > BENCH_MAX_SESSIONS || bench.transfers < 1 || weight <= 0 ||
+        bench.weights[BENCH_RRQ] < 0 || bench.weights[BENCH_WRQ] < 0 || bench.weights[BENCH_DELETE] < 0 ||
+        (bench.options.blksize && (bench.options.blksize < MIN_BLKSIZE || bench.options.blksize > MAX_BLKSIZE)) ||
+        (bench.options.windowsize && (bench.options.windowsize < MIN_WINDOWSIZE || bench.options.windowsize > MAX_WINDOWSIZE)) || (optind < argc && !server_bin) ||
+        server_port <= 0 || server_port > 65535) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    bench.server.sin_family = AF_INET;
+    bench.server.sin_port = htons(server_port);
+    if (inet_pton(AF_INET, server_ip, &bench.server.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IP address\n");
+        return 1;
+    }
+
+    uint64_t largest = 0;
+    for (int i = 0; i < bench.size_count; i++)
+        largest = bench.sizes[i] > largest ? bench.sizes[i] : largest;
+    bench.data = malloc(largest ? largest : 1);
+    bench_session *sessions = calloc(bench.sessions, sizeof(*sessions));
+    if (!bench.data || !sessions) {
+        perror("malloc");
+        return 1;
+    }
+    unsigned int seed = 12345;
+    for (uint64_t i = 0; i < largest; i++)
+        bench.data[i] = rand_r(&seed) & 0xFF;
+
+    pid_t server = -1;
+    if (server_bin) {
+        server = server_spawn(server_bin, server_dir, &argv[optind], argc - optind);
+        if (server < 0)
+            return 1;
+    } else if (!bench_ping(1000)) {
+        fprintf(stderr, "Server not responding\n");
+        return 1;
+    }
+
+    int status = 1;
+    if (bench.weights[BENCH_RRQ] && seed_files() < 0)
+        goto stop;
+
+    fprintf(stderr, "Running %d sessions x %d transfers...\n", bench.sessions, bench.transfers);
+    uint64_t start = rto_now_us();
+    int started = 0;
+    for (; started < bench.sessions; started++) {
+        bench_session *s = &sessions[started];
+        s->id = started;
+        s->seed = 1000 + started;
+        s->results = calloc(bench.transfers, sizeof(*s->results));
+        if (!s->results || pthread_create(&s->thread, NULL, session_main, s) != 0) {
+            fprintf(stderr, "Cannot start session %d\n", started);
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(sessions[i].thread, NULL);
+    double elapsed = (rto_now_us() - start) / 1e6;
+    bench.sessions = started;
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        perror(output);
+    } else {
+        double resend = 0;
+        uint64_t failed = 0;
+        status = report(out, sessions, elapsed, &resend, &failed) < 0;
+        if (output)
+            fclose(out);
+        if (failed > max_failed) {
+            fprintf(stderr, "%llu transfers failed, more than %llu\n", (unsigned long long)failed,
+                    (unsigned long long)max_failed);
+            status = 1;
+        }
+        if (max_resend >= 0 && resend > max_resend) {
+            fprintf(stderr, "Resent %.2f%% of the DATA packets of an operation, more than %.2f%%\n", resend, max_resend);
+            status = 1;
+        }
+    }
+    cleanup_files(sessions);
+
+stop:
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    for (int i = 0; i < bench.sessions; i++)
+        free(sessions[i].results);
+    free(sessions);
+    free(bench.data);
+    return status;
+}
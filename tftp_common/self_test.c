@@ -0,0 +1,402 @@
+/**
+ * @file self_test.c
+ * @brief Known-answer and round-trip checks of the code shared by the client and server.
+ *
+ * Groups of checks:
+ *  - SHA-256: FIPS 180-2 vectors, whole and fed in uneven pieces
+ *  - CRC-32C and xxHash64 reference values, and the DATA trailer of every check
+ *  - LZ4 frames: round trips of compressible and random blocks, malformed frames refused
+ *  - options_parse(): every option, its bounds, case, unknown and malformed entries
+ *  - block_to_wire() and block_distance() across the wrap, for both rollover values
+ *
+ * Prints one line per group and every failed check; exits non-zero if any check failed.
+ *
+ * Usage: self_test
+ */
+
+#include "tftp_crc.h"
+#include "tftp_sha256.h"
+#include "tftp_compress.h"
+#include "tftp_options.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;   // checks failed so far
+
+// Record a failed check with its location
+#define EXPECT(cond, ...)                                  \
+    do {                                                   \
+        if (!(cond)) {                                     \
+            printf("  FAIL line %d: ", __LINE__);          \
+            printf(__VA_ARGS__);                           \
+            printf("\n");                                  \
+            failures++;                                    \
+        }                                                  \
+    } while (0)
+
+/**
+ * @brief Format a digest as lowercase hex.
+ */
+static void to_hex(const uint8_t *digest, char out[2 * SHA256_SIZE + 1]) {
+    for (int i = 0; i < SHA256_SIZE; i++)
+        sprintf(out + 2 * i, "%02x", digest[i]);
+}
+
+/**
+ * @brief SHA-256 of the FIPS 180-2 vectors, also fed in uneven pieces.
+ */
+static void test_sha256(void) {
+    static const struct {
+        const char *input;
+        const char *digest;
+    } vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    };
+    tftp_sha256 c;
+    uint8_t digest[SHA256_SIZE];
+    char hex[2 * SHA256_SIZE + 1];
+
+    for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++) {
+        size_t len = strlen(vectors[v].input);
+        sha256_init(&c);
+        sha256_update(&c, vectors[v].input, len);
+        sha256_final(&c, digest);
+        to_hex(digest, hex);
+        EXPECT(strcmp(hex, vectors[v].digest) == 0, "sha256(\"%s\") = %s", vectors[v].input, hex);
+
+        // byte by byte crosses every block boundary of the buffered path
+        sha256_init(&c);
+        for (size_t i = 0; i < len; i++)
+            sha256_update(&c, vectors[v].input + i, 1);
+        sha256_final(&c, digest);
+        to_hex(digest, hex);
+        EXPECT(strcmp(hex, vectors[v].digest) == 0, "sha256(\"%s\") byte by byte = %s", vectors[v].input, hex);
+    }
+
+    // one million 'a', in pieces of 1000 + 7 bytes so updates straddle blocks
+    static uint8_t a[1007];
+    memset(a, 'a', sizeof(a));
+    sha256_init(&c);
+    size_t left = 1000000;
+    while (left > 0) {
+        size_t n = left < sizeof(a) ? left : sizeof(a);
+        sha256_update(&c, a, n);
+        left -= n;
+    }
+    sha256_final(&c, digest);
+    to_hex(digest, hex);
+    EXPECT(strcmp(hex, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") == 0,
+           "sha256(1000000 x 'a') = %s", hex);
+}
+
+/**
+ * @brief CRC-32C (iSCSI, RFC 3720 B.4) and xxHash64 reference values, and their DATA trailers.
+ */
+static void test_checks(void) {
+    uint8_t zeros[32], ones[32], ramp[100];
+    memset(zeros, 0, sizeof(zeros));
+    memset(ones, 0xFF, sizeof(ones));
+    for (int i = 0; i < (int)sizeof(ramp); i++)
+        ramp[i] = (uint8_t)i;
+    const uint8_t *digits = (const uint8_t *)"123456789";
+
+    EXPECT(crc32c_update(0, digits, 0) == 0, "crc32c(\"\")");
+    EXPECT(crc32c_update(0, digits, 9) == 0xE3069283, "crc32c(\"123456789\") = %08x", crc32c_update(0, digits, 9));
+    EXPECT(crc32c_update(0, zeros, 32) == 0x8A9136AA, "crc32c(32 x 00)");
+    EXPECT(crc32c_update(0, ones, 32) == 0x62A8AB43, "crc32c(32 x ff)");
+    EXPECT(crc32c_update(0, ramp, 32) == 0x46DD794E, "crc32c(00..1f)");
+    for (size_t split = 0; split <= 32; split++)
+        EXPECT(crc32c_update(crc32c_update(0, ramp, split), ramp + split, 32 - split) == 0x46DD794E,
+               "crc32c(00..1f) split at %zu", split);
+
+    const uint8_t *text = (const uint8_t *)"Nobody inspects the spammish repetition";
+    EXPECT(xxh64(text, 0, 0) == 0xEF46DB3751D8E999ULL, "xxh64(\"\")");
+    EXPECT(xxh64((const uint8_t *)"a", 1, 0) == 0xD24EC4F1A98C6E5BULL, "xxh64(\"a\")");
+    EXPECT(xxh64((const uint8_t *)"abc", 3, 0) == 0x44BC2CF5AD770999ULL, "xxh64(\"abc\")");
+    EXPECT(xxh64((const uint8_t *)"abc", 3, 1) == 0xBEA9CA8199328908ULL, "xxh64(\"abc\", seed 1)");
+    EXPECT(xxh64(text, strlen((const char *)text), 0) == 0xFBCEA83C8A378BF1ULL, "xxh64(spammish)");
+    EXPECT(xxh64(ramp, sizeof(ramp), 0) == 0x6AC1E58032166597ULL, "xxh64(00..63)");
+
+    // trailers go most significant byte first, and a flipped bit is caught
+    uint8_t trailer[CHECK_MAX_LEN];
+    block_check_put(CHECK_CRC32C, digits, 9, trailer);
+    EXPECT(block_check_len(CHECK_CRC32C) == 4 && memcmp(trailer, "\xE3\x06\x92\x83", 4) == 0, "crc32c trailer");
+    const int checks[] = {CHECK_CRC8, CHECK_CRC32C, CHECK_XXH64};
+    for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); c++) {
+        block_check_put(checks[c], ramp, sizeof(ramp), trailer);
+        EXPECT(block_check_ok(checks[c], ramp, sizeof(ramp), trailer), "%s trailer rejected", check_name(checks[c]));
+        ramp[50] ^= 0x10;
+        EXPECT(!block_check_ok(checks[c], ramp, sizeof(ramp), trailer), "%s missed a flipped bit",
+               check_name(checks[c]));
+        ramp[50] ^= 0x10;
+    }
+    EXPECT(block_check_len(CHECK_NONE) == 0 && block_check_ok(CHECK_NONE, ramp, sizeof(ramp), trailer),
+           "none has no trailer");
+}
+
+/**
+ * @brief Frame one block, unpack it and compare.
+ *
+ * @param data Block.
+ * @param len Length of the block.
+ * @param want_lz4 1 if the block must compress, 0 if it must go raw, -1 if either.
+ * @param what Description for failures.
+ */
+static void lz4_round_trip(const uint8_t *data, int len, int want_lz4, const char *what) {
+    uint8_t *frame = malloc(len + 1);
+    uint8_t *scratch = malloc(len > 0 ? len : 1);
+    if (!frame || !scratch) {
+        EXPECT(0, "malloc");
+        free(frame);
+        free(scratch);
+        return;
+    }
+
+    int flen = block_pack(data, len, frame);
+    EXPECT(flen >= 1 && flen <= len + 1, "%s (%d bytes): frame of %d bytes", what, len, flen);
+    if (want_lz4 >= 0)
+        EXPECT((frame[0] == COMPRESS_FRAME_LZ4) == want_lz4, "%s (%d bytes): frame flag %d", what, len, frame[0]);
+
+    int out_len = -1;
+    const uint8_t *out = block_unpack(frame, flen, scratch, len, &out_len);
+    EXPECT(out && out_len == len && memcmp(out, data, len) == 0, "%s (%d bytes): round trip differs", what, len);
+    // a block larger than the receiver's blksize is refused
+    if (len > 0)
+        EXPECT(!block_unpack(frame, flen, scratch, len - 1, &out_len), "%s (%d bytes): fits in blksize - 1", what,
+               len);
+
+    free(frame);
+    free(scratch);
+}
+
+/**
+ * @brief LZ4 frames: round trips, and malformed input rejected without overrunning the output.
+ */
+static void test_lz4(void) {
+    const int sizes[] = {0, 1, 7, 512, 1428, 8192, 65464, LZ4_MAX_INPUT};
+    uint8_t *text = malloc(LZ4_MAX_INPUT);
+    uint8_t *noise = malloc(LZ4_MAX_INPUT);
+    uint8_t *zeros = calloc(1, LZ4_MAX_INPUT);
+    if (!text || !noise || !zeros) {
+        EXPECT(0, "malloc");
+        free(text);
+        free(noise);
+        free(zeros);
+        return;
+    }
+    static const char line[] = "2024-05-01 12:00:00 tftp: sent block 1234 of 'firmware.bin'\n";
+    srand(12345);
+    for (int i = 0; i < LZ4_MAX_INPUT; i++) {
+        text[i] = line[i % (sizeof(line) - 1)];
+        noise[i] = rand() & 0xFF;
+    }
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int len = sizes[s];
+        lz4_round_trip(zeros, len, len >= 64 ? 1 : -1, "zeros");
+        lz4_round_trip(text, len, len >= 512 ? 1 : -1, "log lines");
+        lz4_round_trip(noise, len, 0, "random");
+    }
+
+    // hand-made bodies behind an LZ4 flag; each must be refused
+    static const struct {
+        const char *what;
+        int len;
+        uint8_t body[8];
+    } bad[] = {
+        {"empty body", 0, {0}},
+        {"match offset 0", 4, {0x10, 'A', 0x00, 0x00}},
+        {"match before the output", 4, {0x10, 'A', 0x05, 0x00}},
+        {"literals past the input", 3, {0x50, 'A', 'B'}},
+        {"ends with a match", 4, {0x10, 'A', 0x01, 0x00}},
+        {"offset cut short", 3, {0x10, 'A', 0x01}},
+        {"length extension past the input", 2, {0xF0, 0xFF}},
+    };
+    uint8_t frame[16], scratch[256];
+    int out_len;
+    for (size_t b = 0; b < sizeof(bad) / sizeof(bad[0]); b++) {
+        frame[0] = COMPRESS_FRAME_LZ4;
+        memcpy(frame + 1, bad[b].body, bad[b].len);
+        EXPECT(!block_unpack(frame, 1 + bad[b].len, scratch, sizeof(scratch), &out_len), "%s accepted",
+               bad[b].what);
+    }
+
+    // 'A' then a 99-byte match: 100 bytes out, so a 99-byte blksize must refuse it
+    static const uint8_t hundred[] = {COMPRESS_FRAME_LZ4, 0x1F, 'A', 0x01, 0x00, 80, 0x00};
+    const uint8_t *out = block_unpack(hundred, sizeof(hundred), scratch, 100, &out_len);
+    EXPECT(out && out_len == 100 && out[0] == 'A' && out[99] == 'A', "run of 100 'A' not decoded");
+    memset(scratch, 0x5A, sizeof(scratch));
+    EXPECT(!block_unpack(hundred, sizeof(hundred), scratch, 99, &out_len), "run longer than blksize accepted");
+    EXPECT(scratch[99] == 0x5A, "decoder wrote past blksize");
+
+    EXPECT(!block_unpack(frame, 0, scratch, sizeof(scratch), &out_len), "empty frame accepted");
+    frame[0] = 2;
+    EXPECT(!block_unpack(frame, 4, scratch, sizeof(scratch), &out_len), "unknown frame flag accepted");
+
+    // every truncation of a real frame is refused or decodes short, never to the block
+    uint8_t *packed = malloc(1428 + 1), *big = malloc(1428);
+    if (packed && big) {
+        int flen = block_pack(text, 1428, packed);
+        EXPECT(packed[0] == COMPRESS_FRAME_LZ4, "log lines did not compress");
+        for (int cut = 1; cut < flen; cut++) {
+            out = block_unpack(packed, cut, big, 1428, &out_len);
+            EXPECT(!out || out_len < 1428, "frame cut to %d of %d bytes decoded whole", cut, flen);
+        }
+    }
+    free(packed);
+    free(big);
+    free(text);
+    free(noise);
+    free(zeros);
+}
+
+/**
+ * @brief Parse a request's option list written as one string with '|' for every NUL.
+ *
+ * @param list Options, e.g. "blksize|1428|".
+ * @param opts Receives the options.
+ * @return int Number of options recognized.
+ */
+static int parse_list(const char *list, tftp_options *opts) {
+    char buf[256];
+    int len = (int)strlen(list);
+    for (int i = 0; i < len; i++)
+        buf[i] = list[i] == '|' ? '\0' : list[i];
+    return options_parse(buf, len, opts);
+}
+
+/**
+ * @brief options_parse(): every option, its bounds, case, malformed and unknown entries.
+ */
+static void test_options(void) {
+    tftp_options o;
+
+    int n = parse_list("blksize|1428|windowsize|16|rollover|1|tsize|0|offset|4096|length|8192|resume|512|"
+                       "prefixcrc|4294967295|check|crc32c|digest|sha256|compress|lz4|", &o);
+    EXPECT(n == 11, "%d of 11 options recognized", n);
+    EXPECT(o.blksize == 1428 && o.windowsize == 16 && o.rollover == ROLLOVER_TO_1, "blksize, windowsize, rollover");
+    EXPECT(o.has_tsize && o.tsize == 0 && o.offset == 4096 && o.length == 8192 && o.resume == 512,
+           "tsize, offset, length, resume");
+    EXPECT(o.has_prefixcrc && o.prefixcrc == 0xFFFFFFFF, "prefixcrc");
+    EXPECT(o.check == CHECK_CRC32C && o.digest == DIGEST_SHA256 && o.compress == COMPRESS_LZ4,
+           "check, digest, compress");
+
+    // what options_build() writes parses back to the same options
+    unsigned char built[256];
+    int blen = options_build(built, sizeof(built), &o);
+    tftp_options back;
+    EXPECT(blen > 0 && options_parse((const char *)built, blen, &back) == 11, "built options do not parse back");
+    EXPECT(back.blksize == o.blksize && back.windowsize == o.windowsize && back.rollover == o.rollover &&
+               back.tsize == o.tsize && back.offset == o.offset && back.length == o.length &&
+               back.resume == o.resume && back.prefixcrc == o.prefixcrc && back.check == o.check &&
+               back.digest == o.digest && back.compress == o.compress,
+           "built options parse back differently");
+
+    EXPECT(parse_list("BlkSize|512|CHECK|XXH64|Rollover|0|", &o) == 3 && o.blksize == 512 &&
+               o.check == CHECK_XXH64 && o.rollover == ROLLOVER_TO_0,
+           "names and values are case-insensitive");
+
+    // out of range or not a number: ignored
+    static const char *const rejected[] = {
+        "blksize|7|", "blksize|65465|", "blksize|1k|", "blksize||", "blksize|-512|", "windowsize|0|",
+        "windowsize|65536|", "rollover|2|", "tsize|-1|", "offset| 1|", "prefixcrc|4294967296|",
+        "check|md5|", "digest|sha1|", "compress|zstd|", "blksize|1428", "offset|9223372036854775808|",
+        "length|18446744073709551615|", "resume|99999999999999999999|",
+    };
+    for (size_t r = 0; r < sizeof(rejected) / sizeof(rejected[0]); r++) {
+        n = parse_list(rejected[r], &o);
+        EXPECT(n == 0 && !options_present(&o), "\"%s\" accepted", rejected[r]);
+    }
+
+    // byte positions up to what an off_t holds
+    EXPECT(parse_list("offset|9223372036854775807|length|9223372036854775807|", &o) == 2 &&
+               o.offset == INT64_MAX && o.length == INT64_MAX,
+           "largest offset and length");
+
+    // RFC 7440 windows beyond what 16-bit block numbers can track are cut, not refused
+    EXPECT(parse_list("windowsize|65535|", &o) == 1 && o.windowsize == MAX_WINDOWSIZE, "windowsize 65535 not cut");
+    EXPECT(parse_list("windowsize|32767|", &o) == 1 && o.windowsize == 32767, "windowsize 32767");
+
+    // unknown options are skipped, the ones after them still count
+    EXPECT(parse_list("timeout|5|multicast||blksize|1024|", &o) == 1 && o.blksize == 1024, "unknown options");
+    // a repeated option keeps its last value
+    EXPECT(parse_list("blksize|1024|blksize|2048|", &o) == 2 && o.blksize == 2048, "repeated option");
+}
+
+/**
+ * @brief Wire number a block must get, computed independently of block_to_wire().
+ */
+static uint16_t wire_of(uint64_t block, int wrap_to) {
+    if (wrap_to == 0)
+        return (uint16_t)(block & 0xFFFF);
+    if (block <= 65535)
+        return (uint16_t)block;
+    return (uint16_t)((block - 65536) % 65535 + 1);
+}
+
+/**
+ * @brief block_to_wire() and block_distance() around the first and later wraps, for both rollover values.
+ */
+static void test_blocks(void) {
+    EXPECT(block_to_wire(65535, 0) == 65535 && block_to_wire(65536, 0) == 0 && block_to_wire(65537, 0) == 1,
+           "rollover to 0");
+    EXPECT(block_to_wire(65535, 1) == 65535 && block_to_wire(65536, 1) == 1 && block_to_wire(65537, 1) == 2,
+           "rollover to 1");
+    EXPECT(block_to_wire(0, 1) == 0 && block_distance(0, 0, 1) == 0 && block_distance(0, 1, 1) == 1,
+           "block 0 before the first block");
+    EXPECT(block_distance(5, 0, 1) == UINT64_MAX, "wire 0 after the start with rollover to 1");
+
+    const uint64_t starts[] = {0, 1, 65534, 65535, 65536, 131069, 131070, 131071, 1ULL << 33};
+    const uint64_t steps[] = {0, 1, 2, 16, 1000, MAX_WINDOWSIZE};
+    for (int wrap_to = 0; wrap_to <= 1; wrap_to++) {
+        for (size_t s = 0; s < sizeof(starts) / sizeof(starts[0]); s++) {
+            uint64_t from = starts[s];
+            for (size_t d = 0; d < sizeof(steps) / sizeof(steps[0]); d++) {
+                uint64_t block = from + steps[d];
+                uint16_t wire = block_to_wire(block, wrap_to);
+                EXPECT(wire == wire_of(block, wrap_to), "block %llu, rollover %d: wire %u", (unsigned long long)block,
+                       wrap_to, wire);
+                if (wrap_to == 1 && from == 0 && steps[d] > 0)
+                    continue; // counted from block 0, covered above
+                EXPECT(block_distance(from, wire, wrap_to) == steps[d], "distance %llu -> %llu, rollover %d: %llu",
+                       (unsigned long long)from, (unsigned long long)block, wrap_to,
+                       (unsigned long long)block_distance(from, wire, wrap_to));
+            }
+            // a block behind the reference looks a whole cycle ahead: never inside a window
+            if (from > 1) {
+                uint64_t behind = block_distance(from, block_to_wire(from - 1, wrap_to), wrap_to);
+                EXPECT(behind > MAX_WINDOWSIZE, "block before %llu, rollover %d: distance %llu",
+                       (unsigned long long)from, wrap_to, (unsigned long long)behind);
+            }
+        }
+    }
+}
+
+int main(void) {
+    static const struct {
+        const char *name;
+        void (*run)(void);
+    } tests[] = {
+        {"sha256", test_sha256},
+        {"checks", test_checks},
+        {"lz4", test_lz4},
+        {"options", test_options},
+        {"blocks", test_blocks},
+    };
+
+    for (size_t t = 0; t < sizeof(tests) / sizeof(tests[0]); t++) {
+        int before = failures;
+        tests[t].run();
+        printf("%-10s %s\n", tests[t].name, failures == before ? "ok" : "FAILED");
+    }
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,256 @@
+/**
+ * @file tftp_cc.c
+ * @brief Congestion controllers and pacing for windowed transfers.
+ *
+ * Algorithms:
+ *   - aimd: slow start up to ssthresh, then one more block per round trip;
+ *     cwnd is halved on a loss and collapsed on a timeout (TCP Reno style).
+ *   - delay: Vegas-like. The blocks queued in the path are estimated as
+ *     cwnd * (rtt - base_rtt) / rtt; cwnd grows while fewer than CC_DELAY_ALPHA
+ *     are queued and shrinks above CC_DELAY_BETA, so the sender backs off
+ *     before buffers overflow. Losses are handled like aimd.
+ *   - none: the whole negotiated window is sent at once, as before.
+ */
+
+#include "tftp_cc.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Grow cwnd by the acknowledged blocks: exponentially in slow start, by one per round trip after.
+ *
+ * @param cc Controller.
+ * @param acked Blocks acknowledged.
+ */
+static void cc_grow(tftp_cc *cc, uint32_t acked) {
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += acked;
+        return;
+    }
+    cc->cwnd_cnt += acked;
+    while (cc->cwnd_cnt >= cc->cwnd) {
+        cc->cwnd_cnt -= cc->cwnd;
+        cc->cwnd++;
+    }
+}
+
+/**
+ * @brief Multiplicative decrease shared by both algorithms.
+ *
+ * @param cc Controller.
+ */
+static void cc_halve(tftp_cc *cc) {
+    cc->ssthresh = cc->cwnd / 2 > CC_MIN_CWND ? cc->cwnd / 2 : CC_MIN_CWND;
+    cc->cwnd = cc->ssthresh;
+    cc->cwnd_cnt = 0;
+}
+
+static void aimd_on_ack(tftp_cc *cc, uint32_t acked, uint32_t rtt_us) {
+    (void)rtt_us;
+    cc_grow(cc, acked);
+}
+
+/**
+ * @brief Delay-based update, once per round-trip sample.
+ *
+ * Slow start ends as soon as a block is seen queuing.
+ *
+ * @param cc Controller.
+ * @param acked Blocks acknowledged.
+ * @param rtt_us Round-trip sample, 0 if none was taken with this ACK.
+ */
+static void delay_on_ack(tftp_cc *cc, uint32_t acked, uint32_t rtt_us) {
+    if (rtt_us == 0)
+        return;
+    if (cc->base_rtt_us == 0 || rtt_us < cc->base_rtt_us)
+        cc->base_rtt_us = rtt_us;
+
+    uint64_t queued = (uint64_t)cc->cwnd * (rtt_us - cc->base_rtt_us) / rtt_us;
+    if (cc->cwnd < cc->ssthresh) {
+        if (queued >= 1)
+            cc->ssthresh = cc->cwnd;
+        else
+            cc->cwnd += acked;
+    } else if (queued < CC_DELAY_ALPHA) {
+        cc->cwnd++;
+    } else if (queued > CC_DELAY_BETA && cc->cwnd > CC_MIN_CWND) {
+        cc->cwnd--;
+    }
+}
+
+static void noop_on_ack(tftp_cc *cc, uint32_t acked, uint32_t rtt_us) {
+    (void)cc;
+    (void)acked;
+    (void)rtt_us;
+}
+
+static void noop_on_loss(tftp_cc *cc) {
+    (void)cc;
+}
+
+static const tftp_cc_ops cc_aimd = {"aimd", aimd_on_ack, cc_halve};
+static const tftp_cc_ops cc_delay = {"delay", delay_on_ack, cc_halve};
+static const tftp_cc_ops cc_none = {"none", noop_on_ack, noop_on_loss};
+
+/**
+ * @brief Find a congestion control algorithm by name.
+ *
+ * @param name Algorithm name.
+ * @return const tftp_cc_ops* The algorithm, or NULL if unknown.
+ */
+const tftp_cc_ops *cc_find(const char *name) {
+    static const tftp_cc_ops *const all[] = {&cc_aimd, &cc_delay, &cc_none};
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (strcmp(all[i]->name, name) == 0)
+            return all[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reset the controller of a transfer.
+ *
+ * @param cc Controller to initialize.
+ * @param ops Algorithm to use.
+ * @param max_cwnd Negotiated windowsize.
+ */
+void cc_init(tftp_cc *cc, const tftp_cc_ops *ops, uint32_t max_cwnd) {
+    memset(cc, 0, sizeof(*cc));
+    cc->ops = ops;
+    cc->max_cwnd = max_cwnd;
+    cc->ssthresh = max_cwnd;
+    cc->cwnd = ops == &cc_none || max_cwnd < CC_INITIAL_CWND ? max_cwnd : CC_INITIAL_CWND;
+}
+
+/**
+ * @brief Blocks the sender may have in flight.
+ *
+ * @param cc Controller.
+ * @return uint32_t min(cwnd, windowsize).
+ */
+uint32_t cc_flight_limit(const tftp_cc *cc) {
+    return cc->cwnd < cc->max_cwnd ? cc->cwnd : cc->max_cwnd;
+}
+
+/**
+ * @brief Count a transmitted block.
+ *
+ * A go-back-N resend includes blocks that may have arrived, so the resent
+ * share is an upper bound of the loss rate, not the loss rate itself.
+ *
+ * @param cc Controller.
+ * @param resent Non-zero for a retransmission.
+ */
+void cc_on_send(tftp_cc *cc, int resent) {
+    if (resent)
+        cc->resent++;
+    else
+        cc->sent++;
+}
+
+/**
+ * @brief Pass acknowledged blocks to the algorithm.
+ *
+ * @param cc Controller.
+ * @param acked Blocks newly acknowledged.
+ * @param rtt_us Round-trip sample, 0 if none.
+ */
+void cc_on_ack(tftp_cc *cc, uint32_t acked, uint32_t rtt_us) {
+    if (acked == 0)
+        return;
+    cc->ops->on_ack(cc, acked, rtt_us);
+    if (cc->cwnd > cc->max_cwnd)
+        cc->cwnd = cc->max_cwnd;
+}
+
+/**
+ * @brief React to an ACK short of the blocks sent.
+ *
+ * Several gaps of the same window are one congestion event: the window is
+ * only reduced again once the blocks in flight at the first loss are acknowledged.
+ *
+ * @param cc Controller.
+ * @param acked Last block acknowledged.
+ * @param sent_high Highest block sent so far.
+ */
+void cc_on_loss(tftp_cc *cc, uint64_t acked, uint64_t sent_high) {
+    if (acked < cc->recover)
+        return;
+    cc->recover = sent_high;
+    cc->ops->on_loss(cc);
+}
+
+/**
+ * @brief Restart from the minimum window after a retransmission timeout.
+ *
+ * @param cc Controller.
+ */
+void cc_on_timeout(tftp_cc *cc) {
+    if (cc->ops == &cc_none)
+        return;
+    cc_halve(cc);
+    cc->cwnd = cc->max_cwnd < CC_MIN_CWND ? cc->max_cwnd : CC_MIN_CWND;
+}
+
+/**
+ * @brief Time between two paced blocks.
+ *
+ * Nothing is paced until the round-trip time is known, or when cwnd covers
+ * the whole window (the window is then the only limit and is sent at once).
+ *
+ * @param cc Controller.
+ * @param rto Round-trip estimate.
+ * @return uint32_t Microseconds, 0 when not pacing.
+ */
+uint32_t cc_pacing_interval_us(const tftp_cc *cc, const tftp_rto *rto) {
+    if (rto->srtt_us == 0 || cc->cwnd >= cc->max_cwnd)
+        return 0;
+    uint32_t gain = cc->cwnd < cc->ssthresh ? CC_GAIN_SLOW_START : CC_GAIN_AVOIDANCE;
+    return (uint32_t)((uint64_t)rto->srtt_us * 100 / ((uint64_t)cc->cwnd * gain));
+}
+
+/**
+ * @brief Consume the pacing slot of the next block, if it is due.
+ *
+ * Unused slots are not accumulated: an idle sender does not earn a burst.
+ *
+ * @param cc Controller.
+ * @param rto Round-trip estimate.
+ * @param now_us Current time.
+ * @param slack_us Release blocks due within this delay now.
+ * @return uint64_t 0 if the block may be sent, else microseconds to wait.
+ */
+uint64_t cc_release(tftp_cc *cc, const tftp_rto *rto, uint64_t now_us, uint32_t slack_us) {
+    uint32_t interval = cc_pacing_interval_us(cc, rto);
+    if (interval == 0)
+        return 0;
+
+    if (cc->next_send_us < now_us)
+        cc->next_send_us = now_us;
+    if (cc->next_send_us > now_us + slack_us)
+        return cc->next_send_us - now_us;
+    cc->next_send_us += interval;
+    return 0;
+}
+
+/**
+ * @brief Format cwnd, share of blocks resent and pacing rate.
+ *
+ * @param cc Controller.
+ * @param rto Round-trip estimate.
+ * @param blksize Payload bytes per block.
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ */
+void cc_describe(const tftp_cc *cc, const tftp_rto *rto, int blksize, char *buf, size_t size) {
+    double resent = cc->sent ? 100.0 * cc->resent / (cc->sent + cc->resent) : 0.0;
+    uint32_t interval = cc_pacing_interval_us(cc, rto);
+
+    if (interval == 0) {
+        snprintf(buf, size, "%s: cwnd %u, resent %.2f%%, not paced", cc->ops->name, cc->cwnd, resent);
+        return;
+    }
+    double mbit = (double)blksize * 8 / interval;
+    snprintf(buf, size, "%s: cwnd %u, resent %.2f%%, pacing %.1f Mbit/s", cc->ops->name, cc->cwnd, resent,
+             mbit);
+}
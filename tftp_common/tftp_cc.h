@@ -0,0 +1,146 @@
+/**
+ * @file tftp_cc.h
+ * @brief Congestion control and pacing of windowed DATA transfers, shared by the client and server.
+ *
+ * A controller sizes cwnd, the number of blocks a sender may have in flight
+ * (never more than the negotiated windowsize of RFC 7440), and those blocks
+ * are paced out at cwnd blocks per SRTT instead of being sent back to back.
+ * Receivers acknowledge once per window, or after rto_ack_delay_us() without
+ * a new block, so a sender stopped short of the window by cwnd is not left
+ * waiting for a timeout. Controllers are pluggable through tftp_cc_ops and
+ * picked by name.
+ */
+
+#ifndef TFTP_CC_H
+#define TFTP_CC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tftp_rto.h"
+
+#define CC_INITIAL_CWND 10   // blocks per round trip before any feedback (like TCP IW10)
+#define CC_MIN_CWND     2    // floor after a loss
+
+// Pacing gain, in percent of cwnd / SRTT
+#define CC_GAIN_SLOW_START 200
+#define CC_GAIN_AVOIDANCE  125
+
+// Delay-based controller: target number of blocks queued in the path (Vegas alpha/beta)
+#define CC_DELAY_ALPHA 2
+#define CC_DELAY_BETA  4
+
+struct tftp_cc;
+
+/**
+ * @brief Reactions of one congestion control algorithm.
+ */
+typedef struct tftp_cc_ops {
+    const char *name;
+    /**
+     * @brief New blocks were acknowledged.
+     * @param cc Controller state.
+     * @param acked Number of blocks acknowledged.
+     * @param rtt_us Round-trip sample taken with this ACK, 0 if none.
+     */
+    void (*on_ack)(struct tftp_cc *cc, uint32_t acked, uint32_t rtt_us);
+    /**
+     * @brief A loss was detected (at most once per window of data).
+     * @param cc Controller state.
+     */
+    void (*on_loss)(struct tftp_cc *cc);
+} tftp_cc_ops;
+
+/**
+ * @brief Congestion state of one sending transfer.
+ */
+typedef struct tftp_cc {
+    const tftp_cc_ops *ops;
+    uint32_t cwnd;          ///< Blocks in flight at most, released over one round trip
+    uint32_t ssthresh;      ///< Slow start ends above this cwnd
+    uint32_t cwnd_cnt;      ///< Blocks acknowledged towards the next increase in congestion avoidance
+    uint32_t max_cwnd;      ///< Negotiated windowsize, cwnd never exceeds it
+    uint32_t base_rtt_us;   ///< Smallest round-trip time seen (delay-based controller)
+    uint64_t recover;       ///< No further decrease until a block after this one is acknowledged
+    uint64_t sent;          ///< Blocks sent for the first time
+    uint64_t resent;        ///< Blocks sent again (after a gap or a timeout, whether or not they were lost)
+    uint64_t next_send_us;  ///< Earliest release time of the next paced block
+} tftp_cc;
+
+/**
+ * @brief Finds a congestion control algorithm by name.
+ * @param name "aimd", "delay" or "none".
+ * @return The algorithm, or NULL if the name is unknown.
+ */
+const tftp_cc_ops *cc_find(const char *name);
+
+/**
+ * @brief Resets the controller of a transfer.
+ * @param cc Controller to initialize.
+ * @param ops Algorithm to use (from cc_find()).
+ * @param max_cwnd Negotiated windowsize.
+ */
+void cc_init(tftp_cc *cc, const tftp_cc_ops *ops, uint32_t max_cwnd);
+
+/**
+ * @brief Blocks the sender may have in flight: cwnd, within the negotiated window.
+ * @param cc Controller.
+ * @return Number of blocks past the last acknowledged one that may be sent.
+ */
+uint32_t cc_flight_limit(const tftp_cc *cc);
+
+/**
+ * @brief Records the transmission of a block.
+ * @param cc Controller.
+ * @param resent Non-zero if the block was sent before.
+ */
+void cc_on_send(tftp_cc *cc, int resent);
+
+/**
+ * @brief Reports acknowledged blocks to the algorithm.
+ * @param cc Controller.
+ * @param acked Number of blocks newly acknowledged.
+ * @param rtt_us Round-trip sample taken with this ACK, 0 if none.
+ */
+void cc_on_ack(tftp_cc *cc, uint32_t acked, uint32_t rtt_us);
+
+/**
+ * @brief Reports a loss detected from an ACK short of the blocks sent.
+ * @param cc Controller.
+ * @param acked Last block acknowledged.
+ * @param sent_high Highest block sent so far.
+ */
+void cc_on_loss(tftp_cc *cc, uint64_t acked, uint64_t sent_high);
+
+/**
+ * @brief Collapses the window after a retransmission timeout.
+ * @param cc Controller.
+ */
+void cc_on_timeout(tftp_cc *cc);
+
+/**
+ * @brief Time between two paced blocks.
+ * @return Microseconds, 0 when blocks are not paced.
+ */
+uint32_t cc_pacing_interval_us(const tftp_cc *cc, const tftp_rto *rto);
+
+/**
+ * @brief Asks whether the next block may be released now.
+ * @param cc Controller.
+ * @param rto Round-trip estimate of the transfer.
+ * @param now_us Current time (rto_now_us()).
+ * @param slack_us Blocks due within this delay are released early, in one burst.
+ * @return 0 if the block may be sent (its slot is consumed), else microseconds to wait.
+ */
+uint64_t cc_release(tftp_cc *cc, const tftp_rto *rto, uint64_t now_us, uint32_t slack_us);
+
+/**
+ * @brief Formats cwnd, share of blocks resent and pacing rate of a transfer.
+ * @param cc Controller.
+ * @param rto Round-trip estimate of the transfer.
+ * @param blksize Payload bytes per block.
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ */
+void cc_describe(const tftp_cc *cc, const tftp_rto *rto, int blksize, char *buf, size_t size);
+
+#endif // TFTP_CC_H
@@ -0,0 +1,299 @@
+/**
+ * @file tftp_compress.c
+ * @brief LZ4 block codec and the DATA payload frames of the compress option.
+ *
+ * The codec writes and reads the standard LZ4 block format (sequences of a
+ * token, literals, a 16-bit little-endian offset and a match length), so a
+ * block can be checked with any LZ4 implementation. The compressor is the
+ * greedy single-hash search of the reference "fast" mode: blocks are small
+ * and independent, so the table is sized for the block and cleared per call.
+ * The decoder never trusts the input: every literal run, offset and match is
+ * bounded by both buffers before it is copied. Short copies are done as
+ * whole 16- or 8-byte moves when both buffers have room for the overshoot.
+ */
+
+#include "tftp_compress.h"
+#include <string.h>
+
+#define LZ4_MIN_MATCH   4
+#define LZ4_LAST_LITERALS 5    // the last bytes of a block are always literals
+#define LZ4_MF_LIMIT    12     // no match starts in the last bytes of a block
+#define LZ4_HASH_LOG    12
+#define LZ4_SKIP_SHIFT  6      // step faster through data that does not match
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Length of the common prefix of two positions, up to a limit.
+ *
+ * Compares eight bytes at a time; the first differing byte is found from
+ * the lowest set bit of their XOR on little-endian machines.
+ *
+ * @param p Position being matched.
+ * @param ref Earlier position.
+ * @param limit End of the bytes p may cover.
+ * @return const uint8_t* Position of p after the common prefix.
+ */
+static inline const uint8_t *lz4_extend(const uint8_t *p, const uint8_t *ref, const uint8_t *limit) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (limit - p >= 8) {
+        uint64_t diff = read64(p) ^ read64(ref);
+        if (diff)
+            return p + (__builtin_ctzll(diff) >> 3);
+        p += 8;
+        ref += 8;
+    }
+#endif
+    while (p < limit && *p == *ref) {
+        p++;
+        ref++;
+    }
+    return p;
+}
+
+static inline uint32_t lz4_hash(uint32_t v, int log) {
+    return (v * 2654435761u) >> (32 - log);
+}
+
+/**
+ * @brief Write the 255-byte continuation of a literal or match length.
+ *
+ * @param op Output position.
+ * @param n Length minus the 15 held by the token.
+ * @return uint8_t* Output position after the length.
+ */
+static uint8_t *lz4_put_length(uint8_t *op, size_t n) {
+    for (; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+/**
+ * @brief Append one sequence: a literal run, then a match unless it is the last one.
+ *
+ * @param op Output position.
+ * @param oend End of the output buffer.
+ * @param lit Literals.
+ * @param lit_len Number of literals.
+ * @param offset Match distance, 0 for the final literal-only sequence.
+ * @param match_len Match length minus LZ4_MIN_MATCH.
+ * @return uint8_t* Output position after the sequence, NULL if it does not fit.
+ */
+static uint8_t *lz4_put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *lit, size_t lit_len,
+                                 unsigned offset, size_t match_len) {
+    size_t need = 1 + lit_len + lit_len / 255 + 1 + (offset ? 2 + match_len / 255 + 1 : 0);
+    if (need > (size_t)(oend - op))
+        return NULL;
+
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15)
+        op = lz4_put_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (!offset)
+        return op;
+
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    *token |= match_len < 15 ? match_len : 15;
+    if (match_len >= 15)
+        op = lz4_put_length(op, match_len - 15);
+    return op;
+}
+
+/**
+ * @brief Compress one block into the LZ4 block format.
+ *
+ * @param src Input data.
+ * @param len Length of the input, at most LZ4_MAX_INPUT.
+ * @param dst Output buffer.
+ * @param cap Size of the output buffer.
+ * @return int Compressed length, or 0 if it does not fit in cap.
+ */
+int lz4_compress(const uint8_t *src, int len, uint8_t *dst, int cap) {
+    uint16_t table[1 << LZ4_HASH_LOG];
+    const uint8_t *ip = src, *anchor = src, *end = src + len;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    if (len < 0 || len > LZ4_MAX_INPUT)
+        return 0;
+
+    if (len > LZ4_MF_LIMIT) {
+        // a table about the size of the block: clearing it costs less than the search
+        int log = 8;
+        while (log < LZ4_HASH_LOG && (1 << log) < len / 2)
+            log++;
+        memset(table, 0, sizeof(uint16_t) << log);
+
+        const uint8_t *mf_limit = end - LZ4_MF_LIMIT;
+        const uint8_t *match_limit = end - LZ4_LAST_LITERALS;
+        for (ip = src + 1; ip <= mf_limit;) {
+            uint32_t seq = read32(ip);
+            uint32_t h = lz4_hash(seq, log);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint16_t)(ip - src);
+            if (ref >= ip || read32(ref) != seq) {
+                ip += 1 + ((ip - anchor) >> LZ4_SKIP_SHIFT);
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *m = lz4_extend(ip + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, match_limit);
+
+            op = lz4_put_sequence(op, oend, anchor, ip - anchor, (unsigned)(ip - ref), m - ip - LZ4_MIN_MATCH);
+            if (!op)
+                return 0;
+            // index the position just before the next search, where the following match often starts
+            if (m - 2 > src)
+                table[lz4_hash(read32(m - 2), log)] = (uint16_t)(m - 2 - src);
+            anchor = ip = m;
+        }
+    }
+
+    op = lz4_put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    return op ? (int)(op - dst) : 0;
+}
+
+/**
+ * @brief Read the 255-byte continuation of a literal or match length.
+ *
+ * @param ip Input position, advanced.
+ * @param iend End of the input.
+ * @param n Length, increased.
+ * @return int 0 on success, -1 if the input ends first.
+ */
+static int lz4_get_length(const uint8_t **ip, const uint8_t *iend, size_t *n) {
+    uint8_t b;
+    do {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+/**
+ * @brief Decode one LZ4 block.
+ *
+ * @param src Compressed data.
+ * @param len Length of the compressed data.
+ * @param dst Output buffer.
+ * @param cap Size of the output buffer.
+ * @return int Decoded length, or -1 if the input is malformed or decodes to more than cap bytes.
+ */
+int lz4_decompress(const uint8_t *src, int len, uint8_t *dst, int cap) {
+    const uint8_t *ip = src, *iend = src + len;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && lz4_get_length(&ip, iend, &lit_len) < 0)
+            return -1;
+        if (lit_len <= 16 && iend - ip >= 16 && oend - op >= 16) {
+            memcpy(op, ip, 16);
+        } else {
+            if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+                return -1;
+            memcpy(op, ip, lit_len);
+        }
+        op += lit_len;
+        ip += lit_len;
+        if (ip == iend)
+            return (int)(op - dst); // the last sequence has no match
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && lz4_get_length(&ip, iend, &match_len) < 0)
+            return -1;
+        match_len += LZ4_MIN_MATCH;
+        if (match_len > (size_t)(oend - op))
+            return -1;
+
+        // eight bytes at a time while they do not overlap, byte by byte for short runs
+        const uint8_t *m = op - offset;
+        if (offset >= 8 && (size_t)(oend - op) >= match_len + 8) {
+            uint8_t *end = op + match_len;
+            for (; op < end; op += 8, m += 8)
+                memcpy(op, m, 8);
+            op = end;
+        } else {
+            while (match_len--)
+                *op++ = *m++;
+        }
+    }
+    return -1; // empty input, or a block ending with a match
+}
+
+/**
+ * @brief Build the frame of one block: LZ4 if that is shorter, raw otherwise.
+ *
+ * The compressed body is only kept when it saves at least one byte, so a
+ * frame is never longer than the block plus its flag.
+ *
+ * @param data Block.
+ * @param len Length of the block, at most LZ4_MAX_INPUT.
+ * @param frame Output buffer of at least len + 1 bytes.
+ * @return int Length of the frame.
+ */
+int block_pack(const uint8_t *data, int len, uint8_t *frame) {
+    int packed = len > 1 ? lz4_compress(data, len, frame + 1, len - 1) : 0;
+    if (packed > 0) {
+        frame[0] = COMPRESS_FRAME_LZ4;
+        return 1 + packed;
+    }
+    frame[0] = COMPRESS_FRAME_RAW;
+    memcpy(frame + 1, data, len);
+    return 1 + len;
+}
+
+/**
+ * @brief Get the block carried by a received frame.
+ *
+ * @param frame Received frame.
+ * @param len Length of the frame.
+ * @param scratch Buffer of blksize bytes receiving a decompressed block.
+ * @param blksize Largest block expected.
+ * @param out_len Receives the length of the block.
+ * @return const uint8_t* The block, or NULL if the frame is malformed.
+ */
+const uint8_t *block_unpack(const uint8_t *frame, int len, uint8_t *scratch, int blksize, int *out_len) {
+    if (len < 1)
+        return NULL;
+    if (frame[0] == COMPRESS_FRAME_RAW) {
+        if (len - 1 > blksize)
+            return NULL;
+        *out_len = len - 1;
+        return frame + 1;
+    }
+    if (frame[0] != COMPRESS_FRAME_LZ4)
+        return NULL;
+    int n = lz4_decompress(frame + 1, len - 1, scratch, blksize);
+    if (n < 0)
+        return NULL;
+    *out_len = n;
+    return scratch;
+}
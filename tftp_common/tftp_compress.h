@@ -0,0 +1,65 @@
+/**
+ * @file tftp_compress.h
+ * @brief Per-block LZ4 compression of DATA payloads (the "compress" option).
+ *
+ * With compression negotiated, the payload of every DATA packet is a frame:
+ *   | flag | body |
+ * where flag is COMPRESS_FRAME_RAW (body is the block as is) or
+ * COMPRESS_FRAME_LZ4 (body is an LZ4 block decoding to the block). Each
+ * block is compressed on its own, so any block of a window can be resent or
+ * received out of order; a block that does not shrink is sent raw. The
+ * block size and the short final block still refer to the uncompressed data.
+ */
+
+#ifndef TFTP_COMPRESS_H
+#define TFTP_COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define COMPRESS_FRAME_RAW 0
+#define COMPRESS_FRAME_LZ4 1
+
+#define LZ4_MAX_INPUT 65535   // largest block lz4_compress() accepts (offsets are 16-bit)
+
+/**
+ * @brief Compresses one block into the LZ4 block format.
+ * @param src Input data.
+ * @param len Length of the input, at most LZ4_MAX_INPUT.
+ * @param dst Output buffer.
+ * @param cap Size of the output buffer.
+ * @return Compressed length, or 0 if it does not fit in cap.
+ */
+int lz4_compress(const uint8_t *src, int len, uint8_t *dst, int cap);
+
+/**
+ * @brief Decodes one LZ4 block, checking every length and offset against both buffers.
+ * @param src Compressed data.
+ * @param len Length of the compressed data.
+ * @param dst Output buffer.
+ * @param cap Size of the output buffer.
+ * @return Decoded length, or -1 if the input is malformed or decodes to more than cap bytes.
+ */
+int lz4_decompress(const uint8_t *src, int len, uint8_t *dst, int cap);
+
+/**
+ * @brief Builds the frame of one block: LZ4 if that is shorter, raw otherwise.
+ * @param data Block.
+ * @param len Length of the block, at most LZ4_MAX_INPUT.
+ * @param frame Output buffer of at least len + 1 bytes.
+ * @return Length of the frame.
+ */
+int block_pack(const uint8_t *data, int len, uint8_t *frame);
+
+/**
+ * @brief Gets the block carried by a received frame.
+ * @param frame Received frame.
+ * @param len Length of the frame.
+ * @param scratch Buffer of blksize bytes receiving a decompressed block.
+ * @param blksize Largest block expected.
+ * @param out_len Receives the length of the block.
+ * @return The block (inside frame when raw, scratch when decompressed), or NULL if the frame is malformed.
+ */
+const uint8_t *block_unpack(const uint8_t *frame, int len, uint8_t *scratch, int blksize, int *out_len);
+
+#endif // TFTP_COMPRESS_H
@@ -0,0 +1,576 @@
+/**
+ * @file tftp_crc.c
+ * @brief CRC-8 engine shared by the TFTP client and server.
+ *
+ * All implementations compute the same CRC-8 (polynomial 0x07, initial value 0,
+ * no reflection, no final xor) that is appended to every DATA packet:
+ *   - crc8_bitwise: the original bit-by-bit loop, kept as the reference.
+ *   - crc8_table:   one 256-entry table lookup per byte.
+ *   - crc8_slice8:  eight tables, eight independent lookups per 8 bytes.
+ *   - crc8_clmul:   folds 64 bytes per step with carry-less multiplication
+ *                   (PCLMULQDQ) and finishes the last bytes with slice-by-8.
+ *
+ * The tables and the fastest implementation for the running CPU are set up once
+ * before main(). The TFTP_CRC8 environment variable (bitwise, table, slice8 or
+ * clmul) forces a specific implementation, which is handy for benchmarking.
+ *
+ * CRC-32C (reflected polynomial 0x82F63B78) checksums whole file prefixes when a
+ * transfer is resumed: with the SSE4.2 crc32 instruction, eight bytes per step,
+ * otherwise slice-by-8 tables.
+ *
+ * The per-block check of a transfer may instead be CRC-32C or xxHash64 (four
+ * independent 64-bit lanes, no tables), both fast enough to add little to the
+ * cost of sending a packet while catching far more than one corruption in 256.
+ */
+
+#include "tftp_crc.h"
+#include "tftp_options.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC8_HAVE_CLMUL 1
+#endif
+
+// crc8_tables[k][b] = CRC-8 of byte b followed by k zero bytes
+static uint8_t crc8_tables[8][256];
+
+// crc32c_tables[k][b] = CRC-32C of byte b followed by k zero bytes (reflected)
+static uint32_t crc32c_tables[8][256];
+static int crc32c_hw;
+
+static crc8_fn crc8_best = crc8_bitwise;
+static const char *crc8_best_name = "bitwise";
+
+/**
+ * @brief Compute CRC-8 bit by bit (reference implementation).
+ *
+ * @param crc CRC of the preceding data.
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @return uint8_t The updated CRC-8 value.
+ */
+uint8_t crc8_bitwise(uint8_t crc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; ++j)
+            crc = (crc & 0x80) ? (crc << 1) ^ CRC8_POLY : (crc << 1);
+    }
+    return crc;
+}
+
+/**
+ * @brief Compute CRC-8 with one table lookup per byte.
+ *
+ * @param crc CRC of the preceding data.
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @return uint8_t The updated CRC-8 value.
+ */
+uint8_t crc8_table(uint8_t crc, const uint8_t *data, size_t len) {
+    const uint8_t *t = crc8_tables[0];
+    for (size_t i = 0; i < len; ++i)
+        crc = t[crc ^ data[i]];
+    return crc;
+}
+
+/**
+ * @brief Compute CRC-8 eight bytes at a time.
+ *
+ * The CRC state only affects the first byte of each 8-byte slice; every byte
+ * is then looked up in the table that accounts for the bytes following it, so
+ * the eight lookups are independent of each other.
+ *
+ * @param crc CRC of the preceding data.
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @return uint8_t The updated CRC-8 value.
+ */
+uint8_t crc8_slice8(uint8_t crc, const uint8_t *data, size_t len) {
+    while (len >= 8) {
+        crc = crc8_tables[7][data[0] ^ crc] ^ crc8_tables[6][data[1]] ^
+              crc8_tables[5][data[2]] ^ crc8_tables[4][data[3]] ^
+              crc8_tables[3][data[4]] ^ crc8_tables[2][data[5]] ^
+              crc8_tables[1][data[6]] ^ crc8_tables[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+    return crc8_table(crc, data, len);
+}
+
+#ifdef CRC8_HAVE_CLMUL
+
+/**
+ * @brief Compute x^n mod P(x) for the CRC-8 polynomial.
+ *
+ * @param n Exponent.
+ * @return uint8_t The remainder (degree < 8).
+ */
+static uint8_t crc8_xpow(unsigned n) {
+    unsigned r = 1;
+    while (n--) {
+        r <<= 1;
+        if (r & 0x100)
+            r ^= 0x100 | CRC8_POLY;
+    }
+    return (uint8_t)r;
+}
+
+// Folding constants: {x^(d+64) mod P, x^d mod P} for distances d = 512, 384, 256, 128 bits
+static uint64_t crc8_fold_k[4][2];
+
+/**
+ * @brief Replace a 128-bit polynomial X by a value congruent to X * x^d (mod P).
+ *
+ * With X = H * x^64 + L: X * x^d = H * x^(d+64) + L * x^d, and both powers are
+ * reduced to 8-bit constants, so the result fits in 72 bits.
+ *
+ * @param x The 128-bit polynomial.
+ * @param k Constants {x^(d+64) mod P, x^d mod P} as {low, high} qwords.
+ * @return __m128i The folded value.
+ */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc8_fold(__m128i x, __m128i k) {
+    return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x01), _mm_clmulepi64_si128(x, k, 0x10));
+}
+
+/**
+ * @brief Load 16 message bytes as a polynomial (first byte = highest degree).
+ */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc8_load(const uint8_t *p, __m128i swap) {
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), swap);
+}
+
+/**
+ * @brief Compute CRC-8 by folding 64 bytes per step with PCLMULQDQ.
+ *
+ * Four 128-bit lanes are kept congruent (mod P) to the message processed so
+ * far; each step multiplies them by x^512 and adds the next 64 bytes. The lanes
+ * are then merged into one 16-byte value with the same CRC as the whole prefix,
+ * and that value plus the tail go through slice-by-8.
+ *
+ * @param crc CRC of the preceding data.
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @return uint8_t The updated CRC-8 value.
+ */
+__attribute__((target("pclmul,ssse3")))
+uint8_t crc8_clmul(uint8_t crc, const uint8_t *data, size_t len) {
+    if (len < 128)
+        return crc8_slice8(crc, data, len);
+
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k512 = _mm_set_epi64x(crc8_fold_k[0][1], crc8_fold_k[0][0]);
+    const __m128i k384 = _mm_set_epi64x(crc8_fold_k[1][1], crc8_fold_k[1][0]);
+    const __m128i k256 = _mm_set_epi64x(crc8_fold_k[2][1], crc8_fold_k[2][0]);
+    const __m128i k128 = _mm_set_epi64x(crc8_fold_k[3][1], crc8_fold_k[3][0]);
+
+    __m128i x0 = crc8_load(data, swap);
+    __m128i x1 = crc8_load(data + 16, swap);
+    __m128i x2 = crc8_load(data + 32, swap);
+    __m128i x3 = crc8_load(data + 48, swap);
+
+    // A running CRC is the same as xoring it into the first message byte
+    x0 = _mm_xor_si128(x0, _mm_set_epi64x((long long)((uint64_t)crc << 56), 0));
+    data += 64;
+    len -= 64;
+
+    while (len >= 64) {
+        x0 = _mm_xor_si128(crc8_fold(x0, k512), crc8_load(data, swap));
+        x1 = _mm_xor_si128(crc8_fold(x1, k512), crc8_load(data + 16, swap));
+        x2 = _mm_xor_si128(crc8_fold(x2, k512), crc8_load(data + 32, swap));
+        x3 = _mm_xor_si128(crc8_fold(x3, k512), crc8_load(data + 48, swap));
+        data += 64;
+        len -= 64;
+    }
+
+    // message so far = x0 * x^384 + x1 * x^256 + x2 * x^128 + x3
+    __m128i x = _mm_xor_si128(crc8_fold(x0, k384), crc8_fold(x1, k256));
+    x = _mm_xor_si128(x, crc8_fold(x2, k128));
+    x = _mm_xor_si128(x, x3);
+
+    uint8_t folded[16];
+    _mm_storeu_si128((__m128i *)folded, _mm_shuffle_epi8(x, swap));
+    crc = crc8_slice8(0, folded, sizeof(folded));
+    return crc8_slice8(crc, data, len);
+}
+
+/**
+ * @brief Tell whether the CPU supports PCLMULQDQ and SSSE3.
+ *
+ * @return int Non-zero if crc8_clmul() can be used.
+ */
+int crc8_clmul_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+}
+
+#else
+
+uint8_t crc8_clmul(uint8_t crc, const uint8_t *data, size_t len) {
+    return crc8_slice8(crc, data, len);
+}
+
+int crc8_clmul_supported(void) {
+    return 0;
+}
+
+#endif // CRC8_HAVE_CLMUL
+
+/**
+ * @brief Continue a reflected CRC-32C state eight bytes at a time with tables.
+ *
+ * @param crc Internal state (inverted CRC).
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @return uint32_t The updated state.
+ */
+static uint32_t crc32c_slice8(uint32_t crc, const uint8_t *data, size_t len) {
+    while (len >= 8) {
+        uint32_t lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+        crc = crc32c_tables[7][lo & 0xFF] ^ crc32c_tables[6][(lo >> 8) & 0xFF] ^
+              crc32c_tables[5][(lo >> 16) & 0xFF] ^ crc32c_tables[4][lo >> 24] ^
+              crc32c_tables[3][data[4]] ^ crc32c_tables[2][data[5]] ^
+              crc32c_tables[1][data[6]] ^ crc32c_tables[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = (crc >> 8) ^ crc32c_tables[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+#ifdef CRC8_HAVE_CLMUL
+
+/**
+ * @brief Continue a CRC-32C state with the SSE4.2 crc32 instruction.
+ *
+ * @param crc Internal state (inverted CRC).
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @return uint32_t The updated state.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t len) {
+#ifdef __x86_64__
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, data, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        data += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+#endif
+    while (len--)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+
+/**
+ * @brief Tell whether the CPU has the SSE4.2 crc32 instruction.
+ *
+ * @return int Non-zero if crc32c_sse42() can be used.
+ */
+static int crc32c_sse42_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#else
+
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t len) {
+    return crc32c_slice8(crc, data, len);
+}
+
+static int crc32c_sse42_supported(void) {
+    return 0;
+}
+
+#endif // CRC8_HAVE_CLMUL
+
+/**
+ * @brief Build the lookup tables and pick the fastest implementation.
+ *
+ * Runs automatically before main().
+ */
+__attribute__((constructor))
+static void crc8_init(void) {
+    for (int b = 0; b < 256; b++) {
+        uint8_t byte = (uint8_t)b;
+        crc8_tables[0][b] = crc8_bitwise(0, &byte, 1);
+    }
+    for (int k = 1; k < 8; k++)
+        for (int b = 0; b < 256; b++)
+            crc8_tables[k][b] = crc8_tables[0][crc8_tables[k - 1][b]];
+
+#ifdef CRC8_HAVE_CLMUL
+    static const unsigned dist[4] = {512, 384, 256, 128};
+    for (int i = 0; i < 4; i++) {
+        crc8_fold_k[i][0] = crc8_xpow(dist[i] + 64);
+        crc8_fold_k[i][1] = crc8_xpow(dist[i]);
+    }
+#endif
+
+    for (int b = 0; b < 256; b++) {
+        uint32_t c = b;
+        for (int j = 0; j < 8; j++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_tables[0][b] = c;
+    }
+    for (int k = 1; k < 8; k++)
+        for (int b = 0; b < 256; b++)
+            crc32c_tables[k][b] = (crc32c_tables[k - 1][b] >> 8) ^ crc32c_tables[0][crc32c_tables[k - 1][b] & 0xFF];
+    crc32c_hw = crc32c_sse42_supported();
+
+    crc8_best = crc8_slice8;
+    crc8_best_name = "slice8";
+    if (crc8_clmul_supported()) {
+        crc8_best = crc8_clmul;
+        crc8_best_name = "clmul";
+    }
+
+    // Optional override, e.g. TFTP_CRC8=table
+    const char *force = getenv("TFTP_CRC8");
+    if (force) {
+        if (strcmp(force, "bitwise") == 0) {
+            crc8_best = crc8_bitwise;
+            crc8_best_name = "bitwise";
+        } else if (strcmp(force, "table") == 0) {
+            crc8_best = crc8_table;
+            crc8_best_name = "table";
+        } else if (strcmp(force, "slice8") == 0) {
+            crc8_best = crc8_slice8;
+            crc8_best_name = "slice8";
+        }
+    }
+}
+
+/**
+ * @brief Continue a CRC-8 with the fastest implementation available.
+ *
+ * @param crc CRC of the preceding data.
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @return uint8_t The updated CRC-8 value.
+ */
+uint8_t crc8_update(uint8_t crc, const uint8_t *data, size_t len) {
+    return crc8_best(crc, data, len);
+}
+
+/**
+ * @brief Name of the implementation selected at startup.
+ *
+ * @return const char* "bitwise", "table", "slice8" or "clmul".
+ */
+const char *crc8_impl_name(void) {
+    return crc8_best_name;
+}
+
+/**
+ * @brief Calculate CRC-8 checksum over a data buffer.
+ *
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @return uint8_t The computed CRC-8 value.
+ */
+uint8_t calculate_crc8(const uint8_t *data, size_t len) {
+    return crc8_best(0, data, len);
+}
+
+/**
+ * @brief Continue a CRC-32C.
+ *
+ * @param crc CRC-32C of the preceding data (0 for a new computation).
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @return uint32_t The CRC-32C of the preceding data followed by this buffer.
+ */
+uint32_t crc32c_update(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    crc = crc32c_hw ? crc32c_sse42(crc, data, len) : crc32c_slice8(crc, data, len);
+    return ~crc;
+}
+
+/**
+ * @brief Compute the CRC-32C of the first len bytes of a file.
+ *
+ * @param fd File, read with pread().
+ * @param len Number of bytes from the start of the file.
+ * @param crc Receives the CRC-32C.
+ * @return int 0 on success, -1 on a read error or if the file is shorter.
+ */
+int crc32c_file(int fd, uint64_t len, uint32_t *crc) {
+    const size_t size = 256 * 1024;
+    uint8_t *buf = malloc(size);
+    uint64_t done = 0;
+    uint32_t c = 0;
+
+    if (!buf)
+        return -1;
+    while (done < len) {
+        size_t want = len - done < size ? len - done : size;
+        ssize_t n = pread(fd, buf, want, done);
+        if (n <= 0)
+            break;
+        c = crc32c_update(c, buf, n);
+        done += n;
+    }
+    free(buf);
+    if (done < len)
+        return -1;
+    *crc = c;
+    return 0;
+}
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ull
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define XXH_PRIME64_3 0x165667B19E3779F9ull
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ull
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ull
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8); // little-endian hosts only, like the rest of the wire code
+    return v;
+}
+
+static inline uint32_t xxh_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/**
+ * @brief Compute the xxHash64 of a buffer.
+ *
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ * @param seed Hash seed.
+ * @return uint64_t The 64-bit hash.
+ */
+uint64_t xxh64(const uint8_t *data, size_t len, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+    h += len;
+
+    for (; p + 8 <= end; p += 8)
+        h = xxh_rotl(h ^ xxh_round(0, xxh_read64(p)), 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    if (p + 4 <= end) {
+        h = xxh_rotl(h ^ (uint64_t)xxh_read32(p) * XXH_PRIME64_1, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = xxh_rotl(h ^ *p * XXH_PRIME64_5, 11) * XXH_PRIME64_1;
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * @brief Length of the trailer a per-block check appends to a DATA payload.
+ *
+ * @param check One of the CHECK_* values (CHECK_ABSENT is CRC-8).
+ * @return int 0, 1, 4 or 8 bytes.
+ */
+int block_check_len(int check) {
+    switch (check) {
+    case CHECK_NONE:
+        return 0;
+    case CHECK_CRC32C:
+        return 4;
+    case CHECK_XXH64:
+        return 8;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * @brief Compute the trailer of a DATA payload, most significant byte first.
+ *
+ * @param check One of the CHECK_* values.
+ * @param data Payload.
+ * @param len Payload length.
+ * @param out Receives block_check_len(check) bytes.
+ */
+void block_check_put(int check, const uint8_t *data, size_t len, uint8_t *out) {
+    uint64_t v;
+    int n = block_check_len(check);
+
+    switch (check) {
+    case CHECK_NONE:
+        return;
+    case CHECK_CRC32C:
+        v = crc32c_update(0, data, len);
+        break;
+    case CHECK_XXH64:
+        v = xxh64(data, len, 0);
+        break;
+    default:
+        out[0] = crc8_best(0, data, len);
+        return;
+    }
+    for (int i = n - 1; i >= 0; i--, v >>= 8)
+        out[i] = (uint8_t)v;
+}
+
+/**
+ * @brief Verify the trailer of a received DATA payload.
+ *
+ * @param check One of the CHECK_* values.
+ * @param data Payload.
+ * @param len Payload length.
+ * @param trailer The block_check_len(check) bytes following the payload.
+ * @return int Non-zero if the trailer matches.
+ */
+int block_check_ok(int check, const uint8_t *data, size_t len, const uint8_t *trailer) {
+    uint8_t expected[CHECK_MAX_LEN];
+    block_check_put(check, data, len, expected);
+    return memcmp(expected, trailer, block_check_len(check)) == 0;
+}
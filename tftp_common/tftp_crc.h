@@ -0,0 +1,134 @@
+/**
+ * @file tftp_crc.h
+ * @brief CRC-8 (polynomial 0x07, init 0, MSB first) shared by the TFTP client and server.
+ *
+ * Several bit-exact implementations are provided. calculate_crc8() uses the
+ * fastest one available on the running CPU, picked once at program start.
+ *
+ * CRC-32C (Castagnoli) is provided as well, for checksums of whole files where
+ * eight bits are too few, and xxHash64. block_check_*() compute the per-block
+ * check negotiated for a transfer (CHECK_* in tftp_options.h) with either.
+ */
+
+#ifndef TFTP_CRC_H
+#define TFTP_CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-8 generator polynomial x^8 + x^2 + x + 1 (the x^8 term is implicit)
+#define CRC8_POLY 0x07
+
+// CRC-32C (Castagnoli) polynomial, bit-reflected
+#define CRC32C_POLY 0x82F63B78u
+
+/**
+ * @brief Signature shared by all CRC-8 implementations.
+ *
+ * @param crc CRC of the preceding data (0 for a new computation).
+ * @param data Pointer to the data buffer (may be NULL when len is 0).
+ * @param len Length of the data.
+ * @return The CRC-8 of the preceding data followed by this buffer.
+ */
+typedef uint8_t (*crc8_fn)(uint8_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Reference implementation: 8 shift/xor steps per byte.
+ */
+uint8_t crc8_bitwise(uint8_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief One lookup in a 256-entry table per byte.
+ */
+uint8_t crc8_table(uint8_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Slice-by-8: eight independent table lookups per 8 input bytes.
+ */
+uint8_t crc8_slice8(uint8_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Carry-less multiplication (PCLMULQDQ) folding of 64 bytes per step.
+ *
+ * Must only be called when crc8_clmul_supported() returns non-zero.
+ */
+uint8_t crc8_clmul(uint8_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Tells whether the CPU supports the PCLMULQDQ path.
+ * @return Non-zero if crc8_clmul() can be used.
+ */
+int crc8_clmul_supported(void);
+
+/**
+ * @brief Continues a CRC-8 with the fastest implementation available.
+ */
+uint8_t crc8_update(uint8_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Name of the implementation used by crc8_update() / calculate_crc8().
+ */
+const char *crc8_impl_name(void);
+
+/**
+ * @brief Calculates CRC-8 for a given data buffer.
+ * @param data Pointer to the data buffer.
+ * @param len Length of the data.
+ * @return The computed CRC-8 value.
+ */
+uint8_t calculate_crc8(const uint8_t *data, size_t len);
+
+/**
+ * @brief Continues a CRC-32C (SSE4.2 crc32 instruction when available).
+ * @param crc CRC-32C of the preceding data (0 for a new computation).
+ * @param data Pointer to the data buffer.
+ * @param len Length of the data.
+ * @return The CRC-32C of the preceding data followed by this buffer.
+ */
+uint32_t crc32c_update(uint32_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Computes the CRC-32C of the first len bytes of a file.
+ * @param fd File, read with pread().
+ * @param len Number of bytes from the start of the file.
+ * @param crc Receives the CRC-32C.
+ * @return 0 on success, -1 on a read error or if the file is shorter.
+ */
+int crc32c_file(int fd, uint64_t len, uint32_t *crc);
+
+/**
+ * @brief Computes the xxHash64 of a buffer.
+ * @param data Pointer to the data buffer.
+ * @param len Length of the data.
+ * @param seed Hash seed.
+ * @return The 64-bit hash.
+ */
+uint64_t xxh64(const uint8_t *data, size_t len, uint64_t seed);
+
+/**
+ * @brief Length of the trailer a per-block check appends to a DATA payload.
+ * @param check One of the CHECK_* values (CHECK_ABSENT is CRC-8).
+ * @return 0, 1, 4 or 8 bytes.
+ */
+int block_check_len(int check);
+
+/**
+ * @brief Computes the trailer of a DATA payload, most significant byte first.
+ * @param check One of the CHECK_* values.
+ * @param data Payload.
+ * @param len Payload length.
+ * @param out Receives block_check_len(check) bytes.
+ */
+void block_check_put(int check, const uint8_t *data, size_t len, uint8_t *out);
+
+/**
+ * @brief Verifies the trailer of a received DATA payload.
+ * @param check One of the CHECK_* values.
+ * @param data Payload.
+ * @param len Payload length.
+ * @param trailer The block_check_len(check) bytes following the payload.
+ * @return Non-zero if the trailer matches.
+ */
+int block_check_ok(int check, const uint8_t *data, size_t len, const uint8_t *trailer);
+
+#endif // TFTP_CRC_H
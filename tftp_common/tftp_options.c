@@ -0,0 +1,428 @@
+/**
+ * @file tftp_options.c
+ * @brief Encoding and decoding of TFTP options (RFC 2347) and the OACK packet.
+ *
+ * Supported options:
+ *   - blksize (RFC 2348): DATA payload size between MIN_BLKSIZE and MAX_BLKSIZE.
+ *   - windowsize (RFC 7440): number of DATA blocks sent before waiting for an ACK,
+ *     at most MAX_WINDOWSIZE (larger requests are cut to it).
+ *   - rollover: block number (0 or 1) that follows 65535, so transfers may use
+ *     more than 65535 blocks.
+ *   - tsize (RFC 2349): the server reports the size of the requested file.
+ *   - offset / length: an RRQ for a byte range of the file only. Block 1 holds
+ *     the byte at offset and the range ends, like a file, with a short block.
+ *   - resume / prefixcrc: continue an interrupted transfer. An RRQ carries the
+ *     size of the partial local file and the CRC-32C of its content; the
+ *     server sends from there if its file starts with the same bytes, and
+ *     leaves resume out of the OACK (a transfer from byte 0) otherwise. A WRQ
+ *     carries the size of the local file; the OACK answers with the size of
+ *     the partial upload the server kept and its CRC-32C, which the client
+ *     checks before sending the rest.
+ *   - check: integrity check appended to every DATA payload instead of the
+ *     default CRC-8: "none" (the UDP checksum only, e.g. on loopback), "crc8",
+ *     "crc32c" (4 bytes) or "xxh64" (8 bytes), sent most significant byte first.
+ *     The OACK echoes the check the server uses; without it both sides use CRC-8.
+ *   - digest: "sha256" asks both sides to hash the payload as it is sent and
+ *     received; the sender then sends an OP_DIGEST packet after the last block
+ *     and the receiver only accepts the transfer if the digests match.
+ *   - compress: "lz4" has the sender compress every block on its own and the
+ *     receiver decompress it before writing (tftp_compress.h); a block that
+ *     does not shrink is sent raw. Checks cover the payload as sent, the
+ *     digest the uncompressed data.
+ *
+ * Block numbers are tracked as 64-bit absolute values and only reduced to 16 bits
+ * on the wire with block_to_wire() / block_distance().
+ */
+
+#include "tftp_options.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/**
+ * @brief Tell whether any option is set.
+ *
+ * @param opts Options to inspect.
+ * @return int Non-zero if at least one option is present.
+ */
+int options_present(const tftp_options *opts) {
+    return opts && (opts->blksize != 0 || opts->windowsize != 0 || opts->rollover != ROLLOVER_ABSENT ||
+                    opts->has_tsize || opts->offset != 0 || opts->length != 0 || opts->resume != 0 ||
+                    opts->has_prefixcrc || opts->check != CHECK_ABSENT || opts->digest != DIGEST_ABSENT ||
+                    opts->compress != COMPRESS_ABSENT);
+}
+
+static const char *const check_names[] = {
+    [CHECK_ABSENT] = "crc8",
+    [CHECK_NONE] = "none",
+    [CHECK_CRC8] = "crc8",
+    [CHECK_CRC32C] = "crc32c",
+    [CHECK_XXH64] = "xxh64",
+};
+
+/**
+ * @brief Name of a per-block check as sent in the "check" option.
+ *
+ * @param check One of the CHECK_* values (CHECK_ABSENT is CRC-8).
+ * @return const char* "none", "crc8", "crc32c" or "xxh64".
+ */
+const char *check_name(int check) {
+    if (check < 0 || check > CHECK_XXH64)
+        check = CHECK_ABSENT;
+    return check_names[check];
+}
+
+/**
+ * @brief Look up a per-block check by name.
+ *
+ * @param name "none", "crc8", "crc32c" or "xxh64" (case-insensitive).
+ * @return int The CHECK_* value, or CHECK_ABSENT if the name is unknown.
+ */
+int check_find(const char *name) {
+    for (int c = CHECK_NONE; c <= CHECK_XXH64; c++)
+        if (strcasecmp(name, check_names[c]) == 0)
+            return c;
+    return CHECK_ABSENT;
+}
+
+/**
+ * @brief Parse a decimal option value.
+ *
+ * @param value NUL terminated value string.
+ * @param min Smallest accepted value.
+ * @param max Largest accepted value.
+ * @return long The value, or -1 if it is not a number in [min, max].
+ */
+static long option_number(const char *value, long min, long max) {
+    char *end;
+    long v = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || v < min || v > max)
+        return -1;
+    return v;
+}
+
+/**
+ * @brief Parse a decimal 64-bit option value.
+ *
+ * Sizes and offsets end up in an off_t, so values above INT64_MAX are refused.
+ *
+ * @param value NUL terminated value string.
+ * @param out Receives the value.
+ * @return int 0 on success, -1 if it is not a number in [0, INT64_MAX].
+ */
+static int option_u64(const char *value, uint64_t *out) {
+    char *end;
+    if (*value < '0' || *value > '9')
+        return -1;
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (*end != '\0' || errno == ERANGE || v > INT64_MAX)
+        return -1;
+    *out = v;
+    return 0;
+}
+
+/**
+ * @brief Parse "name\0value\0" pairs, ignoring unknown or malformed options.
+ *
+ * @param p First option name.
+ * @param len Number of bytes available from p.
+ * @param opts Receives the recognized options (cleared first).
+ * @return int Number of recognized options.
+ */
+int options_parse(const char *p, int len, tftp_options *opts) {
+    const char *end = p + len;
+    int found = 0;
+
+    memset(opts, 0, sizeof(*opts));
+    while (p < end) {
+        const char *name = p;
+        const char *name_end = memchr(name, 0, end - name);
+        if (!name_end || name_end + 1 >= end)
+            break;
+        const char *value = name_end + 1;
+        const char *value_end = memchr(value, 0, end - value);
+        if (!value_end)
+            break;
+        p = value_end + 1;
+
+        // option names are case-insensitive
+        if (strcasecmp(name, "blksize") == 0) {
+            long v = option_number(value, MIN_BLKSIZE, MAX_BLKSIZE);
+            if (v > 0) {
+                opts->blksize = (int)v;
+                found++;
+            }
+        } else if (strcasecmp(name, "rollover") == 0) {
+            long v = option_number(value, 0, 1);
+            if (v >= 0) {
+                opts->rollover = v == 0 ? ROLLOVER_TO_0 : ROLLOVER_TO_1;
+                found++;
+            }
+        } else if (strcasecmp(name, "windowsize") == 0) {
+            // larger RFC 7440 windows are accepted but cut to what block numbers can track
+            long v = option_number(value, MIN_WINDOWSIZE, RFC_MAX_WINDOWSIZE);
+            if (v > 0) {
+                opts->windowsize = v < MAX_WINDOWSIZE ? (int)v : MAX_WINDOWSIZE;
+                found++;
+            }
+        } else if (strcasecmp(name, "tsize") == 0) {
+            if (option_u64(value, &opts->tsize) == 0) {
+                opts->has_tsize = 1;
+                found++;
+            }
+        } else if (strcasecmp(name, "offset") == 0) {
+            if (option_u64(value, &opts->offset) == 0)
+                found++;
+        } else if (strcasecmp(name, "length") == 0) {
+            if (option_u64(value, &opts->length) == 0)
+                found++;
+        } else if (strcasecmp(name, "resume") == 0) {
+            if (option_u64(value, &opts->resume) == 0)
+                found++;
+        } else if (strcasecmp(name, "prefixcrc") == 0) {
+            uint64_t v;
+            if (option_u64(value, &v) == 0 && v <= UINT32_MAX) {
+                opts->prefixcrc = (uint32_t)v;
+                opts->has_prefixcrc = 1;
+                found++;
+            }
+        } else if (strcasecmp(name, "check") == 0) {
+            opts->check = check_find(value);
+            if (opts->check != CHECK_ABSENT)
+                found++;
+        } else if (strcasecmp(name, "digest") == 0) {
+            if (strcasecmp(value, "sha256") == 0) {
+                opts->digest = DIGEST_SHA256;
+                found++;
+            }
+        } else if (strcasecmp(name, "compress") == 0) {
+            if (strcasecmp(value, "lz4") == 0) {
+                opts->compress = COMPRESS_LZ4;
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Append one "name\0value\0" pair.
+ *
+ * @return int Bytes written, or -1 if it does not fit.
+ */
+static int option_put(unsigned char *buf, int size, const char *name, unsigned long long value) {
+    int n = snprintf((char *)buf, size, "%s%c%llu", name, 0, value);
+    if (n < 0 || n + 1 > size)
+        return -1;
+    return n + 1; // include the terminating NUL of the value
+}
+
+/**
+ * @brief Append one "name\0value\0" pair with a string value.
+ *
+ * @return int Bytes written, or -1 if it does not fit.
+ */
+static int option_put_str(unsigned char *buf, int size, const char *name, const char *value) {
+    int n = snprintf((char *)buf, size, "%s%c%s", name, 0, value);
+    if (n < 0 || n + 1 > size)
+        return -1;
+    return n + 1;
+}
+
+/**
+ * @brief Append the present options as "name\0value\0" pairs.
+ *
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param opts Options to write.
+ * @return int Number of bytes written, or -1 if the buffer is too small.
+ */
+int options_build(unsigned char *buf, int size, const tftp_options *opts) {
+    int len = 0;
+
+    if (opts->blksize) {
+        int n = option_put(buf + len, size - len, "blksize", opts->blksize);
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    if (opts->windowsize) {
+        int n = option_put(buf + len, size - len, "windowsize", opts->windowsize);
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    if (opts->rollover != ROLLOVER_ABSENT) {
+        int n = option_put(buf + len, size - len, "rollover", opts->rollover == ROLLOVER_TO_1);
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    if (opts->has_tsize) {
+        int n = option_put(buf + len, size - len, "tsize", opts->tsize);
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    if (opts->offset || opts->length) {
+        int n = option_put(buf + len, size - len, "offset", opts->offset);
+        if (n < 0)
+            return -1;
+        len += n;
+        n = option_put(buf + len, size - len, "length", opts->length);
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    if (opts->resume) {
+        int n = option_put(buf + len, size - len, "resume", opts->resume);
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    if (opts->has_prefixcrc) {
+        int n = option_put(buf + len, size - len, "prefixcrc", opts->prefixcrc);
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    if (opts->check != CHECK_ABSENT) {
+        int n = option_put_str(buf + len, size - len, "check", check_name(opts->check));
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    if (opts->digest == DIGEST_SHA256) {
+        int n = option_put_str(buf + len, size - len, "digest", "sha256");
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    if (opts->compress == COMPRESS_LZ4) {
+        int n = option_put_str(buf + len, size - len, "compress", "lz4");
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+    return len;
+}
+
+/**
+ * @brief Build an RRQ/WRQ packet, appending mode and options when any are set.
+ *
+ * Without options the packet keeps the original format: opcode + filename.
+ *
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param opcode OP_RRQ or OP_WRQ.
+ * @param filename Requested file name.
+ * @param opts Options to request (may be NULL).
+ * @return int Packet length, or -1 if the buffer is too small.
+ */
+int request_build(unsigned char *buf, int size, int opcode, const char *filename, const tftp_options *opts) {
+    int len = 2 + strlen(filename) + 1;
+    if (len > size)
+        return -1;
+
+    buf[0] = 0;
+    buf[1] = opcode;
+    strcpy((char *)&buf[2], filename);
+
+    if (!options_present(opts))
+        return len;
+
+    static const char mode[] = "octet";
+    if (len + (int)sizeof(mode) > size)
+        return -1;
+    memcpy(&buf[len], mode, sizeof(mode));
+    len += sizeof(mode);
+
+    int n = options_build(&buf[len], size - len, opts);
+    if (n < 0)
+        return -1;
+    return len + n;
+}
+
+/**
+ * @brief Split a received request into filename and options.
+ *
+ * @param buf Request packet, NUL terminated at buf[n].
+ * @param n Length of the packet.
+ * @param opts Receives the requested options.
+ * @return char* Pointer to the filename inside buf.
+ */
+char *request_parse(unsigned char *buf, int n, tftp_options *opts) {
+    char *filename = (char *)&buf[2];
+    char *p = filename + strlen(filename) + 1;      // mode
+    char *end = (char *)&buf[n];
+
+    memset(opts, 0, sizeof(*opts));
+    if (p < end) {
+        p += strlen(p) + 1;                         // skip mode, options follow
+        if (p < end)
+            options_parse(p, end - p, opts);
+    }
+    return filename;
+}
+
+/**
+ * @brief Build an OACK packet listing the accepted options.
+ *
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param opts Accepted options.
+ * @return int Packet length, or -1 if the buffer is too small.
+ */
+int oack_build(unsigned char *buf, int size, const tftp_options *opts) {
+    if (size < 2)
+        return -1;
+    buf[0] = 0;
+    buf[1] = OP_OACK;
+
+    int n = options_build(&buf[2], size - 2, opts);
+    return n < 0 ? -1 : n + 2;
+}
+
+/**
+ * @brief Map an absolute block number to the 16-bit number sent on the wire.
+ *
+ * With wrap_to 0 the wire numbers cycle through 0..65535; with wrap_to 1 they
+ * cycle through 1..65535 (0 is only used before the first block).
+ *
+ * @param block Absolute block number (1 = first block; 0 = before the first block).
+ * @param wrap_to Block number following 65535 (0 or 1).
+ * @return uint16_t The wire block number.
+ */
+uint16_t block_to_wire(uint64_t block, int wrap_to) {
+    if (wrap_to == 1)
+        return block == 0 ? 0 : (uint16_t)((block - 1) % 65535 + 1);
+    return (uint16_t)block;
+}
+
+/**
+ * @brief Forward distance from an absolute block to the next block carrying a wire number.
+ *
+ * Used to turn a received 16-bit ACK or DATA number back into an absolute block
+ * number, given a nearby reference such as the last acknowledged block.
+ *
+ * @param from Absolute block number to count from.
+ * @param wire Block number received on the wire.
+ * @param wrap_to Block number following 65535 (0 or 1).
+ * @return uint64_t Number of blocks from @p from to that block (0 if it is @p from itself).
+ */
+uint64_t block_distance(uint64_t from, uint16_t wire, int wrap_to) {
+    uint16_t from_wire = block_to_wire(from, wrap_to);
+
+    if (wrap_to == 1) {
+        // 0 only designates the position before the first block
+        if (wire == 0)
+            return from == 0 ? 0 : UINT64_MAX;
+        if (from == 0)
+            return wire;
+        return (uint64_t)((wire - from_wire + 65535) % 65535);
+    }
+    return (uint16_t)(wire - from_wire);
+}
@@ -0,0 +1,169 @@
+/**
+ * @file tftp_options.h
+ * @brief TFTP option extension (RFC 2347) shared by the client and server.
+ *
+ * A request carrying options has the form
+ *   | opcode | filename | 0 | mode | 0 | name1 | 0 | value1 | 0 | ... |
+ * and the server answers with an OACK listing the options it accepted.
+ * Requests without options keep the original format (opcode + filename).
+ */
+
+#ifndef TFTP_OPTIONS_H
+#define TFTP_OPTIONS_H
+
+#include <stdint.h>
+
+// Option acknowledgment. RFC 2347 uses 6, which this protocol already uses for DELETE.
+#define OP_OACK 7
+
+// Whole-file digest, sent by the sender once the last DATA block is acknowledged:
+//   | 8 | block | digest |
+// where block follows the last DATA block; the receiver answers with an ACK of that
+// block if the digest matches what it received, or an ERROR if it does not.
+#define OP_DIGEST 8
+
+// Block size limits (RFC 2348)
+#define DEFAULT_BLKSIZE 512
+#define MIN_BLKSIZE     8
+#define MAX_BLKSIZE     65464
+
+// DATA packet overhead: opcode(2) + block(2) + CRC(1)
+#define DATA_OVERHEAD 5
+
+// Per-block integrity check appended to every DATA payload, negotiated with the "check" option
+#define CHECK_ABSENT 0   // option not present (CRC-8)
+#define CHECK_NONE   1   // "none": no trailer, only the UDP checksum
+#define CHECK_CRC8   2   // "crc8": 1-byte CRC-8
+#define CHECK_CRC32C 3   // "crc32c": 4-byte CRC-32C
+#define CHECK_XXH64  4   // "xxh64": 8-byte xxHash64
+#define CHECK_MAX_LEN 8
+
+// Values of the compress field: how DATA payloads are compressed (see tftp_compress.h)
+#define COMPRESS_ABSENT 0   // option not present: payloads sent as is
+#define COMPRESS_LZ4    1   // "lz4": every block is an LZ4 or raw frame
+#define COMPRESS_FLAG_LEN 1 // frame flag in front of every compressed payload
+
+// Largest DATA packet overhead: opcode(2) + block(2) + frame flag + longest check
+#define DATA_OVERHEAD_MAX (4 + COMPRESS_FLAG_LEN + CHECK_MAX_LEN)
+
+// Values of the digest field: whole-file digest exchanged at the end of a transfer
+#define DIGEST_ABSENT 0   // option not present: no digest
+#define DIGEST_SHA256 1   // "sha256"
+
+// Window size limits. RFC 7440 allows up to 65535, but ACKs are matched to
+// blocks by their 16-bit number: a window must stay under half of that range
+// or a stale ACK cannot be told from a new one (see block_distance()).
+#define MIN_WINDOWSIZE 1
+#define MAX_WINDOWSIZE 32767
+#define RFC_MAX_WINDOWSIZE 65535
+
+// Values of the rollover field: which block number follows 65535
+#define ROLLOVER_ABSENT 0   // option not present (transfers wrap to 0)
+#define ROLLOVER_TO_0   1   // "rollover" "0": 65535 is followed by 0
+#define ROLLOVER_TO_1   2   // "rollover" "1": 65535 is followed by 1
+
+/**
+ * @brief Options of one transfer. A field of 0 means the option is absent.
+ */
+typedef struct tftp_options {
+    int blksize;    ///< Payload bytes per DATA block (RFC 2348)
+    int windowsize; ///< DATA blocks sent per ACK (RFC 7440)
+    int rollover;   ///< Block number wrap-around, one of the ROLLOVER_* values
+    int has_tsize;  ///< tsize present (its value may be 0)
+    uint64_t tsize; ///< Transfer size in bytes (RFC 2349): 0 in a request, the file size in the OACK
+    uint64_t offset; ///< RRQ range: first byte of the file to send
+    uint64_t length; ///< RRQ range: bytes to send from offset, 0 for the rest of the file
+    uint64_t resume; ///< Resume offset: bytes the receiver already holds (see tftp_options.c)
+    int has_prefixcrc;  ///< prefixcrc present
+    uint32_t prefixcrc; ///< CRC-32C of the first resume bytes of the file
+    int check;          ///< Per-block check, one of the CHECK_* values
+    int digest;         ///< Whole-file digest, one of the DIGEST_* values
+    int compress;       ///< Block compression, one of the COMPRESS_* values
+} tftp_options;
+
+/**
+ * @brief Tells whether any option is set.
+ * @param opts Options to inspect.
+ * @return Non-zero if at least one option is present.
+ */
+int options_present(const tftp_options *opts);
+
+/**
+ * @brief Parses "name\0value\0" pairs, ignoring unknown or malformed options.
+ * @param p First option name.
+ * @param len Number of bytes available from p.
+ * @param opts Receives the recognized options (cleared first).
+ * @return Number of recognized options.
+ */
+int options_parse(const char *p, int len, tftp_options *opts);
+
+/**
+ * @brief Appends the present options as "name\0value\0" pairs.
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param opts Options to write.
+ * @return Number of bytes written, or -1 if the buffer is too small.
+ */
+int options_build(unsigned char *buf, int size, const tftp_options *opts);
+
+/**
+ * @brief Builds an RRQ/WRQ packet, appending mode and options when any are set.
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param opcode OP_RRQ or OP_WRQ.
+ * @param filename Requested file name.
+ * @param opts Options to request (may be NULL).
+ * @return Packet length, or -1 if the buffer is too small.
+ */
+int request_build(unsigned char *buf, int size, int opcode, const char *filename, const tftp_options *opts);
+
+/**
+ * @brief Splits a received request into filename and options.
+ * @param buf Request packet, NUL terminated at buf[n].
+ * @param n Length of the packet.
+ * @param opts Receives the requested options.
+ * @return Pointer to the filename inside buf.
+ */
+char *request_parse(unsigned char *buf, int n, tftp_options *opts);
+
+/**
+ * @brief Builds an OACK packet listing the accepted options.
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param opts Accepted options.
+ * @return Packet length, or -1 if the buffer is too small.
+ */
+int oack_build(unsigned char *buf, int size, const tftp_options *opts);
+
+/**
+ * @brief Name of a per-block check as sent in the "check" option.
+ * @param check One of the CHECK_* values (CHECK_ABSENT is CRC-8).
+ * @return "none", "crc8", "crc32c" or "xxh64".
+ */
+const char *check_name(int check);
+
+/**
+ * @brief Looks up a per-block check by name.
+ * @param name "none", "crc8", "crc32c" or "xxh64" (case-insensitive).
+ * @return The CHECK_* value, or CHECK_ABSENT if the name is unknown.
+ */
+int check_find(const char *name);
+
+/**
+ * @brief Maps an absolute block number to the 16-bit number sent on the wire.
+ * @param block Absolute block number (1 = first block; 0 = before the first block).
+ * @param wrap_to Block number following 65535 (0 or 1).
+ * @return The wire block number.
+ */
+uint16_t block_to_wire(uint64_t block, int wrap_to);
+
+/**
+ * @brief Forward distance from an absolute block to the next block carrying a wire number.
+ * @param from Absolute block number to count from.
+ * @param wire Block number received on the wire.
+ * @param wrap_to Block number following 65535 (0 or 1).
+ * @return Number of blocks from @p from to that block (0 if it is @p from itself).
+ */
+uint64_t block_distance(uint64_t from, uint16_t wire, int wrap_to);
+
+#endif // TFTP_OPTIONS_H
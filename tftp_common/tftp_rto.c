@@ -0,0 +1,137 @@
+/**
+ * @file tftp_rto.c
+ * @brief RFC 6298 round-trip estimation with exponential backoff.
+ *
+ * Replaces the fixed 1 s / 3 s timeouts: on a LAN the timeout settles near
+ * RTO_MIN_MS, so a lost packet costs a fraction of a second, while a slow
+ * path still gets a timeout above its round-trip time.
+ */
+
+#include "tftp_rto.h"
+#include <time.h>
+
+/**
+ * @brief Reset an estimator to the initial timeout.
+ *
+ * @param r Estimator.
+ */
+void rto_init(tftp_rto *r) {
+    r->srtt_us = 0;
+    r->rttvar_us = 0;
+    r->rtt_us = 0;
+    r->rto_ms = RTO_INITIAL_MS;
+    r->timed_seq = 0;
+    r->timed_at_us = 0;
+}
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return uint64_t Microseconds since an arbitrary point.
+ */
+uint64_t rto_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Start timing a packet sent for the first time.
+ *
+ * Only one packet is timed at a time, as in TCP without timestamps.
+ *
+ * @param r Estimator.
+ * @param seq Sequence number of the packet.
+ */
+void rto_start(tftp_rto *r, uint64_t seq) {
+    if (r->timed_at_us)
+        return;
+    r->timed_seq = seq;
+    r->timed_at_us = rto_now_us();
+}
+
+/**
+ * @brief Drop the measurement when the timed packet is sent again.
+ *
+ * The answer could then belong to either transmission (Karn's algorithm).
+ *
+ * @param r Estimator.
+ * @param seq Sequence number of the retransmitted packet.
+ */
+void rto_resent(tftp_rto *r, uint64_t seq) {
+    if (r->timed_at_us && seq <= r->timed_seq)
+        r->timed_at_us = 0;
+}
+
+/**
+ * @brief Update SRTT, RTTVAR and the timeout with a new sample.
+ *
+ * @param r Estimator.
+ * @param rtt Round-trip time in microseconds.
+ */
+static void rto_update(tftp_rto *r, uint32_t rtt) {
+    if (r->srtt_us == 0) {
+        // first measurement (RFC 6298 2.2)
+        r->srtt_us = rtt ? rtt : 1;
+        r->rttvar_us = rtt / 2;
+    } else {
+        // RTTVAR first, it uses the old SRTT (RFC 6298 2.3): beta = 1/4, alpha = 1/8
+        uint32_t delta = rtt > r->srtt_us ? rtt - r->srtt_us : r->srtt_us - rtt;
+        r->rttvar_us = r->rttvar_us - r->rttvar_us / 4 + delta / 4;
+        r->srtt_us = r->srtt_us - r->srtt_us / 8 + rtt / 8;
+        if (r->srtt_us == 0)
+            r->srtt_us = 1;
+    }
+
+    uint32_t var = 4 * r->rttvar_us;
+    uint64_t rto_us = (uint64_t)r->srtt_us + (var > RTO_CLOCK_US ? var : RTO_CLOCK_US);
+    uint64_t rto_ms = (rto_us + 999) / 1000;
+    if (rto_ms < RTO_MIN_MS)
+        rto_ms = RTO_MIN_MS;
+    if (rto_ms > RTO_MAX_MS)
+        rto_ms = RTO_MAX_MS;
+    r->rto_ms = (uint32_t)rto_ms;
+}
+
+/**
+ * @brief Take a sample if the timed packet has been answered.
+ *
+ * A new sample also cancels any backoff (RFC 6298 5.7).
+ *
+ * @param r Estimator.
+ * @param seq Highest sequence number answered.
+ * @return int 1 if a sample was taken, 0 otherwise.
+ */
+int rto_ack(tftp_rto *r, uint64_t seq) {
+    if (!r->timed_at_us || seq < r->timed_seq)
+        return 0;
+
+    uint64_t rtt = rto_now_us() - r->timed_at_us;
+    r->timed_at_us = 0;
+    r->rtt_us = rtt > UINT32_MAX ? UINT32_MAX : (uint32_t)rtt;
+    rto_update(r, r->rtt_us);
+    return 1;
+}
+
+/**
+ * @brief Silence after which a receiver acknowledges a partial window.
+ *
+ * @param r Estimator.
+ * @return uint32_t SRTT / 4, within [ACK_DELAY_MIN_US, ACK_DELAY_MAX_US].
+ */
+uint32_t rto_ack_delay_us(const tftp_rto *r) {
+    uint32_t delay = r->srtt_us ? r->srtt_us / 4 : ACK_DELAY_MAX_US;
+    if (delay < ACK_DELAY_MIN_US)
+        return ACK_DELAY_MIN_US;
+    return delay > ACK_DELAY_MAX_US ? ACK_DELAY_MAX_US : delay;
+}
+
+/**
+ * @brief Back off after the timeout expired (RFC 6298 5.5).
+ *
+ * @param r Estimator.
+ */
+void rto_backoff(tftp_rto *r) {
+    r->rto_ms = r->rto_ms * 2 > RTO_MAX_MS ? RTO_MAX_MS : r->rto_ms * 2;
+    r->timed_at_us = 0;
+}
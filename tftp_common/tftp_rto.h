@@ -0,0 +1,88 @@
+/**
+ * @file tftp_rto.h
+ * @brief Retransmission timeout estimation (RFC 6298) shared by the TFTP client and server.
+ *
+ * Each transfer times one packet at a time: the time from its first
+ * transmission to the packet answering it (ACK or next DATA) is a round-trip
+ * sample. Samples smooth SRTT and RTTVAR; the timeout is
+ * SRTT + max(G, 4 * RTTVAR), kept within [RTO_MIN_MS, RTO_MAX_MS] and
+ * doubled on every expiry. Retransmitted packets are never timed (Karn).
+ */
+
+#ifndef TFTP_RTO_H
+#define TFTP_RTO_H
+
+#include <stdint.h>
+
+#define RTO_INITIAL_MS 1000   // timeout before the first sample (RFC 6298 2.1)
+#define RTO_MIN_MS     200    // lower bound, keeps delayed peers from spurious resends
+#define RTO_MAX_MS     10000  // upper bound of the backed-off timeout
+#define RTO_CLOCK_US   1000   // G: granularity of the deadlines (milliseconds)
+#define ACK_DELAY_MIN_US 100   // shortest silence before a receiver acknowledges a partial window
+#define ACK_DELAY_MAX_US 2000  // longest, and the delay before the first sample
+
+/**
+ * @brief Round-trip estimator and timeout of one transfer.
+ */
+typedef struct tftp_rto {
+    uint32_t srtt_us;     ///< Smoothed round-trip time, 0 before the first sample
+    uint32_t rttvar_us;   ///< Round-trip time variation
+    uint32_t rtt_us;      ///< Last sample
+    uint32_t rto_ms;      ///< Current timeout, including backoff
+    uint64_t timed_seq;   ///< Sequence number being timed
+    uint64_t timed_at_us; ///< First transmission of timed_seq, 0 if nothing is timed
+} tftp_rto;
+
+/**
+ * @brief Resets an estimator to RTO_INITIAL_MS with nothing timed.
+ * @param r Estimator.
+ */
+void rto_init(tftp_rto *r);
+
+/**
+ * @brief Monotonic clock in microseconds.
+ */
+uint64_t rto_now_us(void);
+
+/**
+ * @brief Starts timing seq unless another packet is being timed.
+ * @param r Estimator.
+ * @param seq Sequence number of a packet sent for the first time.
+ */
+void rto_start(tftp_rto *r, uint64_t seq);
+
+/**
+ * @brief Stops timing if seq, or a packet before it, is sent again.
+ * @param r Estimator.
+ * @param seq Sequence number of a retransmitted packet.
+ */
+void rto_resent(tftp_rto *r, uint64_t seq);
+
+/**
+ * @brief Takes a sample when the answer covering the timed packet arrives.
+ * @param r Estimator.
+ * @param seq Highest sequence number answered.
+ * @return 1 if a sample was taken (r->rtt_us holds it), 0 otherwise.
+ */
+int rto_ack(tftp_rto *r, uint64_t seq);
+
+/**
+ * @brief Silence after which a receiver acknowledges the blocks it holds short of a window.
+ *
+ * A quarter of SRTT, within [ACK_DELAY_MIN_US, ACK_DELAY_MAX_US]: a sender
+ * with more than a few blocks of cwnd paces them closer together than
+ * that, so the silence means it stopped at its congestion window and waits
+ * for an ACK (an early one only slides the window a little sooner).
+ *
+ * @param r Estimator of the receiving transfer.
+ * @return Microseconds.
+ */
+uint32_t rto_ack_delay_us(const tftp_rto *r);
+
+/**
+ * @brief Doubles the timeout after it expired and stops timing.
+ * @param r Estimator.
+ */
+void rto_backoff(tftp_rto *r);
+
+#endif // TFTP_RTO_H
@@ -0,0 +1,267 @@
+/**
+ * @file tftp_sha256.c
+ * @brief Streaming SHA-256 (FIPS 180-4) shared by the TFTP client and server.
+ *
+ * Two bit-exact block functions:
+ *   - sha256_blocks_portable: the reference round function in plain C.
+ *   - sha256_blocks_shani:    the x86 SHA extensions (sha256rnds2, sha256msg1/2),
+ *                             two rounds per instruction.
+ *
+ * The fastest one for the running CPU is picked once before main();
+ * TFTP_SHA256=portable forces the plain C one, e.g. for benchmarking.
+ */
+
+#include "tftp_sha256.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA256_HAVE_SHANI 1
+#endif
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+static inline uint32_t ror32(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+/**
+ * @brief Hash whole 64-byte blocks with the reference round function.
+ *
+ * @param state Chaining value, updated.
+ * @param data Input blocks.
+ * @param blocks Number of 64-byte blocks.
+ */
+static void sha256_blocks_portable(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    uint32_t w[64];
+
+    for (; blocks > 0; blocks--, data += 64) {
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)data[4 * i] << 24 | data[4 * i + 1] << 16 | data[4 * i + 2] << 8 | data[4 * i + 3];
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+            uint32_t t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA256_HAVE_SHANI
+
+/**
+ * @brief Hash whole 64-byte blocks with the SHA extensions.
+ *
+ * The state is kept as the ABEF / CDGH register pair sha256rnds2 works on;
+ * each group of four rounds extends the message schedule by four words.
+ *
+ * @param state Chaining value, updated.
+ * @param data Input blocks.
+ * @param blocks Number of 64-byte blocks.
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);   // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);                                    // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                         // CDGH
+
+    for (; blocks > 0; blocks--, data += 64) {
+        __m128i abef = state0, cdgh = state1;
+        __m128i w[4];
+
+        // unrolled, so the schedule stays in registers
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            __m128i m;
+            if (g < 4) {
+                m = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)), swap);
+            } else {
+                m = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+                m = _mm_add_epi32(m, _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+                m = _mm_sha256msg2_epu32(m, w[(g + 3) & 3]);
+            }
+            w[g & 3] = m;
+
+            __m128i k = _mm_add_epi32(m, _mm_loadu_si128((const __m128i *)&sha256_k[4 * g]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, k);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(k, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);        // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);     // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);     // HGFE
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+/**
+ * @brief Tell whether the CPU has the SHA extensions.
+ *
+ * @return int Non-zero if sha256_blocks_shani() can be used.
+ */
+static int sha256_shani_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+}
+
+#else
+
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    sha256_blocks_portable(state, data, blocks);
+}
+
+static int sha256_shani_supported(void) {
+    return 0;
+}
+
+#endif // SHA256_HAVE_SHANI
+
+static sha256_blocks_fn sha256_blocks = sha256_blocks_portable;
+static const char *sha256_blocks_name = "portable";
+
+/**
+ * @brief Pick the block function for the running CPU.
+ *
+ * Runs automatically before main().
+ */
+__attribute__((constructor))
+static void sha256_pick(void) {
+    if (sha256_shani_supported()) {
+        sha256_blocks = sha256_blocks_shani;
+        sha256_blocks_name = "shani";
+    }
+
+    // Optional override, e.g. TFTP_SHA256=portable
+    const char *force = getenv("TFTP_SHA256");
+    if (force && strcmp(force, "portable") == 0) {
+        sha256_blocks = sha256_blocks_portable;
+        sha256_blocks_name = "portable";
+    }
+}
+
+/**
+ * @brief Start a new SHA-256 computation.
+ *
+ * @param c State to initialize.
+ */
+void sha256_init(tftp_sha256 *c) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(c->state, iv, sizeof(iv));
+    c->length = 0;
+    c->used = 0;
+}
+
+/**
+ * @brief Hash more data.
+ *
+ * Whole blocks are hashed straight from the caller's buffer; only the
+ * bytes around them go through the state's block buffer.
+ *
+ * @param c State.
+ * @param data Pointer to input data buffer.
+ * @param len Length of the input buffer.
+ */
+void sha256_update(tftp_sha256 *c, const void *data, size_t len) {
+    const uint8_t *p = data;
+    c->length += len;
+
+    if (c->used > 0) {
+        size_t n = 64 - c->used < len ? 64 - c->used : len;
+        memcpy(c->block + c->used, p, n);
+        c->used += n;
+        p += n;
+        len -= n;
+        if (c->used < 64)
+            return;
+        sha256_blocks(c->state, c->block, 1);
+        c->used = 0;
+    }
+    if (len >= 64) {
+        sha256_blocks(c->state, p, len / 64);
+        p += len & ~(size_t)63;
+        len &= 63;
+    }
+    if (len > 0) {
+        memcpy(c->block, p, len);
+        c->used = len;
+    }
+}
+
+/**
+ * @brief Finish the computation: pad, append the bit length and output the digest.
+ *
+ * @param c State.
+ * @param out Receives the SHA256_SIZE digest bytes.
+ */
+void sha256_final(tftp_sha256 *c, uint8_t out[SHA256_SIZE]) {
+    uint64_t bits = c->length * 8;
+
+    c->block[c->used++] = 0x80;
+    if (c->used > 56) {
+        memset(c->block + c->used, 0, 64 - c->used);
+        sha256_blocks(c->state, c->block, 1);
+        c->used = 0;
+    }
+    memset(c->block + c->used, 0, 56 - c->used);
+    for (int i = 0; i < 8; i++)
+        c->block[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256_blocks(c->state, c->block, 1);
+
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = c->state[i] >> 24;
+        out[4 * i + 1] = c->state[i] >> 16;
+        out[4 * i + 2] = c->state[i] >> 8;
+        out[4 * i + 3] = c->state[i];
+    }
+}
+
+/**
+ * @brief Name of the block function selected at startup.
+ *
+ * @return const char* "shani" or "portable".
+ */
+const char *sha256_impl_name(void) {
+    return sha256_blocks_name;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file tftp_sha256.h
+ * @brief Streaming SHA-256 for the whole-file digest of a transfer.
+ *
+ * The digest is fed block by block as DATA is sent or received, so the
+ * sender and the receiver can compare the whole stream at the end of a
+ * transfer without reading the file a second time. The SHA extensions
+ * (SHA-NI) are used when the CPU has them, picked once at program start.
+ */
+
+#ifndef TFTP_SHA256_H
+#define TFTP_SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_SIZE 32   // digest bytes
+
+/**
+ * @brief State of a SHA-256 computation.
+ */
+typedef struct tftp_sha256 {
+    uint32_t state[8];   ///< Chaining value
+    uint64_t length;     ///< Bytes hashed so far
+    uint8_t block[64];   ///< Bytes waiting for a full 64-byte block
+    size_t used;         ///< Bytes in block
+} tftp_sha256;
+
+/**
+ * @brief Starts a new SHA-256 computation.
+ * @param c State to initialize.
+ */
+void sha256_init(tftp_sha256 *c);
+
+/**
+ * @brief Hashes more data.
+ * @param c State.
+ * @param data Pointer to the data buffer (may be NULL when len is 0).
+ * @param len Length of the data.
+ */
+void sha256_update(tftp_sha256 *c, const void *data, size_t len);
+
+/**
+ * @brief Finishes the computation; the state must be initialized again before reuse.
+ * @param c State.
+ * @param out Receives the SHA256_SIZE digest bytes.
+ */
+void sha256_final(tftp_sha256 *c, uint8_t out[SHA256_SIZE]);
+
+/**
+ * @brief Name of the block function used: "shani" or "portable".
+ */
+const char *sha256_impl_name(void);
+
+#endif // TFTP_SHA256_H
@@ -0,0 +1,235 @@
+/**
+ * @file tftp_backup.c
+ * @brief Asynchronous backups of uploaded files.
+ *
+ * Finished uploads are queued to a single background thread so that the
+ * event loop never waits for a backup. A backup is a FICLONE reflink when the
+ * filesystem supports it (no data is copied), otherwise copy_file_range()
+ * copies the file inside the kernel, with a read/write loop as last resort.
+ * The queue is bounded; when it is full the backup is dropped and counted
+ * rather than made on the caller (the commit thread, whose next group commit
+ * would wait for the copy).
+ */
+
+#include "tftp_backup.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int running;
+    int stopping;
+    int head;                                 ///< Next entry to back up
+    int count;                                ///< Entries in the queue
+    char names[BACKUP_QUEUE_SIZE][256];
+} backup_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static tftp_backup_stats backup_stats;
+
+#define BACKUP_STAT_ADD(field, n) __atomic_fetch_add(&backup_stats.field, (n), __ATOMIC_RELAXED)
+#define BACKUP_STAT_GET(field) __atomic_load_n(&backup_stats.field, __ATOMIC_RELAXED)
+
+/**
+ * @brief Copy the contents of one file descriptor to another.
+ *
+ * @param src Source, positioned at offset 0.
+ * @param dst Destination, empty.
+ * @return int 0 on success, -1 on error.
+ */
+static int copy_fd(int src, int dst) {
+    ssize_t n;
+
+    // in-kernel copy, no data passes through user space
+    while ((n = copy_file_range(src, NULL, dst, NULL, 1 << 30, 0)) > 0)
+        ;
+    if (n == 0)
+        return 0;
+    if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+        return -1;
+
+    // copy_file_range() unsupported here: plain copy from wherever it stopped
+    char buf[65536];
+    while ((n = read(src, buf, sizeof(buf))) > 0) {
+        if (write(dst, buf, n) != n)
+            return -1;
+    }
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Creates a backup copy of a file inside the "backup" folder.
+ *
+ * Tries a reflink first, then an in-kernel copy.
+ *
+ * @param filename Name of the file to back up.
+ * @return int 0 on success, -1 on error.
+ */
+int backup_file(const char *filename) {
+    // Create backup directory if it doesn't exist
+    if (mkdir(BACKUP_DIR, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create BACKUP directory");
+        BACKUP_STAT_ADD(failed, 1);
+        return -1;
+    }
+
+    char backup_path[512];
+    snprintf(backup_path, sizeof(backup_path), "%s/%s", BACKUP_DIR, filename);
+
+    int src = open(filename, O_RDONLY);
+    if (src < 0) {
+        perror("Backup: cannot open source file");
+        BACKUP_STAT_ADD(failed, 1);
+        return -1;
+    }
+
+    int dst = open(backup_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst < 0) {
+        perror("Backup: cannot open backup file");
+        close(src);
+        BACKUP_STAT_ADD(failed, 1);
+        return -1;
+    }
+
+    int ret = 0;
+    if (ioctl(dst, FICLONE, src) == 0) {
+        BACKUP_STAT_ADD(cloned, 1);
+    } else if (copy_fd(src, dst) == 0) {
+        BACKUP_STAT_ADD(copied, 1);
+    } else {
+        perror("Backup: copy failed");
+        BACKUP_STAT_ADD(failed, 1);
+        ret = -1;
+    }
+
+    close(src);
+    close(dst);
+    if (ret == 0)
+        printf("Backup created: %s\n", backup_path);
+    return ret;
+}
+
+/**
+ * @brief Body of the backup thread: back up queued files until stopped.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void *backup_main(void *arg) {
+    (void)arg;
+    char name[256];
+
+    pthread_mutex_lock(&backup_queue.lock);
+    while (1) {
+        while (backup_queue.count == 0 && !backup_queue.stopping)
+            pthread_cond_wait(&backup_queue.wake, &backup_queue.lock);
+        if (backup_queue.count == 0)
+            break; // stopping and drained
+
+        memcpy(name, backup_queue.names[backup_queue.head], sizeof(name));
+        backup_queue.head = (backup_queue.head + 1) % BACKUP_QUEUE_SIZE;
+        backup_queue.count--;
+        pthread_mutex_unlock(&backup_queue.lock);
+
+        backup_file(name);
+        BACKUP_STAT_ADD(pending, -1);
+
+        pthread_mutex_lock(&backup_queue.lock);
+    }
+    pthread_mutex_unlock(&backup_queue.lock);
+    return NULL;
+}
+
+/**
+ * @brief Start the backup thread.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int backup_start(void) {
+    int err = pthread_create(&backup_queue.thread, NULL, backup_main, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create backup: %s\n", strerror(err));
+        return -1;
+    }
+    backup_queue.running = 1;
+    return 0;
+}
+
+/**
+ * @brief Queue a backup of a finished upload.
+ *
+ * Called from the commit thread once an upload is in place. When the queue
+ * is full (or the backup thread is not running) the backup is dropped: the
+ * caller never copies a file itself.
+ *
+ * @param filename Name of the file to back up.
+ */
+void backup_enqueue(const char *filename) {
+    pthread_mutex_lock(&backup_queue.lock);
+    if (!backup_queue.running || backup_queue.stopping || backup_queue.count == BACKUP_QUEUE_SIZE) {
+        pthread_mutex_unlock(&backup_queue.lock);
+        BACKUP_STAT_ADD(dropped, 1);
+        fprintf(stderr, "Backup queue full, no backup of '%s'\n", filename);
+        return;
+    }
+
+    int tail = (backup_queue.head + backup_queue.count) % BACKUP_QUEUE_SIZE;
+    snprintf(backup_queue.names[tail], sizeof(backup_queue.names[tail]), "%s", filename);
+    backup_queue.count++;
+    BACKUP_STAT_ADD(queued, 1);
+    BACKUP_STAT_ADD(pending, 1);
+    pthread_cond_signal(&backup_queue.wake);
+    pthread_mutex_unlock(&backup_queue.lock);
+}
+
+/**
+ * @brief Let the backup thread finish the queued backups, then join it.
+ */
+void backup_stop(void) {
+    if (!backup_queue.running)
+        return;
+
+    pthread_mutex_lock(&backup_queue.lock);
+    backup_queue.stopping = 1;
+    pthread_cond_signal(&backup_queue.wake);
+    pthread_mutex_unlock(&backup_queue.lock);
+
+    pthread_join(backup_queue.thread, NULL);
+    backup_queue.running = 0;
+}
+
+/**
+ * @brief Snapshot the backup counters.
+ *
+ * @param out Receives the counters.
+ */
+void backup_get_stats(tftp_backup_stats *out) {
+    out->queued = BACKUP_STAT_GET(queued);
+    out->cloned = BACKUP_STAT_GET(cloned);
+    out->copied = BACKUP_STAT_GET(copied);
+    out->failed = BACKUP_STAT_GET(failed);
+    out->dropped = BACKUP_STAT_GET(dropped);
+    out->pending = BACKUP_STAT_GET(pending);
+}
+
+/**
+ * @brief Print the backup counters on one line.
+ */
+void backup_print_stats(void) {
+    printf("backups: queued %llu, cloned %llu, copied %llu, failed %llu, dropped %llu, pending %llu\n",
+           (unsigned long long)BACKUP_STAT_GET(queued), (unsigned long long)BACKUP_STAT_GET(cloned),
+           (unsigned long long)BACKUP_STAT_GET(copied), (unsigned long long)BACKUP_STAT_GET(failed),
+           (unsigned long long)BACKUP_STAT_GET(dropped), (unsigned long long)BACKUP_STAT_GET(pending));
+    fflush(stdout);
+}
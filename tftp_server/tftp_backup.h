@@ -0,0 +1,61 @@
+/**
+ * @file tftp_backup.h
+ * @brief Background copies of uploaded files into the "backup" directory.
+ */
+
+#ifndef TFTP_BACKUP_H
+#define TFTP_BACKUP_H
+
+#include <stdint.h>
+
+#define BACKUP_DIR        "backup"
+#define BACKUP_QUEUE_SIZE 64   // uploads waiting for their backup
+
+/**
+ * @brief Counters of the backup thread, updated with atomic adds.
+ */
+typedef struct tftp_backup_stats {
+    uint64_t queued;     ///< Backups handed to the backup thread
+    uint64_t cloned;     ///< Backups made with a FICLONE reflink
+    uint64_t copied;     ///< Backups made with copy_file_range() or read/write
+    uint64_t failed;     ///< Backups that could not be made
+    uint64_t dropped;    ///< Backups not made because the queue was full
+    uint64_t pending;    ///< Backups waiting in the queue
+} tftp_backup_stats;
+
+/**
+ * @brief Starts the backup thread.
+ * @return 0 on success, -1 on error.
+ */
+int backup_start(void);
+
+/**
+ * @brief Queues a backup of a file; drops it when the queue is full.
+ * @param filename Name of the file to back up.
+ */
+void backup_enqueue(const char *filename);
+
+/**
+ * @brief Finishes the queued backups and stops the backup thread.
+ */
+void backup_stop(void);
+
+/**
+ * @brief Creates a backup copy of a given file in the "backup" directory now.
+ * @param filename Name of the file to back up.
+ * @return 0 on success, -1 on error.
+ */
+int backup_file(const char *filename);
+
+/**
+ * @brief Snapshots the backup counters.
+ * @param out Receives the counters.
+ */
+void backup_get_stats(tftp_backup_stats *out);
+
+/**
+ * @brief Prints the backup counters on one line.
+ */
+void backup_print_stats(void);
+
+#endif // TFTP_BACKUP_H
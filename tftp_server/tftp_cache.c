@@ -0,0 +1,716 @@
+/**
+ * @file tftp_cache.c
+ * @brief Size-bounded LRU cache of downloaded files with precomputed CRCs.
+ *
+ * A few files (boot images, configs) make up most downloads. A cached file
+ * is kept whole in memory, so a download from the cache neither opens nor
+ * reads the file: DATA packets are gathered straight from the entry. Entries
+ * are shared by all workers under one mutex that is only held for lookups
+ * and list updates.
+ *
+ * The event loops never read a file or scan an entry for the cache: that
+ * work is queued to the cache thread. A file is admitted only once it has
+ * missed CACHE_ADMIT_HITS times (a file downloaded once is not worth its
+ * memory), and the downloads until it is loaded are served from disk. An
+ * entry gets the CRC-8 of every block for a blksize when a CRC-8 download
+ * first asks for it, and for downloads with the compress option the LZ4
+ * frame of each block, so a hot file is checksummed and compressed once
+ * rather than once per transfer. Until a table is ready, downloads compute
+ * their checks and frames per packet.
+ */
+
+#include "tftp_cache.h"
+#include "tftp_crc.h"
+#include "tftp_compress.h"
+#include "tftp_options.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+enum { CACHE_JOB_FILL, CACHE_JOB_CRCS, CACHE_JOB_FRAMES };
+
+/**
+ * @brief Work queued for the cache thread.
+ */
+typedef struct cache_job {
+    int kind;                    ///< CACHE_JOB_*
+    int blksize;                 ///< CRCS, FRAMES: block size of the table to build
+    char path[256];              ///< FILL: file to load
+    tftp_cache_entry *e;         ///< CRCS, FRAMES: entry to complete, referenced by the job
+} cache_job;
+
+/**
+ * @brief A file that missed recently, counted towards its admission.
+ */
+typedef struct cache_seen {
+    uint32_t hash;               ///< FNV-1a of the path
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    int misses;                  ///< Misses of this version of the file
+} cache_seen;
+
+static struct {
+    pthread_mutex_t lock;
+    size_t max_bytes;                          ///< Size bound, 0 when disabled
+    size_t used;                               ///< Bytes charged by the entries in the cache
+    tftp_cache_entry *buckets[CACHE_BUCKETS];
+    tftp_cache_entry *lru_head;                ///< Most recently used
+    tftp_cache_entry *lru_tail;                ///< Next to evict
+    cache_seen seen[CACHE_SEEN_SLOTS];         ///< Recent misses, by path hash
+    pthread_cond_t wake;
+    pthread_t thread;
+    int running;
+    int stopping;
+    int head;                                  ///< Next job
+    int count;                                 ///< Jobs in the queue
+    cache_job jobs[CACHE_QUEUE_SIZE];
+} cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static tftp_cache_stats cache_stats;
+
+#define CACHE_STAT_ADD(field, n) __atomic_fetch_add(&cache_stats.field, (n), __ATOMIC_RELAXED)
+#define CACHE_STAT_SUB(field, n) __atomic_fetch_sub(&cache_stats.field, (n), __ATOMIC_RELAXED)
+#define CACHE_STAT_GET(field) __atomic_load_n(&cache_stats.field, __ATOMIC_RELAXED)
+
+/**
+ * @brief Set the size bound of the cache.
+ *
+ * @param max_bytes Largest memory used by cached files and CRCs, 0 disables the cache.
+ */
+void cache_configure(size_t max_bytes) {
+    pthread_mutex_lock(&cache.lock);
+    cache.max_bytes = max_bytes;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * @brief Hash a path (FNV-1a).
+ *
+ * @param path File name.
+ * @return uint32_t Hash.
+ */
+static uint32_t cache_hash(const char *path) {
+    uint32_t h = 2166136261u;
+    while (*path) {
+        h ^= (unsigned char)*path++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static unsigned cache_bucket(const char *path) {
+    return cache_hash(path) % CACHE_BUCKETS;
+}
+
+/**
+ * @brief Tell whether an entry still matches the file on disk.
+ *
+ * @param e Entry.
+ * @param st Current stat of the file.
+ * @return int Non-zero if the file is unchanged.
+ */
+static int cache_matches(const tftp_cache_entry *e, const struct stat *st) {
+    return e->dev == st->st_dev && e->ino == st->st_ino && e->size == st->st_size &&
+           e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Free an entry and its CRC tables.
+ *
+ * @param e Entry no longer referenced nor linked.
+ */
+static void cache_free(tftp_cache_entry *e) {
+    while (e->crcs) {
+        tftp_cache_crcs *t = e->crcs;
+        e->crcs = t->next;
+        free(t->crc);
+        free(t);
+    }
+    while (e->frames) {
+        tftp_cache_frames *f = e->frames;
+        e->frames = f->next;
+        free(f->data);
+        free(f->offset);
+        free(f);
+    }
+    free(e->data);
+    free(e);
+}
+
+static void lru_unlink(tftp_cache_entry *e) {
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache.lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache.lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(tftp_cache_entry *e) {
+    e->lru_next = cache.lru_head;
+    if (cache.lru_head)
+        cache.lru_head->lru_prev = e;
+    cache.lru_head = e;
+    if (!cache.lru_tail)
+        cache.lru_tail = e;
+}
+
+/**
+ * @brief Remove an entry from the cache; it is freed now or with its last reference.
+ *
+ * Called with the cache lock held.
+ *
+ * @param e Entry in the cache.
+ */
+static void cache_remove(tftp_cache_entry *e) {
+    tftp_cache_entry **p = &cache.buckets[cache_bucket(e->path)];
+    while (*p != e)
+        p = &(*p)->hash_next;
+    *p = e->hash_next;
+    lru_unlink(e);
+
+    cache.used -= e->bytes;
+    CACHE_STAT_SUB(entries, 1);
+    CACHE_STAT_SUB(bytes, e->bytes);
+    e->evicted = 1;
+    if (e->refs == 0)
+        cache_free(e);
+}
+
+/**
+ * @brief Evict least recently used entries until the cache fits its bound.
+ *
+ * Called with the cache lock held.
+ */
+static void cache_trim(void) {
+    while (cache.used > cache.max_bytes && cache.lru_tail) {
+        cache_remove(cache.lru_tail);
+        CACHE_STAT_ADD(evictions, 1);
+    }
+}
+
+/**
+ * @brief Find the entry of a path, whether it is current or not.
+ *
+ * Called with the cache lock held.
+ *
+ * @param path File name.
+ * @return tftp_cache_entry* The entry, or NULL.
+ */
+static tftp_cache_entry *cache_find(const char *path) {
+    for (tftp_cache_entry *e = cache.buckets[cache_bucket(path)]; e; e = e->hash_next) {
+        if (strcmp(e->path, path) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static const uint8_t *cache_find_crcs(const tftp_cache_entry *e, int blksize) {
+    for (const tftp_cache_crcs *t = e->crcs; t; t = t->next) {
+        if (t->blksize == blksize)
+            return t->crc;
+    }
+    return NULL;
+}
+
+static const tftp_cache_frames *cache_find_frames(const tftp_cache_entry *e, int blksize) {
+    for (const tftp_cache_frames *f = e->frames; f; f = f->next) {
+        if (f->blksize == blksize)
+            return f;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Queue work for the cache thread unless the same job is already queued.
+ *
+ * Called with the cache lock held. The cache is an optimization: when the
+ * queue is full the job is dropped and asked for again by a later download.
+ *
+ * @param kind CACHE_JOB_FILL, CACHE_JOB_CRCS or CACHE_JOB_FRAMES.
+ * @param path FILL: file to load.
+ * @param e CRCS, FRAMES: entry to complete; the job takes a reference.
+ * @param blksize CRCS, FRAMES: block size of the table.
+ */
+static void cache_enqueue(int kind, const char *path, tftp_cache_entry *e, int blksize) {
+    if (!cache.running || cache.stopping || cache.count == CACHE_QUEUE_SIZE) {
+        CACHE_STAT_ADD(dropped, 1);
+        return;
+    }
+    for (int i = 0; i < cache.count; i++) {
+        const cache_job *job = &cache.jobs[(cache.head + i) % CACHE_QUEUE_SIZE];
+        if (job->kind == kind && (kind == CACHE_JOB_FILL ? strcmp(job->path, path) == 0
+                                                         : job->e == e && job->blksize == blksize))
+            return;
+    }
+
+    cache_job *job = &cache.jobs[(cache.head + cache.count) % CACHE_QUEUE_SIZE];
+    job->kind = kind;
+    job->blksize = blksize;
+    job->e = e;
+    if (e)
+        e->refs++;
+    snprintf(job->path, sizeof(job->path), "%s", path ? path : "");
+    cache.count++;
+    pthread_cond_signal(&cache.wake);
+}
+
+/**
+ * @brief Tell whether a file may go in the cache at all.
+ *
+ * @param path File name.
+ * @param st Stat of the file.
+ * @return int Non-zero if the file is small enough to be cached.
+ */
+static int cache_fits(const char *path, const struct stat *st) {
+    return S_ISREG(st->st_mode) && st->st_size > 0 && (size_t)st->st_size <= cache.max_bytes / CACHE_FILE_SHARE &&
+           strlen(path) < sizeof(((tftp_cache_entry *)0)->path);
+}
+
+/**
+ * @brief Count a miss and queue the file to be loaded once it missed often enough.
+ *
+ * A slot only counts the misses of one version of a file: a file that
+ * changed starts over.
+ *
+ * Called with the cache lock held.
+ *
+ * @param path File name.
+ * @param st Current stat of the file.
+ */
+static void cache_admit(const char *path, const struct stat *st) {
+    if (!cache_fits(path, st))
+        return;
+
+    uint32_t h = cache_hash(path);
+    cache_seen *seen = &cache.seen[h % CACHE_SEEN_SLOTS];
+    if (seen->hash != h || seen->dev != st->st_dev || seen->ino != st->st_ino || seen->size != st->st_size ||
+        seen->mtime.tv_sec != st->st_mtim.tv_sec || seen->mtime.tv_nsec != st->st_mtim.tv_nsec) {
+        *seen = (cache_seen){.hash = h, .dev = st->st_dev, .ino = st->st_ino, .size = st->st_size,
+                             .mtime = st->st_mtim};
+    }
+    if (++seen->misses < CACHE_ADMIT_HITS)
+        return;
+    seen->misses = 0;
+    cache_enqueue(CACHE_JOB_FILL, path, NULL, 0);
+}
+
+/**
+ * @brief Compute the CRC of every block of a file for one blksize.
+ *
+ * The table also covers the empty block that ends a file whose size is a
+ * multiple of blksize.
+ *
+ * @param data File contents.
+ * @param size File size.
+ * @param blksize Block size.
+ * @return uint8_t* The table (malloc'd), or NULL on allocation failure.
+ */
+static uint8_t *cache_compute_crcs(const unsigned char *data, off_t size, int blksize) {
+    size_t blocks = size / blksize + 1;
+    uint8_t *crc = malloc(blocks);
+    if (!crc) {
+        perror("malloc");
+        return NULL;
+    }
+    for (size_t i = 0; i < blocks; i++) {
+        off_t offset = (off_t)i * blksize;
+        size_t len = size - offset < blksize ? size - offset : blksize;
+        crc[i] = calculate_crc8(data + offset, len);
+    }
+    return crc;
+}
+
+/**
+ * @brief Attach the CRC table of an entry for a blksize. Runs on the cache thread.
+ *
+ * @param e Entry referenced by the job.
+ * @param blksize Block size.
+ */
+static void cache_build_crcs(tftp_cache_entry *e, int blksize) {
+    uint8_t *crc = cache_compute_crcs(e->data, e->size, blksize);
+    tftp_cache_crcs *t = malloc(sizeof(*t));
+    if (!crc || !t) {
+        free(crc);
+        free(t);
+        return;
+    }
+    t->blksize = blksize;
+    t->crc = crc;
+
+    size_t bytes = sizeof(*t) + e->size / blksize + 1;
+    pthread_mutex_lock(&cache.lock);
+    t->next = e->crcs;
+    e->crcs = t;
+    e->bytes += bytes;
+    if (!e->evicted) {
+        cache.used += bytes;
+        CACHE_STAT_ADD(bytes, bytes);
+        cache_trim();
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * @brief Compress every block of a file for one blksize.
+ *
+ * Like the CRC tables, the frames also cover the empty block that ends a
+ * file whose size is a multiple of blksize.
+ *
+ * @param data File contents.
+ * @param size File size.
+ * @param blksize Block size.
+ * @return tftp_cache_frames* The frames (malloc'd), or NULL on allocation failure.
+ */
+static tftp_cache_frames *cache_compute_frames(const unsigned char *data, off_t size, int blksize) {
+    size_t blocks = size / blksize + 1;
+    tftp_cache_frames *f = calloc(1, sizeof(*f));
+    if (f) {
+        // a frame is at most its block plus the flag
+        f->data = malloc(size + blocks * COMPRESS_FLAG_LEN);
+        f->offset = malloc((blocks + 1) * sizeof(size_t));
+    }
+    if (!f || !f->data || !f->offset) {
+        perror("malloc");
+        if (f) {
+            free(f->data);
+            free(f->offset);
+        }
+        free(f);
+        return NULL;
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < blocks; i++) {
+        off_t offset = (off_t)i * blksize;
+        size_t len = size - offset < blksize ? size - offset : blksize;
+        f->offset[i] = used;
+        used += block_pack(data + offset, len, f->data + used);
+    }
+    f->offset[blocks] = used;
+    f->blksize = blksize;
+
+    unsigned char *shrunk = realloc(f->data, used);
+    if (shrunk)
+        f->data = shrunk;
+    return f;
+}
+
+/**
+ * @brief Attach the compressed frames of an entry for a blksize. Runs on the cache thread.
+ *
+ * @param e Entry referenced by the job.
+ * @param blksize Block size.
+ */
+static void cache_build_frames(tftp_cache_entry *e, int blksize) {
+    tftp_cache_frames *f = cache_compute_frames(e->data, e->size, blksize);
+    if (!f)
+        return;
+
+    size_t blocks = e->size / blksize + 1;
+    size_t bytes = sizeof(*f) + f->offset[blocks] + (blocks + 1) * sizeof(size_t);
+    pthread_mutex_lock(&cache.lock);
+    f->next = e->frames;
+    e->frames = f;
+    e->bytes += bytes;
+    if (!e->evicted) {
+        cache.used += bytes;
+        CACHE_STAT_ADD(bytes, bytes);
+        cache_trim();
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * @brief Get the compressed frames of a referenced entry for a blksize.
+ *
+ * The first download that asks for a blksize queues the compression of the
+ * file and compresses its own blocks as it sends them.
+ *
+ * @param e Referenced entry.
+ * @param blksize Block size.
+ * @return const tftp_cache_frames* The frames, or NULL if they are not built yet.
+ */
+const tftp_cache_frames *cache_get_frames(tftp_cache_entry *e, int blksize) {
+    pthread_mutex_lock(&cache.lock);
+    const tftp_cache_frames *found = cache_find_frames(e, blksize);
+    if (!found)
+        cache_enqueue(CACHE_JOB_FRAMES, NULL, e, blksize);
+    pthread_mutex_unlock(&cache.lock);
+    return found;
+}
+
+/**
+ * @brief Look a file up and take a reference on it.
+ *
+ * An entry that no longer matches the file on disk is dropped. A miss counts
+ * towards loading the file; a hit without the CRC table asked for queues it.
+ *
+ * @param path File name as requested.
+ * @param st Current stat of the file.
+ * @param blksize Block size of the transfer.
+ * @param want_crcs Non-zero if the transfer sends CRC-8s.
+ * @param crcs Set to the CRC table for blksize, NULL if there is none yet.
+ * @return tftp_cache_entry* The entry, or NULL on a miss.
+ */
+tftp_cache_entry *cache_lookup(const char *path, const struct stat *st, int blksize, int want_crcs,
+                               const uint8_t **crcs) {
+    pthread_mutex_lock(&cache.lock);
+    if (cache.max_bytes == 0) {
+        pthread_mutex_unlock(&cache.lock);
+        return NULL;
+    }
+
+    tftp_cache_entry *e = cache_find(path);
+    if (e && !cache_matches(e, st)) {
+        cache_remove(e);
+        e = NULL;
+    }
+    if (!e) {
+        cache_admit(path, st);
+        pthread_mutex_unlock(&cache.lock);
+        CACHE_STAT_ADD(misses, 1);
+        return NULL;
+    }
+    e->refs++;
+    lru_unlink(e);
+    lru_push_front(e);
+    *crcs = want_crcs ? cache_find_crcs(e, blksize) : NULL;
+    if (want_crcs && !*crcs)
+        cache_enqueue(CACHE_JOB_CRCS, NULL, e, blksize);
+    pthread_mutex_unlock(&cache.lock);
+
+    CACHE_STAT_ADD(hits, 1);
+    return e;
+}
+
+/**
+ * @brief Read a whole file.
+ *
+ * @param fd Open file.
+ * @param size Its size.
+ * @return unsigned char* The contents (malloc'd), or NULL on error.
+ */
+static unsigned char *cache_read_file(int fd, off_t size) {
+    unsigned char *data = malloc(size);
+    if (!data) {
+        perror("malloc");
+        return NULL;
+    }
+    off_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, data + done, size - done, done);
+        if (n <= 0) {
+            free(data);
+            return NULL;
+        }
+        done += n;
+    }
+    return data;
+}
+
+/**
+ * @brief Load a file into the cache. Runs on the cache thread.
+ *
+ * The file is read before the lock is taken and stat'ed again afterwards:
+ * contents that changed while being read are not cached.
+ *
+ * @param path File name as requested.
+ */
+static void cache_fill(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    pthread_mutex_lock(&cache.lock);
+    tftp_cache_entry *old = cache_find(path);
+    int skip = fstat(fd, &st) < 0 || !cache_fits(path, &st) || (old && cache_matches(old, &st));
+    pthread_mutex_unlock(&cache.lock);
+    if (skip) {
+        close(fd);
+        return;
+    }
+
+    tftp_cache_entry *e = calloc(1, sizeof(*e));
+    if (!e) {
+        perror("calloc");
+        close(fd);
+        return;
+    }
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->size = st.st_size;
+    e->mtime = st.st_mtim;
+    e->data = cache_read_file(fd, e->size);
+    e->bytes = sizeof(*e) + e->size;
+
+    struct stat after;
+    int changed = fstat(fd, &after) < 0 || !cache_matches(e, &after);
+    close(fd);
+    if (!e->data || changed) {
+        cache_free(e);
+        return;
+    }
+
+    pthread_mutex_lock(&cache.lock);
+    old = cache_find(path);
+    if (old)
+        cache_remove(old);
+
+    unsigned b = cache_bucket(path);
+    e->hash_next = cache.buckets[b];
+    cache.buckets[b] = e;
+    lru_push_front(e);
+    cache.used += e->bytes;
+    CACHE_STAT_ADD(inserts, 1);
+    CACHE_STAT_ADD(entries, 1);
+    CACHE_STAT_ADD(bytes, e->bytes);
+    cache_trim();
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * @brief Body of the cache thread: run queued jobs until stopped.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void *cache_main(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&cache.lock);
+    while (1) {
+        while (cache.count == 0 && !cache.stopping)
+            pthread_cond_wait(&cache.wake, &cache.lock);
+        if (cache.stopping)
+            break;
+
+        // keep the job queued while it runs, so it is not queued twice
+        cache_job job = cache.jobs[cache.head];
+        pthread_mutex_unlock(&cache.lock);
+
+        if (job.kind == CACHE_JOB_FILL)
+            cache_fill(job.path);
+        else if (job.kind == CACHE_JOB_CRCS)
+            cache_build_crcs(job.e, job.blksize);
+        else
+            cache_build_frames(job.e, job.blksize);
+        if (job.e)
+            cache_put(job.e);
+
+        pthread_mutex_lock(&cache.lock);
+        cache.head = (cache.head + 1) % CACHE_QUEUE_SIZE;
+        cache.count--;
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return NULL;
+}
+
+/**
+ * @brief Start the cache thread.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int cache_start(void) {
+    int err = pthread_create(&cache.thread, NULL, cache_main, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create cache: %s\n", strerror(err));
+        return -1;
+    }
+    pthread_mutex_lock(&cache.lock);
+    cache.running = 1;
+    pthread_mutex_unlock(&cache.lock);
+    return 0;
+}
+
+/**
+ * @brief Stop the cache thread once its current job is done.
+ *
+ * Queued jobs are abandoned and their references dropped; the next
+ * downloads queue them again.
+ */
+void cache_stop(void) {
+    if (!cache.running)
+        return;
+
+    pthread_mutex_lock(&cache.lock);
+    cache.stopping = 1;
+    pthread_cond_signal(&cache.wake);
+    pthread_mutex_unlock(&cache.lock);
+    pthread_join(cache.thread, NULL);
+
+    for (; cache.count > 0; cache.count--, cache.head = (cache.head + 1) % CACHE_QUEUE_SIZE) {
+        if (cache.jobs[cache.head].e)
+            cache_put(cache.jobs[cache.head].e);
+    }
+    cache.running = 0;
+}
+
+/**
+ * @brief Drop a reference; an evicted entry is freed with its last one.
+ *
+ * @param e Entry.
+ */
+void cache_put(tftp_cache_entry *e) {
+    pthread_mutex_lock(&cache.lock);
+    int release = --e->refs == 0 && e->evicted;
+    pthread_mutex_unlock(&cache.lock);
+    if (release)
+        cache_free(e);
+}
+
+/**
+ * @brief Drop the entry of a file that is being rewritten or deleted.
+ *
+ * Stat changes already keep a stale entry from being served; this also
+ * covers a rewrite that keeps the size within one mtime tick.
+ *
+ * @param path File name.
+ */
+void cache_invalidate(const char *path) {
+    pthread_mutex_lock(&cache.lock);
+    tftp_cache_entry *e = cache_find(path);
+    if (e)
+        cache_remove(e);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * @brief Snapshot the cache counters.
+ *
+ * @param out Receives the counters.
+ */
+void cache_get_stats(tftp_cache_stats *out) {
+    out->hits = CACHE_STAT_GET(hits);
+    out->misses = CACHE_STAT_GET(misses);
+    out->inserts = CACHE_STAT_GET(inserts);
+    out->dropped = CACHE_STAT_GET(dropped);
+    out->evictions = CACHE_STAT_GET(evictions);
+    out->entries = CACHE_STAT_GET(entries);
+    out->bytes = CACHE_STAT_GET(bytes);
+}
+
+/**
+ * @brief Print the cache counters on one line.
+ */
+void cache_print_stats(void) {
+    printf("cache: hits %llu, misses %llu, inserts %llu, dropped %llu, evictions %llu, entries %llu, bytes %llu\n",
+           (unsigned long long)CACHE_STAT_GET(hits), (unsigned long long)CACHE_STAT_GET(misses),
+           (unsigned long long)CACHE_STAT_GET(inserts), (unsigned long long)CACHE_STAT_GET(dropped),
+           (unsigned long long)CACHE_STAT_GET(evictions),
+           (unsigned long long)CACHE_STAT_GET(entries), (unsigned long long)CACHE_STAT_GET(bytes));
+    fflush(stdout);
+}
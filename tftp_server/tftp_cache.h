@@ -0,0 +1,143 @@
+/**
+ * @file tftp_cache.h
+ * @brief In-memory cache of frequently downloaded files, shared by all workers.
+ */
+
+#ifndef TFTP_CACHE_H
+#define TFTP_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define CACHE_DEFAULT_MB 64   // default size bound of the cache
+#define CACHE_FILE_SHARE 8    // a file is cached only if it fits CACHE_FILE_SHARE times in the cache
+#define CACHE_BUCKETS    256  // hash buckets (by path)
+#define CACHE_ADMIT_HITS 2    // misses of a file before it is loaded into the cache
+#define CACHE_SEEN_SLOTS 1024 // recently missed files counted towards their admission
+#define CACHE_QUEUE_SIZE 64   // loads and tables waiting for the cache thread
+
+/**
+ * @brief CRC-8 of every block of a cached file, for one blksize.
+ */
+typedef struct tftp_cache_crcs {
+    int blksize;                    ///< Block size the file was chunked with
+    uint8_t *crc;                   ///< CRC of block i + 1, including a final empty block
+    struct tftp_cache_crcs *next;   ///< Table for another blksize
+} tftp_cache_crcs;
+
+/**
+ * @brief Compressed frames (tftp_compress.h) of every block of a cached file, for one blksize.
+ */
+typedef struct tftp_cache_frames {
+    int blksize;                    ///< Block size the file was chunked with
+    unsigned char *data;            ///< Frames of every block, back to back, including a final empty block
+    size_t *offset;                 ///< Frame of block i + 1 spans offset[i] to offset[i + 1]
+    struct tftp_cache_frames *next; ///< Frames for another blksize
+} tftp_cache_frames;
+
+/**
+ * @brief One cached file.
+ *
+ * An entry is identified by path, device, inode, size and mtime, so a file
+ * that changed on disk is never served from the cache. Its contents are
+ * immutable; sessions hold a reference while they send from it, and an entry
+ * evicted meanwhile is freed with its last reference.
+ */
+typedef struct tftp_cache_entry {
+    char path[256];
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned char *data;                ///< The whole file
+    tftp_cache_crcs *crcs;              ///< Precomputed CRCs, one table per blksize served
+    tftp_cache_frames *frames;          ///< Compressed blocks, one table per blksize downloaded compressed
+    size_t bytes;                       ///< Memory charged to the cache
+    int refs;                           ///< Sessions sending from the entry
+    int evicted;                        ///< Removed from the cache, freed with the last reference
+    struct tftp_cache_entry *hash_next; ///< Next entry of the hash bucket
+    struct tftp_cache_entry *lru_prev;  ///< More recently used entry
+    struct tftp_cache_entry *lru_next;  ///< Less recently used entry
+} tftp_cache_entry;
+
+/**
+ * @brief Cache counters, updated with atomic adds.
+ */
+typedef struct tftp_cache_stats {
+    uint64_t hits;        ///< Downloads served from the cache
+    uint64_t misses;      ///< Downloads of files not in the cache
+    uint64_t inserts;     ///< Files loaded into the cache
+    uint64_t dropped;     ///< Loads and tables not queued because the queue was full
+    uint64_t evictions;   ///< Entries dropped to stay within the size bound
+    uint64_t entries;     ///< Files currently cached
+    uint64_t bytes;       ///< Memory currently used by the cache
+} tftp_cache_stats;
+
+/**
+ * @brief Sets the size bound of the cache.
+ * @param max_bytes Largest memory used by cached files and CRCs, 0 disables the cache.
+ */
+void cache_configure(size_t max_bytes);
+
+/**
+ * @brief Starts the cache thread, which loads files and builds their tables.
+ * @return 0 on success, -1 on error.
+ */
+int cache_start(void);
+
+/**
+ * @brief Stops the cache thread; queued loads and tables are abandoned.
+ */
+void cache_stop(void);
+
+/**
+ * @brief Looks a file up and takes a reference on it.
+ *
+ * Never reads the file: a miss counts towards loading it on the cache
+ * thread, and a missing CRC table is queued there as well.
+ *
+ * @param path File name as requested.
+ * @param st Current stat of the file.
+ * @param blksize Block size of the transfer.
+ * @param want_crcs Non-zero if the transfer sends CRC-8s.
+ * @param crcs Set to the CRC table for blksize, NULL if there is none yet.
+ * @return The entry, or NULL on a miss.
+ */
+tftp_cache_entry *cache_lookup(const char *path, const struct stat *st, int blksize, int want_crcs,
+                               const uint8_t **crcs);
+
+/**
+ * @brief Gets the compressed frames of a referenced entry for a blksize, queuing them the first time.
+ * @param e Entry referenced by the caller.
+ * @param blksize Block size of the transfer.
+ * @return The frames, valid as long as the reference, or NULL if they are not built yet.
+ */
+const tftp_cache_frames *cache_get_frames(tftp_cache_entry *e, int blksize);
+
+/**
+ * @brief Drops a reference taken by cache_lookup().
+ * @param e Entry.
+ */
+void cache_put(tftp_cache_entry *e);
+
+/**
+ * @brief Drops the entry of a file that is being rewritten or deleted.
+ * @param path File name.
+ */
+void cache_invalidate(const char *path);
+
+/**
+ * @brief Snapshots the cache counters.
+ * @param out Receives the counters.
+ */
+void cache_get_stats(tftp_cache_stats *out);
+
+/**
+ * @brief Prints the cache counters on one line.
+ */
+void cache_print_stats(void);
+
+#endif // TFTP_CACHE_H
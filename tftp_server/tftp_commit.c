@@ -0,0 +1,382 @@
+/**
+ * @file tftp_commit.c
+ * @brief Atomic, durable publication of finished uploads.
+ *
+ * An upload is received into a temporary file next to its final name and
+ * only renamed into place once it is complete and on disk, so an aborted
+ * upload never replaces or truncates the previous file and never gets backed
+ * up. Making a file durable costs a disk flush for its data and one for the
+ * directory holding the new name; a single commit thread batches every upload
+ * finished while the previous batch was being flushed (group commit): one
+ * flush per file system covers the data of the whole batch (syncfs() when
+ * it holds several files) and one directory flush covers all of its
+ * renames. Workers never flush: when the queue is full an upload is refused
+ * and its session keeps it until a slot frees. The outcome of every upload
+ * is published to its session, which only then sends the client the final
+ * ACK.
+ *
+ * An aborted upload is not thrown away: what was received is kept as
+ * <name>.part (without syncing), and a WRQ asking to resume continues in it.
+ */
+
+#include "tftp_commit.h"
+#include "tftp_backup.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/**
+ * @brief A finished upload waiting to be committed.
+ */
+typedef struct commit_item {
+    FILE *file;          ///< Temporary file, fully written
+    char tmp[288];       ///< Temporary name
+    char name[256];      ///< Final name
+    dev_t dev;           ///< File system holding the file
+    int err;             ///< errno of the first step that failed, 0 if none
+    int *status;         ///< Outcome, read by the session that queued the upload
+} commit_item;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int started;                              ///< The commit thread was created
+    int running;                              ///< The commit thread accepts uploads
+    int stopping;
+    int head;                                 ///< Next upload to commit
+    int count;                                ///< Uploads in the queue
+    commit_item items[COMMIT_QUEUE_SIZE];
+} commit_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static tftp_commit_stats commit_stats;
+
+#define COMMIT_STAT_ADD(field, n) __atomic_fetch_add(&commit_stats.field, (n), __ATOMIC_RELAXED)
+#define COMMIT_STAT_GET(field) __atomic_load_n(&commit_stats.field, __ATOMIC_RELAXED)
+
+/**
+ * @brief Create the temporary file an upload is received into.
+ *
+ * The partial upload of a resumed WRQ is renamed over the new temporary
+ * file, so two uploads can never continue the same partial file.
+ *
+ * @param filename Final name of the upload.
+ * @param tmpname Receives the temporary name.
+ * @param size Size of tmpname.
+ * @param partial Receives the bytes already in the file, or NULL for a new upload.
+ * @return FILE* The open file, or NULL on error.
+ */
+FILE *commit_open_temp(const char *filename, char *tmpname, size_t size, uint64_t *partial) {
+    char kept[288];
+    if ((size_t)snprintf(tmpname, size, "%s" UPLOAD_TMP_SUFFIX, filename) >= size ||
+        (size_t)snprintf(kept, sizeof(kept), "%s" UPLOAD_PARTIAL_SUFFIX, filename) >= sizeof(kept))
+        return NULL;
+    int fd = mkstemp(tmpname);
+    if (fd < 0)
+        return NULL;
+    fchmod(fd, 0644); // mkstemp creates files readable by the owner only
+
+    if (!partial) {
+        unlink(kept); // a new upload: an older partial one can no longer be resumed
+    } else {
+        struct stat st;
+        *partial = 0;
+        if (rename(kept, tmpname) == 0) {
+            close(fd);
+            fd = open(tmpname, O_RDWR);
+            if (fd < 0) {
+                unlink(tmpname);
+                return NULL;
+            }
+            if (fstat(fd, &st) == 0)
+                *partial = st.st_size;
+        }
+    }
+
+    FILE *file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(tmpname);
+    }
+    return file;
+}
+
+/**
+ * @brief Keep the received part of an aborted upload for a resume.
+ *
+ * @param file Temporary file; closed here.
+ * @param tmpname Its name.
+ * @param filename Final name of the upload.
+ * @param received Bytes written from the start of the file, 0 to remove it.
+ */
+void commit_keep_partial(FILE *file, const char *tmpname, const char *filename, uint64_t received) {
+    char kept[288];
+    snprintf(kept, sizeof(kept), "%s" UPLOAD_PARTIAL_SUFFIX, filename);
+
+    int ok = received > 0 && fflush(file) == 0 && ftruncate(fileno(file), received) == 0;
+    fclose(file);
+    if (!ok || rename(tmpname, kept) != 0) {
+        unlink(tmpname);
+        return;
+    }
+    COMMIT_STAT_ADD(partial, 1);
+}
+
+/**
+ * @brief Flush the directory holding a file, making a rename in it durable.
+ *
+ * @param path Name of a file in the directory.
+ * @return int 0 on success, -1 on error.
+ */
+static int sync_parent_dir(const char *path) {
+    char dir[256];
+    const char *slash = strrchr(path, '/');
+    if (slash)
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path) + (slash == path), path);
+    else
+        snprintf(dir, sizeof(dir), ".");
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief Tell whether two files are in the same directory.
+ *
+ * @param a Name of a file.
+ * @param b Name of another file.
+ * @return int Non-zero if both names have the same directory part.
+ */
+static int same_dir(const char *a, const char *b) {
+    const char *sa = strrchr(a, '/');
+    const char *sb = strrchr(b, '/');
+    size_t la = sa ? (size_t)(sa - a) : 0;
+    size_t lb = sb ? (size_t)(sb - b) : 0;
+    return la == lb && strncmp(a, b, la) == 0;
+}
+
+/**
+ * @brief Make a batch of finished uploads durable and rename them into place.
+ *
+ * Writeback of every file is started first so the disk sees the batch at
+ * once; one syncfs() per file system then flushes all of them (fsync() for a
+ * single file). The renames follow, then one flush per directory involved.
+ *
+ * @param items Uploads, their files are closed on return.
+ * @param count Number of uploads.
+ */
+static void commit_batch(commit_item *items, int count) {
+    for (int i = 0; i < count; i++) {
+        commit_item *it = &items[i];
+        struct stat st;
+        it->err = 0;
+        if (fflush(it->file) != 0 || fstat(fileno(it->file), &st) != 0) {
+            it->err = errno;
+            continue;
+        }
+        it->dev = st.st_dev;
+        sync_file_range(fileno(it->file), 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+
+    // the first file of each file system flushes it for the others
+    dev_t devs[COMMIT_QUEUE_SIZE];
+    int dev_err[COMMIT_QUEUE_SIZE];
+    int ndevs = 0;
+    for (int i = 0; i < count; i++) {
+        commit_item *it = &items[i];
+        if (it->err)
+            continue;
+        int d = 0;
+        while (d < ndevs && devs[d] != it->dev)
+            d++;
+        if (d == ndevs) {
+            int fd = fileno(it->file);
+            devs[ndevs++] = it->dev;
+            dev_err[d] = (count == 1 ? fsync(fd) : syncfs(fd)) == 0 ? 0 : errno;
+        }
+        it->err = dev_err[d];
+    }
+
+    for (int i = 0; i < count; i++) {
+        commit_item *it = &items[i];
+        if (fclose(it->file) != 0 && !it->err)
+            it->err = errno;
+        if (!it->err && rename(it->tmp, it->name) != 0)
+            it->err = errno;
+        if (it->err) {
+            fprintf(stderr, "Failed to save '%s': %s\n", it->name, strerror(it->err));
+            unlink(it->tmp);
+            it->name[0] = 0;
+            COMMIT_STAT_ADD(failed, 1);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!items[i].name[0])
+            continue;
+        int dir_synced = 0;
+        for (int j = 0; j < i && !dir_synced; j++)
+            dir_synced = items[j].name[0] && same_dir(items[j].name, items[i].name);
+        if (!dir_synced && sync_parent_dir(items[i].name) != 0)
+            perror("Commit: directory sync");
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!items[i].name[0]) {
+            __atomic_store_n(items[i].status, COMMIT_FAILED, __ATOMIC_RELEASE);
+            continue;
+        }
+        COMMIT_STAT_ADD(committed, 1);
+        printf("Received and saved '%s'\n", items[i].name);
+        backup_enqueue(items[i].name);
+        __atomic_store_n(items[i].status, COMMIT_DONE, __ATOMIC_RELEASE);
+    }
+    COMMIT_STAT_ADD(batches, 1);
+}
+
+/**
+ * @brief Body of the commit thread: commit everything queued, batch after batch.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void *commit_main(void *arg) {
+    (void)arg;
+    static commit_item batch[COMMIT_QUEUE_SIZE];
+
+    pthread_mutex_lock(&commit_queue.lock);
+    while (1) {
+        while (commit_queue.count == 0 && !commit_queue.stopping)
+            pthread_cond_wait(&commit_queue.wake, &commit_queue.lock);
+        if (commit_queue.count == 0) {
+            commit_queue.running = 0; // stopping and drained: refuse later uploads
+            break;
+        }
+
+        // everything that finished during the previous flush goes in this batch
+        int count = commit_queue.count;
+        for (int i = 0; i < count; i++)
+            batch[i] = commit_queue.items[(commit_queue.head + i) % COMMIT_QUEUE_SIZE];
+        commit_queue.head = (commit_queue.head + count) % COMMIT_QUEUE_SIZE;
+        commit_queue.count = 0;
+        pthread_mutex_unlock(&commit_queue.lock);
+
+        commit_batch(batch, count);
+
+        pthread_mutex_lock(&commit_queue.lock);
+    }
+    pthread_mutex_unlock(&commit_queue.lock);
+    return NULL;
+}
+
+/**
+ * @brief Start the commit thread.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int commit_start(void) {
+    commit_queue.running = 1;
+    int err = pthread_create(&commit_queue.thread, NULL, commit_main, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create commit: %s\n", strerror(err));
+        commit_queue.running = 0;
+        return -1;
+    }
+    commit_queue.started = 1;
+    return 0;
+}
+
+/**
+ * @brief Queue a finished upload for the commit thread.
+ *
+ * Called from the worker threads, which must not block on a disk flush:
+ * when the queue is full (or the commit thread has exited) the upload is
+ * refused and stays with the caller, which tries again later.
+ *
+ * @param file Temporary file, fully written; closed by the commit.
+ * @param tmpname Its name.
+ * @param filename Final name.
+ * @param status Receives the outcome; the caller keeps it valid until it is final.
+ * @return int 0 if queued (the queue owns file), -1 if refused.
+ */
+int commit_enqueue(FILE *file, const char *tmpname, const char *filename, int *status) {
+    commit_item item = {.file = file, .status = status};
+    snprintf(item.tmp, sizeof(item.tmp), "%s", tmpname);
+    snprintf(item.name, sizeof(item.name), "%s", filename);
+
+    pthread_mutex_lock(&commit_queue.lock);
+    if (!commit_queue.running || commit_queue.count == COMMIT_QUEUE_SIZE) {
+        pthread_mutex_unlock(&commit_queue.lock);
+        COMMIT_STAT_ADD(deferred, 1);
+        return -1;
+    }
+
+    *status = COMMIT_QUEUED;
+    int tail = (commit_queue.head + commit_queue.count) % COMMIT_QUEUE_SIZE;
+    commit_queue.items[tail] = item;
+    commit_queue.count++;
+    pthread_cond_signal(&commit_queue.wake);
+    pthread_mutex_unlock(&commit_queue.lock);
+    return 0;
+}
+
+/**
+ * @brief Read the state of a queued upload.
+ *
+ * @param status Status passed to commit_enqueue().
+ * @return int COMMIT_QUEUED, COMMIT_DONE or COMMIT_FAILED.
+ */
+int commit_status(const int *status) {
+    return __atomic_load_n(status, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Let the commit thread finish the queued uploads, then join it.
+ */
+void commit_stop(void) {
+    if (!commit_queue.started)
+        return;
+
+    pthread_mutex_lock(&commit_queue.lock);
+    commit_queue.stopping = 1;
+    pthread_cond_signal(&commit_queue.wake);
+    pthread_mutex_unlock(&commit_queue.lock);
+
+    pthread_join(commit_queue.thread, NULL);
+    commit_queue.started = 0;
+}
+
+/**
+ * @brief Snapshot the commit counters.
+ *
+ * @param out Receives the counters.
+ */
+void commit_get_stats(tftp_commit_stats *out) {
+    out->committed = COMMIT_STAT_GET(committed);
+    out->batches = COMMIT_STAT_GET(batches);
+    out->failed = COMMIT_STAT_GET(failed);
+    out->deferred = COMMIT_STAT_GET(deferred);
+    out->partial = COMMIT_STAT_GET(partial);
+}
+
+/**
+ * @brief Print the commit counters on one line.
+ */
+void commit_print_stats(void) {
+    printf("commits: committed %llu, batches %llu, failed %llu, deferred %llu, partial %llu\n",
+           (unsigned long long)COMMIT_STAT_GET(committed), (unsigned long long)COMMIT_STAT_GET(batches),
+           (unsigned long long)COMMIT_STAT_GET(failed), (unsigned long long)COMMIT_STAT_GET(deferred),
+           (unsigned long long)COMMIT_STAT_GET(partial));
+    fflush(stdout);
+}
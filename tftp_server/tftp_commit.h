@@ -0,0 +1,100 @@
+/**
+ * @file tftp_commit.h
+ * @brief Durable, atomic publication of finished uploads, with group commit.
+ */
+
+#ifndef TFTP_COMMIT_H
+#define TFTP_COMMIT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define COMMIT_QUEUE_SIZE 64    // finished uploads waiting to be committed
+#define UPLOAD_TMP_SUFFIX ".part.XXXXXX"
+#define UPLOAD_PARTIAL_SUFFIX ".part"   // aborted upload kept for a resume
+#define COMMIT_POLL_MS 2        // a session waiting for its upload to be committed checks it this often
+
+enum { COMMIT_QUEUED, COMMIT_DONE, COMMIT_FAILED };
+
+/**
+ * @brief Counters of the commit thread, updated with atomic adds.
+ */
+typedef struct tftp_commit_stats {
+    uint64_t committed;  ///< Uploads synced and renamed into place
+    uint64_t batches;    ///< Group commits (one directory sync each)
+    uint64_t failed;     ///< Uploads that could not be synced or renamed
+    uint64_t deferred;   ///< Times an upload was refused because the queue was full
+    uint64_t partial;    ///< Aborted uploads kept for a resume
+} tftp_commit_stats;
+
+/**
+ * @brief Starts the commit thread.
+ * @return 0 on success, -1 on error.
+ */
+int commit_start(void);
+
+/**
+ * @brief Commits the queued uploads and stops the commit thread.
+ */
+void commit_stop(void);
+
+/**
+ * @brief Creates the temporary file an upload is received into.
+ *
+ * With partial non-NULL, the partial upload kept for filename (if any)
+ * becomes the temporary file; otherwise it is discarded.
+ *
+ * @param filename Final name of the upload.
+ * @param tmpname Receives the temporary name (same directory as filename).
+ * @param size Size of tmpname.
+ * @param partial Receives the bytes already in the file, or NULL for a new upload.
+ * @return The open file, or NULL on error.
+ */
+FILE *commit_open_temp(const char *filename, char *tmpname, size_t size, uint64_t *partial);
+
+/**
+ * @brief Keeps the received part of an aborted upload as filename.part.
+ *
+ * Takes ownership of file. With nothing received the temporary file is removed.
+ *
+ * @param file Temporary file.
+ * @param tmpname Its name.
+ * @param filename Final name of the upload.
+ * @param received Bytes written from the start of the file.
+ */
+void commit_keep_partial(FILE *file, const char *tmpname, const char *filename, uint64_t received);
+
+/**
+ * @brief Queues a finished upload: sync, rename to its final name, back up.
+ *
+ * Never syncs on the caller: when the queue is full the upload is refused
+ * and the caller keeps file until it tries again.
+ *
+ * @param file Temporary file, fully written.
+ * @param tmpname Its name.
+ * @param filename Final name.
+ * @param status Set to COMMIT_QUEUED, then to COMMIT_DONE once the file is durable under its
+ *               final name or COMMIT_FAILED; must stay valid until commit_status() is not COMMIT_QUEUED.
+ * @return 0 if queued (ownership of file is taken), -1 if the queue is full or stopped.
+ */
+int commit_enqueue(FILE *file, const char *tmpname, const char *filename, int *status);
+
+/**
+ * @brief Reads the state of a queued upload.
+ * @param status Status passed to commit_enqueue().
+ * @return COMMIT_QUEUED, COMMIT_DONE or COMMIT_FAILED.
+ */
+int commit_status(const int *status);
+
+/**
+ * @brief Snapshots the commit counters.
+ * @param out Receives the counters.
+ */
+void commit_get_stats(tftp_commit_stats *out);
+
+/**
+ * @brief Prints the commit counters on one line.
+ */
+void commit_print_stats(void);
+
+#endif // TFTP_COMMIT_H
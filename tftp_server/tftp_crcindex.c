@@ -0,0 +1,421 @@
+/**
+ * @file tftp_crcindex.c
+ * @brief CRC index files of large downloads.
+ *
+ * Files too large for the hot-file cache are still checksummed block by
+ * block on every download. For those, an index file under CRC_INDEX_DIR keeps
+ * the CRC-8 of every block for a given blksize; a download that finds an
+ * up-to-date index maps it and only reads payload bytes. A missing or stale
+ * index is rebuilt by a background thread, so the event loop never computes
+ * a whole index itself; the download that triggered the build computes its
+ * CRCs per packet as before. Index files are written under a temporary name
+ * and renamed, so a reader never sees a partial one.
+ *
+ * The index of a file in a subdirectory lives directly in CRC_INDEX_DIR: '/'
+ * and '%' are escaped in its name, so no directory has to be created and no
+ * request can place an index outside CRC_INDEX_DIR. A build that fails is
+ * remembered for that version of the file and not queued again.
+ */
+
+#include "tftp_crcindex.h"
+#include "tftp_crc.h"
+#include "tftp_mapguard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int running;
+    int stopping;
+    int head;                                   ///< Next build
+    int count;                                  ///< Builds in the queue
+    char names[CRC_INDEX_QUEUE_SIZE][256];
+    int blksizes[CRC_INDEX_QUEUE_SIZE];
+    tftp_crc_index_header failed[CRC_INDEX_FAILED]; ///< Files whose index could not be built
+    int failed_next;                            ///< Slot the next failure overwrites
+} crcindex_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static tftp_crcindex_stats crcindex_stats;
+
+#define CRCINDEX_STAT_ADD(field, n) __atomic_fetch_add(&crcindex_stats.field, (n), __ATOMIC_RELAXED)
+#define CRCINDEX_STAT_GET(field) __atomic_load_n(&crcindex_stats.field, __ATOMIC_RELAXED)
+
+/**
+ * @brief Build the name of the index of a file for one blksize.
+ *
+ * '/' and '%' in the file name are written as %2F and %25, so every index
+ * is a plain file of CRC_INDEX_DIR.
+ *
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param path File name.
+ * @param blksize Block size.
+ * @return int 0 on success, -1 if the name does not fit.
+ */
+static int crcindex_path(char *buf, size_t size, const char *path, int blksize) {
+    size_t n = snprintf(buf, size, "%s/", CRC_INDEX_DIR);
+    for (; *path && n + 3 < size; path++) {
+        if (*path == '/' || *path == '%')
+            n += snprintf(buf + n, size - n, "%%%02X", (unsigned char)*path);
+        else
+            buf[n++] = *path;
+    }
+    if (*path)
+        return -1;
+    return (size_t)snprintf(buf + n, size - n, ".%d", blksize) < size - n ? 0 : -1;
+}
+
+/**
+ * @brief Tell whether an index header describes a file as it is now.
+ *
+ * @param h Index header.
+ * @param st Current stat of the file.
+ * @param blksize Block size of the transfer.
+ * @return int Non-zero if the index is up to date.
+ */
+static int crcindex_matches(const tftp_crc_index_header *h, const struct stat *st, int blksize) {
+    return memcmp(h->magic, CRC_INDEX_MAGIC, sizeof(h->magic)) == 0 && h->blksize == (uint32_t)blksize &&
+           h->dev == st->st_dev && h->ino == st->st_ino && h->size == st->st_size &&
+           h->mtime_sec == st->st_mtim.tv_sec && h->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Fill an index header for a file as it is now.
+ *
+ * @param h Header.
+ * @param st Stat of the file.
+ * @param blksize Block size.
+ */
+static void crcindex_header(tftp_crc_index_header *h, const struct stat *st, int blksize) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, CRC_INDEX_MAGIC, sizeof(h->magic));
+    h->blksize = blksize;
+    h->dev = st->st_dev;
+    h->ino = st->st_ino;
+    h->size = st->st_size;
+    h->mtime_sec = st->st_mtim.tv_sec;
+    h->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Tell whether building the index of a file already failed.
+ *
+ * Called with the queue lock held.
+ *
+ * @param st Current stat of the file.
+ * @param blksize Block size.
+ * @return int Non-zero if this version of the file failed for blksize.
+ */
+static int crcindex_has_failed(const struct stat *st, int blksize) {
+    for (int i = 0; i < CRC_INDEX_FAILED; i++) {
+        if (crcindex_matches(&crcindex_queue.failed[i], st, blksize))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Remember that the index of a file could not be built, replacing the oldest failure.
+ *
+ * @param st Stat of the file.
+ * @param blksize Block size.
+ */
+static void crcindex_remember_failure(const struct stat *st, int blksize) {
+    pthread_mutex_lock(&crcindex_queue.lock);
+    crcindex_header(&crcindex_queue.failed[crcindex_queue.failed_next], st, blksize);
+    crcindex_queue.failed_next = (crcindex_queue.failed_next + 1) % CRC_INDEX_FAILED;
+    pthread_mutex_unlock(&crcindex_queue.lock);
+}
+
+/**
+ * @brief Queue an index build unless the same one is already queued.
+ *
+ * Builds are an optimization: when the queue is full the build is dropped,
+ * and a build that failed for this version of the file is not tried again.
+ *
+ * @param path File name.
+ * @param st Current stat of the file.
+ * @param blksize Block size.
+ */
+static void crcindex_enqueue(const char *path, const struct stat *st, int blksize) {
+    pthread_mutex_lock(&crcindex_queue.lock);
+    if (crcindex_has_failed(st, blksize)) {
+        pthread_mutex_unlock(&crcindex_queue.lock);
+        return;
+    }
+    if (!crcindex_queue.running || crcindex_queue.stopping || crcindex_queue.count == CRC_INDEX_QUEUE_SIZE) {
+        pthread_mutex_unlock(&crcindex_queue.lock);
+        CRCINDEX_STAT_ADD(dropped, 1);
+        return;
+    }
+    for (int i = 0; i < crcindex_queue.count; i++) {
+        int at = (crcindex_queue.head + i) % CRC_INDEX_QUEUE_SIZE;
+        if (crcindex_queue.blksizes[at] == blksize && strcmp(crcindex_queue.names[at], path) == 0) {
+            pthread_mutex_unlock(&crcindex_queue.lock);
+            return;
+        }
+    }
+
+    int tail = (crcindex_queue.head + crcindex_queue.count) % CRC_INDEX_QUEUE_SIZE;
+    snprintf(crcindex_queue.names[tail], sizeof(crcindex_queue.names[tail]), "%s", path);
+    crcindex_queue.blksizes[tail] = blksize;
+    crcindex_queue.count++;
+    CRCINDEX_STAT_ADD(queued, 1);
+    pthread_cond_signal(&crcindex_queue.wake);
+    pthread_mutex_unlock(&crcindex_queue.lock);
+}
+
+/**
+ * @brief Map the index of a file for one blksize if it is up to date.
+ *
+ * @param path File name.
+ * @param st Current stat of the file.
+ * @param blksize Block size of the transfer.
+ * @param idx Filled with the mapped index.
+ * @return int 0 if idx holds a valid index, -1 otherwise (a build is queued).
+ */
+int crcindex_open(const char *path, const struct stat *st, int blksize, tftp_crc_index *idx) {
+    memset(idx, 0, sizeof(*idx));
+    if (!S_ISREG(st->st_mode) || st->st_size < CRC_INDEX_MIN_SIZE)
+        return -1;
+
+    char name[1024];
+    if (crcindex_path(name, sizeof(name), path, blksize) < 0)
+        return -1;
+    size_t len = sizeof(tftp_crc_index_header) + st->st_size / blksize + 1;
+
+    int fd = open(name, O_RDONLY);
+    struct stat ist;
+    if (fd < 0 || fstat(fd, &ist) < 0 || (size_t)ist.st_size != len) {
+        if (fd >= 0)
+            close(fd);
+        crcindex_enqueue(path, st, blksize);
+        return -1;
+    }
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap crc index");
+        return -1;
+    }
+    if (!crcindex_matches(map, st, blksize)) {
+        munmap(map, len);
+        crcindex_enqueue(path, st, blksize);
+        return -1;
+    }
+
+    idx->map = map;
+    idx->len = len;
+    idx->crcs = (const uint8_t *)map + sizeof(tftp_crc_index_header);
+    CRCINDEX_STAT_ADD(used, 1);
+    return 0;
+}
+
+/**
+ * @brief Unmap an index.
+ *
+ * @param idx Index, possibly empty.
+ */
+void crcindex_close(tftp_crc_index *idx) {
+    if (idx->map)
+        munmap(idx->map, idx->len);
+    idx->map = NULL;
+    idx->crcs = NULL;
+}
+
+/**
+ * @brief Compute and write the index of a file for one blksize.
+ *
+ * The file is stat'ed again once its CRCs are computed: an index of a file
+ * that changed meanwhile is not written. Any other failure is remembered,
+ * so the same version of the file is not queued again.
+ *
+ * @param path File name.
+ * @param blksize Block size.
+ * @return int 0 on success, -1 on error.
+ */
+int crcindex_build(const char *path, int blksize) {
+    int src = open(path, O_RDONLY);
+    struct stat st;
+    if (src < 0 || fstat(src, &st) < 0 || st.st_size == 0) {
+        if (src >= 0)
+            close(src);
+        CRCINDEX_STAT_ADD(failed, 1);
+        return -1;
+    }
+    if (mkdir(CRC_INDEX_DIR, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create CRC index directory");
+        crcindex_remember_failure(&st, blksize);
+        close(src);
+        CRCINDEX_STAT_ADD(failed, 1);
+        return -1;
+    }
+    const unsigned char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, src, 0);
+    if (data == MAP_FAILED) {
+        perror("CRC index: mmap");
+        crcindex_remember_failure(&st, blksize);
+        close(src);
+        CRCINDEX_STAT_ADD(failed, 1);
+        return -1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+    size_t blocks = st.st_size / blksize + 1;
+    size_t len = sizeof(tftp_crc_index_header) + blocks;
+    unsigned char *out = malloc(len);
+    int ret = -1;
+    int changed = 0;
+    if (!out) {
+        perror("malloc");
+        goto done;
+    }
+
+    tftp_crc_index_header *h = (tftp_crc_index_header *)out;
+    crcindex_header(h, &st, blksize);
+    sigjmp_buf fault;
+    if (sigsetjmp(fault, 0)) {
+        changed = 1; // truncated under the mapping while being indexed
+        goto done;
+    }
+    mapguard_enter(&fault);
+    for (size_t i = 0; i < blocks; i++) {
+        off_t offset = (off_t)i * blksize;
+        size_t n = st.st_size - offset < blksize ? st.st_size - offset : blksize;
+        out[sizeof(*h) + i] = calculate_crc8(data + offset, n);
+    }
+    mapguard_leave();
+
+    struct stat after;
+    if (fstat(src, &after) < 0 || !crcindex_matches(h, &after, blksize)) {
+        changed = 1; // changed while being indexed: the next download queues it again
+        goto done;
+    }
+
+    char name[1024], tmp[1032];
+    if (crcindex_path(name, sizeof(name), path, blksize) < 0) {
+        fprintf(stderr, "CRC index: name too long for '%s'\n", path);
+        goto done;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    int dst = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst < 0) {
+        perror("CRC index: cannot create index file");
+        goto done;
+    }
+    if (write(dst, out, len) != (ssize_t)len || close(dst) != 0 || rename(tmp, name) != 0) {
+        perror("CRC index: cannot write index file");
+        unlink(tmp);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    if (ret != 0 && !changed)
+        crcindex_remember_failure(&st, blksize);
+    free(out);
+    munmap((void *)data, st.st_size);
+    close(src);
+    CRCINDEX_STAT_ADD(built, ret == 0);
+    CRCINDEX_STAT_ADD(failed, ret != 0);
+    return ret;
+}
+
+/**
+ * @brief Body of the index thread: build queued indexes until stopped.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void *crcindex_main(void *arg) {
+    (void)arg;
+    char name[256];
+
+    pthread_mutex_lock(&crcindex_queue.lock);
+    while (1) {
+        while (crcindex_queue.count == 0 && !crcindex_queue.stopping)
+            pthread_cond_wait(&crcindex_queue.wake, &crcindex_queue.lock);
+        if (crcindex_queue.stopping)
+            break;
+
+        // keep the entry queued while building, so it is not queued twice
+        memcpy(name, crcindex_queue.names[crcindex_queue.head], sizeof(name));
+        int blksize = crcindex_queue.blksizes[crcindex_queue.head];
+        pthread_mutex_unlock(&crcindex_queue.lock);
+
+        crcindex_build(name, blksize);
+
+        pthread_mutex_lock(&crcindex_queue.lock);
+        crcindex_queue.head = (crcindex_queue.head + 1) % CRC_INDEX_QUEUE_SIZE;
+        crcindex_queue.count--;
+    }
+    pthread_mutex_unlock(&crcindex_queue.lock);
+    return NULL;
+}
+
+/**
+ * @brief Start the index thread.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int crcindex_start(void) {
+    int err = pthread_create(&crcindex_queue.thread, NULL, crcindex_main, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create crc index: %s\n", strerror(err));
+        return -1;
+    }
+    crcindex_queue.running = 1;
+    return 0;
+}
+
+/**
+ * @brief Stop the index thread once its current build is done.
+ *
+ * Queued builds are abandoned; the next downloads queue them again.
+ */
+void crcindex_stop(void) {
+    if (!crcindex_queue.running)
+        return;
+
+    pthread_mutex_lock(&crcindex_queue.lock);
+    crcindex_queue.stopping = 1;
+    pthread_cond_signal(&crcindex_queue.wake);
+    pthread_mutex_unlock(&crcindex_queue.lock);
+
+    pthread_join(crcindex_queue.thread, NULL);
+    crcindex_queue.running = 0;
+}
+
+/**
+ * @brief Snapshot the index counters.
+ *
+ * @param out Receives the counters.
+ */
+void crcindex_get_stats(tftp_crcindex_stats *out) {
+    out->used = CRCINDEX_STAT_GET(used);
+    out->queued = CRCINDEX_STAT_GET(queued);
+    out->built = CRCINDEX_STAT_GET(built);
+    out->failed = CRCINDEX_STAT_GET(failed);
+    out->dropped = CRCINDEX_STAT_GET(dropped);
+}
+
+/**
+ * @brief Print the index counters on one line.
+ */
+void crcindex_print_stats(void) {
+    printf("crc index: used %llu, queued %llu, built %llu, failed %llu, dropped %llu\n",
+           (unsigned long long)CRCINDEX_STAT_GET(used), (unsigned long long)CRCINDEX_STAT_GET(queued),
+           (unsigned long long)CRCINDEX_STAT_GET(built), (unsigned long long)CRCINDEX_STAT_GET(failed),
+           (unsigned long long)CRCINDEX_STAT_GET(dropped));
+    fflush(stdout);
+}
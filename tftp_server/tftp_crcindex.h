@@ -0,0 +1,108 @@
+/**
+ * @file tftp_crcindex.h
+ * @brief Persistent per-file CRC index ("sidecar") files, built in the background.
+ */
+
+#ifndef TFTP_CRCINDEX_H
+#define TFTP_CRCINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define CRC_INDEX_DIR        "crcindex"
+#define CRC_INDEX_QUEUE_SIZE 64            // index builds waiting for the index thread
+#define CRC_INDEX_MIN_SIZE   (256 * 1024)  // smaller files are not indexed
+#define CRC_INDEX_FAILED     64            // file versions remembered as failing to index
+#define CRC_INDEX_MAGIC      "TFTPCRC2"
+
+/**
+ * @brief Header of an index file, followed by one CRC-8 per block.
+ *
+ * An index is valid only for the file it was built from: device, inode,
+ * size and mtime must still match. The table covers size / blksize + 1 blocks
+ * (including the empty block ending a file whose size is a multiple of blksize).
+ */
+typedef struct tftp_crc_index_header {
+    char magic[8];        ///< CRC_INDEX_MAGIC
+    uint32_t blksize;     ///< Block size the CRCs were computed for
+    uint32_t reserved;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} tftp_crc_index_header;
+
+/**
+ * @brief An index file mapped for a download.
+ */
+typedef struct tftp_crc_index {
+    void *map;            ///< Whole index file mapped read-only, NULL if none
+    size_t len;           ///< Length of the mapping
+    const uint8_t *crcs;  ///< CRC of block i + 1
+} tftp_crc_index;
+
+/**
+ * @brief Counters of the index thread, updated with atomic adds.
+ */
+typedef struct tftp_crcindex_stats {
+    uint64_t used;       ///< Downloads that took their CRCs from an index
+    uint64_t queued;     ///< Index builds handed to the index thread
+    uint64_t built;      ///< Index files written
+    uint64_t failed;     ///< Index builds that failed
+    uint64_t dropped;    ///< Builds not queued because the queue was full
+} tftp_crcindex_stats;
+
+/**
+ * @brief Starts the index thread.
+ * @return 0 on success, -1 on error.
+ */
+int crcindex_start(void);
+
+/**
+ * @brief Stops the index thread; queued builds are abandoned.
+ */
+void crcindex_stop(void);
+
+/**
+ * @brief Maps the index of a file for one blksize if it is up to date.
+ *
+ * When it is missing or stale, a build is queued for the next download,
+ * unless building it already failed for this version of the file.
+ *
+ * @param path File name.
+ * @param st Current stat of the file.
+ * @param blksize Block size of the transfer.
+ * @param idx Filled with the mapped index.
+ * @return 0 if idx holds a valid index, -1 otherwise.
+ */
+int crcindex_open(const char *path, const struct stat *st, int blksize, tftp_crc_index *idx);
+
+/**
+ * @brief Unmaps an index opened by crcindex_open().
+ * @param idx Index.
+ */
+void crcindex_close(tftp_crc_index *idx);
+
+/**
+ * @brief Builds the index of a file for one blksize now.
+ * @param path File name.
+ * @param blksize Block size.
+ * @return 0 on success, -1 on error.
+ */
+int crcindex_build(const char *path, int blksize);
+
+/**
+ * @brief Snapshots the index counters.
+ * @param out Receives the counters.
+ */
+void crcindex_get_stats(tftp_crcindex_stats *out);
+
+/**
+ * @brief Prints the index counters on one line.
+ */
+void crcindex_print_stats(void);
+
+#endif // TFTP_CRCINDEX_H
@@ -0,0 +1,408 @@
+/**
+ * @file tftp_loop.c
+ * @brief Single-threaded epoll event loop for the TFTP server.
+ *
+ * The loop owns the listening socket and the data socket of every transfer.
+ * Requests arriving on the listening socket start a new session; datagrams on a
+ * data socket and expired deadlines advance that session. No call in the loop
+ * blocks on a client, so one slow or dead client no longer stalls the others.
+ *
+ * With the io_uring engine (-e uring) every socket has a multishot recvmsg
+ * armed and DATA sends and upload writes are submitted to the same ring, so a
+ * busy loop makes one io_uring_enter() per iteration instead of one syscall
+ * per socket. A removed session is freed once its operations have completed.
+ */
+
+#include "tftp_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+/**
+ * @brief Create the io_uring instance of a loop.
+ *
+ * @param loop Loop to initialize.
+ * @param slot_size Largest datagram to receive.
+ * @return int 0 on success, -1 if io_uring cannot be used.
+ */
+static int loop_init_uring(tftp_loop *loop, int slot_size) {
+    loop->uring = malloc(sizeof(*loop->uring));
+    if (!loop->uring)
+        return -1;
+    if (uring_init(loop->uring, slot_size) < 0) {
+        free(loop->uring);
+        loop->uring = NULL;
+        return -1;
+    }
+
+    loop->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    set_nonblocking(loop->listen_sock);
+    return 0;
+}
+
+/**
+ * @brief Create the epoll instance and register the listening socket.
+ *
+ * With the io_uring engine the ring is created instead; if io_uring is not
+ * available the loop falls back to epoll.
+ *
+ * @param loop Loop to initialize.
+ * @param listen_sock Bound listening socket (switched to non-blocking here).
+ * @return int 0 on success, -1 on error.
+ */
+int loop_init(tftp_loop *loop, int listen_sock) {
+    memset(loop, 0, sizeof(*loop));
+    pthread_mutex_init(&loop->live_lock, NULL);
+    loop->listen_sock = listen_sock;
+    loop->epfd = -1;
+
+    // one slot fits the largest DATA packet a client may send
+    int slot_size = g_config.max_blksize + DATA_OVERHEAD_MAX;
+    if (slot_size < MAX_PACKET_SIZE)
+        slot_size = MAX_PACKET_SIZE;
+
+    if (g_config.engine == ENGINE_URING) {
+        if (loop_init_uring(loop, slot_size) == 0)
+            return 0;
+        fprintf(stderr, "io_uring unavailable, using epoll\n");
+    }
+
+    loop->epfd = epoll_create1(0);
+    if (loop->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    if (ring_init(&loop->ring, RING_BATCH, slot_size) < 0) {
+        close(loop->epfd);
+        return -1;
+    }
+
+    set_nonblocking(listen_sock);
+
+    // data.ptr == NULL marks the listening socket
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listen_sock, &ev) < 0) {
+        perror("epoll_ctl listen");
+        ring_free(&loop->ring);
+        close(loop->epfd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Register a new session with the loop.
+ *
+ * @param loop Owning loop.
+ * @param s Session to add.
+ * @return int 0 on success, -1 on error (the session is closed).
+ */
+int loop_add_session(tftp_loop *loop, tftp_session *s) {
+    if (loop->uring) {
+        struct io_uring_sqe *sqe = uring_get_sqe(loop->uring);
+        uring_prep_recv_multishot(sqe, s->sock_slot >= 0 ? s->sock_slot : s->data_sock, s->sock_slot >= 0,
+                                  &loop->recv_msg, (uint64_t)(uintptr_t)s | URING_RECV);
+        s->io_pending++;
+
+        s->next = loop->sessions;
+        loop->sessions = s;
+        STAT_ADD(&loop->stats, active, 1);
+        return 0;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = s;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, s->data_sock, &ev) < 0) {
+        perror("epoll_ctl session");
+        session_close(s);
+        return -1;
+    }
+
+    s->next = loop->sessions;
+    loop->sessions = s;
+    STAT_ADD(&loop->stats, active, 1);
+    return 0;
+}
+
+/**
+ * @brief Drain the listening socket and start a session for every request.
+ *
+ * Requests are received in batches of up to RING_BATCH datagrams.
+ *
+ * @param loop Owning loop.
+ */
+static void loop_accept(tftp_loop *loop) {
+    tftp_ring *ring = &loop->ring;
+    int batch = ring->count;
+
+    while (batch == ring->count) {
+        batch = ring_recv(ring, loop->listen_sock);
+
+        for (int i = 0; i < batch; i++) {
+            // Every slot has a spare byte so the filename is always NUL terminated
+            int n = ring_length(ring, i);
+            if (n < 0)
+                continue;
+            dispatch_request(loop, ring_packet(ring, i), n, &ring->addrs[i], ring->msgs[i].msg_hdr.msg_namelen);
+        }
+    }
+}
+
+/**
+ * @brief Release a finished session of an io_uring loop.
+ *
+ * Its multishot receive is cancelled; the session is freed by the last
+ * completion that refers to it.
+ *
+ * @param loop Owning loop.
+ * @param s Session removed from the loop.
+ */
+static void loop_release(tftp_loop *loop, tftp_session *s) {
+    s->closing = 1;
+    if (s->io_pending == 0) {
+        session_close(s);
+        return;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(loop->uring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)s | URING_RECV;
+    sqe->user_data = URING_CANCEL;
+}
+
+/**
+ * @brief Copy the counters of every active session out for the admin socket.
+ *
+ * The metrics thread cannot walk the session list, so the loop publishes
+ * it: every METRICS_LIVE_INTERVAL_MS, and at once when the last session
+ * has gone so that an idle loop lists none.
+ *
+ * @param loop Owning loop.
+ * @param now Current time in milliseconds.
+ */
+static void loop_publish(tftp_loop *loop, uint64_t now) {
+    int count = (int)loop->stats.active;
+
+    pthread_mutex_lock(&loop->live_lock);
+    if (count > loop->live_cap) {
+        tftp_session_summary *live = realloc(loop->live, count * sizeof(*live));
+        if (live) {
+            loop->live = live;
+            loop->live_cap = count;
+        }
+    }
+    int n = 0;
+    for (tftp_session *s = loop->sessions; s && n < loop->live_cap; s = s->next)
+        session_summarize(s, 0, &loop->live[n++]);
+    loop->live_count = n;
+    pthread_mutex_unlock(&loop->live_lock);
+
+    loop->live_at = now + METRICS_LIVE_INTERVAL_MS;
+}
+
+/**
+ * @brief Copy the active sessions a loop last published.
+ *
+ * @param loop Loop, possibly running on another thread.
+ * @param count Receives the number of sessions.
+ * @return tftp_session_summary* Array of count summaries to free(), NULL if there are none.
+ */
+tftp_session_summary *loop_get_live(tftp_loop *loop, int *count) {
+    tftp_session_summary *live = NULL;
+
+    pthread_mutex_lock(&loop->live_lock);
+    *count = 0;
+    if (loop->live_count > 0) {
+        live = malloc(loop->live_count * sizeof(*live));
+        if (live) {
+            memcpy(live, loop->live, loop->live_count * sizeof(*live));
+            *count = loop->live_count;
+        }
+    }
+    pthread_mutex_unlock(&loop->live_lock);
+    return live;
+}
+
+/**
+ * @brief Fire timeouts of expired sessions and remove finished ones.
+ *
+ * @param loop Owning loop.
+ * @return int Milliseconds until the next deadline, or -1 if there is none.
+ */
+static int loop_sweep(tftp_loop *loop) {
+    uint64_t now = now_ms();
+    uint64_t next = 0;
+    tftp_session **link = &loop->sessions;
+
+    while (*link) {
+        tftp_session *s = *link;
+
+        if (!s->done && s->pace_at && s->pace_at <= now)
+            session_on_pace(s);
+        if (!s->done && s->deadline <= now)
+            session_on_timeout(s);
+
+        if (s->done) {
+            // Closing the socket also removes it from the epoll set
+            *link = s->next;
+            STAT_ADD(&loop->stats, active, -1);
+            if (loop->uring)
+                loop_release(loop, s);
+            else
+                session_close(s);
+            continue;
+        }
+
+        if (next == 0 || s->deadline < next)
+            next = s->deadline;
+        if (s->pace_at && s->pace_at < next)
+            next = s->pace_at;
+        link = &s->next;
+    }
+
+    if (now >= loop->live_at || (!loop->sessions && loop->live_count > 0))
+        loop_publish(loop, now);
+
+    if (next == 0)
+        return -1;
+    return next > now ? (int)(next - now) : 0;
+}
+
+/**
+ * @brief Arm the multishot receive of the listening socket.
+ *
+ * @param loop io_uring loop.
+ */
+static void loop_arm_listen(tftp_loop *loop) {
+    struct io_uring_sqe *sqe = uring_get_sqe(loop->uring);
+    uring_prep_recv_multishot(sqe, loop->listen_sock, 0, &loop->recv_msg, URING_LISTEN);
+}
+
+/**
+ * @brief Handle one receive completion of an io_uring loop.
+ *
+ * A multishot receive stops when the kernel runs out of buffers (or on
+ * error); it is re-armed unless its session is going away.
+ *
+ * @param loop io_uring loop.
+ * @param cqe Completion.
+ * @param s Receiving session, NULL for the listening socket.
+ */
+static void loop_on_recv(tftp_loop *loop, struct io_uring_cqe *cqe, tftp_session *s) {
+    tftp_uring *u = loop->uring;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        struct sockaddr_in *from;
+        int n;
+        unsigned char *packet = uring_recv_packet(u, bid, cqe->res, &from, &n);
+
+        if (n >= 0) {
+            if (s == NULL)
+                dispatch_request(loop, packet, n, from, sizeof(*from));
+            else if (!s->done && !s->closing)
+                session_on_packet(s, from, packet, n);
+        }
+        uring_recv_recycle(u, bid);
+    }
+
+    if (cqe->flags & IORING_CQE_F_MORE)
+        return;
+    if (s == NULL) {
+        loop_arm_listen(loop);
+    } else if (!s->closing) {
+        struct io_uring_sqe *sqe = uring_get_sqe(u);
+        uring_prep_recv_multishot(sqe, s->sock_slot >= 0 ? s->sock_slot : s->data_sock, s->sock_slot >= 0,
+                                  &loop->recv_msg, (uint64_t)(uintptr_t)s | URING_RECV);
+    } else {
+        session_io_done(s);
+    }
+}
+
+/**
+ * @brief Run the io_uring event loop forever.
+ *
+ * @param loop Loop to run.
+ */
+static void loop_run_uring(tftp_loop *loop) {
+    tftp_uring *u = loop->uring;
+    int timeout = -1;
+
+    loop_arm_listen(loop);
+    while (1) {
+        if (uring_wait(u, timeout) < 0) {
+            perror("io_uring_enter");
+            return;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(u)) != NULL) {
+            uint64_t data = cqe->user_data;
+            void *ptr = (void *)(uintptr_t)(data & ~(uint64_t)URING_TAG_MASK);
+
+            switch (data & URING_TAG_MASK) {
+                case URING_LISTEN:
+                    loop_on_recv(loop, cqe, NULL);
+                    break;
+                case URING_RECV:
+                    loop_on_recv(loop, cqe, ptr);
+                    break;
+                case URING_SEND:
+                    session_on_sent(ptr, cqe->res);
+                    break;
+                case URING_WRITE:
+                    session_on_written(u, (int)(data >> 3), cqe->res);
+                    break;
+                default:
+                    break;
+            }
+            uring_cqe_seen(u);
+        }
+
+        timeout = loop_sweep(loop);
+    }
+}
+
+/**
+ * @brief Run the event loop forever.
+ *
+ * @param loop Loop to run.
+ */
+void loop_run(tftp_loop *loop) {
+    struct epoll_event events[LOOP_MAX_EVENTS];
+    int timeout = -1;
+
+    if (loop->uring) {
+        loop_run_uring(loop);
+        return;
+    }
+
+    while (1) {
+        int n = epoll_wait(loop->epfd, events, LOOP_MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            tftp_session *s = events[i].data.ptr;
+            if (s == NULL)
+                loop_accept(loop);
+            else if (!s->done)
+                session_on_readable(s, &loop->ring);
+        }
+
+        timeout = loop_sweep(loop);
+    }
+}
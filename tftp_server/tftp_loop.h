@@ -0,0 +1,76 @@
+/**
+ * @file tftp_loop.h
+ * @brief Event loop (epoll, or optionally io_uring) driving the listening socket and all transfer sessions.
+ */
+
+#ifndef TFTP_LOOP_H
+#define TFTP_LOOP_H
+
+#include <pthread.h>
+#include "tftp_server.h"
+
+// Upper bound of events handled per epoll_wait() call
+#define LOOP_MAX_EVENTS 64
+
+/**
+ * @brief Event loop owning the listening socket and every active session.
+ */
+typedef struct tftp_loop {
+    int epfd;                 ///< epoll instance, -1 with the io_uring engine
+    int listen_sock;          ///< Socket bound to SERVER_PORT
+    tftp_session *sessions;   ///< Linked list of active sessions
+    tftp_stats stats;         ///< Counters of this loop (stats.active = active sessions)
+    tftp_ring ring;           ///< Receive buffers shared by the listening and data sockets
+    tftp_uring *uring;        ///< io_uring instance, NULL with the epoll engine
+    struct msghdr recv_msg;   ///< Template of the multishot recvmsg operations
+    pthread_mutex_t live_lock;       ///< Guards live and live_count against the metrics thread
+    tftp_session_summary *live;      ///< Active sessions as of the last publish
+    int live_count;                  ///< Entries of live in use
+    int live_cap;                    ///< Entries allocated in live
+    uint64_t live_at;                ///< Time of the next publish
+} tftp_loop;
+
+/**
+ * @brief Creates the epoll instance (or the io_uring), the receive ring and registers the listening socket.
+ * @param loop Loop to initialize.
+ * @param listen_sock Bound listening socket.
+ * @return 0 on success, -1 on error.
+ */
+int loop_init(tftp_loop *loop, int listen_sock);
+
+/**
+ * @brief Registers a session's data socket with the loop.
+ * @param loop Owning loop.
+ * @param s Session to add.
+ * @return 0 on success, -1 on error (the session is closed).
+ */
+int loop_add_session(tftp_loop *loop, tftp_session *s);
+
+/**
+ * @brief Runs the loop forever: accepts requests and drives sessions.
+ * @param loop Loop to run.
+ */
+void loop_run(tftp_loop *loop);
+
+/**
+ * @brief Copies the active sessions a loop last published.
+ *
+ * Safe to call from any thread; the snapshot is at most METRICS_LIVE_INTERVAL_MS old.
+ *
+ * @param loop Loop.
+ * @param count Receives the number of sessions.
+ * @return Array of count summaries to free(), NULL if there are none.
+ */
+tftp_session_summary *loop_get_live(tftp_loop *loop, int *count);
+
+/**
+ * @brief Parses one request received on the listening socket and starts its session.
+ * @param loop Owning loop.
+ * @param buffer Request packet (must have room for a terminating NUL at buffer[n]).
+ * @param n Length of the request.
+ * @param client Address the request came from.
+ * @param client_len Length of the client address.
+ */
+void dispatch_request(tftp_loop *loop, unsigned char *buffer, int n, struct sockaddr_in *client, socklen_t client_len);
+
+#endif // TFTP_LOOP_H
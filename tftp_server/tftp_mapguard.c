@@ -0,0 +1,73 @@
+/**
+ * @file tftp_mapguard.c
+ * @brief SIGBUS handler for reads of file mappings that may be truncated.
+ *
+ * Served files are mapped MAP_PRIVATE, but a private mapping still shows the
+ * file as it changes: when another process truncates it, touching a page past
+ * the new end raises SIGBUS. The event loops, the prefix thread and the CRC
+ * index thread read mappings under a per-thread guard; the handler jumps back
+ * to it, and the reader gives up on the file. Any other SIGBUS is a bug and
+ * keeps its default action.
+ */
+
+#include "tftp_mapguard.h"
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+static __thread sigjmp_buf *mapguard; // armed guard of this thread, NULL if none
+
+/**
+ * @brief SIGBUS handler: jump to the armed guard of the thread.
+ *
+ * Without one the default action is restored and the handler returns, so the
+ * faulting access runs again and ends the process as it would have.
+ *
+ * @param sig SIGBUS.
+ */
+static void mapguard_on_sigbus(int sig) {
+    sigjmp_buf *env = mapguard;
+    if (!env) {
+        signal(sig, SIG_DFL);
+        return;
+    }
+    mapguard = NULL;
+    siglongjmp(*env, 1);
+}
+
+/**
+ * @brief Install the SIGBUS handler.
+ *
+ * SA_NODEFER keeps SIGBUS unblocked in the handler: the jump out of it does
+ * not restore the signal mask, and the next fault must be delivered too.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int mapguard_install(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = mapguard_on_sigbus;
+    sa.sa_flags = SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGBUS, &sa, NULL) < 0) {
+        perror("sigaction SIGBUS");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Arm the guard of the calling thread.
+ *
+ * @param env Jump buffer set by sigsetjmp(env, 0).
+ */
+void mapguard_enter(sigjmp_buf *env) {
+    mapguard = env;
+}
+
+/**
+ * @brief Disarm the guard of the calling thread.
+ */
+void mapguard_leave(void) {
+    mapguard = NULL;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file tftp_mapguard.h
+ * @brief Reading file mappings that may be truncated underneath, without dying of SIGBUS.
+ *
+ * A page of a mapping beyond the current end of its file raises SIGBUS when
+ * touched. A thread about to read a mapping arms its guard with sigsetjmp()
+ * and mapguard_enter(); the SIGBUS handler then jumps back there instead of
+ * ending the process:
+ *
+ *     sigjmp_buf fault;
+ *     if (sigsetjmp(fault, 0)) {
+ *         // the file shrank: give up on the mapping
+ *     }
+ *     mapguard_enter(&fault);
+ *     ... read the mapping ...
+ *     mapguard_leave();
+ *
+ * The signal mask is not saved (sigsetjmp(..., 0) costs no system call), so
+ * the handler runs with SIGBUS unblocked. Kernel reads of a mapping, such as
+ * sendmsg() from it, fail with EFAULT instead and need no guard.
+ */
+
+#ifndef TFTP_MAPGUARD_H
+#define TFTP_MAPGUARD_H
+
+#include <setjmp.h>
+
+/**
+ * @brief Installs the SIGBUS handler. A SIGBUS outside a guard still ends the process.
+ * @return 0 on success, -1 on error.
+ */
+int mapguard_install(void);
+
+/**
+ * @brief Arms the guard of the calling thread.
+ * @param env Set by sigsetjmp(env, 0) in a frame that stays live until mapguard_leave().
+ */
+void mapguard_enter(sigjmp_buf *env);
+
+/**
+ * @brief Disarms the guard of the calling thread (also done by the jump on a fault).
+ */
+void mapguard_leave(void);
+
+#endif // TFTP_MAPGUARD_H
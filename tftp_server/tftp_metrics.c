@@ -0,0 +1,464 @@
+/**
+ * @file tftp_metrics.c
+ * @brief Machine-readable server metrics.
+ *
+ * The per-worker counters, the round-trip time and transfer duration
+ * histograms and the counters of the background threads (backup, commit,
+ * CRC index, cache) are rendered in the Prometheus text exposition format.
+ * A metrics thread rewrites that text into a file every few seconds (written
+ * to a temporary name and renamed, for the node exporter textfile collector)
+ * and answers a local Unix stream socket:
+ *   - "stats":    the same Prometheus text;
+ *   - "sessions": one line per active transfer of every worker (as last
+ *                 published by its loop), then one per recently finished
+ *                 transfer, each with its own counters.
+ * The thread only reads counters with atomic loads; workers never wait for it.
+ */
+
+#include "tftp_metrics.h"
+#include "tftp_worker.h"
+#include "tftp_backup.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Upper bounds of the histogram buckets; the last bucket of each is +Inf
+static const uint64_t rtt_bounds_us[METRICS_RTT_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000,
+};
+static const uint64_t duration_bounds_ms[METRICS_DURATION_BUCKETS - 1] = {
+    10, 50, 100, 500, 1000, 5000, 10000, 30000, 60000, 300000,
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_t thread;
+    int running;
+    int stop_pipe[2];                              ///< Written to wake the thread up for stopping
+    int admin_sock;                                ///< Listening admin socket, -1 if none
+    char admin_path[108];
+    char file[256];                                ///< Metrics file, empty if none
+    int interval;                                  ///< Seconds between rewrites of the file
+    tftp_worker *workers;
+    int count;
+    int recent_next;                               ///< Slot of the next finished session
+    int recent_count;                              ///< Finished sessions recorded, up to METRICS_RECENT
+    tftp_session_summary recent[METRICS_RECENT];
+} metrics = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .admin_sock = -1,
+};
+
+/**
+ * @brief Find the bucket of a value.
+ *
+ * @param bounds Upper bounds of the finite buckets, ascending.
+ * @param n Number of finite buckets.
+ * @param value Value to place.
+ * @return int Index of the first bucket whose bound is >= value, n for +Inf.
+ */
+static int bucket_of(const uint64_t *bounds, int n, uint64_t value) {
+    int i = 0;
+    while (i < n && value > bounds[i])
+        i++;
+    return i;
+}
+
+/**
+ * @brief Histogram bucket of a round-trip time.
+ *
+ * @param us Round-trip time in microseconds.
+ * @return int Bucket index.
+ */
+int metrics_rtt_bucket(uint64_t us) {
+    return bucket_of(rtt_bounds_us, METRICS_RTT_BUCKETS - 1, us);
+}
+
+/**
+ * @brief Histogram bucket of a transfer duration.
+ *
+ * @param ms Duration in milliseconds.
+ * @return int Bucket index.
+ */
+int metrics_duration_bucket(uint64_t ms) {
+    return bucket_of(duration_bounds_ms, METRICS_DURATION_BUCKETS - 1, ms);
+}
+
+/**
+ * @brief Record a finished transfer for the "sessions" admin command.
+ *
+ * Called by the workers once per transfer; the oldest record is replaced.
+ *
+ * @param summary Counters of the transfer.
+ */
+void metrics_session_done(const tftp_session_summary *summary) {
+    pthread_mutex_lock(&metrics.lock);
+    metrics.recent[metrics.recent_next] = *summary;
+    metrics.recent_next = (metrics.recent_next + 1) % METRICS_RECENT;
+    if (metrics.recent_count < METRICS_RECENT)
+        metrics.recent_count++;
+    pthread_mutex_unlock(&metrics.lock);
+}
+
+/**
+ * @brief Write the HELP and TYPE lines of a metric.
+ */
+static void metric_header(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * @brief Write a metric without labels.
+ */
+static void metric_value(FILE *out, const char *name, const char *type, const char *help, uint64_t value) {
+    metric_header(out, name, type, help);
+    fprintf(out, "%s %llu\n", name, (unsigned long long)value);
+}
+
+/**
+ * @brief Write a histogram from per-bucket (non-cumulative) counts.
+ *
+ * @param out Output stream.
+ * @param name Metric name.
+ * @param help Description.
+ * @param counts Count of every bucket, the last one being +Inf.
+ * @param bounds Upper bounds of the finite buckets.
+ * @param n Number of buckets, including +Inf.
+ * @param scale Divisor turning bounds and sum into seconds.
+ * @param sum Sum of the observed values, in the unit of bounds.
+ */
+static void metric_histogram(FILE *out, const char *name, const char *help, const uint64_t *counts,
+                             const uint64_t *bounds, int n, double scale, uint64_t sum) {
+    uint64_t cumulative = 0;
+
+    metric_header(out, name, "histogram", help);
+    for (int i = 0; i < n; i++) {
+        cumulative += counts[i];
+        if (i < n - 1)
+            fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", name, bounds[i] / scale, (unsigned long long)cumulative);
+        else
+            fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+    }
+    fprintf(out, "%s_sum %g\n%s_count %llu\n", name, sum / scale, name, (unsigned long long)cumulative);
+}
+
+/**
+ * @brief Write every counter in the Prometheus text format.
+ *
+ * Worker counters carry a worker label; histograms cover all workers.
+ *
+ * @param out Output stream.
+ * @param workers Array of workers.
+ * @param count Number of workers.
+ */
+void metrics_render(FILE *out, tftp_worker *workers, int count) {
+    tftp_stats *st = calloc(count, sizeof(*st));
+    if (!st)
+        return;
+    tftp_stats total = {0};
+    for (int i = 0; i < count; i++) {
+        worker_get_stats(&workers[i], &st[i]);
+        for (int b = 0; b < METRICS_RTT_BUCKETS; b++)
+            total.rtt_hist[b] += st[i].rtt_hist[b];
+        for (int b = 0; b < METRICS_DURATION_BUCKETS; b++)
+            total.duration_hist[b] += st[i].duration_hist[b];
+        total.rtt_sum_us += st[i].rtt_sum_us;
+        total.duration_sum_ms += st[i].duration_sum_ms;
+    }
+
+    // one labelled series per worker
+    static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+        size_t offset;
+    } series[] = {
+        {"tftp_requests_total", "counter", "Requests received on the listening sockets.", offsetof(tftp_stats, requests)},
+        {"tftp_rrq_total", "counter", "Download sessions started.", offsetof(tftp_stats, rrq)},
+        {"tftp_wrq_total", "counter", "Upload sessions started.", offsetof(tftp_stats, wrq)},
+        {"tftp_deletes_total", "counter", "DELETE requests handled.", offsetof(tftp_stats, deletes)},
+        {"tftp_completed_total", "counter", "Transfers finished successfully.", offsetof(tftp_stats, completed)},
+        {"tftp_aborted_total", "counter", "Transfers aborted.", offsetof(tftp_stats, aborted)},
+        {"tftp_blocks_sent_total", "counter", "DATA blocks sent (first transmission).", offsetof(tftp_stats, blocks_sent)},
+        {"tftp_blocks_received_total", "counter", "DATA blocks accepted.", offsetof(tftp_stats, blocks_received)},
+        {"tftp_bytes_sent_total", "counter", "Payload bytes sent.", offsetof(tftp_stats, bytes_sent)},
+        {"tftp_bytes_received_total", "counter", "Payload bytes accepted.", offsetof(tftp_stats, bytes_received)},
+        {"tftp_retransmits_total", "counter", "Packets resent.", offsetof(tftp_stats, retransmits)},
+        {"tftp_crc_errors_total", "counter", "DATA blocks dropped for a bad per-block check.", offsetof(tftp_stats, crc_errors)},
+        {"tftp_timeouts_total", "counter", "Retransmission timeouts.", offsetof(tftp_stats, timeouts)},
+        {"tftp_active_sessions", "gauge", "Transfers in progress.", offsetof(tftp_stats, active)},
+    };
+    for (size_t m = 0; m < sizeof(series) / sizeof(series[0]); m++) {
+        metric_header(out, series[m].name, series[m].type, series[m].help);
+        for (int i = 0; i < count; i++) {
+            uint64_t v = *(const uint64_t *)((const char *)&st[i] + series[m].offset);
+            fprintf(out, "%s{worker=\"%d\"} %llu\n", series[m].name, workers[i].id, (unsigned long long)v);
+        }
+    }
+    free(st);
+
+    metric_histogram(out, "tftp_rtt_seconds", "Round-trip times measured by the transfers.", total.rtt_hist,
+                     rtt_bounds_us, METRICS_RTT_BUCKETS, 1e6, total.rtt_sum_us);
+    metric_histogram(out, "tftp_transfer_duration_seconds", "Duration of the completed transfers.",
+                     total.duration_hist, duration_bounds_ms, METRICS_DURATION_BUCKETS, 1e3, total.duration_sum_ms);
+
+    tftp_backup_stats backup;
+    backup_get_stats(&backup);
+    metric_value(out, "tftp_backup_queue_depth", "gauge", "Backups waiting for the backup thread.", backup.pending);
+    metric_value(out, "tftp_backups_total", "counter", "Backups made.", backup.cloned + backup.copied);
+    metric_value(out, "tftp_backup_failures_total", "counter", "Backups that failed.", backup.failed);
+    metric_value(out, "tftp_backups_dropped_total", "counter", "Backups dropped because the queue was full.",
+                 backup.dropped);
+
+    tftp_commit_stats commit;
+    commit_get_stats(&commit);
+    metric_value(out, "tftp_commits_total", "counter", "Uploads synced and renamed into place.", commit.committed);
+    metric_value(out, "tftp_commit_batches_total", "counter", "Group commits.", commit.batches);
+    metric_value(out, "tftp_commit_failures_total", "counter", "Uploads that could not be saved.", commit.failed);
+    metric_value(out, "tftp_commit_deferred_total", "counter", "Uploads refused while the commit queue was full.",
+                 commit.deferred);
+    metric_value(out, "tftp_partial_uploads_total", "counter", "Aborted uploads kept for a resume.", commit.partial);
+
+    tftp_cache_stats cache;
+    cache_get_stats(&cache);
+    metric_value(out, "tftp_cache_hits_total", "counter", "Downloads served from the cache.", cache.hits);
+    metric_value(out, "tftp_cache_misses_total", "counter", "Downloads of files not in the cache.", cache.misses);
+    metric_value(out, "tftp_cache_inserts_total", "counter", "Files loaded into the cache.", cache.inserts);
+    metric_value(out, "tftp_cache_evictions_total", "counter", "Cache entries evicted.", cache.evictions);
+    metric_value(out, "tftp_cache_bytes", "gauge", "Memory used by the cache.", cache.bytes);
+
+    tftp_crcindex_stats index;
+    crcindex_get_stats(&index);
+    metric_value(out, "tftp_crc_index_used_total", "counter", "Downloads that used a CRC index file.", index.used);
+    metric_value(out, "tftp_crc_index_built_total", "counter", "CRC index files written.", index.built);
+}
+
+/**
+ * @brief Write one session line of the "sessions" command.
+ *
+ * @param out Output stream.
+ * @param r Counters of the session.
+ * @param state "active", "completed" or "aborted".
+ */
+static void metrics_render_session(FILE *out, const tftp_session_summary *r, const char *state) {
+    fprintf(out, "%s %s %s %s bytes=%llu blocks=%llu retransmits=%llu crc_errors=%llu timeouts=%llu "
+                 "duration_ms=%llu rtt_us=%u cwnd=%u\n",
+            r->opcode == OP_RRQ ? "rrq" : "wrq", state, r->client, r->filename, (unsigned long long)r->bytes,
+            (unsigned long long)r->blocks, (unsigned long long)r->retransmits, (unsigned long long)r->crc_errors,
+            (unsigned long long)r->timeouts, (unsigned long long)r->duration_ms, r->rtt_us, r->cwnd);
+}
+
+/**
+ * @brief Write the active transfers of every worker, then the recently finished ones, newest first.
+ *
+ * @param out Output stream.
+ */
+static void metrics_render_sessions(FILE *out) {
+    for (int i = 0; i < metrics.count; i++) {
+        int n;
+        tftp_session_summary *live = loop_get_live(&metrics.workers[i].loop, &n);
+        for (int j = 0; j < n; j++)
+            metrics_render_session(out, &live[j], "active");
+        free(live);
+    }
+
+    // copied out first: writing to a slow reader must not hold up the workers
+    tftp_session_summary *recent = malloc(sizeof(metrics.recent));
+    if (!recent)
+        return;
+    pthread_mutex_lock(&metrics.lock);
+    int count = metrics.recent_count;
+    for (int i = 0; i < count; i++)
+        recent[i] = metrics.recent[(metrics.recent_next - 1 - i + METRICS_RECENT) % METRICS_RECENT];
+    pthread_mutex_unlock(&metrics.lock);
+
+    for (int i = 0; i < count; i++)
+        metrics_render_session(out, &recent[i], recent[i].completed ? "completed" : "aborted");
+    free(recent);
+}
+
+/**
+ * @brief Rewrite the metrics file atomically.
+ */
+static void metrics_write_file(void) {
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metrics.file);
+
+    FILE *out = fopen(tmp, "w");
+    if (!out) {
+        perror("Metrics file");
+        return;
+    }
+    metrics_render(out, metrics.workers, metrics.count);
+    if (fclose(out) != 0 || rename(tmp, metrics.file) != 0) {
+        perror("Metrics file");
+        unlink(tmp);
+    }
+}
+
+/**
+ * @brief Answer one admin connection: read a command, write the reply, close.
+ *
+ * @param fd Accepted connection.
+ */
+static void metrics_serve(int fd) {
+    char cmd[64];
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)); // a stuck reader must not stall the file
+
+    ssize_t n = recv(fd, cmd, sizeof(cmd) - 1, 0);
+    if (n <= 0) {
+        close(fd);
+        return;
+    }
+    cmd[n] = 0;
+    cmd[strcspn(cmd, "\r\n")] = 0;
+
+    FILE *out = fdopen(fd, "w");
+    if (!out) {
+        close(fd);
+        return;
+    }
+    if (strcmp(cmd, "stats") == 0)
+        metrics_render(out, metrics.workers, metrics.count);
+    else if (strcmp(cmd, "sessions") == 0)
+        metrics_render_sessions(out);
+    else
+        fprintf(out, "unknown command '%s' (stats, sessions)\n", cmd);
+    fclose(out);
+}
+
+/**
+ * @brief Body of the metrics thread.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void *metrics_main(void *arg) {
+    (void)arg;
+    struct pollfd fds[2] = {
+        {.fd = metrics.stop_pipe[0], .events = POLLIN},
+        {.fd = metrics.admin_sock, .events = POLLIN},
+    };
+    int nfds = metrics.admin_sock >= 0 ? 2 : 1;
+    uint64_t next_write = 0;
+
+    while (1) {
+        uint64_t now = now_ms();
+        if (metrics.file[0] && now >= next_write) {
+            metrics_write_file();
+            next_write = now + (uint64_t)metrics.interval * 1000;
+        }
+
+        int timeout = metrics.file[0] ? (int)(next_write - now) : -1;
+        if (poll(fds, nfds, timeout) < 0 && errno != EINTR)
+            break;
+        if (fds[0].revents)
+            break; // stopping
+        if (nfds > 1 && (fds[1].revents & POLLIN)) {
+            int fd = accept(metrics.admin_sock, NULL, NULL);
+            if (fd >= 0)
+                metrics_serve(fd);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Create the listening admin socket.
+ *
+ * @param path Unix socket path; an old socket file there is replaced.
+ * @return int The socket, or -1 on error.
+ */
+static int metrics_admin_socket(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Admin socket path too long: %s\n", path);
+        return -1;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        perror("Admin socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 8) < 0) {
+        perror("Admin socket");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Start the metrics thread.
+ *
+ * Nothing is started when neither a file nor an admin socket is requested.
+ *
+ * @param workers Array of workers.
+ * @param count Number of workers.
+ * @param file Metrics file path, NULL for none.
+ * @param interval Seconds between rewrites of the file.
+ * @param admin_path Unix socket path of the admin socket, NULL for none.
+ * @return int 0 on success, -1 on error.
+ */
+int metrics_start(tftp_worker *workers, int count, const char *file, int interval, const char *admin_path) {
+    if (!file && !admin_path)
+        return 0;
+
+    metrics.workers = workers;
+    metrics.count = count;
+    metrics.interval = interval > 0 ? interval : METRICS_DEFAULT_INTERVAL;
+    if (file)
+        snprintf(metrics.file, sizeof(metrics.file), "%s", file);
+    if (admin_path) {
+        metrics.admin_sock = metrics_admin_socket(admin_path);
+        if (metrics.admin_sock < 0)
+            return -1;
+        snprintf(metrics.admin_path, sizeof(metrics.admin_path), "%s", admin_path);
+    }
+    if (pipe(metrics.stop_pipe) < 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    int err = pthread_create(&metrics.thread, NULL, metrics_main, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create metrics: %s\n", strerror(err));
+        return -1;
+    }
+    metrics.running = 1;
+    return 0;
+}
+
+/**
+ * @brief Stop the metrics thread, write the file a last time and remove the admin socket.
+ */
+void metrics_stop(void) {
+    if (!metrics.running)
+        return;
+
+    char c = 0;
+    if (write(metrics.stop_pipe[1], &c, 1) < 0)
+        perror("write");
+    pthread_join(metrics.thread, NULL);
+    metrics.running = 0;
+
+    if (metrics.file[0])
+        metrics_write_file();
+    if (metrics.admin_sock >= 0) {
+        close(metrics.admin_sock);
+        unlink(metrics.admin_path);
+    }
+    close(metrics.stop_pipe[0]);
+    close(metrics.stop_pipe[1]);
+}
@@ -0,0 +1,82 @@
+/**
+ * @file tftp_metrics.h
+ * @brief Prometheus text export of the server counters, and the local admin socket.
+ */
+
+#ifndef TFTP_METRICS_H
+#define TFTP_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define METRICS_RTT_BUCKETS      13    // round-trip time histogram, last bucket is +Inf
+#define METRICS_DURATION_BUCKETS 11    // transfer duration histogram, last bucket is +Inf
+#define METRICS_RECENT           32    // finished sessions listed by the admin "sessions" command
+#define METRICS_DEFAULT_INTERVAL 10    // seconds between rewrites of the metrics file
+#define METRICS_LIVE_INTERVAL_MS 500   // workers copy out their active sessions for "sessions" this often
+
+struct tftp_worker;
+
+/**
+ * @brief Counters of one finished transfer, or of an active one so far.
+ */
+typedef struct tftp_session_summary {
+    char filename[256];    ///< File transferred
+    char client[32];       ///< Client address and port
+    int opcode;            ///< OP_RRQ or OP_WRQ
+    int completed;         ///< 1 if the transfer finished, 0 if it was aborted
+    uint64_t bytes;        ///< Payload bytes sent or received
+    uint64_t blocks;       ///< DATA blocks sent (first transmission) or received
+    uint64_t retransmits;  ///< Packets resent
+    uint64_t crc_errors;   ///< DATA blocks dropped for a bad per-block check
+    uint64_t timeouts;     ///< Retransmission timeouts
+    uint64_t duration_ms;  ///< Time from the request to the end of the transfer (or to now)
+    uint32_t rtt_us;       ///< Smoothed round-trip time, 0 if never measured
+    uint32_t cwnd;         ///< RRQ congestion window in blocks, 0 for a WRQ
+} tftp_session_summary;
+
+/**
+ * @brief Histogram bucket of a round-trip time.
+ * @param us Round-trip time in microseconds.
+ * @return Bucket index, below METRICS_RTT_BUCKETS.
+ */
+int metrics_rtt_bucket(uint64_t us);
+
+/**
+ * @brief Histogram bucket of a transfer duration.
+ * @param ms Duration in milliseconds.
+ * @return Bucket index, below METRICS_DURATION_BUCKETS.
+ */
+int metrics_duration_bucket(uint64_t ms);
+
+/**
+ * @brief Records a finished transfer for the admin "sessions" command.
+ * @param summary Counters of the transfer.
+ */
+void metrics_session_done(const tftp_session_summary *summary);
+
+/**
+ * @brief Writes every counter in the Prometheus text format.
+ * @param out Output stream.
+ * @param workers Array of workers.
+ * @param count Number of workers.
+ */
+void metrics_render(FILE *out, struct tftp_worker *workers, int count);
+
+/**
+ * @brief Starts the metrics thread: rewrites the metrics file and serves the admin socket.
+ * @param workers Array of workers.
+ * @param count Number of workers.
+ * @param file Metrics file path, NULL for none.
+ * @param interval Seconds between rewrites of the file.
+ * @param admin_path Unix socket path of the admin socket, NULL for none.
+ * @return 0 on success, -1 on error.
+ */
+int metrics_start(struct tftp_worker *workers, int count, const char *file, int interval, const char *admin_path);
+
+/**
+ * @brief Stops the metrics thread, writes the file a last time and removes the admin socket.
+ */
+void metrics_stop(void);
+
+#endif // TFTP_METRICS_H
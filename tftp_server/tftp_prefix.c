@@ -0,0 +1,146 @@
+/**
+ * @file tftp_prefix.c
+ * @brief Prefix CRC-32C of resumed transfers, on a helper thread.
+ *
+ * A resumed download is checked against the CRC-32C of the bytes the client
+ * already holds, and a resumed upload announces the CRC-32C of the bytes the
+ * server kept. Either prefix can be most of a large image, so it is never
+ * read on an event loop: the session queues a job here and holds its OACK
+ * back until the result is in. Jobs live in their sessions, so the queue is
+ * a plain list and never fills up.
+ */
+
+#include "tftp_prefix.h"
+#include "tftp_crc.h"
+#include "tftp_mapguard.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int running;
+    int stopping;
+    tftp_prefix_job *head;   ///< Next job
+    tftp_prefix_job *tail;   ///< Last job queued
+} prefix_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+/**
+ * @brief Body of the prefix thread: checksum queued prefixes until stopped.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void *prefix_main(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&prefix_queue.lock);
+    while (1) {
+        while (!prefix_queue.head && !prefix_queue.stopping)
+            pthread_cond_wait(&prefix_queue.wake, &prefix_queue.lock);
+        if (prefix_queue.stopping)
+            break;
+
+        tftp_prefix_job *job = prefix_queue.head;
+        prefix_queue.head = job->next;
+        if (!prefix_queue.head)
+            prefix_queue.tail = NULL;
+        pthread_mutex_unlock(&prefix_queue.lock);
+
+        int status = PREFIX_DONE;
+        sigjmp_buf fault;
+        if (job->map) {
+            // the file may be truncated under its mapping: then the prefix cannot match
+            if (sigsetjmp(fault, 0) == 0) {
+                mapguard_enter(&fault);
+                job->crc = crc32c_update(0, job->map, job->len);
+                mapguard_leave();
+            } else {
+                status = PREFIX_FAILED;
+            }
+        } else if (crc32c_file(job->fd, job->len, &job->crc) < 0)
+            status = PREFIX_FAILED;
+        // the session may free the job as soon as it sees the status
+        __atomic_store_n(&job->status, status, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&prefix_queue.lock);
+    }
+    pthread_mutex_unlock(&prefix_queue.lock);
+    return NULL;
+}
+
+/**
+ * @brief Start the prefix thread.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int prefix_start(void) {
+    int err = pthread_create(&prefix_queue.thread, NULL, prefix_main, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create prefix: %s\n", strerror(err));
+        return -1;
+    }
+    pthread_mutex_lock(&prefix_queue.lock);
+    prefix_queue.running = 1;
+    pthread_mutex_unlock(&prefix_queue.lock);
+    return 0;
+}
+
+/**
+ * @brief Stop the prefix thread once its current job is done.
+ *
+ * Queued jobs are abandoned: their sessions are only left at exit.
+ */
+void prefix_stop(void) {
+    if (!prefix_queue.running)
+        return;
+
+    pthread_mutex_lock(&prefix_queue.lock);
+    prefix_queue.stopping = 1;
+    pthread_cond_signal(&prefix_queue.wake);
+    pthread_mutex_unlock(&prefix_queue.lock);
+
+    pthread_join(prefix_queue.thread, NULL);
+    prefix_queue.running = 0;
+}
+
+/**
+ * @brief Queue a prefix to checksum.
+ *
+ * @param job Job with map or fd and len set, valid until it is done.
+ * @return int 0 if queued, -1 if the thread is not running (the job is marked failed).
+ */
+int prefix_submit(tftp_prefix_job *job) {
+    job->status = PREFIX_QUEUED;
+    job->next = NULL;
+
+    pthread_mutex_lock(&prefix_queue.lock);
+    if (!prefix_queue.running || prefix_queue.stopping) {
+        pthread_mutex_unlock(&prefix_queue.lock);
+        job->status = PREFIX_FAILED;
+        return -1;
+    }
+    if (prefix_queue.tail)
+        prefix_queue.tail->next = job;
+    else
+        prefix_queue.head = job;
+    prefix_queue.tail = job;
+    pthread_cond_signal(&prefix_queue.wake);
+    pthread_mutex_unlock(&prefix_queue.lock);
+    return 0;
+}
+
+/**
+ * @brief Read the state of a job.
+ *
+ * @param job Submitted job.
+ * @return int PREFIX_QUEUED, PREFIX_DONE or PREFIX_FAILED.
+ */
+int prefix_status(const tftp_prefix_job *job) {
+    return __atomic_load_n(&job->status, __ATOMIC_ACQUIRE);
+}
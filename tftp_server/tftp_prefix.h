@@ -0,0 +1,52 @@
+/**
+ * @file tftp_prefix.h
+ * @brief CRC-32C of the prefix a resumed transfer continues after, computed off the event loops.
+ */
+
+#ifndef TFTP_PREFIX_H
+#define TFTP_PREFIX_H
+
+#include <stdint.h>
+
+#define PREFIX_POLL_MS 2   // a session waiting for its prefix CRC checks it this often
+
+enum { PREFIX_QUEUED, PREFIX_DONE, PREFIX_FAILED };
+
+/**
+ * @brief One prefix to checksum, owned by the session that submitted it.
+ */
+typedef struct tftp_prefix_job {
+    const unsigned char *map;      ///< Mapped file, or NULL to read fd
+    int fd;                        ///< File read when map is NULL
+    uint64_t len;                  ///< Bytes from the start of the file
+    uint32_t crc;                  ///< Result, valid once status is PREFIX_DONE
+    int status;                    ///< PREFIX_QUEUED until the helper thread is done with it
+    struct tftp_prefix_job *next;  ///< Next job of the queue
+} tftp_prefix_job;
+
+/**
+ * @brief Starts the prefix thread.
+ * @return 0 on success, -1 on error.
+ */
+int prefix_start(void);
+
+/**
+ * @brief Stops the prefix thread; queued jobs are abandoned.
+ */
+void prefix_stop(void);
+
+/**
+ * @brief Queues a job. The job and its file must stay valid until prefix_status() is not PREFIX_QUEUED.
+ * @param job Job with map or fd and len set.
+ * @return 0 if queued, -1 if the prefix thread is not running (the job is marked PREFIX_FAILED).
+ */
+int prefix_submit(tftp_prefix_job *job);
+
+/**
+ * @brief Reads the state of a job.
+ * @param job Submitted job.
+ * @return PREFIX_QUEUED, PREFIX_DONE or PREFIX_FAILED.
+ */
+int prefix_status(const tftp_prefix_job *job);
+
+#endif // TFTP_PREFIX_H
@@ -0,0 +1,67 @@
+/**
+ * @file tftp_ring.h
+ * @brief Preallocated packet buffers filled by recvmmsg(), several datagrams per syscall.
+ */
+
+#ifndef TFTP_RING_H
+#define TFTP_RING_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Datagrams received per recvmmsg() call
+#define RING_BATCH 32
+
+/**
+ * @brief Fixed set of receive slots shared by every socket of one event loop.
+ *
+ * The loop handles one socket at a time, so a single ring per loop is enough:
+ * a batch is fully processed before the next recvmmsg() overwrites it.
+ */
+typedef struct tftp_ring {
+    int count;                    ///< Number of slots
+    int slot_size;                ///< Largest datagram accepted per slot
+    unsigned char *data;          ///< count slots of slot_size + 1 bytes (room for a NUL)
+    struct mmsghdr *msgs;         ///< One message header per slot
+    struct iovec *iov;            ///< One buffer per slot
+    struct sockaddr_in *addrs;    ///< Sender address of each slot
+} tftp_ring;
+
+/**
+ * @brief Allocates the slots of a ring.
+ * @param ring Ring to initialize.
+ * @param count Number of slots.
+ * @param slot_size Largest datagram to receive.
+ * @return 0 on success, -1 on error.
+ */
+int ring_init(tftp_ring *ring, int count, int slot_size);
+
+/**
+ * @brief Frees the slots of a ring.
+ * @param ring Ring to release.
+ */
+void ring_free(tftp_ring *ring);
+
+/**
+ * @brief Receives up to ring->count datagrams from a non-blocking socket.
+ * @param ring Ring to fill.
+ * @param sock Socket to read.
+ * @return Number of datagrams received, 0 if none was queued, -1 on error.
+ */
+int ring_recv(tftp_ring *ring, int sock);
+
+/**
+ * @brief Returns the payload of slot i (valid until the next ring_recv()).
+ */
+static inline unsigned char *ring_packet(tftp_ring *ring, int i) {
+    return ring->iov[i].iov_base;
+}
+
+/**
+ * @brief Returns the length of the datagram in slot i, or -1 if it was truncated.
+ */
+static inline int ring_length(tftp_ring *ring, int i) {
+    return (ring->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? -1 : (int)ring->msgs[i].msg_len;
+}
+
+#endif // TFTP_RING_H
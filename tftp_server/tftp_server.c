@@ -3,18 +3,44 @@
  * @brief TFTP Server implementation supporting RRQ (read), WRQ (write), and DELETE operations.
  *
  * This TFTP server listens on a fixed port and handles TFTP requests from clients using the UDP protocol.
+ * Transfers run as non-blocking sessions driven by an epoll event loop (see tftp_loop.c), so many
+ * clients are served concurrently on one thread; several such loops run in parallel as
+ * SO_REUSEPORT-sharded worker threads (see tftp_worker.c).
  * It supports:
  *   - Read requests (RRQ): Sends files to the client with CRC-8 validation and ACK-based reliability.
+ *     Files are memory-mapped and DATA packets are gathered straight from the mapping; a window
+ *     is sent with one sendmmsg() call, coalesced with UDP GSO where block sizes allow.
+ *     Frequently downloaded files are served from a shared in-memory cache filled by its own thread,
+ *     larger ones take their CRCs from index files built in the background (tftp_crcindex.c).
+ *   - Optional io_uring engine: receives, DATA sends and upload writes are queued as SQEs.
+ *   - Option negotiation (RFC 2347) with an OACK reply; blksize (RFC 2348) up to 65464 bytes.
+ *   - Sliding windows (RFC 7440 windowsize) with cumulative ACKs and go-back-N recovery.
+ *   - Block number rollover (wrap to 0 or 1) and 64-bit offsets: no file size limit.
+ *   - tsize (RFC 2349) and offset/length options: an RRQ may fetch one byte range of a file.
+ *   - resume option: interrupted downloads and uploads continue where they stopped, once
+ *     a CRC-32C of the bytes already transferred shows both sides hold the same prefix.
+ *   - digest option: both sides hash the payload as it goes by and compare the SHA-256
+ *     after the last block; an upload whose digest differs is discarded, not saved.
  *   - Write requests (WRQ): Receives files from clients with CRC-8 validation and sends ACKs.
+ *     Blocks are coalesced into large aligned chunks written with pwrite(), optionally with O_DIRECT.
  *   - Delete requests: Deletes a file and sends confirmation or failure.
- *   - CRC-8 error detection for data blocks to ensure data integrity.
+ *   - CRC-8 error detection for data blocks to ensure data integrity; the check option trades it
+ *     for none (trusted links), CRC-32C or xxHash64 per transfer.
+ *   - compress option: every DATA block is sent LZ4-compressed, or raw when it does not shrink;
+ *     cached files keep their compressed blocks so a hot file is compressed only once.
  *   - Dynamic port binding for each data transfer session (per client).
- *   - Backup creation for uploaded files under the "backup" folder.
+ *   - Uploads are received into a temporary file, synced and renamed into place in group commits (tftp_commit.c).
+ *   - Backup creation for uploaded files under the "backup" folder, in the background (tftp_backup.c).
  *   - Ping support (client sends "__ping__" RRQ and receives a single dummy DATA block).
  *    -The server is robust against missing ACKs or CRC mismatches and supports retransmission retries.
  */
 
  #include "tftp_server.h"
+ #include "tftp_loop.h"
+ #include "tftp_worker.h"
+ #include "tftp_backup.h"
+ #include "tftp_commit.h"
+ #include "tftp_mapguard.h"
  #include <stdio.h>
  #include <stdlib.h>
  #include <string.h>
@@ -23,24 +49,55 @@
  #include <sys/socket.h>
  #include <sys/time.h>
  #include <sys/stat.h>
+ #include <sys/mman.h>
+ #include <sys/uio.h>
+ #include <netinet/udp.h>
  #include <errno.h>
- 
- /**
-  * @brief Calculate CRC-8 checksum over a data buffer.
-  * 
-  * @param data Pointer to input data buffer.
-  * @param len Length of the input buffer.
-  * @return uint8_t The computed CRC-8 value.
-  */
- uint8_t calculate_crc8(const uint8_t *data, size_t len) {
-     uint8_t crc = 0;
-     for (size_t i = 0; i < len; ++i) {
-         crc ^= data[i];
-         for (int j = 0; j < 8; ++j)
-             crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
-     }
-     return crc;
- }
+ #include <fcntl.h>
+ #include <time.h>
+ #include <signal.h>
+ #include <pthread.h>
+
+ tftp_config g_config = {
+     .workers = 0,         // 0: one worker per CPU
+     .stats_interval = 0,
+     .max_blksize = MAX_BLKSIZE,
+     .max_windowsize = 64,
+     .send_mode = SEND_GSO,
+     .engine = ENGINE_EPOLL,
+     .cache_size = (size_t)CACHE_DEFAULT_MB << 20,
+     .crc_index = 1,
+     .write_chunk = WRITE_CHUNK_DEFAULT,
+     .direct_min = 0,
+     .metrics_file = NULL,
+     .metrics_interval = METRICS_DEFAULT_INTERVAL,
+     .admin_socket = NULL,
+ };
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+/**
+ * @brief DATA packets of an RRQ window waiting to be sent.
+ *
+ * Each packet is three iovecs: its header, its payload (in the file mapping)
+ * and its check trailer (empty when the check is "none"). With the io_uring engine the burst is allocated and stays
+ * alive until every sendmsg submitted for it has completed.
+ */
+typedef struct rrq_burst {
+    int count;                          ///< Packets queued
+    int len[SEND_BATCH];                ///< Length of each packet
+    unsigned char header[SEND_BATCH][4];
+    unsigned char check[SEND_BATCH][CHECK_MAX_LEN];
+    struct iovec iov[SEND_BATCH][3];
+    struct mmsghdr msgs[SEND_BATCH];    ///< Messages built from the packets
+    int first[SEND_BATCH];              ///< First packet of each message
+    char control[SEND_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+    int async;                          ///< Allocated for io_uring submission
+    int pending;                        ///< io_uring: sendmsg operations not completed yet
+    tftp_session *session;              ///< io_uring: session that sent the burst
+} rrq_burst;
  
  /**
   * @brief Send an ERROR packet to the client with a specific error message.
@@ -64,287 +121,1689 @@
      sendto(sock, buffer, len, 0, (struct sockaddr *)client, client_len);
  }
  
- /**
-  * @brief Creates a backup copy of a file inside the "backup" folder.
-  * 
-  * @param filename Name of the file to back up.
-  */
- void backup_file(const char *filename) {
-     char backup_dir[] = "backup";
- 
-     // Create backup directory if it doesn't exist
-     struct stat st = {0}; // reset struct
-     // if DIR not exist so create
-     if (stat(backup_dir, &st) == -1) {
-
-        // creat DIR with permission setting
-         if (mkdir(backup_dir, 0755) != 0) {
-             perror("Failed to create BACKUP directory");
-             return;
-         }
-     }
- 
-     char backup_path[512];
-     snprintf(backup_path, sizeof(backup_path), "%s/%s", backup_dir, filename);
- 
-     // open source file
-     FILE *src = fopen(filename, "rb");
-     if (!src) {
-         perror("Backup: cannot open source file");
-         return;
-     }
+/**
+ * @brief Return the monotonic clock in milliseconds.
+ *
+ * @return uint64_t Milliseconds since an arbitrary fixed point.
+ */
+uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Switch a socket to non-blocking mode.
+ *
+ * @param sock Socket file descriptor.
+ */
+void set_nonblocking(int sock) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags >= 0)
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * @brief Create a non-blocking UDP socket bound to a dynamic port.
+ *
+ * @return int The socket, or -1 on error.
+ */
+static int open_data_socket(void) {
+    // Create new UDP socket for data transfer
+    int data_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (data_sock < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in data_addr = {0}; // Initialize address struct with zeros
+    data_addr.sin_family = AF_INET;     // IPv4
+    data_addr.sin_addr.s_addr = INADDR_ANY; // Accept any IP
+    data_addr.sin_port = 0;             // System chooses a dynamic port
+
+    // Bind socket to dynamic port
+    if (bind(data_sock, (struct sockaddr *)&data_addr, sizeof(data_addr)) < 0) {
+        perror("bind");
+        close(data_sock);
+        return -1;
+    }
+
+    set_nonblocking(data_sock);
+    return data_sock;
+}
+
+/**
+ * @brief Allocate a session for a new transfer and give it its own data socket.
+ *
+ * The negotiated block size is taken from the request options (capped by the
+ * server limit) and the packet buffers are sized for it.
+ *
+ * @param opcode OP_RRQ or OP_WRQ.
+ * @param stats Counters of the owning worker.
+ * @param uring io_uring of the owning loop, NULL with the epoll engine.
+ * @param client Client's address.
+ * @param client_len Length of client's address.
+ * @param filename The name of the file to transfer.
+ * @param opts Options sent with the request.
+ * @return tftp_session* The new session, or NULL on error.
+ */
+static tftp_session *session_new(int opcode, tftp_stats *stats, tftp_uring *uring, struct sockaddr_in *client,
+                                 socklen_t client_len, const char *filename, const tftp_options *opts) {
+    tftp_session *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+
+    s->blksize = MAX_DATA_SIZE;
+    if (opts->blksize)
+        s->blksize = opts->blksize < g_config.max_blksize ? opts->blksize : g_config.max_blksize;
+
+    // without the rollover option block numbers still wrap to 0
+    s->wrap_to = opts->rollover == ROLLOVER_TO_1 ? 1 : 0;
+
+    s->windowsize = 1;
+    if (opts->windowsize)
+        s->windowsize = opts->windowsize < g_config.max_windowsize ? opts->windowsize : g_config.max_windowsize;
+    s->send_mode = g_config.send_mode;
+    cc_init(&s->cc, g_config.cc, s->windowsize);
+
+    // without the check option every block carries a CRC-8
+    s->check = opts->check != CHECK_ABSENT ? opts->check : CHECK_CRC8;
+    s->check_len = block_check_len(s->check);
+
+    s->digest = opts->digest;
+    if (s->digest)
+        sha256_init(&s->sha);
+
+    // every compressed payload starts with its frame flag
+    s->compress = opts->compress;
+    int frame_len = s->compress ? COMPRESS_FLAG_LEN : 0;
+
+    // big enough for a full DATA block, an OACK or an ERROR packet
+    s->packet_size = s->blksize + 4 + frame_len + s->check_len;
+    if (s->packet_size < MAX_PACKET_SIZE)
+        s->packet_size = MAX_PACKET_SIZE;
+
+    s->buffer = malloc(s->packet_size);
+    if (s->compress)
+        s->zbuf = malloc(opcode == OP_RRQ ? RRQ_ZBUF_SIZE : s->blksize);
+    if (!s->buffer || (s->compress && !s->zbuf)) {
+        perror("malloc");
+        free(s->buffer);
+        free(s->zbuf);
+        free(s);
+        return NULL;
+    }
+
+    s->data_sock = open_data_socket();
+    if (s->data_sock < 0) {
+        free(s->buffer);
+        free(s->zbuf);
+        free(s);
+        return NULL;
+    }
+
+    // An upload window arrives as one burst: the socket must hold all of it, or
+    // the tail of every window is dropped (the kernel caps this at rmem_max)
+    uint64_t window_bytes = (uint64_t)s->windowsize * s->packet_size * 2;
+    int rcvbuf = window_bytes < INT_MAX ? (int)window_bytes : INT_MAX;
+    if (opcode == OP_WRQ && rcvbuf > RCVBUF_DEFAULT)
+        setsockopt(s->data_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    s->opcode = opcode;
+    s->stats = stats;
+    rto_init(&s->rto);
+    s->uring = uring;
+    s->sock_slot = uring ? uring_file_register(uring, s->data_sock) : -1;
+    s->file_slot = -1;
+    s->write_buf = -1;
+    s->client = *client;
+    s->started_ms = now_ms();
+    s->client_len = client_len;
+    snprintf(s->filename, sizeof(s->filename), "%s", filename);
+    return s;
+}
+
+static void wrq_flush(tftp_session *s);
+
+/**
+ * @brief Release the file, socket and buffers of a session and free it.
+ *
+ * The temporary file of an aborted upload that received data is kept for a
+ * resume, up to the last byte written.
+ *
+ * @param s Session to close.
+ */
+void session_close(tftp_session *s) {
+    if (s->sock_slot >= 0)
+        uring_file_unregister(s->uring, s->sock_slot);
+    if (s->file_slot >= 0)
+        uring_file_unregister(s->uring, s->file_slot);
+    if (s->write_buf >= 0)
+        uring_write_put(s->uring, s->write_buf);
+    crcindex_close(&s->crc_index);
+    if (s->cached)
+        cache_put(s->cached);
+    else if (s->map)
+        munmap((void *)s->map, s->file_size);
+    if (s->tmpname[0] && s->file) {
+        // aborted upload
+        if (s->chunk)
+            wrq_flush(s);
+        // a resume refused by the client (its file differs) received nothing: drop it
+        int received = !s->write_failed && (uint64_t)s->write_off > s->resume;
+        commit_keep_partial(s->file, s->tmpname, s->filename, received ? s->write_off : 0);
+        s->file = NULL;
+    }
+    if (s->file)
+        fclose(s->file);
+    close(s->data_sock);
+    free(s->chunk);
+    free(s->zbuf);
+    free(s->buffer);
+    free(s);
+}
+
+/**
+ * @brief Drop one io_uring operation reference of a session.
+ *
+ * A session removed from its loop is only freed once nothing in flight
+ * refers to it any more.
+ *
+ * @param s Session.
+ */
+void session_io_done(tftp_session *s) {
+    if (--s->io_pending == 0 && s->closing)
+        session_close(s);
+}
+
+/**
+ * @brief Send the packet currently held in the session buffer to the client.
+ *
+ * The length is remembered so the packet can be resent on timeout.
+ *
+ * @param s Session.
+ * @param len Length of the packet.
+ */
+static void session_send(tftp_session *s, int len) {
+    s->tx_len = len;
+    sendto(s->data_sock, s->buffer, len, 0, (struct sockaddr *)&s->client, s->client_len);
+}
+
+/**
+ * @brief Send an OACK confirming the options the server accepted.
+ *
+ * Only options present in the request are listed, with the values granted.
+ *
+ * @param s Session.
+ * @param opts Options sent with the request.
+ */
+static void session_send_oack(tftp_session *s, const tftp_options *opts) {
+    tftp_options accepted = {0};
+    if (opts->blksize)
+        accepted.blksize = s->blksize;
+    if (opts->windowsize)
+        accepted.windowsize = s->windowsize;
+    accepted.rollover = opts->rollover;
+    accepted.check = opts->check;
+    accepted.digest = opts->digest;
+    accepted.compress = opts->compress;
+    if (opts->has_tsize && (s->opcode == OP_WRQ || s->file_size >= 0)) {
+        // RFC 2349: the size of the file sent, or the upload size echoed
+        accepted.has_tsize = 1;
+        accepted.tsize = s->opcode == OP_RRQ ? (uint64_t)s->file_size : opts->tsize;
+    }
+    if (s->opcode == OP_RRQ) {
+        accepted.offset = opts->offset;
+        accepted.length = opts->length;
+    }
+    if (s->resume) {
+        // left out when the transfer starts over from byte 0
+        accepted.resume = s->resume;
+        accepted.has_prefixcrc = 1;
+        accepted.prefixcrc = s->resume_crc;
+    }
+
+    session_send(s, oack_build(s->buffer, s->packet_size, &accepted));
+    s->retries = MAX_RETRIES - 1;
+    s->deadline = now_ms() + s->rto.rto_ms;
+}
+
+/**
+ * @brief Fill the admin summary of a session with its counters so far.
+ *
+ * @param s Session.
+ * @param completed 1 if the transfer finished, 0 if it was aborted or is still running.
+ * @param summary Filled with the counters.
+ */
+void session_summarize(const tftp_session *s, int completed, tftp_session_summary *summary) {
+    *summary = (tftp_session_summary){
+        .opcode = s->opcode,
+        .completed = completed,
+        .bytes = s->bytes,
+        .blocks = s->blocks,
+        .retransmits = s->retransmits,
+        .crc_errors = s->crc_errors,
+        .timeouts = s->timeouts,
+        .duration_ms = now_ms() - s->started_ms,
+        .rtt_us = s->rto.srtt_us,
+        .cwnd = s->opcode == OP_RRQ ? s->cc.cwnd : 0,
+    };
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &s->client.sin_addr, ip, sizeof(ip));
+    snprintf(summary->client, sizeof(summary->client), "%s:%d", ip, ntohs(s->client.sin_port));
+    snprintf(summary->filename, sizeof(summary->filename), "%s", s->filename);
+}
+
+/**
+ * @brief Account for a finished or aborted transfer.
+ *
+ * Updates the worker counters and the duration histogram, and records the
+ * counters of the transfer for the admin "sessions" command.
+ *
+ * @param s Session.
+ * @param completed 1 if the transfer finished, 0 if it was aborted.
+ */
+static void session_end(tftp_session *s, int completed) {
+    tftp_session_summary summary;
+    session_summarize(s, completed, &summary);
+    if (completed) {
+        STAT_ADD(s->stats, completed, 1);
+        STAT_ADD(s->stats, duration_hist[metrics_duration_bucket(summary.duration_ms)], 1);
+        STAT_ADD(s->stats, duration_sum_ms, summary.duration_ms);
+    } else {
+        STAT_ADD(s->stats, aborted, 1);
+    }
+    metrics_session_done(&summary);
+}
+
+/**
+ * @brief Feed the round-trip estimator of a session with an answer from the client.
+ *
+ * @param s Session.
+ * @param seq Highest block (or ACK number) the client answered.
+ * @return uint32_t The round-trip sample in microseconds, 0 if none was taken.
+ */
+static uint32_t session_rtt_sample(tftp_session *s, uint64_t seq) {
+    if (!rto_ack(&s->rto, seq))
+        return 0;
+    STAT_ADD(s->stats, rtt_samples, 1);
+    STAT_ADD(s->stats, rtt_sum_us, s->rto.rtt_us);
+    STAT_ADD(s->stats, rtt_hist[metrics_rtt_bucket(s->rto.rtt_us)], 1);
+    return s->rto.rtt_us;
+}
+
+/**
+ * @brief Map the file of an RRQ session into memory.
+ *
+ * The kernel is told the mapping is read sequentially, to read ahead the first
+ * window, and to back large files with huge pages where it can. When the file
+ * cannot be mapped, blocks are read with pread() instead.
+ *
+ * @param s RRQ session with an open file.
+ */
+static void rrq_map_file(tftp_session *s) {
+    struct stat st;
+    if (fstat(fileno(s->file), &st) < 0 || !S_ISREG(st.st_mode)) {
+        s->file_size = -1; // unknown: read with pread() until a short block
+        return;
+    }
+    s->file_size = st.st_size;
+    if (st.st_size == 0)
+        return;
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(s->file), 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    size_t ahead = (size_t)s->blksize * s->windowsize * 4;
+    madvise(map, ahead < (size_t)st.st_size ? ahead : (size_t)st.st_size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if (st.st_size >= RRQ_HUGEPAGE_MIN)
+        madvise(map, st.st_size, MADV_HUGEPAGE);
+#endif
+    s->map = map;
+}
+
+/**
+ * @brief Open the file of an RRQ session: from the cache, or mapped from disk.
+ *
+ * A file found in the hot-file cache is not opened at all. Otherwise it is
+ * mapped (the cache thread loads it once it has been asked for often
+ * enough); the CRCs of a mapped file come from its index file when that is
+ * up to date.
+ *
+ * @param s RRQ session.
+ * @return int 0 on success, -1 if the file cannot be opened.
+ */
+static int rrq_open_file(tftp_session *s) {
+    struct stat st;
+    // the precomputed CRC-8s only serve uncompressed CRC-8 transfers
+    int want_crcs = s->check == CHECK_CRC8 && !s->compress;
+    if (stat(s->filename, &st) == 0 && S_ISREG(st.st_mode))
+        s->cached = cache_lookup(s->filename, &st, s->blksize, want_crcs, &s->crcs);
+
+    if (!s->cached) {
+        s->file = fopen(s->filename, "rb");
+        if (!s->file)
+            return -1;
+        if (fstat(fileno(s->file), &st) < 0)
+            st.st_mode = 0;
+        rrq_map_file(s);
+        // the index only holds CRC-8s, other checks are computed per packet
+        if (g_config.crc_index && want_crcs && crcindex_open(s->filename, &st, s->blksize, &s->crc_index) == 0)
+            s->crcs = s->crc_index.crcs;
+        return 0;
+    }
+    s->map = s->cached->data;
+    s->file_size = s->cached->size;
+    return 0;
+}
+
+/**
+ * @brief Hold the OACK of a session back until the prefix thread has checksummed its prefix.
+ *
+ * @param s Session whose prefix job is set up.
+ * @param opts Options sent with the request, answered once the CRC is in.
+ */
+static void session_wait_prefix(tftp_session *s, const tftp_options *opts) {
+    s->request = *opts;
+    s->prefix_pending = 1;
+    prefix_submit(&s->prefix);
+    s->deadline = now_ms() + PREFIX_POLL_MS;
+}
+
+/**
+ * @brief Queue the check of a resumed download: does the file start with the bytes the client holds?
+ *
+ * @param s RRQ session with its file open.
+ * @param opts Options sent with the request.
+ * @return int Non-zero if the check was queued and the OACK waits for it.
+ */
+static int rrq_resume_submit(tftp_session *s, const tftp_options *opts) {
+    if (!opts->resume || !opts->has_prefixcrc || opts->offset || opts->length)
+        return 0;
+    if (s->file_size < 0 || opts->resume > (uint64_t)s->file_size)
+        return 0;
+    s->prefix.map = s->map;
+    s->prefix.fd = s->file ? fileno(s->file) : -1;
+    s->prefix.len = opts->resume;
+    session_wait_prefix(s, opts);
+    return 1;
+}
+
+/**
+ * @brief Restrict an RRQ session to the byte range requested with the offset and length options.
+ *
+ * Without a range the whole file is sent. A range past the end of the file
+ * is cut at the end (an offset beyond it sends a single empty block). A
+ * resumed download starts where the client's copy ends if that copy is a
+ * prefix of the file (checked by rrq_resume_submit()), and at byte 0 otherwise.
+ *
+ * @param s RRQ session with its file open.
+ * @param opts Options sent with the request.
+ */
+static void rrq_set_range(tftp_session *s, const tftp_options *opts) {
+    // offset and length come from the client: clamp them unsigned, before they become an off_t
+    uint64_t start = opts->offset;
+    uint64_t end = UINT64_MAX;
+    if (opts->length)
+        end = opts->length <= UINT64_MAX - start ? start + opts->length : UINT64_MAX;
+    if (prefix_status(&s->prefix) == PREFIX_DONE && s->prefix.len == opts->resume &&
+        s->prefix.crc == opts->prefixcrc) {
+        s->resume = opts->resume;
+        s->resume_crc = opts->prefixcrc;
+        start = opts->resume;
+    }
+    if (s->file_size >= 0) {
+        uint64_t size = (uint64_t)s->file_size;
+        if (start > size)
+            start = size;
+        if (end > size)
+            end = size;
+    }
+    s->range_start = start <= INT64_MAX ? (off_t)start : INT64_MAX;
+    s->range_end = end <= INT64_MAX ? (off_t)end : -1;
+    if (s->file_size < 0)
+        return;
+
+    if (s->map && !s->cached && s->range_start > 0) {
+        // read ahead where this range starts rather than at the start of the file
+        off_t page = s->range_start & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+        size_t ahead = (size_t)s->blksize * s->windowsize * 4;
+        if ((off_t)ahead > s->file_size - page)
+            ahead = s->file_size - page;
+        madvise((void *)(s->map + page), ahead, MADV_WILLNEED);
+    }
+
+    // the cached frames cover whole blocks of the file, up to its end
+    if (s->compress && s->cached && s->range_start % s->blksize == 0 && s->range_end == s->file_size)
+        s->frames = cache_get_frames(s->cached, s->blksize);
+}
+
+/**
+ * @brief Send every message of an array with as few sendmmsg() calls as possible.
+ *
+ * @param sock Socket to send on.
+ * @param msgs Messages to send.
+ * @param count Number of messages.
+ * @return int Number of messages sent; when short, errno tells why.
+ */
+static int send_all(int sock, struct mmsghdr *msgs, int count) {
+    int sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(sock, msgs + sent, count - sent, 0);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    return sent;
+}
+
+/**
+ * @brief Hand the queued DATA packets of an RRQ session to the kernel.
+ *
+ * SEND_GSO packs runs of equal-sized packets (the last one may be shorter)
+ * into one UDP_SEGMENT super-datagram each, SEND_MMSG sends every packet as
+ * its own message; both need a single sendmmsg() call for the whole burst.
+ * If the kernel or device refuses GSO the session switches to SEND_MMSG, and
+ * to SEND_PLAIN (one sendmsg() per packet) without sendmmsg().
+ * A full socket buffer drops the rest of the burst; the retransmission timer
+ * recovers from that like from any other loss.
+ *
+ * An allocated (async) burst is instead queued as one IORING_OP_SENDMSG per
+ * message and handed over to the ring, which frees it on completion.
+ *
+ * @param s RRQ session.
+ * @param b Queued packets, emptied (or handed over) on return.
+ */
+static void rrq_flush(tftp_session *s, rrq_burst *b) {
+    struct mmsghdr *msgs = b->msgs;
+    int *first = b->first;
+    int start = 0;
+
+    while (start < b->count) {
+        int count = 0;
+        memset(msgs, 0, sizeof(b->msgs));
+
+        for (int i = start; i < b->count; count++) {
+            struct msghdr *m = &msgs[count].msg_hdr;
+            m->msg_name = &s->client;
+            m->msg_namelen = s->client_len;
+            m->msg_iov = b->iov[i];
+            first[count] = i;
+
+            int segments = 1;
+            int bytes = b->len[i];
+            if (s->send_mode == SEND_GSO) {
+                // a run of packets as long as the first; a shorter one may end it
+                while (i + segments < b->count && segments < GSO_MAX_SEGMENTS &&
+                       bytes + b->len[i + segments] <= GSO_MAX_BYTES &&
+                       b->len[i + segments] <= b->len[i] && b->len[i + segments - 1] == b->len[i]) {
+                    bytes += b->len[i + segments];
+                    segments++;
+                }
+            }
+            m->msg_iovlen = 3 * segments;
+
+            if (segments > 1) {
+                m->msg_control = b->control[count];
+                m->msg_controllen = sizeof(b->control[count]);
+                struct cmsghdr *cm = CMSG_FIRSTHDR(m);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t gso_size = b->len[i];
+                memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+            }
+            i += segments;
+        }
+
+        if (b->async) {
+            for (int i = 0; i < count; i++) {
+                struct io_uring_sqe *sqe = uring_get_sqe(s->uring);
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = s->sock_slot >= 0 ? s->sock_slot : s->data_sock;
+                sqe->flags = s->sock_slot >= 0 ? IOSQE_FIXED_FILE : 0;
+                sqe->addr = (uint64_t)(uintptr_t)&msgs[i].msg_hdr;
+                sqe->len = 1;
+                sqe->user_data = (uint64_t)(uintptr_t)b | URING_SEND;
+            }
+            b->pending = count;
+            b->session = s;
+            s->io_pending++;
+            return;
+        }
+
+        if (s->send_mode == SEND_PLAIN) {
+            for (int i = 0; i < count; i++)
+                sendmsg(s->data_sock, &msgs[i].msg_hdr, 0);
+            break;
+        }
+
+        int sent = send_all(s->data_sock, msgs, count);
+        if (sent == count)
+            break;
+
+        if (s->send_mode == SEND_GSO && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ||
+                                         errno == EOPNOTSUPP || errno == EMSGSIZE)) {
+            printf("UDP GSO refused (%s), using sendmmsg\n", strerror(errno));
+            s->send_mode = SEND_MMSG;
+        } else if (errno == ENOSYS) {
+            s->send_mode = SEND_PLAIN;
+        } else {
+            break; // socket buffer full: the rest counts as lost
+        }
+        start = first[sent];
+    }
+    b->count = 0;
+}
+
+/**
+ * @brief Queue one DATA block of an RRQ session for sending.
+ *
+ * The DATA packet is gathered from three pieces (header, payload, CRC); the
+ * payload comes straight from the file mapping, or from a pread() into the
+ * session buffer when the file is not mapped (the caller then flushes the
+ * block at once, as the buffer is reused). With compression the payload is
+ * the block's frame, taken from the cache or compressed into zbuf. Blocks
+ * are addressed by offset so any block of the current window can be resent.
+ *
+ * A mapped file can be truncated by another process while it is sent, so the
+ * reads of the mapping (compression, check, digest) run under a SIGBUS guard.
+ *
+ * @param s RRQ session.
+ * @param b Burst to append to.
+ * @param block Absolute block number to send (1 = first block of the file).
+ * @return int 0 on success, -1 if the file shrank under its mapping (the burst is then unusable).
+ */
+static int rrq_queue_block(tftp_session *s, rrq_burst *b, uint64_t block) {
+    off_t offset = s->range_start + (off_t)(block - 1) * s->blksize;
+    uint16_t wire = block_to_wire(block, s->wrap_to);
+    const unsigned char *payload = &s->buffer[4];
+    ssize_t bytes = s->blksize;
+
+    if (s->range_end >= 0 && bytes > s->range_end - offset)
+        bytes = offset < s->range_end ? s->range_end - offset : 0;
+    if (s->map)
+        payload = s->map + offset;
+    else if (bytes > 0)
+        bytes = pread(fileno(s->file), &s->buffer[4], bytes, offset);
+    if (bytes < 0)
+        bytes = 0;
+
+    // A short block is the last one of the file
+    if (bytes < s->blksize)
+        s->last_block = block;
+
+    sigjmp_buf fault;
+    int guarded = s->map && !s->cached;
+    if (guarded) {
+        if (sigsetjmp(fault, 0))
+            return -1;
+        mapguard_enter(&fault);
+    }
+
+    const unsigned char *data = payload;
+    ssize_t data_len = bytes;
+    if (s->frames) {
+        size_t index = offset / s->blksize;
+        payload = s->frames->data + s->frames->offset[index];
+        bytes = s->frames->offset[index + 1] - s->frames->offset[index];
+    } else if (s->compress) {
+        unsigned char *frame = s->zbuf + s->zbuf_used;
+        bytes = block_pack(data, data_len, frame);
+        s->zbuf_used += bytes;
+        payload = frame;
+    }
+
+    int i = b->count++;
+    unsigned char *header = b->header[i];
+    header[0] = 0;
+    header[1] = OP_DATA;
+    header[2] = (wire >> 8) & 0xFF;
+    header[3] = wire & 0xFF;
+    // the precomputed CRC-8s cover whole uncompressed blocks of the file, not blocks cut by a range
+    if (s->crcs && s->check == CHECK_CRC8 && !s->compress && s->range_start % s->blksize == 0 &&
+        (bytes == s->blksize || offset + bytes == s->file_size))
+        b->check[i][0] = s->crcs[offset / s->blksize];
+    else
+        block_check_put(s->check, payload, bytes, b->check[i]);
+    b->len[i] = bytes + 4 + s->check_len;
+
+    b->iov[i][0] = (struct iovec){.iov_base = header, .iov_len = 4};
+    b->iov[i][1] = (struct iovec){.iov_base = (void *)payload, .iov_len = bytes};
+    b->iov[i][2] = (struct iovec){.iov_base = b->check[i], .iov_len = s->check_len};
+
+    if (block > s->sent_block) {
+        s->sent_block = block;
+        // time the block the client answers, the last one allowed in flight,
+        // so pacing the window does not count as round-trip time
+        if (block == s->block + cc_flight_limit(&s->cc) || block == s->last_block)
+            rto_start(&s->rto, block);
+        cc_on_send(&s->cc, 0);
+        // first transmissions go out in order: they make up the digested stream
+        if (s->digest)
+            sha256_update(&s->sha, data, data_len);
+        STAT_ADD(s->stats, blocks_sent, 1);
+        STAT_ADD(s->stats, bytes_sent, data_len);
+        s->blocks++;
+        s->bytes += data_len;
+        s->wire_bytes += bytes;
+    } else {
+        rto_resent(&s->rto, block);
+        cc_on_send(&s->cc, 1);
+        STAT_ADD(s->stats, retransmits, 1);
+        s->retransmits++;
+    }
+    if (guarded)
+        mapguard_leave();
+    return 0;
+}
+
+/**
+ * @brief Handle the completion of one sendmsg of an io_uring DATA burst.
+ *
+ * Lost sends are recovered by the retransmission timer, as with any loss.
+ *
+ * @param burst Burst the sendmsg belonged to.
+ * @param res Bytes sent or negative errno.
+ */
+void session_on_sent(void *burst, int res) {
+    rrq_burst *b = burst;
+    tftp_session *s = b->session;
+
+    if (res < 0 && s->send_mode == SEND_GSO && (res == -EIO || res == -EINVAL || res == -ENOPROTOOPT ||
+                                                res == -EOPNOTSUPP || res == -EMSGSIZE)) {
+        printf("UDP GSO refused (%s), using sendmmsg\n", strerror(-res));
+        s->send_mode = SEND_MMSG;
+    }
+    if (--b->pending == 0) {
+        free(b);
+        session_io_done(s);
+    }
+}
+
+/**
+ * @brief Get an empty burst: allocated when it can go through io_uring.
+ *
+ * Only mapped payloads and cached frames outlive the call, so unmapped files
+ * and blocks compressed per packet keep the synchronous path.
+ *
+ * @param s RRQ session.
+ * @param local Burst on the caller's stack, used otherwise.
+ * @return rrq_burst* The burst.
+ */
+static rrq_burst *rrq_burst_new(tftp_session *s, rrq_burst *local) {
+    rrq_burst *b = NULL;
+    if (s->uring && s->map && (!s->compress || s->frames))
+        b = malloc(sizeof(*b));
+    if (!b)
+        b = local;
+    b->count = 0;
+    b->async = b != local;
+    return b;
+}
+
+/**
+ * @brief Send blocks from next_block until cwnd blocks are in flight or the file ends.
+ *
+ * Blocks are queued and sent in bursts of up to SEND_BATCH packets. When the
+ * congestion window is smaller than the window, blocks are released at the
+ * pacing rate instead: whatever is due within PACE_SLACK_US goes out now and
+ * pace_at schedules the rest. The client acknowledges a partial window after
+ * rto_ack_delay_us() of silence, which slides it.
+ *
+ * @param s RRQ session.
+ */
+static void rrq_fill_window(tftp_session *s) {
+    rrq_burst local;
+    rrq_burst *burst = rrq_burst_new(s, &local);
+    uint64_t now = rto_now_us();
+
+    s->pace_at = 0;
+    while (s->next_block <= s->block + cc_flight_limit(&s->cc) &&
+           (s->last_block == 0 || s->next_block <= s->last_block)) {
+        uint64_t wait = cc_release(&s->cc, &s->rto, now, PACE_SLACK_US);
+        if (wait > 0) {
+            s->pace_at = now_ms() + (wait + 999) / 1000;
+            break;
+        }
+        if (rrq_queue_block(s, burst, s->next_block) < 0) {
+            // blocks queued so far may point past the new end of the file: none is sent
+            if (burst->async)
+                free(burst);
+            printf("'%s' shrank while it was sent, aborting.\n", s->filename);
+            send_error(s->data_sock, &s->client, s->client_len, 0, "File changed during transfer");
+            session_end(s, 0);
+            s->done = 1;
+            return;
+        }
+        s->next_block++;
+        // without a mapping the payload sits in the session buffer; frames
+        // compressed per packet stay in zbuf until it cannot take another one
+        if (burst->count == SEND_BATCH || !s->map ||
+            (s->compress && !s->frames && RRQ_ZBUF_SIZE - s->zbuf_used < s->blksize + COMPRESS_FLAG_LEN)) {
+            rrq_flush(s, burst);
+            s->zbuf_used = 0;
+            if (burst->async)
+                burst = rrq_burst_new(s, &local);
+        }
+    }
+    if (burst->count > 0)
+        rrq_flush(s, burst);
+    else if (burst->async)
+        free(burst);
+    s->zbuf_used = 0;
+    s->deadline = now_ms() + s->rto.rto_ms;
+}
+
+/**
+ * @brief Release the next paced blocks of an RRQ window.
+ *
+ * @param s Session whose pacing time has come.
+ */
+void session_on_pace(tftp_session *s) {
+    rrq_fill_window(s);
+}
+
+/**
+ * @brief Print how a finished or aborted RRQ used its congestion window.
+ *
+ * @param s RRQ session.
+ */
+static void rrq_report(tftp_session *s) {
+    char cc[128];
+    if (s->windowsize <= 1)
+        return;
+    cc_describe(&s->cc, &s->rto, s->blksize, cc, sizeof(cc));
+    printf("  '%s' %s\n", s->filename, cc);
+}
+
+/**
+ * @brief Print how much a compressed transfer saved.
+ *
+ * @param s Session that finished.
+ */
+static void compress_report(tftp_session *s) {
+    if (!s->compress || s->bytes == 0)
+        return;
+    printf("  '%s' lz4: %llu bytes as %llu (%.1f%%)\n", s->filename, (unsigned long long)s->bytes,
+           (unsigned long long)s->wire_bytes, 100.0 * s->wire_bytes / s->bytes);
+}
+
+/**
+ * @brief End an RRQ session whose last block (and digest, if any) was acknowledged.
+ *
+ * @param s RRQ session.
+ */
+static void rrq_finish(tftp_session *s) {
+    printf("Finished sending '%s'\n", s->filename);
+    rrq_report(s);
+    compress_report(s);
+    session_end(s, 1);
+    s->done = 1;
+}
+
+/**
+ * @brief Send the digest of everything sent, once the last block is acknowledged.
+ *
+ * It travels as the block after the last one; the client acknowledges it if
+ * it matches what was received. It is resent on timeout like an OACK.
+ *
+ * @param s RRQ session.
+ */
+static void rrq_send_digest(tftp_session *s) {
+    uint16_t wire = block_to_wire(s->last_block + 1, s->wrap_to);
+    s->buffer[0] = 0;
+    s->buffer[1] = OP_DIGEST;
+    s->buffer[2] = (wire >> 8) & 0xFF;
+    s->buffer[3] = wire & 0xFF;
+    sha256_final(&s->sha, &s->buffer[4]);
+    s->digest_pending = 1;
+    session_send(s, 4 + SHA256_SIZE);
+    rto_start(&s->rto, s->last_block + 1);
+    s->retries = MAX_RETRIES - 1;
+    s->deadline = now_ms() + s->rto.rto_ms;
+}
+
+/**
+ * @brief Answer a download request once its range is set: OACK, or the first window.
+ *
+ * @param s RRQ session.
+ * @param opts Options sent with the request.
+ */
+static void rrq_start(tftp_session *s, const tftp_options *opts) {
+    if (options_present(opts)) {
+        // wait for ACK(0) before sending block 1
+        s->oack_pending = 1;
+        session_send_oack(s, opts);
+        rto_start(&s->rto, 0);
+        return;
+    }
+
+    s->next_block = 1;
+    s->retries = MAX_RETRIES - 1;
+    rrq_fill_window(s);
+}
+
+/**
+ * @brief Handle RRQ (Read Request) from client: start sending file contents (download).
+ *
+ * If the request carried options, an OACK is sent and the first DATA block
+ * follows the client's ACK(0); otherwise the first DATA block is sent right away.
+ * The rest of the transfer is driven by the event loop through
+ * session_on_readable() and session_on_timeout().
+ *
+ * @param listen_sock Listening socket used to receive RRQ.
+ * @param stats Counters of the worker that will own the session.
+ * @param uring io_uring of the owning loop, NULL with the epoll engine.
+ * @param client Pointer to client's socket address.
+ * @param client_len Length of client's socket address.
+ * @param filename The name of the file to send.
+ * @param opts Options sent with the request.
+ * @return tftp_session* The new session, or NULL if the request was answered immediately.
+ */
+tftp_session *handle_rrq(int listen_sock, tftp_stats *stats, tftp_uring *uring, struct sockaddr_in *client,
+                         socklen_t client_len, char *filename, const tftp_options *opts) {
+    tftp_session *s = session_new(OP_RRQ, stats, uring, client, client_len, filename, opts);
+    if (!s)
+        return NULL;
+
+    // Handle "__ping__" special request with a dummy DATA packet
+    if (strcmp(filename, "__ping__") == 0) {
+        unsigned char ping_data[] = {0, OP_DATA, 0, 1, 0}; // DATA block #1 with 0 data bytes and CRC 0
+        sendto(s->data_sock, ping_data, sizeof(ping_data), 0, (struct sockaddr *)client, client_len);
+        session_close(s);
+        return NULL;
+    }
+
+    if (rrq_open_file(s) < 0) {
+        send_error(listen_sock, client, client_len, 1, "File not found");
+        session_close(s);
+        return NULL;
+    }
+
+    STAT_ADD(stats, rrq, 1);
+    // a resumed download is answered once its prefix is checked, off the loop
+    if (rrq_resume_submit(s, opts))
+        return s;
+    rrq_set_range(s, opts);
+    rrq_start(s, opts);
+    return s;
+}
+
+/**
+ * @brief Cut the partial file of a resumed upload to the bytes kept.
+ *
+ * @param s WRQ session whose temporary file is the partial upload.
+ * @param keep Bytes kept, whose CRC-32C is in resume_crc; 0 to start over.
+ */
+static void wrq_resume_keep(tftp_session *s, uint64_t keep) {
+    if (ftruncate(fileno(s->file), keep) < 0) {
+        perror("ftruncate");
+        keep = 0;
+    }
+    s->resume = keep;
+    s->write_off = keep;
+}
+
+/**
+ * @brief Continue an upload in the partial file kept from an aborted one.
+ *
+ * The upload resumes at the largest WRITE_ALIGN multiple the partial file
+ * and the client's file both reach, so chunk writes stay aligned. The OACK
+ * carries the CRC-32C of the bytes kept, computed by the prefix thread; a
+ * client whose file differs aborts and uploads again without resume.
+ *
+ * @param s WRQ session whose temporary file is the partial upload.
+ * @param partial Bytes in the partial file.
+ * @param opts Options sent with the request (resume is the size of the client's file).
+ * @return int Non-zero if the CRC was queued and the OACK waits for it.
+ */
+static int wrq_resume(tftp_session *s, uint64_t partial, const tftp_options *opts) {
+    uint64_t keep = (partial < opts->resume ? partial : opts->resume) & ~(uint64_t)(WRITE_ALIGN - 1);
+    if (keep == 0) {
+        wrq_resume_keep(s, 0);
+        return 0;
+    }
+    s->prefix.map = NULL;
+    s->prefix.fd = fileno(s->file);
+    s->prefix.len = keep;
+    session_wait_prefix(s, opts);
+    return 1;
+}
+
+/**
+ * @brief Acknowledge an upload request: OACK, or ACK(0) without options.
+ *
+ * @param s WRQ session.
+ * @param opts Options sent with the request.
+ */
+static void wrq_start(tftp_session *s, const tftp_options *opts) {
+    if (options_present(opts)) {
+        // the OACK replaces ACK(0)
+        session_send_oack(s, opts);
+        rto_start(&s->rto, 1);
+        s->retries = MAX_RETRIES;
+        return;
+    }
+
+    // Send initial ACK(0) to confirm WRQ acceptance
+    s->buffer[0] = 0;
+    s->buffer[1] = OP_ACK;
+    s->buffer[2] = 0;
+    s->buffer[3] = 0;
+    session_send(s, 4);
+    rto_start(&s->rto, 1);
+
+    s->retries = MAX_RETRIES;
+    s->deadline = now_ms() + s->rto.rto_ms;
+}
 
-    // open destenation file
-     FILE *dst = fopen(backup_path, "wb");
-     if (!dst) {
-         perror("Backup: cannot open backup file");
-         fclose(src);
-         return;
-     }
-    // copy the file for backup in 1024
-    // bytes parts
-     char buf[1024];
-     size_t n;
-     while ((n = fread(buf, 1, sizeof(buf), src)) > 0) {
-         fwrite(buf, 1, n, dst);
-     }
-     // close the files
-     fclose(src);
-     fclose(dst);
-     printf("Backup created: %s\n", backup_path);
- }
- 
 /**
- * @brief Handle WRQ (Write Request) from client: receive and store file (upload).
- * 
+ * @brief Handle WRQ (Write Request) from client: start receiving a file (upload).
+ *
+ * Opens the target file and acknowledges the request with ACK(0), or with an
+ * OACK if the request carried options; DATA blocks are then processed by the
+ * event loop through session_on_readable().
+ *
  * @param listen_sock Listening socket used to receive WRQ.
+ * @param stats Counters of the worker that will own the session.
+ * @param uring io_uring of the owning loop, NULL with the epoll engine.
  * @param client Pointer to client's socket address.
  * @param client_len Length of client's socket address.
  * @param filename The name of the file to store.
+ * @param opts Options sent with the request.
+ * @return tftp_session* The new session, or NULL if the request was rejected.
  */
-void handle_wrq(int listen_sock, struct sockaddr_in *client, socklen_t client_len, char *filename) {
-    // Create new UDP socket for data transfer
-    int data_sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (data_sock < 0) {
-        perror("socket");
+tftp_session *handle_wrq(int listen_sock, tftp_stats *stats, tftp_uring *uring, struct sockaddr_in *client,
+                         socklen_t client_len, char *filename, const tftp_options *opts) {
+    tftp_session *s = session_new(OP_WRQ, stats, uring, client, client_len, filename, opts);
+    if (!s)
+        return NULL;
+
+    // Receive into a temporary file, renamed to filename once complete and synced
+    uint64_t partial = 0;
+    s->file = commit_open_temp(filename, s->tmpname, sizeof(s->tmpname), opts->resume ? &partial : NULL);
+    if (!s->file) {
+        send_error(listen_sock, client, client_len, 2, "Cannot create file");
+        session_close(s);
+        return NULL;
+    }
+    if (uring)
+        s->file_slot = uring_file_register(uring, fileno(s->file));
+
+    STAT_ADD(stats, wrq, 1);
+    s->block = 0;  // Track last accepted block number
+
+    // a resumed upload is answered once the CRC of the part kept is in
+    if (partial > 0 && wrq_resume(s, partial, opts))
+        return s;
+    wrq_start(s, opts);
+    return s;
+}
+
+/**
+ * @brief Answer a resumed request once the prefix thread is done with its CRC.
+ *
+ * Called from session_on_timeout(), every PREFIX_POLL_MS while the CRC is
+ * being computed.
+ *
+ * @param s Session waiting for its prefix.
+ */
+static void session_on_prefix(tftp_session *s) {
+    int status = prefix_status(&s->prefix);
+    if (status == PREFIX_QUEUED) {
+        s->deadline = now_ms() + PREFIX_POLL_MS;
         return;
     }
+    s->prefix_pending = 0;
 
-    // Initialize address structure for binding
-    struct sockaddr_in data_addr = {0};
-    data_addr.sin_family = AF_INET;
-    data_addr.sin_addr.s_addr = INADDR_ANY;
-    data_addr.sin_port = 0;  // Let system choose dynamic port
+    if (s->opcode == OP_RRQ) {
+        rrq_set_range(s, &s->request);
+        rrq_start(s, &s->request);
+        return;
+    }
+    if (status == PREFIX_DONE)
+        s->resume_crc = s->prefix.crc;
+    wrq_resume_keep(s, status == PREFIX_DONE ? s->prefix.len : 0);
+    wrq_start(s, &s->request);
+}
 
-    // Bind socket to dynamic port
-    if (bind(data_sock, (struct sockaddr *)&data_addr, sizeof(data_addr)) < 0) {
-        perror("bind");
-        close(data_sock);
+/**
+ * @brief Process one ACK received by an RRQ session.
+ *
+ * ACKs are cumulative: an ACK for block k confirms every block up to k and
+ * slides the window, even when k is short of the last block sent (the client
+ * acknowledges once per window of its own count). Only a repeated ACK, with
+ * which the client reports a gap, resends from k + 1 (go-back-N), once per k.
+ *
+ * @param s RRQ session.
+ * @param ack Received packet.
+ * @param n Length of the packet.
+ */
+static void rrq_on_packet(tftp_session *s, const unsigned char *ack, int n) {
+    if (n < 4 || ack[1] != OP_ACK)
+        return;
+
+    // ACK(0) confirms the OACK: start with block 1
+    if (s->oack_pending) {
+        if (ack[2] == 0 && ack[3] == 0) {
+            session_rtt_sample(s, 0);
+            s->oack_pending = 0;
+            s->next_block = 1;
+            rrq_fill_window(s);
+        }
         return;
     }
 
-    // Open file for writing binary data
-    FILE *file = fopen(filename, "wb");
-    if (!file) {
-        send_error(listen_sock, client, client_len, 2, "Cannot create file");
-        close(data_sock);
+    // Only the ACK of the digest is expected after the last block
+    if (s->digest_pending) {
+        if (((ack[2] << 8) | ack[3]) == block_to_wire(s->last_block + 1, s->wrap_to)) {
+            session_rtt_sample(s, s->last_block + 1);
+            rrq_finish(s);
+        }
         return;
     }
 
-    // Send initial ACK(0) to confirm WRQ acceptance
-    unsigned char ack[4] = {0, OP_ACK, 0, 0};
-    sendto(data_sock, ack, 4, 0, (struct sockaddr *)client, client_len);
+    // Distance from the last acknowledged block, modulo the 16-bit block number
+    uint16_t ack_block = (ack[2] << 8) | ack[3];
+    uint64_t advance = block_distance(s->block, ack_block, s->wrap_to);
+    if (advance > s->sent_block - s->block)
+        return; // stale ACK for a block before the window
+    if (advance == 0 && s->rewound == s->block + 1)
+        return; // duplicate of an ACK the window was already resent after
+
+    if (advance == 0) {
+        // a repeated ACK: the client saw a gap, resend from the block after it
+        if (s->block == s->sent_block)
+            return;
+        cc_on_loss(&s->cc, s->block, s->sent_block);
+        s->rewound = s->block + 1;
+        s->next_block = s->block + 1;
+        rrq_fill_window(s);
+        return;
+    }
+
+    // the window slides; blocks still in flight are not resent
+    s->block += advance;
+    s->retries = MAX_RETRIES - 1;
+    cc_on_ack(&s->cc, (uint32_t)advance, session_rtt_sample(s, s->block));
+
+    // The last block is acknowledged: transfer complete, once the digest is confirmed if any
+    if (s->last_block && s->block == s->last_block) {
+        if (s->digest)
+            rrq_send_digest(s);
+        else
+            rrq_finish(s);
+        return;
+    }
 
-    unsigned char buffer[MAX_PACKET_SIZE];
+    if (s->next_block <= s->block)
+        s->next_block = s->block + 1;
+    rrq_fill_window(s);
+}
 
-    // Copy client address for communication on dynamic port
-    struct sockaddr_in client_addr = *client;
-    socklen_t client_addr_len = client_len;
+/**
+ * @brief Submit the registered buffer of a WRQ session as one file write.
+ *
+ * @param s WRQ session using the io_uring engine.
+ */
+static void wrq_submit_write(tftp_session *s) {
+    if (s->write_buf < 0)
+        return;
 
-    int last_block = 0;  // Track last accepted block number
+    struct io_uring_sqe *sqe = uring_get_sqe(s->uring);
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = s->file_slot >= 0 ? s->file_slot : fileno(s->file);
+    sqe->flags = s->file_slot >= 0 ? IOSQE_FIXED_FILE : 0;
+    sqe->addr = (uint64_t)(uintptr_t)uring_write_buffer(s->uring, s->write_buf);
+    sqe->len = s->write_len;
+    sqe->off = s->write_off;
+    sqe->buf_index = s->write_buf;
+    sqe->user_data = ((uint64_t)s->write_buf << 3) | URING_WRITE;
 
-    // Set 3-second timeout for receiving data packets
-    struct timeval timeout = {3, 0};
-    setsockopt(data_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    s->uring->write_owner[s->write_buf] = s;
+    s->write_off += s->write_len;
+    s->write_buf = -1;
+    s->write_len = 0;
+    s->writes_pending++;
+    s->io_pending++;
+}
 
-    while (1) {
-        int retries = 3;
+/**
+ * @brief Turn O_DIRECT on or off for the file of a WRQ session.
+ *
+ * @param s WRQ session.
+ * @param on Non-zero to bypass the page cache.
+ * @return int 0 on success, -1 if the file system refuses it.
+ */
+static int wrq_set_direct(tftp_session *s, int on) {
+    int fd = fileno(s->file);
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, on ? flags | O_DIRECT : flags & ~O_DIRECT) < 0)
+        return -1;
+    return 0;
+}
 
-        int n;
-        // Retry loop: receive DATA block with retries if no data received
-        while (retries-- > 0) {
-            n = recvfrom(data_sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&client_addr, &client_addr_len);
+/**
+ * @brief Write the coalesced chunk of a WRQ session with pwrite().
+ *
+ * Chunks are WRITE_ALIGN-aligned in memory and in the file, so once an
+ * upload passes direct_min they are written with O_DIRECT and do not fill
+ * the page cache. The final, partial chunk goes through the page cache. If
+ * the file system refuses O_DIRECT the upload stays buffered.
+ *
+ * @param s WRQ session using the epoll engine.
+ */
+static void wrq_flush(tftp_session *s) {
+    if (s->write_len == 0)
+        return;
 
-            if (n >= 0) {
-                // Packet received, exit retry loop
-                break;
-            }
+    int aligned = s->write_len % WRITE_ALIGN == 0;
+    if (s->direct == 0 && g_config.direct_min > 0 && s->write_off >= g_config.direct_min && aligned)
+        s->direct = wrq_set_direct(s, 1) == 0 ? 1 : -1;
+    else if (s->direct == 1 && !aligned && wrq_set_direct(s, 0) == 0)
+        s->direct = 0;
 
-            // Timeout or error: wait 200ms before retrying
-            usleep(200000);
+    int done = 0;
+    while (done < s->write_len) {
+        ssize_t n = pwrite(fileno(s->file), s->chunk + done, s->write_len - done, s->write_off + done);
+        if (n < 0 && errno == EINVAL && s->direct == 1) {
+            wrq_set_direct(s, 0);
+            s->direct = -1;
+            continue;
         }
-
-        if (n < 0) {
-            printf("Timeout waiting for DATA block %d\n", last_block + 1);
+        if (n <= 0) {
+            perror("pwrite");
+            s->write_failed = 1;
             break;
         }
+        done += n;
+    }
+    s->write_off += s->write_len;
+    s->write_len = 0;
+}
 
-        // Extract block number from DATA packet
-        int recv_block = (buffer[2] << 8) | buffer[3];
-
-        // Validate CRC8 of received data
-        uint8_t received_crc = buffer[n - 1];
-        uint8_t calc_crc = calculate_crc8(&buffer[4], n - 5);
+/**
+ * @brief Append received payload to the file of a WRQ session.
+ *
+ * With the epoll engine blocks are gathered into a chunk of write_chunk
+ * bytes, written with one pwrite() when full (see wrq_flush()).
+ * With the io_uring engine the payload is gathered in a registered buffer
+ * that is submitted once it cannot hold another block, so the loop never
+ * waits for the disk; when every buffer is busy it falls back to pwrite().
+ *
+ * @param s WRQ session.
+ * @param data Payload.
+ * @param len Length of the payload.
+ */
+static void wrq_write(tftp_session *s, const unsigned char *data, int len) {
+    if (!s->uring) {
+        if (!s->chunk && posix_memalign((void **)&s->chunk, WRITE_ALIGN, g_config.write_chunk) != 0) {
+            s->chunk = NULL;
+            if (pwrite(fileno(s->file), data, len, s->write_off) != len) {
+                perror("pwrite");
+                s->write_failed = 1;
+            }
+            s->write_off += len;
+            return;
+        }
+        while (len > 0) {
+            int n = g_config.write_chunk - s->write_len < len ? g_config.write_chunk - s->write_len : len;
+            memcpy(s->chunk + s->write_len, data, n);
+            s->write_len += n;
+            data += n;
+            len -= n;
+            if (s->write_len == g_config.write_chunk)
+                wrq_flush(s);
+        }
+        return;
+    }
 
-        if (received_crc != calc_crc) {
-            printf("CRC mismatch on block %d\n", recv_block);
-            // Ignore this packet, wait for resend
-            continue;
+    if (s->write_buf < 0)
+        s->write_buf = uring_write_get(s->uring);
+    if (s->write_buf < 0) {
+        if (pwrite(fileno(s->file), data, len, s->write_off) != len) {
+            perror("pwrite");
+            s->write_failed = 1;
         }
+        s->write_off += len;
+        return;
+    }
+
+    memcpy(uring_write_buffer(s->uring, s->write_buf) + s->write_len, data, len);
+    s->write_len += len;
+    if (URING_WRITE_SIZE - s->write_len < s->blksize)
+        wrq_submit_write(s);
+}
 
-        // Accept only next expected block (discard duplicates/out-of-order)
-        if (recv_block == last_block + 1) {
-            // Write data payload to file (excluding 4-byte header + CRC byte)
-            fwrite(&buffer[4], 1, n - 5, file);
-            last_block = recv_block;
+/**
+ * @brief Hand the uploaded file over to be synced, renamed into place and backed up.
+ *
+ * The worker never syncs the file itself: while the commit queue is full the
+ * session stays open and tries again every COMMIT_RETRY_MS. Once queued, the
+ * session waits for the commit in wrq_on_commit().
+ *
+ * @param s WRQ session whose last block (and digest) was received and written.
+ */
+static void wrq_finish(tftp_session *s) {
+    if (!s->commit_pending) {
+        if (s->chunk)
+            wrq_flush(s);
+        if (s->file_slot >= 0) {
+            uring_file_unregister(s->uring, s->file_slot);
+            s->file_slot = -1;
         }
+        s->finish_pending = 0;
 
-        // Send ACK for the last valid block received
-        ack[0] = 0;
-        ack[1] = OP_ACK;
-        ack[2] = buffer[2];
-        ack[3] = buffer[3];
-        sendto(data_sock, ack, 4, 0, (struct sockaddr *)&client_addr, client_addr_len);
+        if (s->write_failed) {
+            printf("Failed to save '%s'\n", s->filename);
+            send_error(s->data_sock, &s->client, s->client_len, 0, "Failed to save file");
+            session_end(s, 0);
+            s->done = 1;
+            return; // session_close() removes the temporary file
+        }
+    }
 
-        // If data length < 512, this is last block, finish transfer
-        if (n - 5 < MAX_DATA_SIZE) break;
+    if (commit_enqueue(s->file, s->tmpname, s->filename, &s->commit_status) < 0) {
+        s->commit_pending = 1;
+        s->deadline = now_ms() + COMMIT_RETRY_MS;
+        return;
     }
+    s->commit_pending = 0;
+    s->file = NULL;
+    s->tmpname[0] = 0;
+    s->commit_wait = 1;
+    s->deadline = now_ms() + COMMIT_POLL_MS;
+}
 
-    fclose(file);
-    backup_file(filename);
-    close(data_sock);
-    printf("Received and saved '%s'\n", filename);
+/**
+ * @brief Send the ACK ending an upload: of its last block, or of its digest.
+ *
+ * @param s WRQ session.
+ */
+static void wrq_send_final_ack(tftp_session *s) {
+    // the digest is acknowledged with the number of the block after the last
+    uint16_t wire = block_to_wire(s->block + (s->digest ? 1 : 0), s->wrap_to);
+    s->buffer[0] = 0;
+    s->buffer[1] = OP_ACK;
+    s->buffer[2] = (wire >> 8) & 0xFF;
+    s->buffer[3] = wire & 0xFF;
+    session_send(s, 4);
 }
 
- 
- /**
- * @brief Handle RRQ (Read Request) from client: send file contents (download).
- * 
- * @param listen_sock Listening socket used to receive RRQ.
- * @param client Pointer to client's socket address.
- * @param client_len Length of client's socket address.
- * @param filename The name of the file to send.
+/**
+ * @brief Answer the client once the commit thread is done with its upload.
+ *
+ * Called from session_on_timeout(), every COMMIT_POLL_MS while the upload is
+ * queued: the final ACK only goes out once the file is on disk under its
+ * final name, so a client told of success never loses the upload to a crash.
+ * The session then dallies for WRQ_DALLY_RTOS retransmission timeouts: a
+ * lost final ACK is sent again after each, and whenever the client resends
+ * its last packet, as a client that backed off may not resend in time.
+ *
+ * @param s WRQ session waiting for its commit.
  */
-void handle_rrq(int listen_sock, struct sockaddr_in *client, socklen_t client_len, char *filename) {
-    // Create new UDP socket for data transfer
-    int data_sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (data_sock < 0) {
-        perror("socket");
+static void wrq_on_commit(tftp_session *s) {
+    int status = commit_status(&s->commit_status);
+    if (status == COMMIT_QUEUED) {
+        s->deadline = now_ms() + COMMIT_POLL_MS;
         return;
     }
+    s->commit_wait = 0;
 
-    struct sockaddr_in data_addr = {0}; // Initialize address struct with zeros
-    data_addr.sin_family = AF_INET;     // IPv4
-    data_addr.sin_addr.s_addr = INADDR_ANY; // Accept any IP
-    data_addr.sin_port = 0;             // System chooses a dynamic port
+    if (status == COMMIT_FAILED) {
+        send_error(s->data_sock, &s->client, s->client_len, 0, "Failed to save file");
+        session_end(s, 0);
+        s->done = 1;
+        return;
+    }
+    wrq_send_final_ack(s);
+    session_end(s, 1);
+    s->dally = WRQ_DALLY_RTOS;
+    s->deadline = now_ms() + s->rto.rto_ms;
+}
 
-    // Bind socket to dynamic port
-    if (bind(data_sock, (struct sockaddr *)&data_addr, sizeof(data_addr)) < 0) {
-        perror("bind");
-        close(data_sock);
+/**
+ * @brief Handle the completion of an io_uring upload write.
+ *
+ * @param u Ring the write was submitted to.
+ * @param index Registered buffer that was written.
+ * @param res Bytes written or negative errno.
+ */
+void session_on_written(tftp_uring *u, int index, int res) {
+    tftp_session *s = u->write_owner[index];
+    uring_write_put(u, index);
+
+    if (res < 0) {
+        fprintf(stderr, "write '%s': %s\n", s->filename, strerror(-res));
+        s->write_failed = 1;
+    }
+    if (--s->writes_pending == 0 && s->finish_pending)
+        wrq_finish(s);
+    session_io_done(s);
+}
+
+/**
+ * @brief Save the upload once its last block (and digest, if any) is received.
+ *
+ * @param s WRQ session.
+ */
+static void wrq_save(tftp_session *s) {
+    compress_report(s);
+    // the file is closed once every write submitted to io_uring has completed
+    if (s->writes_pending > 0)
+        s->finish_pending = 1;
+    else
+        wrq_finish(s);
+}
+
+/**
+ * @brief Check the digest the client sent after the last block of an upload.
+ *
+ * A matching digest saves the upload, acknowledged once committed. Otherwise the
+ * client gets an ERROR and the upload is dropped without replacing the file
+ * or being kept for a resume.
+ *
+ * @param s WRQ session whose last block was received.
+ * @param buffer Received OP_DIGEST packet.
+ * @param n Length of the packet.
+ */
+static void wrq_on_digest(tftp_session *s, const unsigned char *buffer, int n) {
+    uint16_t wire = block_to_wire(s->block + 1, s->wrap_to);
+    if (n != 4 + SHA256_SIZE || ((buffer[2] << 8) | buffer[3]) != wire)
+        return;
+
+    uint8_t digest[SHA256_SIZE];
+    sha256_final(&s->sha, digest);
+    if (memcmp(digest, &buffer[4], SHA256_SIZE) != 0) {
+        printf("Digest mismatch on '%s', upload discarded\n", s->filename);
+        send_error(s->data_sock, &s->client, s->client_len, 0, "Digest mismatch");
+        s->write_failed = 1; // session_close() removes the temporary file
+        session_end(s, 0);
+        s->done = 1;
         return;
     }
+    wrq_save(s);
+}
 
-    // Handle "__ping__" special request with a dummy DATA packet
-    if (strcmp(filename, "__ping__") == 0) {
-        unsigned char ping_data[] = {0, OP_DATA, 0, 1, 0}; // DATA block #1 with 0 data bytes and CRC 0
-        sendto(data_sock, ping_data, sizeof(ping_data), 0, (struct sockaddr *)client, client_len);
-        close(data_sock);
+/**
+ * @brief Acknowledge the last in-order block of a WRQ session.
+ *
+ * @param s WRQ session.
+ */
+static void wrq_send_ack(tftp_session *s) {
+    uint16_t wire = block_to_wire(s->block, s->wrap_to);
+    s->buffer[0] = 0;
+    s->buffer[1] = OP_ACK;
+    s->buffer[2] = (wire >> 8) & 0xFF;
+    s->buffer[3] = wire & 0xFF;
+    session_send(s, 4);
+}
+
+/**
+ * @brief Process one DATA packet received by a WRQ session.
+ *
+ * In-order blocks are written and acknowledged once per window (every
+ * windowsize blocks), after rto_ack_delay_us() without another one (the client
+ * keeps fewer blocks in flight while its cwnd is below the window). The last
+ * block is only acknowledged once the upload is committed (or, with a digest,
+ * right away, the digest ACK being held instead). Other blocks get at most one
+ * ACK of the last in-order block until the next in-order one arrives: a
+ * block already held means the client timed out and missed our ACK; a block
+ * ahead means a gap, reported as a repeated ACK so the client resends from
+ * there. Neither resets the count of blocks towards the next window ACK.
+ *
+ * @param s WRQ session.
+ * @param buffer Received packet.
+ * @param n Length of the packet.
+ */
+static void wrq_on_packet(tftp_session *s, const unsigned char *buffer, int n) {
+    if (s->digest_pending && n >= 4 && buffer[1] == OP_DIGEST) {
+        wrq_on_digest(s, buffer, n);
         return;
     }
+    if (n < 4 + s->check_len || buffer[1] != OP_DATA)
+        return;
 
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        send_error(listen_sock, client, client_len, 1, "File not found");
-        close(data_sock);
+    // Extract block number from DATA packet
+    uint16_t recv_block = (buffer[2] << 8) | buffer[3];
+    int data_len = n - 4 - s->check_len;
+
+    // Validate the negotiated check of received data (the frame, when compressed)
+    if (!block_check_ok(s->check, &buffer[4], data_len, &buffer[4 + data_len])) {
+        printf("%s mismatch on block %d\n", check_name(s->check), recv_block);
+        STAT_ADD(s->stats, crc_errors, 1);
+        s->crc_errors++;
+        // Ignore this packet, wait for resend
         return;
     }
 
-    unsigned char buffer[MAX_PACKET_SIZE], ack[4];
-    int block = 1;
-    struct sockaddr_in client_addr = *client;
-    socklen_t client_addr_len = client_len;
+    int last = 0;
+    int advanced = 0;
+    int repeat = 0;
+    uint64_t distance = block_distance(s->block, recv_block, s->wrap_to);
+    if (!s->digest_pending && distance == 1) {
+        const unsigned char *data = &buffer[4];
+        int wire_len = data_len;
+        if (s->compress && !(data = block_unpack(&buffer[4], wire_len, s->zbuf, s->blksize, &data_len))) {
+            printf("Malformed compressed block %d\n", recv_block);
+            STAT_ADD(s->stats, crc_errors, 1);
+            s->crc_errors++;
+            return;
+        }
+
+        // Write data payload to file (excluding 4-byte header + check trailer)
+        wrq_write(s, data, data_len);
+        if (s->digest)
+            sha256_update(&s->sha, data, data_len);
+        s->block++;
+        advanced = 1;
+        session_rtt_sample(s, s->block);
+        s->since_ack++;
+        s->gap_acked = 0;
+        STAT_ADD(s->stats, blocks_received, 1);
+        STAT_ADD(s->stats, bytes_received, data_len);
+        s->blocks++;
+        s->bytes += data_len;
+        s->wire_bytes += wire_len;
 
-    // Set 1-second timeout for receiving ACK packets
-    struct timeval timeout = {1, 0}; 
-    setsockopt(data_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        // If data length < blksize, this is last block
+        last = data_len < s->blksize;
+        if (!last && s->since_ack < s->windowsize)
+            goto rearm; // keep collecting the window
+        s->since_ack = 0;
+        if (last && !s->digest) {
+            // acknowledged by wrq_on_commit() once the upload is on disk
+            if (s->uring)
+                wrq_submit_write(s);
+            wrq_save(s);
+            return;
+        }
+    } else if (s->gap_acked) {
+        return; // already answered since the last in-order block
+    } else {
+        s->gap_acked = 1;
+        // A block ahead is a gap. The client slides its window on an ACK that
+        // advances and only resends after a repeated one, so when it has not
+        // been told of the last in-order block yet that ACK goes out twice.
+        if (distance > 1 && distance <= (uint64_t)s->windowsize && s->since_ack > 0)
+            repeat = 1;
+    }
 
-    while (1) {
-        // Read up to 512 bytes from file into buffer starting at offset 4
-        int bytes = fread(&buffer[4], 1, MAX_DATA_SIZE, file);
+    wrq_send_ack(s);
+    if (repeat)
+        session_send(s, 4);
+    // the DATA answering a repeated ACK cannot be timed
+    if (advanced)
+        rto_start(&s->rto, s->block + 1);
+    else
+        rto_resent(&s->rto, s->block + 1);
 
-        // Prepare DATA packet header
-        buffer[0] = 0;
-        buffer[1] = OP_DATA;
-        buffer[2] = (block >> 8) & 0xFF;
-        buffer[3] = block & 0xFF;
+    if (last) {
+        if (s->uring)
+            wrq_submit_write(s);
+        // with a digest the upload is only saved once the client's digest matches
+        s->digest_pending = 1;
+    }
 
-        // Append CRC8 of data
-        buffer[bytes + 4] = calculate_crc8(&buffer[4], bytes);
+rearm:
+    s->retries = MAX_RETRIES;
+    // a partial window is acknowledged once the client stops sending
+    if (s->since_ack > 0 && !s->gap_acked)
+        s->deadline = now_ms() + (rto_ack_delay_us(&s->rto) + 999) / 1000;
+    else
+        s->deadline = now_ms() + s->rto.rto_ms;
+}
 
-        int retries = 3;
-        while (retries-- > 0) {
-            // Send DATA packet
-            sendto(data_sock, buffer, bytes + 5, 0, (struct sockaddr *)&client_addr, client_addr_len);
+/**
+ * @brief Drain every datagram queued on a session's data socket.
+ *
+ * Datagrams are received in batches into the loop's ring; a batch shorter
+ * than the ring means the socket queue is empty.
+ *
+ * @param s Session whose socket became readable.
+ * @param ring Receive ring of the owning loop.
+ */
+void session_on_readable(tftp_session *s, tftp_ring *ring) {
+    int batch = ring->count;
 
-            // Wait for ACK with timeout
-            socklen_t len = sizeof(client_addr);
-            int n = recvfrom(data_sock, ack, sizeof(ack), 0, (struct sockaddr *)&client_addr, &len);
+    while (!s->done && batch == ring->count) {
+        batch = ring_recv(ring, s->data_sock);
 
-            if (n >= 4 && ack[1] == OP_ACK && ack[2] == buffer[2] && ack[3] == buffer[3]) {
-                // Valid ACK received for current block
-                client_addr_len = len; // Update client address length if changed
-                break;
-            }
-        }
+        for (int i = 0; i < batch && !s->done; i++)
+            session_on_packet(s, &ring->addrs[i], ring_packet(ring, i), ring_length(ring, i));
+    }
+}
 
-        if (retries < 0) {
-            printf("No ACK for block %d, aborting.\n", block);
-            break;
-        }
+/**
+ * @brief Process one datagram received on a session's data socket.
+ *
+ * @param s Session.
+ * @param from Sender address.
+ * @param packet Received packet.
+ * @param n Length of the packet, -1 if it was truncated.
+ */
+void session_on_packet(tftp_session *s, const struct sockaddr_in *from, const unsigned char *packet, int n) {
+    // Ignore packets that do not come from this transfer's client, or too large for it
+    if (from->sin_addr.s_addr != s->client.sin_addr.s_addr || from->sin_port != s->client.sin_port)
+        return;
+    if (n < 0 || n > s->packet_size)
+        return;
 
-        // If last block is exactly 512 bytes, send final empty DATA block
-        if (bytes < MAX_DATA_SIZE) {
-            if (bytes == MAX_DATA_SIZE) {
-                block++;
-                buffer[0] = 0;
-                buffer[1] = OP_DATA;
-                buffer[2] = (block >> 8) & 0xFF;
-                buffer[3] = block & 0xFF;
-                buffer[4] =calculate_crc8(NULL, 0); // CRC of empty data
-
-                retries = 3;
-                while (retries-- > 0) {
-                    sendto(data_sock, buffer, 5, 0, (struct sockaddr *)&client_addr, client_addr_len);
-
-                    // Reset timeout for recvfrom
-                    setsockopt(data_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-
-                    int n = recvfrom(data_sock, ack, sizeof(ack), 0, (struct sockaddr *)&client_addr, &client_addr_len);
-                    if (n >= 4 && ack[1] == OP_ACK && ack[2] == buffer[2] && ack[3] == buffer[3]) {
-                        break; // ACK received for final empty block
-                    }
-                }
-            }
-            break; // Finished sending file
+    // The request is not answered yet: the client is still waiting for the OACK
+    if (s->prefix_pending)
+        return;
+    // The upload is being saved: the final ACK answers a resent last block or digest
+    if (s->finish_pending || s->commit_pending || s->commit_wait)
+        return;
+    // The upload is saved: a resent last block or digest means the final ACK was lost
+    if (s->dally) {
+        if (n >= 4 && (packet[1] == OP_DIGEST ||
+                       (packet[1] == OP_DATA && ((packet[2] << 8) | packet[3]) == block_to_wire(s->block, s->wrap_to))))
+            session_send(s, s->tx_len);
+        return;
+    }
+
+    // The client gave up (e.g. it refused our OACK)
+    if (n >= 4 && packet[1] == OP_ERROR) {
+        if (s->digest_pending && s->opcode == OP_RRQ)
+            printf("Client reported a digest mismatch on '%s'\n", s->filename);
+        else
+            printf("Client aborted transfer of '%s'\n", s->filename);
+        session_end(s, 0);
+        s->done = 1;
+        return;
+    }
+
+    if (s->opcode == OP_RRQ)
+        rrq_on_packet(s, packet, n);
+    else
+        wrq_on_packet(s, packet, n);
+}
+
+/**
+ * @brief Handle an expired session deadline: retransmit or abort.
+ *
+ * RRQ sessions resend their window of DATA blocks (or the OACK, or the digest);
+ * WRQ sessions resend their last ACK (or OACK).
+ * A session that runs out of retries is marked done.
+ *
+ * @param s Session whose deadline expired.
+ */
+void session_on_timeout(tftp_session *s) {
+    if (s->prefix_pending) {
+        session_on_prefix(s);
+        return;
+    }
+    // a finished upload resends its final ACK in case it was lost, then ends
+    if (s->dally) {
+        if (--s->dally == 0) {
+            s->done = 1;
+            return;
         }
+        session_send(s, s->tx_len);
+        s->deadline = now_ms() + s->rto.rto_ms;
+        return;
+    }
+    // a finished upload waiting for its writes, for room in the commit queue or for the commit
+    if (s->commit_wait) {
+        wrq_on_commit(s);
+        return;
+    }
+    if (s->commit_pending) {
+        wrq_finish(s);
+        return;
+    }
+    if (s->finish_pending) {
+        s->deadline = now_ms() + COMMIT_RETRY_MS;
+        return;
+    }
+    // the client went quiet before the end of a window: acknowledge what arrived
+    if (s->opcode == OP_WRQ && s->since_ack > 0 && !s->gap_acked) {
+        s->since_ack = 0;
+        wrq_send_ack(s);
+        rto_start(&s->rto, s->block + 1);
+        s->deadline = now_ms() + s->rto.rto_ms;
+        return;
+    }
+
+    STAT_ADD(s->stats, timeouts, 1);
+    s->timeouts++;
+    if (s->retries-- <= 0) {
+        if (s->digest_pending) {
+            printf("No answer to the digest of '%s', aborting.\n", s->filename);
+        } else if (s->opcode == OP_RRQ) {
+            printf("No ACK for block %llu, aborting.\n", (unsigned long long)s->block + 1);
+            rrq_report(s);
+        } else
+            printf("Timeout waiting for DATA block %llu\n", (unsigned long long)s->block + 1);
+        session_end(s, 0);
+        s->done = 1;
+        return;
+    }
+    rto_backoff(&s->rto);
 
-        block++;
+    if (s->opcode == OP_RRQ && !s->oack_pending && !s->digest_pending) {
+        cc_on_timeout(&s->cc);
+        // resend the whole window, starting after the last acknowledged block
+        s->next_block = s->block + 1;
+        s->rewound = s->next_block;
+        rrq_fill_window(s);
+        return;
     }
 
-    fclose(file);
-    close(data_sock);
-    printf("Finished sending '%s'\n", filename);
+    STAT_ADD(s->stats, retransmits, 1);
+    s->retransmits++;
+    session_send(s, s->tx_len);
+    s->gap_acked = 0;
+    s->deadline = now_ms() + s->rto.rto_ms;
 }
 
  /**
@@ -359,6 +1818,7 @@ void handle_rrq(int listen_sock, struct sockaddr_in *client, socklen_t client_le
 
      printf("DELETE request for file: %s\n", filename);
       // delete file
+     cache_invalidate(filename);
      if (remove(filename) == 0) {
          send_error(sock, client, client_len, 0, "File deleted successfully");
          printf("File '%s' deleted successfully.\n", filename);
@@ -369,64 +1829,247 @@ void handle_rrq(int listen_sock, struct sockaddr_in *client, socklen_t client_le
  }
  
  /**
-  * @brief Main server loop: initializes and handles incoming TFTP requests.
+  * @brief Parse a request from the listening socket and start the matching session.
+  *
+  * @param loop Loop that will own the new session.
+  * @param buffer Request packet, with room for a NUL terminator at buffer[n].
+  * @param n Length of the request.
+  * @param client Client's address.
+  * @param client_len Length of client's address.
+  */
+ void dispatch_request(tftp_loop *loop, unsigned char *buffer, int n, struct sockaddr_in *client, socklen_t client_len) {
+     if (n < 4) return;
+     buffer[n] = 0;
+     STAT_ADD(&loop->stats, requests, 1);
+     int opcode = buffer[1];
+
+     // get the file name and the requested options
+     tftp_options opts;
+     char *filename = request_parse(buffer, n, &opts);
+     tftp_session *s = NULL;
+     // check opcode
+     if (opcode == OP_RRQ) {
+         // handle rrq (download)
+         printf("RRQ for file: %s\n", filename);
+         s = handle_rrq(loop->listen_sock, &loop->stats, loop->uring, client, client_len, filename, &opts);
+     } else if (opcode == OP_WRQ) {
+         // handle wrq (upload)
+         printf("WRQ for file: %s\n", filename);
+         s = handle_wrq(loop->listen_sock, &loop->stats, loop->uring, client, client_len, filename, &opts);
+     } else if (opcode == OP_DELETE) {
+         // delete file
+         STAT_ADD(&loop->stats, deletes, 1);
+         handle_delete(loop->listen_sock, client, client_len, filename);
+     } else {
+         // iligal opcode
+         send_error(loop->listen_sock, client, client_len, 4, "Illegal TFTP operation");
+     }
+
+     if (s)
+         loop_add_session(loop, s);
+ }
+
+ /**
+  * @brief Print command line usage.
+  *
+  * @param prog Program name.
+  */
+ static void usage(const char *prog) {
+     fprintf(stderr, "Usage: %s [-w workers] [-i stats_interval] [-b max_blksize] [-W max_windowsize] [-s send_mode] [-e engine] [-c cc] [-m cache_mb] [-x] [-C chunk_kb] [-D direct_mb] [-P metrics_file] [-I metrics_interval] [-A admin_socket]\n", prog);
+     fprintf(stderr, "  -w N  number of worker threads (default: number of CPUs)\n");
+     fprintf(stderr, "  -i S  print per-worker stats every S seconds (default: off, SIGUSR1 prints on demand)\n");
+     fprintf(stderr, "  -b N  largest blksize option granted to clients (%d-%d, default %d)\n", MIN_BLKSIZE, MAX_BLKSIZE, MAX_BLKSIZE);
+     fprintf(stderr, "  -W N  largest windowsize option granted to clients (%d-%d, default 64)\n", MIN_WINDOWSIZE, MAX_WINDOWSIZE);
+     fprintf(stderr, "  -s M  how DATA windows are sent: plain (sendmsg per block), mmsg (sendmmsg) or gso (default)\n");
+     fprintf(stderr, "  -e E  event loop engine: epoll (default) or uring (falls back to epoll if unavailable)\n");
+     fprintf(stderr, "  -c C  congestion control of DATA windows: aimd (default), delay or none\n");
+     fprintf(stderr, "  -m N  size of the hot-file cache in MiB, 0 to disable (default %d)\n", CACHE_DEFAULT_MB);
+     fprintf(stderr, "  -x    do not use or build CRC index files of large downloads\n");
+     fprintf(stderr, "  -C N  upload data written per pwrite() in KiB, multiple of 4 (default %d)\n", WRITE_CHUNK_DEFAULT / 1024);
+     fprintf(stderr, "  -D N  write uploads with O_DIRECT past N MiB (default: never)\n");
+     fprintf(stderr, "  -P F  write Prometheus metrics to file F (default: off)\n");
+     fprintf(stderr, "  -I S  rewrite the metrics file every S seconds (default %d)\n", METRICS_DEFAULT_INTERVAL);
+     fprintf(stderr, "  -A F  answer \"stats\" and \"sessions\" on Unix socket F (default: off)\n");
+ }
+
+ /**
+  * @brief Main server entry: starts the workers and reports their stats.
+  *
+  * Each worker binds its own SO_REUSEPORT socket on SERVER_PORT and runs an
+  * event loop. The main thread only handles signals: SIGUSR1 prints the
+  * per-worker counters, SIGINT/SIGTERM print them and exit.
   * 
   * @return int Exit status.
   */
- int main() {
+ int main(int argc, char *argv[]) {
+     int opt;
+     while ((opt = getopt(argc, argv, "w:i:b:W:s:e:c:m:xC:D:P:I:A:h")) != -1) {
+         switch (opt) {
+             case 'w':
+                 g_config.workers = atoi(optarg);
+                 break;
+             case 'i':
+                 g_config.stats_interval = atoi(optarg);
+                 break;
+             case 'b':
+                 g_config.max_blksize = atoi(optarg);
+                 if (g_config.max_blksize < MIN_BLKSIZE || g_config.max_blksize > MAX_BLKSIZE) {
+                     usage(argv[0]);
+                     return 1;
+                 }
+                 break;
+             case 'W':
+                 g_config.max_windowsize = atoi(optarg);
+                 if (g_config.max_windowsize < MIN_WINDOWSIZE || g_config.max_windowsize > MAX_WINDOWSIZE) {
+                     usage(argv[0]);
+                     return 1;
+                 }
+                 break;
+             case 's':
+                 if (strcmp(optarg, "plain") == 0) {
+                     g_config.send_mode = SEND_PLAIN;
+                 } else if (strcmp(optarg, "mmsg") == 0) {
+                     g_config.send_mode = SEND_MMSG;
+                 } else if (strcmp(optarg, "gso") == 0) {
+                     g_config.send_mode = SEND_GSO;
+                 } else {
+                     usage(argv[0]);
+                     return 1;
+                 }
+                 break;
+             case 'e':
+                 if (strcmp(optarg, "epoll") == 0) {
+                     g_config.engine = ENGINE_EPOLL;
+                 } else if (strcmp(optarg, "uring") == 0) {
+                     g_config.engine = ENGINE_URING;
+                 } else {
+                     usage(argv[0]);
+                     return 1;
+                 }
+                 break;
+             case 'c':
+                 g_config.cc = cc_find(optarg);
+                 if (!g_config.cc) {
+                     usage(argv[0]);
+                     return 1;
+                 }
+                 break;
+             case 'm':
+                 if (atoi(optarg) < 0) {
+                     usage(argv[0]);
+                     return 1;
+                 }
+                 g_config.cache_size = (size_t)atoi(optarg) << 20;
+                 break;
+             case 'x':
+                 g_config.crc_index = 0;
+                 break;
+             case 'C':
+                 g_config.write_chunk = atoi(optarg) * 1024;
+                 if (g_config.write_chunk <= 0 || g_config.write_chunk % WRITE_ALIGN != 0) {
+                     usage(argv[0]);
+                     return 1;
+                 }
+                 break;
+             case 'D':
+                 if (atoi(optarg) < 0) {
+                     usage(argv[0]);
+                     return 1;
+                 }
+                 g_config.direct_min = (off_t)atoi(optarg) << 20;
+                 break;
+             case 'P':
+                 g_config.metrics_file = optarg;
+                 break;
+             case 'I':
+                 g_config.metrics_interval = atoi(optarg);
+                 if (g_config.metrics_interval <= 0) {
+                     usage(argv[0]);
+                     return 1;
+                 }
+                 break;
+             case 'A':
+                 g_config.admin_socket = optarg;
+                 break;
+             default:
+                 usage(argv[0]);
+                 return opt == 'h' ? 0 : 1;
+         }
+     }
+     if (!g_config.cc)
+         g_config.cc = cc_find("aimd");
+     cache_configure(g_config.cache_size);
+     if (g_config.workers <= 0)
+         g_config.workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+     if (g_config.workers <= 0)
+         g_config.workers = 1;
 
-    // create socket
-     int sock = socket(AF_INET, SOCK_DGRAM, 0); // IPv4 m UDP ,
-     struct sockaddr_in server = {0}, client; // address for server , add for clinet
-     socklen_t client_len = sizeof(client); // the len of the clinet  IP & Port
- 
      // Ensure backup directory exists
      struct stat st = {0};
-     if (stat("backup", &st) == -1) {
-         mkdir("backup", 0755);
+     if (stat(BACKUP_DIR, &st) == -1) {
+         mkdir(BACKUP_DIR, 0755);
      }
- 
-      // init
-     server.sin_family = AF_INET; //  IPv4
-     server.sin_port = htons(SERVER_PORT); // 6969
-     server.sin_addr.s_addr = INADDR_ANY; // for any IP
-      // link the socket to IP & port 
-     if (bind(sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
-         perror("Bind failed");
+
+     // Workers inherit this mask, so only the main thread receives these signals
+     sigset_t signals;
+     sigemptyset(&signals);
+     sigaddset(&signals, SIGUSR1);
+     sigaddset(&signals, SIGINT);
+     sigaddset(&signals, SIGTERM);
+     pthread_sigmask(SIG_BLOCK, &signals, NULL);
+     // an admin client that hangs up before its reply is written must not end the server: EPIPE instead
+     signal(SIGPIPE, SIG_IGN);
+     if (mapguard_install() < 0)
+         return 1;
+
+     if (backup_start() < 0 || commit_start() < 0 || cache_start() < 0 || prefix_start() < 0)
+         return 1;
+     if (g_config.crc_index && crcindex_start() < 0)
+         return 1;
+
+     tftp_worker *workers = calloc(g_config.workers, sizeof(*workers));
+     if (!workers) {
+         perror("calloc");
          return 1;
      }
- 
-     printf("TFTP server running on port %d...\n", SERVER_PORT);
- 
-     while (1) {
+     for (int i = 0; i < g_config.workers; i++) {
+         if (worker_start(&workers[i], i) < 0)
+             return 1;
+     }
+     if (metrics_start(workers, g_config.workers, g_config.metrics_file, g_config.metrics_interval,
+                       g_config.admin_socket) < 0)
+         return 1;
 
-         unsigned char buffer[MAX_PACKET_SIZE];
-         int n = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&client, &client_len);
-
-         if (n < 4) continue;
-          int opcode = buffer[1];
-
-           // get the file name
-         char *filename = (char *)&buffer[2];
-        // check opcode
-         if (opcode == OP_RRQ) {
-            // handle rrq (download)
-             printf("RRQ for file: %s\n", filename);
-             handle_rrq(sock, &client, client_len, filename);
-         } else if (opcode == OP_WRQ) {
-            // handle wrq (upload)
-             printf("WRQ for file: %s\n", filename);
-             handle_wrq(sock, &client, client_len, filename);
-         } else if (opcode == OP_DELETE) {
-            // delete file
-             handle_delete(sock, &client, client_len, filename);
+     printf("TFTP server running on port %d with %d worker(s)...\n", SERVER_PORT, g_config.workers);
+     fflush(stdout);
+
+     while (1) {
+         int sig;
+         if (g_config.stats_interval > 0) {
+             struct timespec interval = {g_config.stats_interval, 0};
+             sig = sigtimedwait(&signals, NULL, &interval);
          } else {
-             // iligal opcode 
-             send_error(sock, &client, client_len, 4, "Illegal TFTP operation");
+             sig = sigwaitinfo(&signals, NULL);
          }
+
+         if (sig < 0 && errno != EAGAIN)
+             continue; // interrupted
+
+         workers_print_stats(workers, g_config.workers);
+         backup_print_stats();
+         cache_print_stats();
+         crcindex_print_stats();
+         commit_print_stats();
+         if (sig == SIGINT || sig == SIGTERM)
+             break;
      }
- 
-     close(sock);
+
+     // let the queued commits and backups finish before exiting
+     commit_stop();
+     backup_stop();
+     crcindex_stop();
+     cache_stop();
+     prefix_stop();
+     metrics_stop();
      return 0;
  }
- 
\ No newline at end of file
@@ -7,11 +7,65 @@
  #define TFTP_SERVER_H
  
  #include <stdint.h>
+ #include <limits.h>
+ #include <stdio.h>
+ #include <sys/types.h>
  #include <netinet/in.h>
+ #include "tftp_crc.h"
+ #include "tftp_options.h"
+ #include "tftp_sha256.h"
+ #include "tftp_compress.h"
+ #include "tftp_rto.h"
+ #include "tftp_cc.h"
+ #include "tftp_ring.h"
+ #include "tftp_uring.h"
+ #include "tftp_cache.h"
+ #include "tftp_crcindex.h"
+ #include "tftp_commit.h"
+ #include "tftp_prefix.h"
+ #include "tftp_metrics.h"
  
  #define SERVER_PORT 6969
  #define MAX_DATA_SIZE 512
  #define MAX_PACKET_SIZE 517
+
+ // Per-session retransmission settings (the timeout itself adapts, see tftp_rto.h)
+ #define MAX_RETRIES    3
+
+ // How a window of RRQ DATA blocks is handed to the kernel
+ #define SEND_PLAIN 0         // one sendmsg() per block
+ #define SEND_MMSG  1         // one sendmmsg() per burst of blocks
+ #define SEND_GSO   2         // equal-sized blocks coalesced with UDP_SEGMENT, sent with sendmmsg()
+
+ #define SEND_BATCH       64     // DATA blocks handed to the kernel at once
+ #define GSO_MAX_SEGMENTS 64     // UDP_MAX_SEGMENTS of the kernel
+ #define GSO_MAX_BYTES    65507  // largest UDP payload over IPv4
+
+ // RRQ blocks compressed per packet are staged in a buffer of this size, flushed when full
+ #define RRQ_ZBUF_SIZE (256 * 1024)
+
+ // Receive buffers below this many bytes are left at the kernel default (net.core.rmem_default)
+ #define RCVBUF_DEFAULT (208 * 1024)
+
+ // A finished upload refused by the full commit queue is offered again after this delay
+ #define COMMIT_RETRY_MS 5
+
+ // A finished upload keeps its session this many RTOs, resending its final ACK after each
+ #define WRQ_DALLY_RTOS 3
+
+ // Paced blocks due within this delay are released together (the loop timer has 1 ms resolution)
+ #define PACE_SLACK_US 1000
+
+ // Event loop engine
+ #define ENGINE_EPOLL 0       // readiness with epoll, I/O with plain syscalls
+ #define ENGINE_URING 1       // receives, DATA sends and upload writes submitted through io_uring
+
+ // Upload writes (epoll engine): blocks are coalesced into chunks of this size, written with pwrite()
+ #define WRITE_CHUNK_DEFAULT (1024 * 1024)
+ #define WRITE_ALIGN         4096   // chunk size and O_DIRECT buffer/offset alignment
+
+ // Files at least this large get a huge page hint on their RRQ mapping
+ #define RRQ_HUGEPAGE_MIN (2 * 1024 * 1024)
  
  // TFTP Opcodes
  #define OP_RRQ    1
@@ -20,14 +74,148 @@
  #define OP_ACK    4
  #define OP_ERROR  5
  #define OP_DELETE 6
- 
+
+ /**
+  * @brief Per-worker counters.
+  *
+  * Each counter is written only by the worker that owns it and may be read
+  * concurrently by the main thread, so updates go through STAT_ADD().
+  */
+ typedef struct tftp_stats {
+     uint64_t requests;         ///< Requests received on the listening socket
+     uint64_t rrq;              ///< RRQ sessions started
+     uint64_t wrq;              ///< WRQ sessions started
+     uint64_t deletes;          ///< DELETE requests handled
+     uint64_t completed;        ///< Transfers finished successfully
+     uint64_t aborted;          ///< Transfers aborted after running out of retries
+     uint64_t blocks_sent;      ///< DATA blocks sent (first transmission)
+     uint64_t blocks_received;  ///< DATA blocks accepted
+     uint64_t bytes_sent;       ///< Payload bytes sent
+     uint64_t bytes_received;   ///< Payload bytes accepted
+     uint64_t retransmits;      ///< Packets resent after a timeout
+     uint64_t crc_errors;       ///< DATA blocks dropped for a bad per-block check
+     uint64_t timeouts;         ///< Retransmission timeouts
+     uint64_t rtt_samples;      ///< Round-trip times measured
+     uint64_t rtt_sum_us;       ///< Sum of the measured round-trip times (microseconds)
+     uint64_t active;           ///< Sessions currently running
+     uint64_t rtt_hist[METRICS_RTT_BUCKETS];           ///< Round-trip times per histogram bucket
+     uint64_t duration_hist[METRICS_DURATION_BUCKETS]; ///< Completed transfer durations per bucket
+     uint64_t duration_sum_ms;  ///< Sum of the completed transfer durations
+ } tftp_stats;
+
+ // Single-writer counter update that is safe to read from another thread
+ #define STAT_ADD(st, field, n) \
+     __atomic_store_n(&(st)->field, (st)->field + (n), __ATOMIC_RELAXED)
+
+ // Lock-free read of a counter owned by another thread
+ #define STAT_GET(st, field) __atomic_load_n(&(st)->field, __ATOMIC_RELAXED)
+
+ /**
+  * @brief Server settings taken from the command line.
+  */
+ typedef struct tftp_config {
+     int workers;          ///< Number of worker threads (each with its own SO_REUSEPORT socket)
+     int stats_interval;   ///< Seconds between per-worker stats reports, 0 to disable
+     int max_blksize;      ///< Largest blksize granted to a client
+     int max_windowsize;   ///< Largest windowsize granted to a client
+     int send_mode;        ///< SEND_PLAIN, SEND_MMSG or SEND_GSO
+     int engine;           ///< ENGINE_EPOLL or ENGINE_URING
+     const tftp_cc_ops *cc; ///< Congestion control of RRQ windows
+     size_t cache_size;    ///< Size bound of the hot-file cache in bytes, 0 to disable
+     int crc_index;        ///< Take the CRCs of large downloads from index files
+     int write_chunk;      ///< Bytes of upload data coalesced per pwrite() (multiple of WRITE_ALIGN)
+     off_t direct_min;     ///< Uploads switch to O_DIRECT past this many bytes, 0 to never
+     const char *metrics_file; ///< Prometheus text file rewritten periodically, NULL for none
+     int metrics_interval; ///< Seconds between rewrites of the metrics file
+     const char *admin_socket; ///< Unix socket answering "stats" and "sessions", NULL for none
+ } tftp_config;
+
+ extern tftp_config g_config;
+
  /**
-  * @brief Calculates CRC-8 for a given data buffer.
-  * @param data Pointer to the data buffer.
-  * @param len Length of the data.
-  * @return The computed CRC-8 value.
+  * @brief State of one RRQ/WRQ transfer driven by the event loop.
+  *
+  * Every transfer owns its own data socket (dynamic port). The event loop
+  * calls session_on_readable() when that socket has datagrams queued and
+  * session_on_timeout() when the session deadline expires.
   */
- uint8_t calculate_crc8(const uint8_t *data, size_t len);
+ typedef struct tftp_session {
+     int data_sock;                  ///< Socket bound to a dynamic port for this transfer
+     int opcode;                     ///< OP_RRQ or OP_WRQ
+     FILE *file;                     ///< File being sent or received
+     const unsigned char *map;       ///< RRQ: file contents mapped read-only (or cached), NULL if not mapped
+     tftp_cache_entry *cached;       ///< RRQ: cache entry map points into, NULL if not cached
+     const uint8_t *crcs;            ///< RRQ: precomputed CRC of each block (cache or index), NULL if none
+     const tftp_cache_frames *frames; ///< RRQ: cached compressed frame of each block, NULL if compressed per packet
+     tftp_crc_index crc_index;       ///< RRQ: CRC index file mapped for a large file
+     off_t file_size;                ///< RRQ: size of the file when the transfer started
+     off_t range_start;              ///< RRQ: file offset of block 1 (offset option, else 0)
+     off_t range_end;                ///< RRQ: end of the bytes to send, -1 if unknown (not a regular file)
+     uint64_t resume;                ///< Bytes skipped by a resumed transfer (resume option), 0 if not resumed
+     uint32_t resume_crc;            ///< CRC-32C of those bytes
+     tftp_prefix_job prefix;         ///< CRC-32C of the resumed prefix, computed by the prefix thread
+     int prefix_pending;             ///< The OACK waits for prefix
+     tftp_options request;           ///< Options of the request, kept while the OACK waits
+     char filename[256];             ///< Name of the file being transferred
+     char tmpname[288];              ///< WRQ: temporary file receiving the upload, empty once handed over
+     struct sockaddr_in client;      ///< Client address (transfer ID)
+     socklen_t client_len;           ///< Length of client address
+     uint64_t block;                 ///< RRQ: last acknowledged block, WRQ: last accepted block
+     uint64_t next_block;            ///< RRQ: next block to send
+     uint64_t sent_block;            ///< RRQ: highest block sent so far
+     uint64_t last_block;            ///< RRQ: final (short) block once known, 0 before
+     uint64_t rewound;               ///< RRQ: window resent from this block, 0 if not resent
+     int wrap_to;                    ///< Block number following 65535 on the wire (0 or 1)
+     int blksize;                    ///< Negotiated payload bytes per DATA block
+     int windowsize;                 ///< Negotiated DATA blocks per ACK
+     int check;                      ///< Negotiated per-block check, one of the CHECK_* values
+     int check_len;                  ///< Length of its trailer in every DATA packet
+     int compress;                   ///< Negotiated block compression, one of the COMPRESS_* values
+     unsigned char *zbuf;            ///< RRQ: frames compressed for the burst being queued, WRQ: decompressed block
+     int zbuf_used;                  ///< RRQ: bytes of zbuf holding queued frames
+     int send_mode;                  ///< RRQ: how DATA bursts are sent (downgraded if the kernel refuses)
+     int since_ack;                  ///< WRQ: blocks accepted since the last window ACK
+     int gap_acked;                  ///< WRQ: out-of-order or repeated block already answered
+     int packet_size;                ///< Size of buffer, largest datagram accepted from the client
+     int oack_pending;               ///< RRQ: OACK sent, waiting for ACK(0)
+     int digest;                     ///< Whole-file digest negotiated, one of the DIGEST_* values
+     int digest_pending;             ///< Last block acknowledged, digest exchange not finished yet
+     tftp_sha256 sha;                ///< Digest of the payload sent or received so far
+     int retries;                    ///< Retransmissions left before aborting
+     uint64_t deadline;              ///< Monotonic time (ms) of the next timeout
+     tftp_rto rto;                   ///< Round-trip estimate and current retransmission timeout
+     tftp_cc cc;                     ///< RRQ: congestion window and pacing state
+     uint64_t pace_at;               ///< RRQ: monotonic time (ms) to release more paced blocks, 0 if none
+     int done;                       ///< Set once the transfer finished or aborted
+     int tx_len;                     ///< Length of the packet in buffer
+     unsigned char *buffer;          ///< Last DATA, ACK or OACK sent (resent on timeout)
+     tftp_stats *stats;              ///< Counters of the owning worker
+     tftp_uring *uring;              ///< io_uring of the owning loop, NULL with the epoll engine
+     int sock_slot;                  ///< Registered file slot of data_sock, -1 if none
+     int file_slot;                  ///< WRQ: registered file slot of file, -1 if none
+     int io_pending;                 ///< io_uring operations still referring to the session
+     int closing;                    ///< Removed from the loop, freed once io_pending drops to 0
+     int write_buf;                  ///< WRQ: registered buffer being filled, -1 if none
+     unsigned char *chunk;           ///< WRQ: epoll engine, aligned buffer coalescing blocks, NULL if none
+     int direct;                     ///< WRQ: 1 while writing with O_DIRECT, -1 once refused
+     int write_len;                  ///< WRQ: bytes in write_buf or chunk
+     off_t write_off;                ///< WRQ: file offset of the next write
+     int writes_pending;             ///< WRQ: writes submitted and not completed yet
+     int write_failed;               ///< WRQ: a write did not complete
+     int finish_pending;             ///< WRQ: last block received, file saved once writes complete
+     int commit_pending;             ///< WRQ: saved file waiting for room in the commit queue
+     int commit_wait;                ///< WRQ: file queued for commit, final ACK held until it is durable
+     int commit_status;              ///< WRQ: COMMIT_* outcome published by the commit thread
+     int dally;                      ///< WRQ: final ACK sent, RTOs left before the session ends
+     uint64_t started_ms;            ///< Monotonic time (ms) the request arrived
+     uint64_t bytes;                 ///< Payload bytes sent (first transmission) or received
+     uint64_t blocks;                ///< DATA blocks sent (first transmission) or received
+     uint64_t wire_bytes;            ///< Compressed payload (frames) sent (first transmission) or received
+     uint64_t retransmits;           ///< Packets resent by this transfer
+     uint64_t crc_errors;            ///< WRQ: DATA blocks dropped for a bad per-block check
+     uint64_t timeouts;              ///< Retransmission timeouts of this transfer
+     struct tftp_session *next;      ///< Next session in the owning loop
+ } tftp_session;
  
  /**
   * @brief Sends an error message to the client.
@@ -40,22 +228,104 @@
  void send_error(int sock, struct sockaddr_in *client, socklen_t client_len, int error_code, const char *msg);
  
  /**
-  * @brief Handles read requests from the client (RRQ).
+  * @brief Starts a read request (RRQ) session and sends the first DATA block.
   * @param listen_sock Listening socket.
+  * @param stats Counters of the worker that will own the session.
+  * @param uring io_uring of the owning loop, NULL with the epoll engine.
   * @param client Pointer to client address.
   * @param client_len Length of client address.
   * @param filename Requested file name.
+  * @param opts Options sent with the request (answered with an OACK when present).
+  * @return The new session, or NULL if the request was answered immediately.
   */
- void handle_rrq(int listen_sock, struct sockaddr_in *client, socklen_t client_len, char *filename);
+ tftp_session *handle_rrq(int listen_sock, tftp_stats *stats, tftp_uring *uring, struct sockaddr_in *client, socklen_t client_len, char *filename, const tftp_options *opts);
  
  /**
-  * @brief Handles write requests from the client (WRQ).
+  * @brief Starts a write request (WRQ) session and sends ACK(0).
   * @param listen_sock Listening socket.
+  * @param stats Counters of the worker that will own the session.
+  * @param uring io_uring of the owning loop, NULL with the epoll engine.
   * @param client Pointer to client address.
   * @param client_len Length of client address.
   * @param filename Target file name.
+  * @param opts Options sent with the request (answered with an OACK when present).
+  * @return The new session, or NULL if the request was rejected.
   */
- void handle_wrq(int listen_sock, struct sockaddr_in *client, socklen_t client_len, char *filename);
+ tftp_session *handle_wrq(int listen_sock, tftp_stats *stats, tftp_uring *uring, struct sockaddr_in *client, socklen_t client_len, char *filename, const tftp_options *opts);
+
+ /**
+  * @brief Processes all datagrams queued on a session's data socket.
+  * @param s Session whose socket became readable.
+  * @param ring Receive ring of the owning loop.
+  */
+ void session_on_readable(tftp_session *s, tftp_ring *ring);
+
+ /**
+  * @brief Processes one datagram received on a session's data socket.
+  * @param s Session.
+  * @param from Sender address.
+  * @param packet Received packet.
+  * @param n Length of the packet.
+  */
+ void session_on_packet(tftp_session *s, const struct sockaddr_in *from, const unsigned char *packet, int n);
+
+ /**
+  * @brief Handles the completion of an io_uring DATA burst send.
+  * @param burst Burst passed as user_data.
+  * @param res Completion result.
+  */
+ void session_on_sent(void *burst, int res);
+
+ /**
+  * @brief Handles the completion of an io_uring upload write.
+  * @param u Ring the write was submitted to.
+  * @param index Registered buffer that was written.
+  * @param res Completion result.
+  */
+ void session_on_written(tftp_uring *u, int index, int res);
+
+ /**
+  * @brief Drops one io_uring operation reference; frees a closing session at zero.
+  * @param s Session.
+  */
+ void session_io_done(tftp_session *s);
+
+ /**
+  * @brief Releases the next paced blocks of an RRQ window once pace_at is reached.
+  * @param s Session whose pacing timer expired.
+  */
+ void session_on_pace(tftp_session *s);
+
+ /**
+  * @brief Retransmits the last packet of a session or aborts it when out of retries.
+  * @param s Session whose deadline expired.
+  */
+ void session_on_timeout(tftp_session *s);
+
+ /**
+  * @brief Fills the admin summary of a session with its counters so far.
+  * @param s Session.
+  * @param completed 1 if the transfer finished, 0 if it was aborted or is still running.
+  * @param summary Filled with the counters.
+  */
+ void session_summarize(const tftp_session *s, int completed, tftp_session_summary *summary);
+
+ /**
+  * @brief Releases the file and socket of a session and frees it.
+  * @param s Session to close.
+  */
+ void session_close(tftp_session *s);
+
+ /**
+  * @brief Returns the monotonic clock in milliseconds.
+  */
+ uint64_t now_ms(void);
+
+ /**
+  * @brief Switches a socket to non-blocking mode.
+  * @param sock Socket file descriptor.
+  */
+ void set_nonblocking(int sock);
  
  /**
   * @brief Handles file delete requests from the client.
@@ -66,11 +336,5 @@
   */
  void handle_delete(int sock, struct sockaddr_in *client, socklen_t client_len, char *filename);
  
- /**
-  * @brief Creates a backup copy of a given file in the "backup" directory.
-  * @param filename Name of the file to back up.
-  */
- void backup_file(const char *filename);
- 
  #endif // TFTP_SERVER_H
  
\ No newline at end of file
@@ -0,0 +1,419 @@
+/**
+ * @file tftp_uring.c
+ * @brief io_uring setup, submission and completion through raw syscalls.
+ *
+ * Only the pieces the server needs are implemented: the SQ/CQ rings, a
+ * provided buffer ring for multishot receives, a pool of registered buffers
+ * for file writes and a sparse registered file table. Everything belongs to
+ * one event loop thread, so no locking is involved.
+ */
+
+#include "tftp_uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                           void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * @brief Map the submission and completion rings.
+ *
+ * @param u Ring being initialized.
+ * @param p Parameters returned by io_uring_setup().
+ * @return int 0 on success, -1 on error.
+ */
+static int uring_map_rings(tftp_uring *u, struct io_uring_params *p) {
+    u->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_size > u->sq_ring_size)
+            u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = u->sq_ring_size;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        u->sq_ring = NULL;
+        return -1;
+    }
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            u->cq_ring = NULL;
+            return -1;
+        }
+    }
+
+    u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        return -1;
+    }
+
+    unsigned char *sq = u->sq_ring, *cq = u->cq_ring;
+    u->sq_head = (unsigned *)(sq + p->sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p->sq_off.array);
+    u->sq_entries = p->sq_entries;
+    u->cq_head = (unsigned *)(cq + p->cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+/**
+ * @brief Register the provided buffer ring used by multishot receives.
+ *
+ * @param u Ring being initialized.
+ * @param recv_size Largest datagram to receive.
+ * @return int 0 on success, -1 on error.
+ */
+static int uring_setup_recv(tftp_uring *u, int recv_size) {
+    u->recv_ring_size = URING_RECV_BUFS * sizeof(struct io_uring_buf);
+    u->recv_ring = mmap(NULL, u->recv_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->recv_ring == MAP_FAILED) {
+        u->recv_ring = NULL;
+        return -1;
+    }
+
+    u->recv_stride = URING_RECV_HEADER + recv_size + 1;
+    u->recv_data = malloc(URING_RECV_BUFS * u->recv_stride);
+    if (!u->recv_data)
+        return -1;
+
+    struct io_uring_buf_reg reg = {0};
+    reg.ring_addr = (uint64_t)(uintptr_t)u->recv_ring;
+    reg.ring_entries = URING_RECV_BUFS;
+    reg.bgid = URING_RECV_GROUP;
+    if (sys_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+
+    for (int bid = 0; bid < URING_RECV_BUFS; bid++)
+        uring_recv_recycle(u, bid);
+    return 0;
+}
+
+/**
+ * @brief Register the write buffers and a sparse file table.
+ *
+ * @param u Ring being initialized.
+ * @return int 0 on success, -1 on error.
+ */
+static int uring_setup_registered(tftp_uring *u) {
+    u->write_data = mmap(NULL, (size_t)URING_WRITE_BUFS * URING_WRITE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->write_data == MAP_FAILED) {
+        u->write_data = NULL;
+        return -1;
+    }
+
+    struct iovec iov[URING_WRITE_BUFS];
+    for (int i = 0; i < URING_WRITE_BUFS; i++) {
+        iov[i].iov_base = uring_write_buffer(u, i);
+        iov[i].iov_len = URING_WRITE_SIZE;
+        u->write_free[u->write_nfree++] = URING_WRITE_BUFS - 1 - i;
+    }
+    if (sys_uring_register(u->fd, IORING_REGISTER_BUFFERS, iov, URING_WRITE_BUFS) < 0)
+        return -1;
+
+    struct io_uring_rsrc_register files = {0};
+    files.nr = URING_FILES;
+    files.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (sys_uring_register(u->fd, IORING_REGISTER_FILES2, &files, sizeof(files)) < 0)
+        return -1;
+    for (int i = 0; i < URING_FILES; i++)
+        u->file_free[u->file_nfree++] = URING_FILES - 1 - i;
+    return 0;
+}
+
+/**
+ * @brief Create the ring and every resource the io_uring engine needs.
+ *
+ * Needs io_uring_enter() with a timeout argument (5.11), provided buffer
+ * rings (5.19) and multishot recvmsg (6.0).
+ *
+ * @param u Ring to initialize.
+ * @param recv_size Largest datagram received through the provided buffers.
+ * @return int 0 on success, -1 if io_uring cannot be used (errno is set).
+ */
+int uring_init(tftp_uring *u, int recv_size) {
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+
+    struct io_uring_params p = {0};
+    // the ring is created by the main thread and driven by a worker: no SINGLE_ISSUER
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = URING_CQ_ENTRIES;
+    u->fd = sys_uring_setup(URING_ENTRIES, &p);
+    if (u->fd < 0 && errno == EINVAL) {
+        // older kernel: retry without the optional flags
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = URING_CQ_ENTRIES;
+        u->fd = sys_uring_setup(URING_ENTRIES, &p);
+    }
+    if (u->fd < 0)
+        return -1;
+
+    if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+        uring_free(u);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    if (uring_map_rings(u, &p) < 0 || uring_setup_recv(u, recv_size) < 0 || uring_setup_registered(u) < 0) {
+        int err = errno;
+        uring_free(u);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Release the ring and its resources.
+ *
+ * @param u Ring to release.
+ */
+void uring_free(tftp_uring *u) {
+    if (u->fd >= 0)
+        close(u->fd); // also drops every registration
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring)
+        munmap(u->sq_ring, u->sq_ring_size);
+    if (u->recv_ring)
+        munmap(u->recv_ring, u->recv_ring_size);
+    if (u->write_data)
+        munmap(u->write_data, (size_t)URING_WRITE_BUFS * URING_WRITE_SIZE);
+    free(u->recv_data);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+/**
+ * @brief Hand queued SQEs to the kernel without waiting.
+ *
+ * @param u Ring.
+ */
+static void uring_submit(tftp_uring *u) {
+    while (u->to_submit > 0) {
+        int n = sys_uring_enter(u->fd, u->to_submit, 0, 0, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("io_uring_enter");
+            return;
+        }
+        u->to_submit -= n;
+    }
+}
+
+/**
+ * @brief Get a zeroed SQE and queue it.
+ *
+ * @param u Ring.
+ * @return struct io_uring_sqe* The SQE.
+ */
+struct io_uring_sqe *uring_get_sqe(tftp_uring *u) {
+    unsigned tail = *u->sq_tail;
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+        uring_submit(u);
+        tail = *u->sq_tail;
+    }
+
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[index] = index;
+    // the kernel reads the SQE once the tail moves past it, at the next io_uring_enter()
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+    return sqe;
+}
+
+/**
+ * @brief Submit queued SQEs and wait for a completion or the timeout.
+ *
+ * @param u Ring.
+ * @param timeout_ms Longest wait in milliseconds, -1 to wait forever.
+ * @return int 0 on success or timeout, -1 on error.
+ */
+int uring_wait(tftp_uring *u, int timeout_ms) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = {0};
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+
+    int n = sys_uring_enter(u->fd, u->to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                            &arg, sizeof(arg));
+    if (n < 0) {
+        if (errno == ETIME || errno == EINTR || errno == EBUSY)
+            return 0;
+        return -1;
+    }
+    u->to_submit -= n;
+    return 0;
+}
+
+/**
+ * @brief Return the oldest unprocessed completion.
+ *
+ * @param u Ring.
+ * @return struct io_uring_cqe* The completion, or NULL if the queue is empty.
+ */
+struct io_uring_cqe *uring_peek_cqe(tftp_uring *u) {
+    unsigned head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &u->cqes[head & *u->cq_mask];
+}
+
+/**
+ * @brief Release the completion returned by uring_peek_cqe().
+ *
+ * @param u Ring.
+ */
+void uring_cqe_seen(tftp_uring *u) {
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Prepare a multishot recvmsg that selects buffers from the receive ring.
+ *
+ * @param sqe SQE to fill.
+ * @param fd Socket, or registered file slot when fixed is set.
+ * @param fixed Non-zero if fd is a registered file slot.
+ * @param msg Template message (msg_namelen = sizeof(struct sockaddr_in)).
+ * @param user_data Value returned with every completion.
+ */
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, int fixed, struct msghdr *msg, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT | (fixed ? IOSQE_FIXED_FILE : 0);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->buf_group = URING_RECV_GROUP;
+    sqe->user_data = user_data;
+}
+
+/**
+ * @brief Locate the datagram stored in a receive buffer.
+ *
+ * A multishot recvmsg buffer starts with struct io_uring_recvmsg_out, then
+ * the sender address, then the payload.
+ *
+ * @param u Ring.
+ * @param bid Buffer id.
+ * @param res Completion result.
+ * @param from Set to the sender address.
+ * @param len Set to the payload length, -1 if the datagram was truncated.
+ * @return unsigned char* The payload.
+ */
+unsigned char *uring_recv_packet(tftp_uring *u, int bid, int res, struct sockaddr_in **from, int *len) {
+    unsigned char *buf = u->recv_data + (size_t)bid * u->recv_stride;
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+
+    *from = (struct sockaddr_in *)(buf + sizeof(*out));
+    *len = (out->flags & MSG_TRUNC) || res < (int)URING_RECV_HEADER ? -1 : (int)out->payloadlen;
+    return buf + URING_RECV_HEADER;
+}
+
+/**
+ * @brief Give a receive buffer back to the kernel.
+ *
+ * @param u Ring.
+ * @param bid Buffer id.
+ */
+void uring_recv_recycle(tftp_uring *u, int bid) {
+    struct io_uring_buf *buf = &u->recv_ring->bufs[u->recv_tail & (URING_RECV_BUFS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(u->recv_data + (size_t)bid * u->recv_stride);
+    buf->len = u->recv_stride - 1; // keep the spare byte out of the kernel's reach
+    buf->bid = bid;
+    u->recv_tail++;
+    __atomic_store_n(&u->recv_ring->tail, (uint16_t)u->recv_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Take a registered write buffer.
+ *
+ * @param u Ring.
+ * @return int Buffer index, or -1 if all are in use.
+ */
+int uring_write_get(tftp_uring *u) {
+    return u->write_nfree > 0 ? u->write_free[--u->write_nfree] : -1;
+}
+
+/**
+ * @brief Return a registered write buffer to the pool.
+ *
+ * @param u Ring.
+ * @param index Buffer index.
+ */
+void uring_write_put(tftp_uring *u, int index) {
+    u->write_owner[index] = NULL;
+    u->write_free[u->write_nfree++] = index;
+}
+
+/**
+ * @brief Install a file descriptor in the registered file table.
+ *
+ * @param u Ring.
+ * @param fd File descriptor.
+ * @return int Slot index, or -1 if the table is full or the update failed.
+ */
+int uring_file_register(tftp_uring *u, int fd) {
+    if (u->file_nfree == 0)
+        return -1;
+
+    int slot = u->file_free[u->file_nfree - 1];
+    struct io_uring_files_update update = {.offset = slot, .fds = (uint64_t)(uintptr_t)&fd};
+    if (sys_uring_register(u->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1)
+        return -1;
+    u->file_nfree--;
+    return slot;
+}
+
+/**
+ * @brief Remove a file from the registered file table.
+ *
+ * @param u Ring.
+ * @param slot Slot returned by uring_file_register().
+ */
+void uring_file_unregister(tftp_uring *u, int slot) {
+    int fd = -1;
+    struct io_uring_files_update update = {.offset = slot, .fds = (uint64_t)(uintptr_t)&fd};
+    sys_uring_register(u->fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+    u->file_free[u->file_nfree++] = slot;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file tftp_uring.h
+ * @brief Minimal io_uring wrapper (raw syscalls) used by the optional io_uring engine.
+ */
+
+#ifndef TFTP_URING_H
+#define TFTP_URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES     256     // submission queue size
+#define URING_CQ_ENTRIES  4096    // completion queue size
+#define URING_RECV_BUFS   64      // provided receive buffers (power of two)
+#define URING_RECV_GROUP  0       // buffer group id of the receive buffers
+#define URING_WRITE_BUFS  16      // registered buffers for file writes
+#define URING_WRITE_SIZE  (128 * 1024)
+#define URING_FILES       1024    // slots of the registered file table
+
+// Kind of operation, stored in the low bits of user_data
+#define URING_LISTEN 1            // multishot recvmsg on the listening socket
+#define URING_RECV   2            // multishot recvmsg on a session socket (pointer = session)
+#define URING_SEND   3            // sendmsg of a DATA burst (pointer = burst)
+#define URING_WRITE  4            // file write from a registered buffer (index << 3)
+#define URING_CANCEL 5            // cancellation request, result ignored
+#define URING_TAG_MASK 7
+
+// Bytes in front of the payload of a received datagram: header and sender address
+#define URING_RECV_HEADER (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in))
+
+/**
+ * @brief One io_uring instance with its queues, receive buffers and registered resources.
+ */
+typedef struct tftp_uring {
+    int fd;                              ///< io_uring file descriptor
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned to_submit;                  ///< SQEs queued since the last io_uring_enter()
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+
+    struct io_uring_buf_ring *recv_ring; ///< Provided buffer ring for multishot receives
+    unsigned char *recv_data;            ///< URING_RECV_BUFS buffers of recv_stride bytes
+    size_t recv_stride;                  ///< Buffer size, one spare byte after the datagram
+    size_t recv_ring_size;
+    unsigned recv_tail;
+
+    unsigned char *write_data;           ///< URING_WRITE_BUFS registered buffers
+    int write_free[URING_WRITE_BUFS];    ///< Stack of unused write buffers
+    int write_nfree;
+    void *write_owner[URING_WRITE_BUFS]; ///< Session writing each buffer
+
+    int file_free[URING_FILES];          ///< Stack of unused registered file slots
+    int file_nfree;
+} tftp_uring;
+
+/**
+ * @brief Creates the ring, the receive buffers, the write buffers and the file table.
+ * @param u Ring to initialize.
+ * @param recv_size Largest datagram received through the provided buffers.
+ * @return 0 on success, -1 if io_uring (or a feature it needs) is unavailable.
+ */
+int uring_init(tftp_uring *u, int recv_size);
+
+/**
+ * @brief Releases everything created by uring_init().
+ * @param u Ring to release.
+ */
+void uring_free(tftp_uring *u);
+
+/**
+ * @brief Returns a zeroed SQE, submitting queued ones first if the queue is full.
+ * @param u Ring.
+ * @return The SQE, queued for the next io_uring_enter().
+ */
+struct io_uring_sqe *uring_get_sqe(tftp_uring *u);
+
+/**
+ * @brief Submits queued SQEs and waits for at least one completion.
+ * @param u Ring.
+ * @param timeout_ms Longest wait in milliseconds, -1 to wait forever.
+ * @return 0 on success or timeout, -1 on error.
+ */
+int uring_wait(tftp_uring *u, int timeout_ms);
+
+/**
+ * @brief Returns the next completion, or NULL if there is none.
+ */
+struct io_uring_cqe *uring_peek_cqe(tftp_uring *u);
+
+/**
+ * @brief Releases the completion returned by uring_peek_cqe().
+ */
+void uring_cqe_seen(tftp_uring *u);
+
+/**
+ * @brief Prepares a multishot recvmsg picking buffers from the receive buffer ring.
+ * @param sqe SQE to fill.
+ * @param fd Socket, or registered file slot when fixed is set.
+ * @param fixed Non-zero if fd is a registered file slot.
+ * @param msg Template message (only msg_namelen and msg_controllen are used).
+ * @param user_data Value returned with every completion.
+ */
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, int fixed, struct msghdr *msg, uint64_t user_data);
+
+/**
+ * @brief Returns the datagram held by receive buffer bid and its sender.
+ * @param u Ring.
+ * @param bid Buffer id from the completion flags.
+ * @param res Completion result (bytes used in the buffer).
+ * @param from Set to the sender address.
+ * @param len Set to the payload length, -1 if the datagram was truncated.
+ * @return The payload, with one writable spare byte after it.
+ */
+unsigned char *uring_recv_packet(tftp_uring *u, int bid, int res, struct sockaddr_in **from, int *len);
+
+/**
+ * @brief Gives a receive buffer back to the kernel.
+ */
+void uring_recv_recycle(tftp_uring *u, int bid);
+
+/**
+ * @brief Takes a registered write buffer.
+ * @return Buffer index, or -1 if all are in use.
+ */
+int uring_write_get(tftp_uring *u);
+
+/**
+ * @brief Returns a registered write buffer to the pool.
+ */
+void uring_write_put(tftp_uring *u, int index);
+
+/**
+ * @brief Address of a registered write buffer.
+ */
+static inline unsigned char *uring_write_buffer(tftp_uring *u, int index) {
+    return u->write_data + (size_t)index * URING_WRITE_SIZE;
+}
+
+/**
+ * @brief Installs a file descriptor in the registered file table.
+ * @return Slot index, or -1 if the table is full.
+ */
+int uring_file_register(tftp_uring *u, int fd);
+
+/**
+ * @brief Removes a file from the registered file table.
+ */
+void uring_file_unregister(tftp_uring *u, int slot);
+
+#endif // TFTP_URING_H
@@ -0,0 +1,185 @@
+/**
+ * @file tftp_worker.c
+ * @brief Multi-core worker model: one event loop per thread, sharded with SO_REUSEPORT.
+ *
+ * Every worker binds its own UDP socket on SERVER_PORT with SO_REUSEPORT, so the
+ * kernel hashes each client's requests to one of the workers. The worker then owns
+ * the sessions it starts (data sockets, files, counters); no state is shared between
+ * workers, and throughput scales with the number of cores.
+ */
+
+#include "tftp_worker.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/**
+ * @brief Create a UDP socket bound to SERVER_PORT that other workers may share.
+ *
+ * @return int The socket, or -1 on error.
+ */
+int open_listen_socket(void) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0); // IPv4 UDP
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // let every worker bind its own socket to the same port
+    int one = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("SO_REUSEPORT");
+        close(sock);
+        return -1;
+    }
+
+    struct sockaddr_in server = {0};
+    server.sin_family = AF_INET; //  IPv4
+    server.sin_port = htons(SERVER_PORT); // 6969
+    server.sin_addr.s_addr = INADDR_ANY; // for any IP
+    if (bind(sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        perror("Bind failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Thread entry: run the worker's loop forever.
+ *
+ * @param arg The tftp_worker to run.
+ * @return void* Never returns unless the loop fails.
+ */
+static void *worker_main(void *arg) {
+    tftp_worker *w = arg;
+    loop_run(&w->loop);
+    return NULL;
+}
+
+/**
+ * @brief Bind the worker's listening socket and start its thread.
+ *
+ * @param w Worker to start.
+ * @param id Worker index.
+ * @return int 0 on success, -1 on error.
+ */
+int worker_start(tftp_worker *w, int id) {
+    w->id = id;
+
+    int sock = open_listen_socket();
+    if (sock < 0)
+        return -1;
+
+    if (loop_init(&w->loop, sock) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    int err = pthread_create(&w->thread, NULL, worker_main, w);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        if (w->loop.epfd >= 0)
+            close(w->loop.epfd);
+        close(sock);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Snapshot the counters of a running worker.
+ *
+ * @param w Worker.
+ * @param out Receives the counters.
+ */
+void worker_get_stats(const tftp_worker *w, tftp_stats *out) {
+    const tftp_stats *src = &w->loop.stats;
+
+    out->requests = STAT_GET(src, requests);
+    out->rrq = STAT_GET(src, rrq);
+    out->wrq = STAT_GET(src, wrq);
+    out->deletes = STAT_GET(src, deletes);
+    out->completed = STAT_GET(src, completed);
+    out->aborted = STAT_GET(src, aborted);
+    out->blocks_sent = STAT_GET(src, blocks_sent);
+    out->blocks_received = STAT_GET(src, blocks_received);
+    out->bytes_sent = STAT_GET(src, bytes_sent);
+    out->bytes_received = STAT_GET(src, bytes_received);
+    out->retransmits = STAT_GET(src, retransmits);
+    out->crc_errors = STAT_GET(src, crc_errors);
+    out->timeouts = STAT_GET(src, timeouts);
+    out->active = STAT_GET(src, active);
+    out->rtt_samples = STAT_GET(src, rtt_samples);
+    out->rtt_sum_us = STAT_GET(src, rtt_sum_us);
+    for (int i = 0; i < METRICS_RTT_BUCKETS; i++)
+        out->rtt_hist[i] = STAT_GET(src, rtt_hist[i]);
+    for (int i = 0; i < METRICS_DURATION_BUCKETS; i++)
+        out->duration_hist[i] = STAT_GET(src, duration_hist[i]);
+    out->duration_sum_ms = STAT_GET(src, duration_sum_ms);
+}
+
+/**
+ * @brief Print one row of the stats table.
+ *
+ * @param name Row label.
+ * @param st Counters to print.
+ */
+static void print_stats_row(const char *name, const tftp_stats *st) {
+    // average round-trip time of the transfers, 0 before any was measured
+    uint64_t rtt_us = st->rtt_samples ? st->rtt_sum_us / st->rtt_samples : 0;
+
+    printf("%-7s %8llu %6llu %6llu %6llu %6llu %9llu %7llu %10llu %7llu %8llu %12llu %12llu %8llu %8llu\n", name,
+           (unsigned long long)st->requests, (unsigned long long)st->rrq,
+           (unsigned long long)st->wrq, (unsigned long long)st->deletes,
+           (unsigned long long)st->active, (unsigned long long)st->completed,
+           (unsigned long long)st->aborted, (unsigned long long)st->retransmits,
+           (unsigned long long)st->crc_errors, (unsigned long long)st->timeouts,
+           (unsigned long long)st->bytes_sent, (unsigned long long)st->bytes_received,
+           (unsigned long long)(st->blocks_sent + st->blocks_received), (unsigned long long)rtt_us);
+}
+
+/**
+ * @brief Print the counters of every worker followed by their totals.
+ *
+ * @param workers Array of workers.
+ * @param count Number of workers.
+ */
+void workers_print_stats(tftp_worker *workers, int count) {
+    tftp_stats total = {0};
+
+    printf("%-7s %8s %6s %6s %6s %6s %9s %7s %10s %7s %8s %12s %12s %8s %8s\n", "worker", "requests", "rrq",
+           "wrq", "delete", "active", "completed", "aborted", "retransmit", "crc_err", "timeouts", "bytes_sent",
+           "bytes_recv", "blocks", "rtt_us");
+
+    for (int i = 0; i < count; i++) {
+        tftp_stats st;
+        worker_get_stats(&workers[i], &st);
+
+        char name[16];
+        snprintf(name, sizeof(name), "%d", workers[i].id);
+        print_stats_row(name, &st);
+
+        total.requests += st.requests;
+        total.rrq += st.rrq;
+        total.wrq += st.wrq;
+        total.deletes += st.deletes;
+        total.completed += st.completed;
+        total.aborted += st.aborted;
+        total.blocks_sent += st.blocks_sent;
+        total.blocks_received += st.blocks_received;
+        total.bytes_sent += st.bytes_sent;
+        total.bytes_received += st.bytes_received;
+        total.retransmits += st.retransmits;
+        total.crc_errors += st.crc_errors;
+        total.timeouts += st.timeouts;
+        total.active += st.active;
+        total.rtt_samples += st.rtt_samples;
+        total.rtt_sum_us += st.rtt_sum_us;
+    }
+
+    print_stats_row("total", &total);
+    fflush(stdout);
+}
@@ -0,0 +1,53 @@
+/**
+ * @file tftp_worker.h
+ * @brief Worker threads, each running its own event loop on a SO_REUSEPORT socket.
+ */
+
+#ifndef TFTP_WORKER_H
+#define TFTP_WORKER_H
+
+#include <pthread.h>
+#include "tftp_loop.h"
+
+/**
+ * @brief One worker thread and the loop it owns.
+ *
+ * Workers share nothing: each binds its own listening socket on SERVER_PORT with
+ * SO_REUSEPORT, the kernel spreads incoming requests across those sockets, and a
+ * session stays on the worker that accepted its request for its whole life.
+ */
+typedef struct tftp_worker {
+    int id;              ///< Worker index, starting at 0
+    pthread_t thread;    ///< Thread running the loop
+    tftp_loop loop;      ///< Event loop (and counters) of this worker
+} tftp_worker;
+
+/**
+ * @brief Binds a SO_REUSEPORT listening socket on SERVER_PORT.
+ * @return The socket, or -1 on error.
+ */
+int open_listen_socket(void);
+
+/**
+ * @brief Binds the worker's listening socket and starts its thread.
+ * @param w Worker to start.
+ * @param id Worker index.
+ * @return 0 on success, -1 on error.
+ */
+int worker_start(tftp_worker *w, int id);
+
+/**
+ * @brief Snapshots the counters of a running worker.
+ * @param w Worker.
+ * @param out Receives the counters.
+ */
+void worker_get_stats(const tftp_worker *w, tftp_stats *out);
+
+/**
+ * @brief Prints the counters of every worker and their totals.
+ * @param workers Array of workers.
+ * @param count Number of workers.
+ */
+void workers_print_stats(tftp_worker *workers, int count);
+
+#endif // TFTP_WORKER_H